@@ -0,0 +1,479 @@
+/******************************************************************************\
+| Animation clip compression - see anim_compress.h for the format              |
+\******************************************************************************/
+#include "anim_compress.h"
+#include "assimp/anim.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* smallest-three components of a unit quaternion never exceed 1/sqrt(2) */
+#define SMALLEST_THREE_RANGE 0.70710678f
+
+enum channel_kind { CHANNEL_POS, CHANNEL_ROT, CHANNEL_SCA };
+
+/*----------------------------------QUANTISING--------------------------------*/
+static unsigned short quantise_unorm16( float f ) {
+	if ( f < 0.0f ) {
+		f = 0.0f;
+	} else if ( f > 1.0f ) {
+		f = 1.0f;
+	}
+	return (unsigned short)( f * 65535.0f + 0.5f );
+}
+
+static void encode_vec( const float *v, const float *mn, const float *ext,
+												unsigned short *out ) {
+	for ( int i = 0; i < 3; i++ ) {
+		out[i] = ext[i] > 0.0f ? quantise_unorm16( ( v[i] - mn[i] ) / ext[i] ) : 0;
+	}
+}
+
+static void decode_vec( const unsigned short *in, const float *mn,
+												const float *ext, float *out ) {
+	for ( int i = 0; i < 3; i++ ) {
+		out[i] = mn[i] + ext[i] * ( (float)in[i] * ( 1.0f / 65535.0f ) );
+	}
+	out[3] = 0.0f;
+}
+
+/* q is w,x,y,z and must be unit length. the index of the dropped component is
+stored in the top bits of the first two words */
+static void encode_rot( const float *q, unsigned short *out ) {
+	int largest = 0;
+	for ( int i = 1; i < 4; i++ ) {
+		if ( fabsf( q[i] ) > fabsf( q[largest] ) ) {
+			largest = i;
+		}
+	}
+	// q and -q are the same rotation, so flip to make the dropped one positive
+	float sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+	int j = 0;
+	for ( int i = 0; i < 4; i++ ) {
+		if ( i == largest ) {
+			continue;
+		}
+		float f = ( q[i] * sign / SMALLEST_THREE_RANGE ) * 0.5f + 0.5f;
+		f = f < 0.0f ? 0.0f : ( f > 1.0f ? 1.0f : f );
+		out[j++] = (unsigned short)( f * 32767.0f + 0.5f );
+	}
+	out[0] |= (unsigned short)( ( largest >> 1 ) << 15 );
+	out[1] |= (unsigned short)( ( largest & 1 ) << 15 );
+}
+
+static void decode_rot( const unsigned short *in, float *q ) {
+	int largest = ( ( in[0] >> 15 ) << 1 ) | ( in[1] >> 15 );
+	float sum = 0.0f;
+	int j = 0;
+	for ( int i = 0; i < 4; i++ ) {
+		if ( i == largest ) {
+			continue;
+		}
+		float f = (float)( in[j++] & 0x7FFF ) * ( 1.0f / 32767.0f );
+		q[i] = ( f * 2.0f - 1.0f ) * SMALLEST_THREE_RANGE;
+		sum += q[i] * q[i];
+	}
+	q[largest] = sum < 1.0f ? sqrtf( 1.0f - sum ) : 0.0f;
+}
+
+/*------------------------------------ERROR-----------------------------------*/
+/* how far apart two values put a point ANIM_ERROR_DISTANCE from the joint */
+static float value_error( int kind, const float *a, const float *b ) {
+	if ( CHANNEL_ROT == kind ) {
+		// chord length swept by the relative rotation: 2 * d * sin( theta / 2 )
+		float d = fabsf( a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3] );
+		d = d > 1.0f ? 1.0f : d;
+		return 2.0f * ANIM_ERROR_DISTANCE * sqrtf( 1.0f - d * d );
+	}
+	float dx = a[0] - b[0];
+	float dy = a[1] - b[1];
+	float dz = a[2] - b[2];
+	float dist = sqrtf( dx * dx + dy * dy + dz * dz );
+	if ( CHANNEL_SCA == kind ) {
+		return dist * ANIM_ERROR_DISTANCE;
+	}
+	return dist;
+}
+
+/* lerp for vectors, nlerp for rotations. the sampler does exactly the same so
+the reduction error bound holds at run time */
+static void interp_value( int kind, const float *a, const float *b, float f,
+													float *out ) {
+	if ( CHANNEL_ROT == kind ) {
+		float d = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+		float fb = d < 0.0f ? -f : f; // take the short way around
+		float sum = 0.0f;
+		for ( int i = 0; i < 4; i++ ) {
+			out[i] = a[i] * ( 1.0f - f ) + b[i] * fb;
+			sum += out[i] * out[i];
+		}
+		float inv = sum > 0.0f ? 1.0f / sqrtf( sum ) : 0.0f;
+		for ( int i = 0; i < 4; i++ ) {
+			out[i] *= inv;
+		}
+		return;
+	}
+	for ( int i = 0; i < 3; i++ ) {
+		out[i] = a[i] + ( b[i] - a[i] ) * f;
+	}
+	out[3] = 0.0f;
+}
+
+/*-----------------------------------SAMPLING---------------------------------*/
+/* find the key at or before quantised time qt and the blend towards the next */
+static int find_key( const unsigned short *times, int count, float qt,
+										 float *f ) {
+	*f = 0.0f;
+	if ( count < 2 || qt <= (float)times[0] ) {
+		return 0;
+	}
+	if ( qt >= (float)times[count - 1] ) {
+		return count - 1;
+	}
+	int lo = 0, hi = count - 1;
+	while ( hi - lo > 1 ) {
+		int mid = ( lo + hi ) / 2;
+		if ( (float)times[mid] <= qt ) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	float span = (float)times[hi] - (float)times[lo];
+	*f = span > 0.0f ? ( qt - (float)times[lo] ) / span : 0.0f;
+	return lo;
+}
+
+static void decode_key( int kind, const unsigned short *keys, int i,
+												const float *mn, const float *ext, float *out ) {
+	if ( CHANNEL_ROT == kind ) {
+		decode_rot( &keys[i * 3], out );
+	} else {
+		decode_vec( &keys[i * 3], mn, ext, out );
+	}
+}
+
+static void sample_channel( int kind, const unsigned short *times,
+														const unsigned short *keys, int count, float qt,
+														const float *mn, const float *ext, float *out ) {
+	float f;
+	int i = find_key( times, count, qt, &f );
+	float a[4], b[4];
+	decode_key( kind, keys, i, mn, ext, a );
+	if ( f <= 0.0f || i + 1 >= count ) {
+		memcpy( out, a, sizeof( a ) );
+		return;
+	}
+	decode_key( kind, keys, i + 1, mn, ext, b );
+	interp_value( kind, a, b, f, out );
+}
+
+void sample_anim_track( const anim_track *track, float duration_seconds,
+												float t, vec3 *pos, versor *rot, vec3 *sca ) {
+	float t01 = duration_seconds > 0.0f ? t / duration_seconds : 0.0f;
+	t01 = t01 < 0.0f ? 0.0f : ( t01 > 1.0f ? 1.0f : t01 );
+	float qt = t01 * 65535.0f;
+	float v[4];
+	if ( pos ) {
+		*pos = vec3( 0.0f, 0.0f, 0.0f );
+		if ( track->pos_key_count > 0 ) {
+			sample_channel( CHANNEL_POS, track->pos_times, track->pos_keys,
+											track->pos_key_count, qt, track->pos_min,
+											track->pos_extent, v );
+			*pos = vec3( v[0], v[1], v[2] );
+		}
+	}
+	if ( rot ) {
+		rot->q[0] = 1.0f;
+		rot->q[1] = rot->q[2] = rot->q[3] = 0.0f;
+		if ( track->rot_key_count > 0 ) {
+			sample_channel( CHANNEL_ROT, track->rot_times, track->rot_keys,
+											track->rot_key_count, qt, NULL, NULL, rot->q );
+		}
+	}
+	if ( sca ) {
+		*sca = vec3( 1.0f, 1.0f, 1.0f );
+		if ( track->sca_key_count > 0 ) {
+			sample_channel( CHANNEL_SCA, track->sca_times, track->sca_keys,
+											track->sca_key_count, qt, track->sca_min,
+											track->sca_extent, v );
+			*sca = vec3( v[0], v[1], v[2] );
+		}
+	}
+}
+
+/*----------------------------------COMPRESSION-------------------------------*/
+/* quantise every key of one channel, then greedily drop keys that the
+neighbours either side can rebuild to within max_error. values are 4 floats per
+key (x,y,z,unused for vectors; w,x,y,z for rotations) and times are 0-1. kept
+keys are written to out_times/out_keys and their number returned */
+static int compress_channel( int kind, const float *times01, const float *values,
+														 int count, const float *mn, const float *ext,
+														 float max_error, unsigned short *out_times,
+														 unsigned short *out_keys ) {
+	if ( count < 1 ) {
+		return 0;
+	}
+	unsigned short *q_times = (unsigned short *)malloc( count * sizeof( unsigned short ) );
+	unsigned short *q_keys = (unsigned short *)malloc( count * 3 * sizeof( unsigned short ) );
+	float *decoded = (float *)malloc( count * 4 * sizeof( float ) );
+	int *kept = (int *)malloc( count * sizeof( int ) );
+	for ( int i = 0; i < count; i++ ) {
+		q_times[i] = quantise_unorm16( times01[i] );
+		if ( CHANNEL_ROT == kind ) {
+			encode_rot( &values[i * 4], &q_keys[i * 3] );
+		} else {
+			encode_vec( &values[i * 4], mn, ext, &q_keys[i * 3] );
+		}
+		decode_key( kind, q_keys, i, mn, ext, &decoded[i * 4] );
+	}
+
+	int kept_count = 0;
+	kept[kept_count++] = 0;
+	// a channel that never leaves its first value only needs that one key
+	bool constant = true;
+	for ( int i = 1; i < count && constant; i++ ) {
+		constant = value_error( kind, &decoded[0], &values[i * 4] ) <= max_error;
+	}
+	if ( !constant ) {
+		int anchor = 0;
+		float tmp[4];
+		for ( int end = 2; end < count; end++ ) {
+			float span = (float)q_times[end] - (float)q_times[anchor];
+			bool fits = true;
+			for ( int k = anchor + 1; k < end && fits; k++ ) {
+				float f = span > 0.0f ? ( (float)q_times[k] - (float)q_times[anchor] ) / span
+															: 0.0f;
+				interp_value( kind, &decoded[anchor * 4], &decoded[end * 4], f, tmp );
+				fits = value_error( kind, tmp, &values[k * 4] ) <= max_error;
+			}
+			if ( !fits ) {
+				anchor = end - 1;
+				kept[kept_count++] = anchor;
+			}
+		}
+		if ( count > 1 ) {
+			kept[kept_count++] = count - 1;
+		}
+	}
+
+	for ( int i = 0; i < kept_count; i++ ) {
+		out_times[i] = q_times[kept[i]];
+		memcpy( &out_keys[i * 3], &q_keys[kept[i] * 3], 3 * sizeof( unsigned short ) );
+	}
+	free( q_times );
+	free( q_keys );
+	free( decoded );
+	free( kept );
+	return kept_count;
+}
+
+/* get the range of a vector channel for range quantisation */
+static void vector_range( const float *values, int count, float *mn, float *ext ) {
+	float mx[3];
+	for ( int i = 0; i < 3; i++ ) {
+		mn[i] = mx[i] = count > 0 ? values[i] : 0.0f;
+	}
+	for ( int k = 1; k < count; k++ ) {
+		for ( int i = 0; i < 3; i++ ) {
+			float v = values[k * 4 + i];
+			mn[i] = v < mn[i] ? v : mn[i];
+			mx[i] = v > mx[i] ? v : mx[i];
+		}
+	}
+	for ( int i = 0; i < 3; i++ ) {
+		ext[i] = mx[i] - mn[i];
+	}
+}
+
+/* trim one channel's key arrays, allocated for length keys, down to the count
+reduction kept. a failed realloc leaves the old block, so this returns the
+bytes the arrays really hold now */
+static int shrink_channel( unsigned short **times, unsigned short **keys, int length,
+													 int count ) {
+	int n = count > 0 ? count : 1; // a 0 byte realloc may free the block
+	int times_len = length, keys_len = length;
+	unsigned short *t = (unsigned short *)realloc( *times, n * sizeof( unsigned short ) );
+	if ( t ) {
+		*times = t;
+		times_len = n;
+	}
+	unsigned short *k = (unsigned short *)realloc( *keys, n * 3 * sizeof( unsigned short ) );
+	if ( k ) {
+		*keys = k;
+		keys_len = n;
+	}
+	return ( times_len + keys_len * 3 ) * (int)sizeof( unsigned short );
+}
+
+bool compress_animation( const aiAnimation *anim, float max_error,
+												 anim_clip *clip ) {
+	memset( clip, 0, sizeof( anim_clip ) );
+	strncpy( clip->name, anim->mName.data, 63 );
+	double ticks_per_second = anim->mTicksPerSecond > 0.0 ? anim->mTicksPerSecond
+																												: 25.0;
+	double duration_ticks = anim->mDuration;
+	clip->duration_seconds = (float)( duration_ticks / ticks_per_second );
+	if ( 0 == anim->mNumChannels ) {
+		fprintf( stderr, "ERROR: clip %s has no channels\n", clip->name );
+		return false;
+	}
+	clip->track_count = (int)anim->mNumChannels;
+	clip->tracks = (anim_track *)calloc( clip->track_count, sizeof( anim_track ) );
+	if ( !clip->tracks ) {
+		fprintf( stderr, "ERROR: out of memory compressing clip %s\n", clip->name );
+		return false;
+	}
+
+	for ( int c_i = 0; c_i < clip->track_count; c_i++ ) {
+		const aiNodeAnim *channel = anim->mChannels[c_i];
+		anim_track *track = &clip->tracks[c_i];
+		strncpy( track->bone_name, channel->mNodeName.data, 63 );
+
+		int max_keys = (int)channel->mNumPositionKeys;
+		if ( (int)channel->mNumRotationKeys > max_keys ) {
+			max_keys = (int)channel->mNumRotationKeys;
+		}
+		if ( (int)channel->mNumScalingKeys > max_keys ) {
+			max_keys = (int)channel->mNumScalingKeys;
+		}
+		float *times01 = (float *)malloc( ( max_keys + 1 ) * sizeof( float ) );
+		float *values = (float *)malloc( ( max_keys + 1 ) * 4 * sizeof( float ) );
+		track->pos_times = (unsigned short *)malloc( ( max_keys + 1 ) * sizeof( unsigned short ) );
+		track->pos_keys = (unsigned short *)malloc( ( max_keys + 1 ) * 3 * sizeof( unsigned short ) );
+		track->rot_times = (unsigned short *)malloc( ( max_keys + 1 ) * sizeof( unsigned short ) );
+		track->rot_keys = (unsigned short *)malloc( ( max_keys + 1 ) * 3 * sizeof( unsigned short ) );
+		track->sca_times = (unsigned short *)malloc( ( max_keys + 1 ) * sizeof( unsigned short ) );
+		track->sca_keys = (unsigned short *)malloc( ( max_keys + 1 ) * 3 * sizeof( unsigned short ) );
+		if ( !times01 || !values || !track->pos_times || !track->pos_keys || !track->rot_times ||
+				 !track->rot_keys || !track->sca_times || !track->sca_keys ) {
+			fprintf( stderr, "ERROR: out of memory compressing clip %s\n", clip->name );
+			free( times01 );
+			free( values );
+			free_anim_clip( clip );
+			return false;
+		}
+
+		/* positions */
+		int n = (int)channel->mNumPositionKeys;
+		for ( int k = 0; k < n; k++ ) {
+			const aiVectorKey *key = &channel->mPositionKeys[k];
+			times01[k] = duration_ticks > 0.0 ? (float)( key->mTime / duration_ticks ) : 0.0f;
+			values[k * 4] = key->mValue.x;
+			values[k * 4 + 1] = key->mValue.y;
+			values[k * 4 + 2] = key->mValue.z;
+			values[k * 4 + 3] = 0.0f;
+		}
+		vector_range( values, n, track->pos_min, track->pos_extent );
+		track->pos_key_count =
+			compress_channel( CHANNEL_POS, times01, values, n, track->pos_min,
+												track->pos_extent, max_error, track->pos_times,
+												track->pos_keys );
+		clip->raw_bytes += n * 4 * (int)sizeof( float );
+
+		/* rotations - assimp stores w,x,y,z like our versor */
+		n = (int)channel->mNumRotationKeys;
+		for ( int k = 0; k < n; k++ ) {
+			const aiQuatKey *key = &channel->mRotationKeys[k];
+			times01[k] = duration_ticks > 0.0 ? (float)( key->mTime / duration_ticks ) : 0.0f;
+			versor q;
+			q.q[0] = key->mValue.w;
+			q.q[1] = key->mValue.x;
+			q.q[2] = key->mValue.y;
+			q.q[3] = key->mValue.z;
+			q = normalise( q );
+			memcpy( &values[k * 4], q.q, 4 * sizeof( float ) );
+		}
+		track->rot_key_count =
+			compress_channel( CHANNEL_ROT, times01, values, n, NULL, NULL, max_error,
+												track->rot_times, track->rot_keys );
+		clip->raw_bytes += n * 5 * (int)sizeof( float );
+
+		/* scales */
+		n = (int)channel->mNumScalingKeys;
+		for ( int k = 0; k < n; k++ ) {
+			const aiVectorKey *key = &channel->mScalingKeys[k];
+			times01[k] = duration_ticks > 0.0 ? (float)( key->mTime / duration_ticks ) : 0.0f;
+			values[k * 4] = key->mValue.x;
+			values[k * 4 + 1] = key->mValue.y;
+			values[k * 4 + 2] = key->mValue.z;
+			values[k * 4 + 3] = 0.0f;
+		}
+		vector_range( values, n, track->sca_min, track->sca_extent );
+		track->sca_key_count =
+			compress_channel( CHANNEL_SCA, times01, values, n, track->sca_min,
+												track->sca_extent, max_error, track->sca_times,
+												track->sca_keys );
+		clip->raw_bytes += n * 4 * (int)sizeof( float );
+
+		/* reduction only saves memory once the arrays are cut to the kept keys */
+		clip->compressed_bytes +=
+			(int)sizeof( anim_track ) +
+			shrink_channel( &track->pos_times, &track->pos_keys, max_keys + 1, track->pos_key_count ) +
+			shrink_channel( &track->rot_times, &track->rot_keys, max_keys + 1, track->rot_key_count ) +
+			shrink_channel( &track->sca_times, &track->sca_keys, max_keys + 1, track->sca_key_count );
+		free( times01 );
+		free( values );
+
+		/* measure the real error at every original key time */
+		int key_counts[3] = { (int)channel->mNumPositionKeys,
+													(int)channel->mNumRotationKeys,
+													(int)channel->mNumScalingKeys };
+		for ( int kind = CHANNEL_POS; kind <= CHANNEL_SCA; kind++ ) {
+			for ( int k = 0; k < key_counts[kind]; k++ ) {
+				float orig[4];
+				double t_ticks;
+				vec3 p, s;
+				versor r;
+				if ( CHANNEL_ROT == kind ) {
+					const aiQuatKey *key = &channel->mRotationKeys[k];
+					t_ticks = key->mTime;
+					versor q;
+					q.q[0] = key->mValue.w;
+					q.q[1] = key->mValue.x;
+					q.q[2] = key->mValue.y;
+					q.q[3] = key->mValue.z;
+					q = normalise( q );
+					memcpy( orig, q.q, sizeof( orig ) );
+				} else {
+					const aiVectorKey *key = CHANNEL_POS == kind ? &channel->mPositionKeys[k]
+																											 : &channel->mScalingKeys[k];
+					t_ticks = key->mTime;
+					orig[0] = key->mValue.x;
+					orig[1] = key->mValue.y;
+					orig[2] = key->mValue.z;
+					orig[3] = 0.0f;
+				}
+				sample_anim_track( track, clip->duration_seconds,
+													 (float)( t_ticks / ticks_per_second ), &p, &r, &s );
+				float got[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+				if ( CHANNEL_ROT == kind ) {
+					memcpy( got, r.q, sizeof( got ) );
+				} else {
+					const vec3 &v = CHANNEL_POS == kind ? p : s;
+					memcpy( got, v.v, 3 * sizeof( float ) );
+				}
+				float err = value_error( kind, got, orig );
+				if ( err > clip->max_error ) {
+					clip->max_error = err;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+void free_anim_clip( anim_clip *clip ) {
+	for ( int c_i = 0; c_i < clip->track_count; c_i++ ) {
+		anim_track *track = &clip->tracks[c_i];
+		free( track->pos_times );
+		free( track->pos_keys );
+		free( track->rot_times );
+		free( track->rot_keys );
+		free( track->sca_times );
+		free( track->sca_keys );
+	}
+	free( clip->tracks );
+	memset( clip, 0, sizeof( anim_clip ) );
+}
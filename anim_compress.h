@@ -0,0 +1,63 @@
+/******************************************************************************\
+| Animation clip compression                                                   |
+| Assimp hands us a float32 time and value for every key on every bone. Here   |
+| each channel is squeezed down to 16-bit words:                               |
+|   rotations    - "smallest three": drop the largest quaternion component,    |
+|                  store the other three in 15 bits each plus a 2-bit index    |
+|   translations - range-quantised to 16 bits per axis over the channel extents|
+|   scales       - same as translations                                        |
+|   key times    - 16 bits over the clip duration                              |
+| then keys that can be rebuilt by interpolating their neighbours to within an |
+| error tolerance are thrown away. Error is measured as a distance in bone     |
+| space: how far a point ANIM_ERROR_DISTANCE out from the joint would move.    |
+| Sampling reads straight from the packed words - there is no unpack step.     |
+\******************************************************************************/
+#ifndef _ANIM_COMPRESS_H_
+#define _ANIM_COMPRESS_H_
+
+#include "maths_funcs.h" // my maths functions
+
+struct aiAnimation;
+
+/* distance from the joint of the imaginary vertex we measure error at */
+#define ANIM_ERROR_DISTANCE 1.0f
+/* default error tolerance in bone-space units at ANIM_ERROR_DISTANCE */
+#define ANIM_DEFAULT_MAX_ERROR 0.001f
+
+/* one compressed bone channel. every key keeps its own 16-bit time because
+reduction leaves the remaining keys irregularly spaced */
+struct anim_track {
+	char bone_name[64];
+	int pos_key_count;
+	int rot_key_count;
+	int sca_key_count;
+	unsigned short *pos_times; // 1 per key
+	unsigned short *pos_keys;	// 3 per key
+	unsigned short *rot_times;
+	unsigned short *rot_keys;
+	unsigned short *sca_times;
+	unsigned short *sca_keys;
+	float pos_min[3], pos_extent[3];
+	float sca_min[3], sca_extent[3];
+};
+
+struct anim_clip {
+	char name[64];
+	float duration_seconds;
+	int track_count;
+	anim_track *tracks;
+	/* stats filled in by compress_animation() */
+	int raw_bytes;				// size as float32 keys
+	int compressed_bytes; // size of the packed tracks
+	float max_error;			// worst bone-space error over all original keys
+};
+
+/* compress one assimp animation. max_error is the keyframe reduction tolerance
+in bone-space units at ANIM_ERROR_DISTANCE */
+bool compress_animation( const aiAnimation *anim, float max_error,
+												 anim_clip *clip );
+void free_anim_clip( anim_clip *clip );
+/* sample one track at a time in seconds. any of the outputs may be NULL */
+void sample_anim_track( const anim_track *track, float duration_seconds,
+												float t, vec3 *pos, versor *rot, vec3 *sca );
+#endif
@@ -0,0 +1,258 @@
+/******************************************************************************\
+| Mesh bounding volumes - see bounds.h                                         |
+\******************************************************************************/
+#include "bounds.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#if defined( __SSE__ ) || defined( _M_X64 ) ||                                 \
+	( defined( _M_IX86_FP ) && _M_IX86_FP >= 1 )
+#define BOUNDS_SSE
+#include <xmmintrin.h>
+#endif
+
+void compute_aabb( const float *points, int count, float *mn, float *mx ) {
+	if ( count < 1 ) {
+		mn[0] = mn[1] = mn[2] = mx[0] = mx[1] = mx[2] = 0.0f;
+		return;
+	}
+	mn[0] = mn[1] = mn[2] = FLT_MAX;
+	mx[0] = mx[1] = mx[2] = -FLT_MAX;
+	int i = 0;
+#ifdef BOUNDS_SSE
+	if ( count >= 4 ) {
+		/* 4 points are 3 loads: [x0 y0 z0 x1] [y1 z1 x2 y2] [z2 x3 y3 z3]. keep a
+		min and max per load position and sort the lanes out at the end */
+		__m128 a = _mm_loadu_ps( points );
+		__m128 b = _mm_loadu_ps( points + 4 );
+		__m128 c = _mm_loadu_ps( points + 8 );
+		__m128 mn_a = a, mn_b = b, mn_c = c, mx_a = a, mx_b = b, mx_c = c;
+		for ( i = 4; i + 4 <= count; i += 4 ) {
+			const float *p = &points[i * 3];
+			a = _mm_loadu_ps( p );
+			b = _mm_loadu_ps( p + 4 );
+			c = _mm_loadu_ps( p + 8 );
+			mn_a = _mm_min_ps( mn_a, a );
+			mn_b = _mm_min_ps( mn_b, b );
+			mn_c = _mm_min_ps( mn_c, c );
+			mx_a = _mm_max_ps( mx_a, a );
+			mx_b = _mm_max_ps( mx_b, b );
+			mx_c = _mm_max_ps( mx_c, c );
+		}
+		float la[4], lb[4], lc[4], ha[4], hb[4], hc[4];
+		_mm_storeu_ps( la, mn_a );
+		_mm_storeu_ps( lb, mn_b );
+		_mm_storeu_ps( lc, mn_c );
+		_mm_storeu_ps( ha, mx_a );
+		_mm_storeu_ps( hb, mx_b );
+		_mm_storeu_ps( hc, mx_c );
+		mn[0] = fminf( fminf( la[0], la[3] ), fminf( lb[2], lc[1] ) );
+		mn[1] = fminf( fminf( la[1], lb[0] ), fminf( lb[3], lc[2] ) );
+		mn[2] = fminf( fminf( la[2], lb[1] ), fminf( lc[0], lc[3] ) );
+		mx[0] = fmaxf( fmaxf( ha[0], ha[3] ), fmaxf( hb[2], hc[1] ) );
+		mx[1] = fmaxf( fmaxf( ha[1], hb[0] ), fmaxf( hb[3], hc[2] ) );
+		mx[2] = fmaxf( fmaxf( ha[2], hb[1] ), fmaxf( hc[0], hc[3] ) );
+	}
+#endif
+	for ( ; i < count; i++ ) {
+		for ( int k = 0; k < 3; k++ ) {
+			float v = points[i * 3 + k];
+			mn[k] = v < mn[k] ? v : mn[k];
+			mx[k] = v > mx[k] ? v : mx[k];
+		}
+	}
+}
+
+static float dist2( const float *a, const float *b ) {
+	float dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+	return dx * dx + dy * dy + dz * dz;
+}
+
+static const float *farthest_from( const float *points, int count,
+																	 const float *from ) {
+	const float *best = points;
+	float best_d2 = -1.0f;
+	for ( int i = 0; i < count; i++ ) {
+		float d2 = dist2( &points[i * 3], from );
+		if ( d2 > best_d2 ) {
+			best_d2 = d2;
+			best = &points[i * 3];
+		}
+	}
+	return best;
+}
+
+/* Ritter's sphere: start from two far-apart points then grow to fit */
+static void ritter_sphere( const float *points, int count, float *centre,
+													 float *radius ) {
+	const float *x = farthest_from( points, count, points );
+	const float *y = farthest_from( points, count, x );
+	float r = sqrtf( dist2( x, y ) ) * 0.5f;
+	for ( int k = 0; k < 3; k++ ) {
+		centre[k] = ( x[k] + y[k] ) * 0.5f;
+	}
+	for ( int i = 0; i < count; i++ ) {
+		const float *p = &points[i * 3];
+		float d2 = dist2( p, centre );
+		if ( d2 > r * r ) {
+			float d = sqrtf( d2 );
+			float new_r = ( r + d ) * 0.5f;
+			float f = ( new_r - r ) / d;
+			for ( int k = 0; k < 3; k++ ) {
+				centre[k] += ( p[k] - centre[k] ) * f;
+			}
+			r = new_r;
+		}
+	}
+	*radius = r;
+}
+
+/* eigenvectors of a symmetric 3x3 matrix by cyclic Jacobi rotations. a is
+destroyed. eigenvectors come out in the columns of v */
+static void jacobi_eigen( float a[3][3], float v[3][3] ) {
+	for ( int r = 0; r < 3; r++ ) {
+		for ( int c = 0; c < 3; c++ ) {
+			v[r][c] = r == c ? 1.0f : 0.0f;
+		}
+	}
+	for ( int sweep = 0; sweep < 16; sweep++ ) {
+		float off = fabsf( a[0][1] ) + fabsf( a[0][2] ) + fabsf( a[1][2] );
+		if ( off < 1e-12f ) {
+			break;
+		}
+		for ( int p = 0; p < 2; p++ ) {
+			for ( int q = p + 1; q < 3; q++ ) {
+				if ( fabsf( a[p][q] ) < 1e-20f ) {
+					continue;
+				}
+				float theta = ( a[q][q] - a[p][p] ) / ( 2.0f * a[p][q] );
+				float t = ( theta >= 0.0f ? 1.0f : -1.0f ) /
+									( fabsf( theta ) + sqrtf( theta * theta + 1.0f ) );
+				float c = 1.0f / sqrtf( t * t + 1.0f );
+				float s = t * c;
+				for ( int k = 0; k < 3; k++ ) {
+					float akp = a[k][p], akq = a[k][q];
+					a[k][p] = c * akp - s * akq;
+					a[k][q] = s * akp + c * akq;
+				}
+				for ( int k = 0; k < 3; k++ ) {
+					float apk = a[p][k], aqk = a[q][k];
+					a[p][k] = c * apk - s * aqk;
+					a[q][k] = s * apk + c * aqk;
+				}
+				for ( int k = 0; k < 3; k++ ) {
+					float vkp = v[k][p], vkq = v[k][q];
+					v[k][p] = c * vkp - s * vkq;
+					v[k][q] = s * vkp + c * vkq;
+				}
+			}
+		}
+	}
+}
+
+/* oriented box from the principal axes of the points */
+static void pca_obb( const float *points, int count, mesh_bounds *bounds ) {
+	double mean[3] = { 0.0, 0.0, 0.0 };
+	for ( int i = 0; i < count; i++ ) {
+		for ( int k = 0; k < 3; k++ ) {
+			mean[k] += points[i * 3 + k];
+		}
+	}
+	for ( int k = 0; k < 3; k++ ) {
+		mean[k] /= (double)count;
+	}
+	double cov[3][3] = { { 0.0 } };
+	for ( int i = 0; i < count; i++ ) {
+		double d[3] = { points[i * 3] - mean[0], points[i * 3 + 1] - mean[1],
+										points[i * 3 + 2] - mean[2] };
+		for ( int r = 0; r < 3; r++ ) {
+			for ( int c = r; c < 3; c++ ) {
+				cov[r][c] += d[r] * d[c];
+			}
+		}
+	}
+	float a[3][3], v[3][3];
+	for ( int r = 0; r < 3; r++ ) {
+		for ( int c = 0; c < 3; c++ ) {
+			a[r][c] = (float)( ( r <= c ? cov[r][c] : cov[c][r] ) / (double)count );
+		}
+	}
+	jacobi_eigen( a, v );
+
+	float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for ( int ax = 0; ax < 3; ax++ ) {
+		bounds->obb_axes[ax] = normalise( vec3( v[0][ax], v[1][ax], v[2][ax] ) );
+	}
+	for ( int i = 0; i < count; i++ ) {
+		vec3 p( points[i * 3], points[i * 3 + 1], points[i * 3 + 2] );
+		for ( int ax = 0; ax < 3; ax++ ) {
+			float d = dot( p, bounds->obb_axes[ax] );
+			lo[ax] = d < lo[ax] ? d : lo[ax];
+			hi[ax] = d > hi[ax] ? d : hi[ax];
+		}
+	}
+	bounds->obb_centre = vec3( 0.0f, 0.0f, 0.0f );
+	for ( int ax = 0; ax < 3; ax++ ) {
+		bounds->obb_half_extents.v[ax] = ( hi[ax] - lo[ax] ) * 0.5f;
+		bounds->obb_centre += bounds->obb_axes[ax] * ( ( hi[ax] + lo[ax] ) * 0.5f );
+	}
+
+	/* PCA can lose to the plain box on boxy meshes - keep whichever is smaller */
+	vec3 ext = bounds->aabb_max - bounds->aabb_min;
+	const vec3 &h = bounds->obb_half_extents;
+	if ( ext.v[0] * ext.v[1] * ext.v[2] <= 8.0f * h.v[0] * h.v[1] * h.v[2] ) {
+		bounds->obb_centre = ( bounds->aabb_min + bounds->aabb_max ) * 0.5f;
+		bounds->obb_half_extents = ext * 0.5f;
+		bounds->obb_axes[0] = vec3( 1.0f, 0.0f, 0.0f );
+		bounds->obb_axes[1] = vec3( 0.0f, 1.0f, 0.0f );
+		bounds->obb_axes[2] = vec3( 0.0f, 0.0f, 1.0f );
+	}
+	bounds->has_obb = true;
+}
+
+void compute_mesh_bounds( const float *points, int count, bool with_obb,
+													mesh_bounds *bounds ) {
+	bounds->has_obb = false;
+	compute_aabb( points, count, bounds->aabb_min.v, bounds->aabb_max.v );
+	bounds->sphere_centre = ( bounds->aabb_min + bounds->aabb_max ) * 0.5f;
+	bounds->sphere_radius = 0.0f;
+	if ( count < 1 ) {
+		return;
+	}
+
+	/* Ritter is usually tighter, but not always, than the sphere around the box
+	centre - try both */
+	float box_r2 = 0.0f;
+	for ( int i = 0; i < count; i++ ) {
+		float d2 = dist2( &points[i * 3], bounds->sphere_centre.v );
+		box_r2 = d2 > box_r2 ? d2 : box_r2;
+	}
+	float centre[3], radius;
+	ritter_sphere( points, count, centre, &radius );
+	if ( radius < sqrtf( box_r2 ) ) {
+		bounds->sphere_centre = vec3( centre[0], centre[1], centre[2] );
+		bounds->sphere_radius = radius;
+	} else {
+		bounds->sphere_radius = sqrtf( box_r2 );
+	}
+
+	if ( with_obb ) {
+		pca_obb( points, count, bounds );
+	}
+}
+
+void print_bounds( const mesh_bounds &bounds ) {
+	printf( "    aabb [%.3f %.3f %.3f] - [%.3f %.3f %.3f]\n", bounds.aabb_min.v[0],
+					bounds.aabb_min.v[1], bounds.aabb_min.v[2], bounds.aabb_max.v[0],
+					bounds.aabb_max.v[1], bounds.aabb_max.v[2] );
+	printf( "    sphere [%.3f %.3f %.3f] r %.3f\n", bounds.sphere_centre.v[0],
+					bounds.sphere_centre.v[1], bounds.sphere_centre.v[2],
+					bounds.sphere_radius );
+	if ( bounds.has_obb ) {
+		printf( "    obb [%.3f %.3f %.3f] half extents [%.3f %.3f %.3f]\n",
+						bounds.obb_centre.v[0], bounds.obb_centre.v[1], bounds.obb_centre.v[2],
+						bounds.obb_half_extents.v[0], bounds.obb_half_extents.v[1],
+						bounds.obb_half_extents.v[2] );
+	}
+}
@@ -0,0 +1,31 @@
+/******************************************************************************\
+| Mesh bounding volumes                                                        |
+| Axis-aligned box, bounding sphere, and optionally an oriented box for a      |
+| packed array of x,y,z positions. The box is an SSE min/max reduction that    |
+| takes 4 points per 3 loads. The sphere is Ritter's, tightened by also trying |
+| the box-centred sphere and keeping the smaller one. The oriented box takes   |
+| its axes from the principal components of the points.                        |
+| Call it straight after copying the positions so they are still in cache.     |
+\******************************************************************************/
+#ifndef _BOUNDS_H_
+#define _BOUNDS_H_
+
+#include "maths_funcs.h" // my maths functions
+
+struct mesh_bounds {
+	vec3 aabb_min;
+	vec3 aabb_max;
+	vec3 sphere_centre;
+	float sphere_radius;
+	bool has_obb;
+	vec3 obb_centre;
+	vec3 obb_axes[3];				 // unit length, orthogonal
+	vec3 obb_half_extents; // along each of obb_axes
+};
+
+/* min/max of count packed x,y,z points */
+void compute_aabb( const float *points, int count, float *mn, float *mx );
+void compute_mesh_bounds( const float *points, int count, bool with_obb,
+													mesh_bounds *bounds );
+void print_bounds( const mesh_bounds &bounds );
+#endif
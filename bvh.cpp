@@ -0,0 +1,556 @@
+/******************************************************************************\
+| Triangle bounding volume hierarchy - see bvh.h                               |
+\******************************************************************************/
+#include "bvh.h"
+#include "parallel.h"
+#include <atomic>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined( __SSE2__ ) || defined( _M_X64 ) ||                                \
+	( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define BVH_SSE
+#include <emmintrin.h>
+#endif
+
+/* traversal stack depth. the builder stops splitting before this */
+#define BVH_STACK_SIZE 64
+#define BVH_MAX_DEPTH ( BVH_STACK_SIZE - 4 )
+#define BVH_DET_EPSILON 1e-12f
+
+/*------------------------------------BUILD-----------------------------------*/
+/* shared by all build threads. each thread works on a disjoint range of
+tri_indices and takes pairs of nodes from the atomic counter */
+struct bvh_build_ctx {
+	bvh *b;
+	float *tri_bmin;	// 3 per triangle
+	float *tri_bmax;	// 3 per triangle
+	float *centroids; // 3 per triangle
+	std::atomic<int> next_node;
+	/* sub-trees left for the pool by the serial top of the build */
+	int *subtree_nodes;
+	int *subtree_depths;
+	int subtree_count, subtree_max;
+	bool out_of_memory;
+};
+
+struct bvh_bin {
+	float bmin[3], bmax[3];
+	int count;
+};
+
+static void reset_bounds( float *mn, float *mx ) {
+	mn[0] = mn[1] = mn[2] = FLT_MAX;
+	mx[0] = mx[1] = mx[2] = -FLT_MAX;
+}
+
+static void grow_bounds( float *mn, float *mx, const float *pmn,
+												 const float *pmx ) {
+	for ( int i = 0; i < 3; i++ ) {
+		mn[i] = pmn[i] < mn[i] ? pmn[i] : mn[i];
+		mx[i] = pmx[i] > mx[i] ? pmx[i] : mx[i];
+	}
+}
+
+static float half_area( const float *mn, const float *mx ) {
+	if ( mn[0] > mx[0] ) {
+		return 0.0f;
+	}
+	float dx = mx[0] - mn[0], dy = mx[1] - mn[1], dz = mx[2] - mn[2];
+	return dx * dy + dy * dz + dz * dx;
+}
+
+static void fit_node( bvh_build_ctx *ctx, bvh_node *node ) {
+	reset_bounds( node->bmin, node->bmax );
+	for ( unsigned int i = 0; i < node->tri_count; i++ ) {
+		unsigned int tri = ctx->b->tri_indices[node->left_first + i];
+		grow_bounds( node->bmin, node->bmax, &ctx->tri_bmin[tri * 3],
+								 &ctx->tri_bmax[tri * 3] );
+	}
+}
+
+static int bin_of( float c, float cmin, float scale ) {
+	int bi = (int)( ( c - cmin ) * scale );
+	return bi < 0 ? 0 : ( bi >= BVH_BIN_COUNT ? BVH_BIN_COUNT - 1 : bi );
+}
+
+/* defer is only set for the top of the tree, on one thread */
+static void subdivide( bvh_build_ctx *ctx, int node_index, int depth, bool defer );
+
+/* leave a small enough node to be built on the pool */
+static void defer_subtree( bvh_build_ctx *ctx, int node_index, int depth ) {
+	if ( ctx->subtree_count == ctx->subtree_max ) {
+		int max = ctx->subtree_max ? ctx->subtree_max * 2 : 64;
+		int *nodes = (int *)realloc( ctx->subtree_nodes, max * sizeof( int ) );
+		if ( nodes ) {
+			ctx->subtree_nodes = nodes;
+		}
+		int *depths = (int *)realloc( ctx->subtree_depths, max * sizeof( int ) );
+		if ( depths ) {
+			ctx->subtree_depths = depths;
+		}
+		if ( !nodes || !depths ) {
+			/* still a valid tree, just built here instead */
+			ctx->out_of_memory = true;
+			subdivide( ctx, node_index, depth, false );
+			return;
+		}
+		ctx->subtree_max = max;
+	}
+	ctx->subtree_nodes[ctx->subtree_count] = node_index;
+	ctx->subtree_depths[ctx->subtree_count] = depth;
+	ctx->subtree_count++;
+}
+
+static void build_subtree( int i, void *user ) {
+	bvh_build_ctx *ctx = (bvh_build_ctx *)user;
+	subdivide( ctx, ctx->subtree_nodes[i], ctx->subtree_depths[i], false );
+}
+
+static void subdivide( bvh_build_ctx *ctx, int node_index, int depth, bool defer ) {
+	bvh_node *node = &ctx->b->nodes[node_index];
+	unsigned int first = node->left_first;
+	unsigned int count = node->tri_count;
+	unsigned int *ids = ctx->b->tri_indices;
+	if ( count <= 2 || depth >= BVH_MAX_DEPTH ) {
+		return;
+	}
+
+	/* bin by centroid so that big triangles don't stretch the bins */
+	float cmin[3], cmax[3];
+	reset_bounds( cmin, cmax );
+	for ( unsigned int i = 0; i < count; i++ ) {
+		const float *c = &ctx->centroids[ids[first + i] * 3];
+		grow_bounds( cmin, cmax, c, c );
+	}
+	float best_cost = FLT_MAX;
+	int best_axis = -1, best_split = 0;
+	for ( int axis = 0; axis < 3; axis++ ) {
+		float extent = cmax[axis] - cmin[axis];
+		if ( extent <= 0.0f ) {
+			continue;
+		}
+		bvh_bin bins[BVH_BIN_COUNT];
+		for ( int i = 0; i < BVH_BIN_COUNT; i++ ) {
+			reset_bounds( bins[i].bmin, bins[i].bmax );
+			bins[i].count = 0;
+		}
+		float scale = (float)BVH_BIN_COUNT / extent;
+		for ( unsigned int i = 0; i < count; i++ ) {
+			unsigned int tri = ids[first + i];
+			bvh_bin *bin = &bins[bin_of( ctx->centroids[tri * 3 + axis], cmin[axis], scale )];
+			grow_bounds( bin->bmin, bin->bmax, &ctx->tri_bmin[tri * 3],
+									 &ctx->tri_bmax[tri * 3] );
+			bin->count++;
+		}
+		/* sweep from both ends to get the cost of every split plane */
+		float left_area[BVH_BIN_COUNT - 1], right_area[BVH_BIN_COUNT - 1];
+		int left_count[BVH_BIN_COUNT - 1], right_count[BVH_BIN_COUNT - 1];
+		float lmn[3], lmx[3], rmn[3], rmx[3];
+		reset_bounds( lmn, lmx );
+		reset_bounds( rmn, rmx );
+		int lsum = 0, rsum = 0;
+		for ( int i = 0; i < BVH_BIN_COUNT - 1; i++ ) {
+			lsum += bins[i].count;
+			left_count[i] = lsum;
+			grow_bounds( lmn, lmx, bins[i].bmin, bins[i].bmax );
+			left_area[i] = half_area( lmn, lmx );
+			int r = BVH_BIN_COUNT - 1 - i;
+			rsum += bins[r].count;
+			right_count[r - 1] = rsum;
+			grow_bounds( rmn, rmx, bins[r].bmin, bins[r].bmax );
+			right_area[r - 1] = half_area( rmn, rmx );
+		}
+		for ( int i = 0; i < BVH_BIN_COUNT - 1; i++ ) {
+			if ( 0 == left_count[i] || 0 == right_count[i] ) {
+				continue;
+			}
+			float cost = left_count[i] * left_area[i] + right_count[i] * right_area[i];
+			if ( cost < best_cost ) {
+				best_cost = cost;
+				best_axis = axis;
+				best_split = i;
+			}
+		}
+	}
+
+	/* SAH with traversal cost 1 and triangle cost 1 */
+	float parent_area = half_area( node->bmin, node->bmax );
+	float split_cost = FLT_MAX;
+	if ( best_axis >= 0 && parent_area > 0.0f ) {
+		split_cost = 1.0f + best_cost / parent_area;
+	}
+	if ( split_cost >= (float)count && count <= BVH_MAX_LEAF_TRIS ) {
+		return;
+	}
+
+	unsigned int mid = first + count / 2;
+	if ( best_axis >= 0 ) {
+		float scale = (float)BVH_BIN_COUNT / ( cmax[best_axis] - cmin[best_axis] );
+		int i = (int)first, j = (int)( first + count ) - 1;
+		while ( i <= j ) {
+			float c = ctx->centroids[ids[i] * 3 + best_axis];
+			if ( bin_of( c, cmin[best_axis], scale ) <= best_split ) {
+				i++;
+			} else {
+				unsigned int tmp = ids[i];
+				ids[i] = ids[j];
+				ids[j--] = tmp;
+			}
+		}
+		mid = (unsigned int)i;
+	}
+	// all centroids in one spot - any split is as good as another
+	if ( mid == first || mid == first + count ) {
+		mid = first + count / 2;
+	}
+
+	int left = ctx->next_node.fetch_add( 2 );
+	bvh_node *children = &ctx->b->nodes[left];
+	children[0].left_first = first;
+	children[0].tri_count = mid - first;
+	children[1].left_first = mid;
+	children[1].tri_count = first + count - mid;
+	fit_node( ctx, &children[0] );
+	fit_node( ctx, &children[1] );
+	node->left_first = (unsigned int)left;
+	node->tri_count = 0;
+
+	for ( int c = 0; c < 2; c++ ) {
+		if ( defer && children[c].tri_count <= BVH_PARALLEL_THRESHOLD ) {
+			defer_subtree( ctx, left + c, depth + 1 );
+		} else {
+			subdivide( ctx, left + c, depth + 1, defer );
+		}
+	}
+}
+
+bool build_bvh( const float *points, const unsigned int *indices, int tri_count,
+								bvh *out ) {
+	memset( out, 0, sizeof( bvh ) );
+	if ( tri_count < 1 ) {
+		fprintf( stderr, "ERROR: no triangles to build BVH from\n" );
+		return false;
+	}
+	int padded = ( ( tri_count + 3 ) & ~3 ) + 4;
+	out->tri_count = tri_count;
+	out->nodes = (bvh_node *)malloc( 2 * tri_count * sizeof( bvh_node ) );
+	out->tri_indices = (unsigned int *)malloc( tri_count * sizeof( unsigned int ) );
+	out->tri_soa = (float *)calloc( 9 * padded, sizeof( float ) );
+	bvh_build_ctx ctx;
+	ctx.b = out;
+	ctx.tri_bmin = (float *)malloc( tri_count * 3 * sizeof( float ) );
+	ctx.tri_bmax = (float *)malloc( tri_count * 3 * sizeof( float ) );
+	ctx.centroids = (float *)malloc( tri_count * 3 * sizeof( float ) );
+	if ( !out->nodes || !out->tri_indices || !out->tri_soa || !ctx.tri_bmin ||
+			 !ctx.tri_bmax || !ctx.centroids ) {
+		fprintf( stderr, "ERROR: out of memory building BVH of %i triangles\n",
+						 tri_count );
+		free( ctx.tri_bmin );
+		free( ctx.tri_bmax );
+		free( ctx.centroids );
+		free_bvh( out );
+		return false;
+	}
+
+	for ( int t = 0; t < tri_count; t++ ) {
+		reset_bounds( &ctx.tri_bmin[t * 3], &ctx.tri_bmax[t * 3] );
+		for ( int k = 0; k < 3; k++ ) {
+			unsigned int vi = indices ? indices[t * 3 + k] : (unsigned int)( t * 3 + k );
+			const float *p = &points[vi * 3];
+			grow_bounds( &ctx.tri_bmin[t * 3], &ctx.tri_bmax[t * 3], p, p );
+		}
+		for ( int k = 0; k < 3; k++ ) {
+			ctx.centroids[t * 3 + k] =
+				( ctx.tri_bmin[t * 3 + k] + ctx.tri_bmax[t * 3 + k] ) * 0.5f;
+		}
+		out->tri_indices[t] = (unsigned int)t;
+	}
+
+	out->nodes[0].left_first = 0;
+	out->nodes[0].tri_count = (unsigned int)tri_count;
+	fit_node( &ctx, &out->nodes[0] );
+	// node 1 is left unused so that sibling pairs start on even slots
+	ctx.next_node = 2;
+	ctx.subtree_nodes = ctx.subtree_depths = NULL;
+	ctx.subtree_count = ctx.subtree_max = 0;
+	ctx.out_of_memory = false;
+	subdivide( &ctx, 0, 0, tri_count > BVH_PARALLEL_THRESHOLD );
+	parallel_for( ctx.subtree_count, build_subtree, &ctx );
+	if ( ctx.out_of_memory ) {
+		fprintf( stderr, "WARNING: BVH of %i triangles partly built on one thread\n", tri_count );
+	}
+	free( ctx.subtree_nodes );
+	free( ctx.subtree_depths );
+	out->node_count = ctx.next_node;
+
+	/* copy the triangles into leaf order as v0, e1, e2 for the intersector */
+	for ( int slot = 0; slot < tri_count; slot++ ) {
+		int t = (int)out->tri_indices[slot];
+		const float *v[3];
+		for ( int k = 0; k < 3; k++ ) {
+			unsigned int vi = indices ? indices[t * 3 + k] : (unsigned int)( t * 3 + k );
+			v[k] = &points[vi * 3];
+		}
+		for ( int a = 0; a < 3; a++ ) {
+			out->tri_soa[a * padded + slot] = v[0][a];
+			out->tri_soa[( 3 + a ) * padded + slot] = v[1][a] - v[0][a];
+			out->tri_soa[( 6 + a ) * padded + slot] = v[2][a] - v[0][a];
+		}
+	}
+
+	free( ctx.tri_bmin );
+	free( ctx.tri_bmax );
+	free( ctx.centroids );
+	printf( "built BVH: %i triangles, %i nodes\n", tri_count, out->node_count );
+	return true;
+}
+
+void free_bvh( bvh *b ) {
+	free( b->nodes );
+	free( b->tri_indices );
+	free( b->tri_soa );
+	memset( b, 0, sizeof( bvh ) );
+}
+
+/*----------------------------------TRAVERSAL---------------------------------*/
+struct bvh_ray {
+	float o[4], d[4], inv_d[4];
+#ifdef BVH_SSE
+	__m128 o4, inv_d4;
+#endif
+};
+
+static void setup_ray( bvh_ray *r, const vec3 &origin, const vec3 &dir ) {
+	for ( int i = 0; i < 3; i++ ) {
+		r->o[i] = origin.v[i];
+		r->d[i] = dir.v[i];
+		// keep 0 * inf out of the slab test
+		float d = fabsf( dir.v[i] ) > 1e-20f ? dir.v[i] : ( dir.v[i] < 0.0f ? -1e-20f : 1e-20f );
+		r->inv_d[i] = 1.0f / d;
+	}
+	r->o[3] = r->d[3] = r->inv_d[3] = 0.0f;
+#ifdef BVH_SSE
+	r->o4 = _mm_loadu_ps( r->o );
+	r->inv_d4 = _mm_loadu_ps( r->inv_d );
+#endif
+}
+
+/* distance to where the ray enters the node's box, or FLT_MAX for a miss */
+static float ray_box( const bvh_ray *r, const bvh_node *node, float max_t ) {
+#ifdef BVH_SSE
+	const __m128 xyz_mask = _mm_castsi128_ps( _mm_set_epi32( 0, -1, -1, -1 ) );
+	// the 4th lane holds the node's index/count, so it gets masked out below
+	__m128 t1 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( node->bmin ), r->o4 ), r->inv_d4 );
+	__m128 t2 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( node->bmax ), r->o4 ), r->inv_d4 );
+	__m128 tnear = _mm_and_ps( _mm_min_ps( t1, t2 ), xyz_mask );
+	__m128 tfar = _mm_or_ps( _mm_and_ps( _mm_max_ps( t1, t2 ), xyz_mask ),
+													 _mm_andnot_ps( xyz_mask, _mm_set1_ps( max_t ) ) );
+	tnear = _mm_max_ps( tnear, _mm_shuffle_ps( tnear, tnear, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	tnear = _mm_max_ps( tnear, _mm_shuffle_ps( tnear, tnear, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	tfar = _mm_min_ps( tfar, _mm_shuffle_ps( tfar, tfar, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	tfar = _mm_min_ps( tfar, _mm_shuffle_ps( tfar, tfar, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	float t_enter = _mm_cvtss_f32( tnear );
+	float t_exit = _mm_cvtss_f32( tfar );
+#else
+	float t_enter = 0.0f, t_exit = max_t;
+	for ( int i = 0; i < 3; i++ ) {
+		float t1 = ( node->bmin[i] - r->o[i] ) * r->inv_d[i];
+		float t2 = ( node->bmax[i] - r->o[i] ) * r->inv_d[i];
+		float lo = t1 < t2 ? t1 : t2, hi = t1 < t2 ? t2 : t1;
+		t_enter = lo > t_enter ? lo : t_enter;
+		t_exit = hi < t_exit ? hi : t_exit;
+	}
+#endif
+	return t_exit >= t_enter ? t_enter : FLT_MAX;
+}
+
+/* test the triangles in one leaf. updates hit and returns true if any triangle
+is closer than hit->t */
+static bool ray_leaf( const bvh *b, const bvh_ray *r, const bvh_node *node,
+											ray_hit *hit ) {
+	int padded = ( ( b->tri_count + 3 ) & ~3 ) + 4;
+	const float *soa = b->tri_soa;
+	bool found = false;
+	int first = (int)node->left_first;
+	int count = (int)node->tri_count;
+#ifdef BVH_SSE
+	const __m128 ox = _mm_set1_ps( r->o[0] ), oy = _mm_set1_ps( r->o[1] ),
+							 oz = _mm_set1_ps( r->o[2] );
+	const __m128 dx = _mm_set1_ps( r->d[0] ), dy = _mm_set1_ps( r->d[1] ),
+							 dz = _mm_set1_ps( r->d[2] );
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps( 1.0f );
+	const __m128 sign_mask = _mm_set1_ps( -0.0f );
+	for ( int g = 0; g < count; g += 4 ) {
+		int s = first + g;
+		__m128 v0x = _mm_loadu_ps( &soa[0 * padded + s] );
+		__m128 v0y = _mm_loadu_ps( &soa[1 * padded + s] );
+		__m128 v0z = _mm_loadu_ps( &soa[2 * padded + s] );
+		__m128 e1x = _mm_loadu_ps( &soa[3 * padded + s] );
+		__m128 e1y = _mm_loadu_ps( &soa[4 * padded + s] );
+		__m128 e1z = _mm_loadu_ps( &soa[5 * padded + s] );
+		__m128 e2x = _mm_loadu_ps( &soa[6 * padded + s] );
+		__m128 e2y = _mm_loadu_ps( &soa[7 * padded + s] );
+		__m128 e2z = _mm_loadu_ps( &soa[8 * padded + s] );
+		// p = d x e2
+		__m128 px = _mm_sub_ps( _mm_mul_ps( dy, e2z ), _mm_mul_ps( dz, e2y ) );
+		__m128 py = _mm_sub_ps( _mm_mul_ps( dz, e2x ), _mm_mul_ps( dx, e2z ) );
+		__m128 pz = _mm_sub_ps( _mm_mul_ps( dx, e2y ), _mm_mul_ps( dy, e2x ) );
+		__m128 det = _mm_add_ps( _mm_add_ps( _mm_mul_ps( e1x, px ), _mm_mul_ps( e1y, py ) ),
+														 _mm_mul_ps( e1z, pz ) );
+		__m128 det_ok = _mm_cmpgt_ps( _mm_andnot_ps( sign_mask, det ),
+																	_mm_set1_ps( BVH_DET_EPSILON ) );
+		__m128 inv_det = _mm_div_ps( one, _mm_or_ps( _mm_and_ps( det_ok, det ),
+																								 _mm_andnot_ps( det_ok, one ) ) );
+		__m128 tx = _mm_sub_ps( ox, v0x );
+		__m128 ty = _mm_sub_ps( oy, v0y );
+		__m128 tz = _mm_sub_ps( oz, v0z );
+		__m128 u = _mm_mul_ps(
+			_mm_add_ps( _mm_add_ps( _mm_mul_ps( tx, px ), _mm_mul_ps( ty, py ) ), _mm_mul_ps( tz, pz ) ),
+			inv_det );
+		// q = t x e1
+		__m128 qx = _mm_sub_ps( _mm_mul_ps( ty, e1z ), _mm_mul_ps( tz, e1y ) );
+		__m128 qy = _mm_sub_ps( _mm_mul_ps( tz, e1x ), _mm_mul_ps( tx, e1z ) );
+		__m128 qz = _mm_sub_ps( _mm_mul_ps( tx, e1y ), _mm_mul_ps( ty, e1x ) );
+		__m128 v = _mm_mul_ps(
+			_mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, qx ), _mm_mul_ps( dy, qy ) ), _mm_mul_ps( dz, qz ) ),
+			inv_det );
+		__m128 t = _mm_mul_ps(
+			_mm_add_ps( _mm_add_ps( _mm_mul_ps( e2x, qx ), _mm_mul_ps( e2y, qy ) ), _mm_mul_ps( e2z, qz ) ),
+			inv_det );
+		__m128 mask = _mm_and_ps( det_ok, _mm_cmpge_ps( u, zero ) );
+		mask = _mm_and_ps( mask, _mm_cmpge_ps( v, zero ) );
+		mask = _mm_and_ps( mask, _mm_cmple_ps( _mm_add_ps( u, v ), one ) );
+		mask = _mm_and_ps( mask, _mm_cmpge_ps( t, zero ) );
+		mask = _mm_and_ps( mask, _mm_cmplt_ps( t, _mm_set1_ps( hit->t ) ) );
+		int bits = _mm_movemask_ps( mask );
+		// the last group can run into the next leaf's triangles
+		int valid = count - g;
+		if ( valid < 4 ) {
+			bits &= ( 1 << valid ) - 1;
+		}
+		if ( !bits ) {
+			continue;
+		}
+		float ts[4], us[4], vs[4];
+		_mm_storeu_ps( ts, t );
+		_mm_storeu_ps( us, u );
+		_mm_storeu_ps( vs, v );
+		for ( int lane = 0; lane < 4; lane++ ) {
+			if ( ( bits & ( 1 << lane ) ) && ts[lane] < hit->t ) {
+				hit->t = ts[lane];
+				hit->u = us[lane];
+				hit->v = vs[lane];
+				hit->triangle = (int)b->tri_indices[s + lane];
+				found = true;
+			}
+		}
+	}
+#else
+	for ( int i = 0; i < count; i++ ) {
+		int s = first + i;
+		float v0[3], e1[3], e2[3];
+		for ( int a = 0; a < 3; a++ ) {
+			v0[a] = soa[a * padded + s];
+			e1[a] = soa[( 3 + a ) * padded + s];
+			e2[a] = soa[( 6 + a ) * padded + s];
+		}
+		const float *d = r->d;
+		float p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2],
+									 d[0] * e2[1] - d[1] * e2[0] };
+		float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+		if ( fabsf( det ) <= BVH_DET_EPSILON ) {
+			continue;
+		}
+		float inv_det = 1.0f / det;
+		float tv[3] = { r->o[0] - v0[0], r->o[1] - v0[1], r->o[2] - v0[2] };
+		float u = ( tv[0] * p[0] + tv[1] * p[1] + tv[2] * p[2] ) * inv_det;
+		if ( u < 0.0f || u > 1.0f ) {
+			continue;
+		}
+		float q[3] = { tv[1] * e1[2] - tv[2] * e1[1], tv[2] * e1[0] - tv[0] * e1[2],
+									 tv[0] * e1[1] - tv[1] * e1[0] };
+		float v = ( d[0] * q[0] + d[1] * q[1] + d[2] * q[2] ) * inv_det;
+		if ( v < 0.0f || u + v > 1.0f ) {
+			continue;
+		}
+		float t = ( e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2] ) * inv_det;
+		if ( t >= 0.0f && t < hit->t ) {
+			hit->t = t;
+			hit->u = u;
+			hit->v = v;
+			hit->triangle = (int)b->tri_indices[s];
+			found = true;
+		}
+	}
+#endif
+	return found;
+}
+
+static bool traverse( const bvh *b, const vec3 &origin, const vec3 &dir,
+											float max_t, bool any_hit, ray_hit *hit ) {
+	hit->t = max_t;
+	hit->triangle = -1;
+	hit->u = hit->v = 0.0f;
+	if ( !b->nodes ) {
+		return false;
+	}
+	bvh_ray r;
+	setup_ray( &r, origin, dir );
+	if ( ray_box( &r, &b->nodes[0], max_t ) == FLT_MAX ) {
+		return false;
+	}
+	int stack[BVH_STACK_SIZE];
+	int sp = 0;
+	int node_index = 0;
+	bool found = false;
+	while ( true ) {
+		const bvh_node *node = &b->nodes[node_index];
+		if ( node->tri_count > 0 ) {
+			if ( ray_leaf( b, &r, node, hit ) ) {
+				found = true;
+				if ( any_hit ) {
+					return true;
+				}
+			}
+		} else {
+			/* visit the nearer child first and come back for the other */
+			int near_i = (int)node->left_first, far_i = near_i + 1;
+			float d_near = ray_box( &r, &b->nodes[near_i], hit->t );
+			float d_far = ray_box( &r, &b->nodes[far_i], hit->t );
+			if ( d_far < d_near ) {
+				float tmp_d = d_near;
+				d_near = d_far;
+				d_far = tmp_d;
+				int tmp_i = near_i;
+				near_i = far_i;
+				far_i = tmp_i;
+			}
+			if ( d_near != FLT_MAX ) {
+				if ( d_far != FLT_MAX ) {
+					stack[sp++] = far_i;
+				}
+				node_index = near_i;
+				continue;
+			}
+		}
+		if ( 0 == sp ) {
+			break;
+		}
+		node_index = stack[--sp];
+	}
+	return found;
+}
+
+bool bvh_closest_hit( const bvh *b, const vec3 &origin, const vec3 &dir,
+											float max_t, ray_hit *hit ) {
+	return traverse( b, origin, dir, max_t, false, hit );
+}
+
+bool bvh_raycast( const bvh *b, const vec3 &origin, const vec3 &dir,
+									float max_t ) {
+	ray_hit hit;
+	return traverse( b, origin, dir, max_t, true, &hit );
+}
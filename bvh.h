@@ -0,0 +1,56 @@
+/******************************************************************************\
+| Triangle bounding volume hierarchy for ray queries and mouse picking         |
+| Built on the CPU from the loaded mesh positions with a binned surface area   |
+| heuristic (SAH) splitter. Sub-trees of large meshes are built on their own   |
+| threads. Nodes are 32 bytes: bounds in the first 3 floats of each half, and  |
+| the child/triangle index and triangle count packed into the 4th slots.       |
+| Traversal tests node boxes with SSE slab tests and leaf triangles 4 at a time|
+| with an SSE Moller-Trumbore, reading a structure-of-arrays copy of the       |
+| triangles stored in leaf order. There is a plain C fallback without SSE.     |
+\******************************************************************************/
+#ifndef _BVH_H_
+#define _BVH_H_
+
+#include "maths_funcs.h" // my maths functions
+
+/* the top of the tree is split on the calling thread down to sub-trees of at
+most this many triangles, which are then built across the parallel_for() pool */
+#define BVH_PARALLEL_THRESHOLD 65536
+/* leaves are allowed to grow to this many triangles if SAH says so */
+#define BVH_MAX_LEAF_TRIS 8
+#define BVH_BIN_COUNT 16
+
+struct bvh_node {
+	float bmin[3];
+	unsigned int left_first; // left child if interior (right is +1), else tri
+	float bmax[3];
+	unsigned int tri_count; // 0 for interior nodes
+};
+
+struct bvh {
+	bvh_node *nodes;
+	int node_count;
+	/* original triangle number for each leaf slot */
+	unsigned int *tri_indices;
+	/* v0, edge1, edge2 as 9 arrays of floats in leaf order, padded to 4 */
+	float *tri_soa;
+	int tri_count;
+};
+
+struct ray_hit {
+	float t;			// distance along the ray in units of the direction's length
+	int triangle; // index of the triangle in the source data
+	float u, v;		// barycentric coordinates of the hit
+};
+
+/* build from triangles. if indices is NULL then points is a triangle soup,
+otherwise every 3 indices into points make a triangle */
+bool build_bvh( const float *points, const unsigned int *indices, int tri_count,
+								bvh *out );
+void free_bvh( bvh *b );
+/* closest triangle hit along origin + t * dir for t in [0, max_t] */
+bool bvh_closest_hit( const bvh *b, const vec3 &origin, const vec3 &dir,
+											float max_t, ray_hit *hit );
+/* true if anything at all is hit - use for line-of-sight */
+bool bvh_raycast( const bvh *b, const vec3 &origin, const vec3 &dir, float max_t );
+#endif
@@ -0,0 +1,579 @@
+/******************************************************************************\
+| GGX prefiltered environment map - see env_prefilter.h                        |
+\******************************************************************************/
+#include "env_prefilter.h"
+#include "gl_utils.h"
+#include "image_cache.h" // fnv1a64, write_file_atomic
+#include "mapped_file.h"
+#include "mipmap.h"
+#include "parallel.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined( __SSE2__ ) || defined( _M_X64 ) ||                                \
+	( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define ENV_SSE
+#include <emmintrin.h>
+#endif
+
+/* bump this whenever the filtering changes to invalidate old caches */
+#define ENV_CACHE_VERSION 2
+#define ENV_PI 3.14159265f
+
+/*-------------------------------------SOURCE---------------------------------*/
+/* the sky-box faces as linear RGBA floats, from ENV_SOURCE_MAX_SIZE down */
+struct env_source {
+	int level_count;
+	int sizes[MIP_MAX_LEVELS];
+	float *faces[MIP_MAX_LEVELS][6];
+	float *data;
+};
+
+struct face_batch {
+	decoded_image images[6];
+	mip_chain chains[6];
+	bool ok[6];
+};
+
+static void decode_face( int i, void *user ) {
+	face_batch *batch = (face_batch *)user;
+	batch->ok[i] = decode_image_mipped( &batch->images[i], MIP_COLOUR, MIP_BOX,
+																			&batch->chains[i] );
+}
+
+static bool load_source( const char **face_files, env_source *src ) {
+	memset( src, 0, sizeof( env_source ) );
+	face_batch batch;
+	for ( int i = 0; i < 6; i++ ) {
+		batch.images[i].file_name = face_files[i];
+		batch.images[i].flip = false; // cube-map sides are used the right way up
+	}
+	parallel_for( 6, decode_face, &batch );
+	bool ok = true;
+	for ( int i = 0; i < 6; i++ ) {
+		ok = ok && batch.ok[i];
+	}
+	for ( int i = 0; ok && i < 6; i++ ) {
+		ok = batch.images[i].width == batch.images[0].width &&
+				 batch.images[i].height == batch.images[0].width;
+		if ( !ok ) {
+			fprintf( stderr, "ERROR: sky-box face %s is not square or not the size of %s\n",
+							 face_files[i], face_files[0] );
+		}
+	}
+	if ( ok ) {
+		/* skip the mips bigger than the output could ever need */
+		const mip_chain *chain = &batch.chains[0];
+		int first = 0;
+		while ( first < chain->level_count - 1 && chain->widths[first] > ENV_SOURCE_MAX_SIZE ) {
+			first++;
+		}
+		src->level_count = chain->level_count - first;
+		size_t total = 0;
+		for ( int l = 0; l < src->level_count; l++ ) {
+			src->sizes[l] = chain->widths[first + l];
+			total += (size_t)src->sizes[l] * src->sizes[l] * 4 * 6;
+		}
+		src->data = (float *)malloc( total * sizeof( float ) );
+		ok = NULL != src->data;
+		float *f = src->data;
+		for ( int l = 0; ok && l < src->level_count; l++ ) {
+			int texels = src->sizes[l] * src->sizes[l];
+			for ( int i = 0; i < 6; i++ ) {
+				src->faces[l][i] = f;
+				const unsigned char *p = batch.chains[i].levels[first + l];
+				for ( int j = 0; j < texels * 4; j += 4 ) {
+					f[j + 0] = srgb_to_linear( p[j + 0] );
+					f[j + 1] = srgb_to_linear( p[j + 1] );
+					f[j + 2] = srgb_to_linear( p[j + 2] );
+					f[j + 3] = p[j + 3] / 255.0f;
+				}
+				f += texels * 4;
+			}
+		}
+	}
+	for ( int i = 0; i < 6; i++ ) {
+		if ( batch.ok[i] ) {
+			free_mip_chain( &batch.chains[i] );
+			free_decoded_image( &batch.images[i] );
+		}
+	}
+	return ok;
+}
+
+/*------------------------------------SAMPLING--------------------------------*/
+/* direction through the centre of texel (x, y) of a face, following the GL
+cube-map face layout */
+static void face_direction( int face, int x, int y, int size, float *d ) {
+	float s = 2.0f * ( x + 0.5f ) / size - 1.0f;
+	float t = 2.0f * ( y + 0.5f ) / size - 1.0f;
+	const float dirs[6][3] = { { 1.0f, -t, -s }, { -1.0f, -t, s }, { s, 1.0f, t },
+														 { s, -1.0f, -t }, { s, -t, 1.0f }, { -s, -t, -1.0f } };
+	memcpy( d, dirs[face], sizeof( dirs[face] ) );
+	float len = sqrtf( d[0] * d[0] + d[1] * d[1] + d[2] * d[2] );
+	d[0] /= len;
+	d[1] /= len;
+	d[2] /= len;
+}
+
+/* the inverse: which face a direction hits, and where on it in [0, 1] */
+static int direction_face( const float *d, float *s, float *t ) {
+	float ax = fabsf( d[0] ), ay = fabsf( d[1] ), az = fabsf( d[2] );
+	int face;
+	float sc, tc, ma;
+	if ( ax >= ay && ax >= az ) {
+		face = d[0] > 0.0f ? 0 : 1;
+		sc = d[0] > 0.0f ? -d[2] : d[2];
+		tc = -d[1];
+		ma = ax;
+	} else if ( ay >= az ) {
+		face = d[1] > 0.0f ? 2 : 3;
+		sc = d[0];
+		tc = d[1] > 0.0f ? d[2] : -d[2];
+		ma = ay;
+	} else {
+		face = d[2] > 0.0f ? 4 : 5;
+		sc = d[2] > 0.0f ? d[0] : -d[0];
+		tc = -d[1];
+		ma = az;
+	}
+	*s = ( sc / ma + 1.0f ) * 0.5f;
+	*t = ( tc / ma + 1.0f ) * 0.5f;
+	return face;
+}
+
+/* acc += weight * bilinear sample of one face level. edges clamp - at the
+sizes sampled here the seams don't show through the blur */
+static void add_bilinear( const float *texels, int size, float s, float t,
+													float weight, float *acc ) {
+	float x = s * size - 0.5f, y = t * size - 0.5f;
+	int x0 = (int)floorf( x ), y0 = (int)floorf( y );
+	float fx = x - x0, fy = y - y0;
+	int x1 = x0 + 1, y1 = y0 + 1;
+	x0 = x0 < 0 ? 0 : ( x0 >= size ? size - 1 : x0 );
+	x1 = x1 < 0 ? 0 : ( x1 >= size ? size - 1 : x1 );
+	y0 = y0 < 0 ? 0 : ( y0 >= size ? size - 1 : y0 );
+	y1 = y1 < 0 ? 0 : ( y1 >= size ? size - 1 : y1 );
+	const float *p00 = texels + ( y0 * size + x0 ) * 4;
+	const float *p10 = texels + ( y0 * size + x1 ) * 4;
+	const float *p01 = texels + ( y1 * size + x0 ) * 4;
+	const float *p11 = texels + ( y1 * size + x1 ) * 4;
+	float w00 = ( 1.0f - fx ) * ( 1.0f - fy ) * weight, w10 = fx * ( 1.0f - fy ) * weight;
+	float w01 = ( 1.0f - fx ) * fy * weight, w11 = fx * fy * weight;
+#ifdef ENV_SSE
+	__m128 sum = _mm_loadu_ps( acc );
+	sum = _mm_add_ps( sum, _mm_mul_ps( _mm_set1_ps( w00 ), _mm_loadu_ps( p00 ) ) );
+	sum = _mm_add_ps( sum, _mm_mul_ps( _mm_set1_ps( w10 ), _mm_loadu_ps( p10 ) ) );
+	sum = _mm_add_ps( sum, _mm_mul_ps( _mm_set1_ps( w01 ), _mm_loadu_ps( p01 ) ) );
+	sum = _mm_add_ps( sum, _mm_mul_ps( _mm_set1_ps( w11 ), _mm_loadu_ps( p11 ) ) );
+	_mm_storeu_ps( acc, sum );
+#else
+	for ( int c = 0; c < 4; c++ ) {
+		acc[c] += w00 * p00[c] + w10 * p10[c] + w01 * p01[c] + w11 * p11[c];
+	}
+#endif
+}
+
+/* acc += weight * trilinear sample of the source along d */
+static void add_sample( const env_source *src, const float *d, float lod, float weight,
+												float *acc ) {
+	float s, t;
+	int face = direction_face( d, &s, &t );
+	int l0 = (int)lod;
+	int l1 = l0 + 1 < src->level_count ? l0 + 1 : l0;
+	float f = lod - l0;
+	add_bilinear( src->faces[l0][face], src->sizes[l0], s, t, weight * ( 1.0f - f ), acc );
+	if ( f > 0.0f && l1 != l0 ) {
+		add_bilinear( src->faces[l1][face], src->sizes[l1], s, t, weight * f, acc );
+	}
+}
+
+/*-------------------------------------FILTER---------------------------------*/
+/* one sample direction in tangent space, the same for every texel of a level */
+struct env_sample {
+	float l[3];
+	float weight; // n.l
+	float lod;		// source mip matching the sample's solid angle
+};
+
+static float radical_inverse( unsigned int bits ) {
+	bits = ( bits << 16u ) | ( bits >> 16u );
+	bits = ( ( bits & 0x55555555u ) << 1u ) | ( ( bits & 0xAAAAAAAAu ) >> 1u );
+	bits = ( ( bits & 0x33333333u ) << 2u ) | ( ( bits & 0xCCCCCCCCu ) >> 2u );
+	bits = ( ( bits & 0x0F0F0F0Fu ) << 4u ) | ( ( bits & 0xF0F0F0F0u ) >> 4u );
+	bits = ( ( bits & 0x00FF00FFu ) << 8u ) | ( ( bits & 0xFF00FF00u ) >> 8u );
+	return bits * 2.3283064365386963e-10f;
+}
+
+static int make_samples( const env_source *src, float roughness, int out_size,
+												 env_sample *samples ) {
+	/* never sharper than the output texel itself */
+	float min_lod = log2f( (float)src->sizes[0] / out_size );
+	float max_lod = (float)( src->level_count - 1 );
+	min_lod = min_lod > 0.0f ? ( min_lod < max_lod ? min_lod : max_lod ) : 0.0f;
+	if ( roughness <= 0.0f ) {
+		samples[0].l[0] = samples[0].l[1] = 0.0f; // a mirror: just the one direction
+		samples[0].l[2] = 1.0f;
+		samples[0].weight = 1.0f;
+		samples[0].lod = min_lod;
+		return 1;
+	}
+	float alpha = roughness * roughness, a2 = alpha * alpha;
+	float texel_solid_angle = 4.0f * ENV_PI / ( 6.0f * src->sizes[0] * src->sizes[0] );
+	int count = 0;
+	for ( int i = 0; i < ENV_PREFILTER_SAMPLES; i++ ) {
+		float u = (float)i / ENV_PREFILTER_SAMPLES, v = radical_inverse( i );
+		float phi = 2.0f * ENV_PI * u;
+		float cos_theta = sqrtf( ( 1.0f - v ) / ( 1.0f + ( a2 - 1.0f ) * v ) );
+		float sin_theta = sqrtf( 1.0f - cos_theta * cos_theta );
+		float h[3] = { sin_theta * cosf( phi ), sin_theta * sinf( phi ), cos_theta };
+		/* reflect v = n = (0, 0, 1) about h */
+		float l[3] = { 2.0f * cos_theta * h[0], 2.0f * cos_theta * h[1],
+									 2.0f * cos_theta * cos_theta - 1.0f };
+		if ( l[2] <= 0.0f ) {
+			continue;
+		}
+		/* pdf of l is D(h) (n.h) / (4 v.h), and n.h = v.h here */
+		float denom = cos_theta * cos_theta * ( a2 - 1.0f ) + 1.0f;
+		float pdf = a2 / ( ENV_PI * denom * denom ) * 0.25f;
+		float sample_solid_angle = 1.0f / ( ENV_PREFILTER_SAMPLES * pdf );
+		float lod = 0.5f * log2f( sample_solid_angle / texel_solid_angle ) + 1.0f;
+		env_sample *sample = &samples[count++];
+		memcpy( sample->l, l, sizeof( l ) );
+		sample->weight = l[2];
+		sample->lod = lod < min_lod ? min_lod : ( lod > max_lod ? max_lod : lod );
+	}
+	return count;
+}
+
+struct env_job {
+	const env_source *src;
+	const env_sample *samples;
+	int sample_count;
+	int size;
+	unsigned char *faces[6];
+};
+
+/* row i is row i % size of face i / size */
+static void filter_row( int i, void *user ) {
+	env_job *job = (env_job *)user;
+	int face = i / job->size, y = i % job->size;
+	unsigned char *out = job->faces[face] + (size_t)y * job->size * 4;
+	for ( int x = 0; x < job->size; x++ ) {
+		float n[3];
+		face_direction( face, x, y, job->size, n );
+		/* any tangent frame will do - the lobe is symmetric about n */
+		float up[3] = { 0.0f, 0.0f, 1.0f };
+		if ( fabsf( n[2] ) > 0.999f ) {
+			up[0] = 1.0f;
+			up[2] = 0.0f;
+		}
+		float tx[3] = { up[1] * n[2] - up[2] * n[1], up[2] * n[0] - up[0] * n[2],
+										up[0] * n[1] - up[1] * n[0] };
+		float len = sqrtf( tx[0] * tx[0] + tx[1] * tx[1] + tx[2] * tx[2] );
+		tx[0] /= len;
+		tx[1] /= len;
+		tx[2] /= len;
+		float ty[3] = { n[1] * tx[2] - n[2] * tx[1], n[2] * tx[0] - n[0] * tx[2],
+										n[0] * tx[1] - n[1] * tx[0] };
+		float acc[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		float total_weight = 0.0f;
+		for ( int k = 0; k < job->sample_count; k++ ) {
+			const env_sample *sample = &job->samples[k];
+			float d[3];
+			for ( int c = 0; c < 3; c++ ) {
+				d[c] = sample->l[0] * tx[c] + sample->l[1] * ty[c] + sample->l[2] * n[c];
+			}
+			add_sample( job->src, d, sample->lod, sample->weight, acc );
+			total_weight += sample->weight;
+		}
+		unsigned char *p = out + x * 4;
+		for ( int c = 0; c < 3; c++ ) {
+			p[c] = linear_to_srgb( acc[c] / total_weight );
+		}
+		p[3] = 255;
+	}
+}
+
+/*-------------------------------SPHERICAL HARMONICS--------------------------*/
+struct sh_job {
+	const float *faces[6];
+	int size;
+	/* per face, so each thread sums on its own. rgba lanes */
+	float sums[6][ENV_SH_COEFFS][4];
+	float weights[6];
+};
+
+/* the 9 real L2 basis functions are these constants times the polynomial
+terms below. the shaders evaluate the same terms */
+static const float sh_constants[ENV_SH_COEFFS] = { 0.282095f, 0.488603f, 0.488603f,
+																									 0.488603f, 1.092548f, 1.092548f,
+																									 0.315392f, 1.092548f, 0.546274f };
+
+static void sh_terms( const float *d, float *y ) {
+	y[0] = 1.0f;
+	y[1] = d[1];
+	y[2] = d[2];
+	y[3] = d[0];
+	y[4] = d[0] * d[1];
+	y[5] = d[1] * d[2];
+	y[6] = 3.0f * d[2] * d[2] - 1.0f;
+	y[7] = d[0] * d[2];
+	y[8] = d[0] * d[0] - d[1] * d[1];
+}
+
+static void project_face( int face, void *user ) {
+	sh_job *job = (sh_job *)user;
+	int size = job->size;
+#ifdef ENV_SSE
+	__m128 sums[ENV_SH_COEFFS];
+	for ( int k = 0; k < ENV_SH_COEFFS; k++ ) {
+		sums[k] = _mm_setzero_ps();
+	}
+#else
+	float sums[ENV_SH_COEFFS][4];
+	memset( sums, 0, sizeof( sums ) );
+#endif
+	float total_weight = 0.0f;
+	for ( int y = 0; y < size; y++ ) {
+		for ( int x = 0; x < size; x++ ) {
+			float s = 2.0f * ( x + 0.5f ) / size - 1.0f;
+			float t = 2.0f * ( y + 0.5f ) / size - 1.0f;
+			/* solid angle of the texel, up to a constant: texels further from the
+			face centre are further away and seen at an angle */
+			float r2 = 1.0f + s * s + t * t;
+			float weight = 1.0f / ( r2 * sqrtf( r2 ) );
+			float d[3], basis[ENV_SH_COEFFS];
+			face_direction( face, x, y, size, d );
+			sh_terms( d, basis );
+			for ( int k = 0; k < ENV_SH_COEFFS; k++ ) {
+				basis[k] *= sh_constants[k];
+			}
+			const float *texel = job->faces[face] + ( y * size + x ) * 4;
+#ifdef ENV_SSE
+			__m128 colour = _mm_mul_ps( _mm_loadu_ps( texel ), _mm_set1_ps( weight ) );
+			for ( int k = 0; k < ENV_SH_COEFFS; k++ ) {
+				sums[k] = _mm_add_ps( sums[k], _mm_mul_ps( colour, _mm_set1_ps( basis[k] ) ) );
+			}
+#else
+			for ( int k = 0; k < ENV_SH_COEFFS; k++ ) {
+				for ( int c = 0; c < 4; c++ ) {
+					sums[k][c] += texel[c] * weight * basis[k];
+				}
+			}
+#endif
+			total_weight += weight;
+		}
+	}
+#ifdef ENV_SSE
+	for ( int k = 0; k < ENV_SH_COEFFS; k++ ) {
+		_mm_storeu_ps( job->sums[face][k], sums[k] );
+	}
+#else
+	memcpy( job->sums[face], sums, sizeof( sums ) );
+#endif
+	job->weights[face] = total_weight;
+}
+
+/* project the source onto the basis, then convolve with the cosine lobe
+(Ramamoorthi and Hanrahan's A0 = pi, A1 = 2pi/3, A2 = pi/4) and fold in the
+basis constants and 1/pi, leaving one coefficient per term of the polynomial */
+static void project_irradiance( const env_source *src, float sh[ENV_SH_COEFFS][3] ) {
+	int level = 0;
+	while ( level < src->level_count - 1 && src->sizes[level] > ENV_SH_SOURCE_SIZE ) {
+		level++;
+	}
+	sh_job job;
+	memcpy( job.faces, src->faces[level], sizeof( job.faces ) );
+	job.size = src->sizes[level];
+	parallel_for( 6, project_face, &job );
+	/* add the faces up in order, so the result doesn't depend on the threads */
+	float weight = 0.0f;
+	for ( int i = 0; i < 6; i++ ) {
+		weight += job.weights[i];
+	}
+	/* the weights cover the whole sphere */
+	float norm = 4.0f * ENV_PI / weight;
+	const float band[ENV_SH_COEFFS] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f,
+																			0.25f, 0.25f, 0.25f, 0.25f };
+	for ( int k = 0; k < ENV_SH_COEFFS; k++ ) {
+		for ( int c = 0; c < 3; c++ ) {
+			float sum = 0.0f;
+			for ( int i = 0; i < 6; i++ ) {
+				sum += job.sums[i][k][c];
+			}
+			/* A_l / pi is just band[] */
+			sh[k][c] = sum * norm * band[k] * sh_constants[k];
+		}
+	}
+}
+
+/*-------------------------------------CACHE----------------------------------*/
+struct env_cache_header {
+	char magic[4]; // "ENV1"
+	int version;
+	int size;
+	int level_count;
+	int sample_count;
+	float irradiance_sh[ENV_SH_COEFFS][3];
+};
+
+static size_t env_bytes( int size, int level_count ) {
+	size_t total = 0;
+	for ( int l = 0; l < level_count; l++ ) {
+		int s = size >> l > 0 ? size >> l : 1;
+		total += (size_t)s * s * 4 * 6;
+	}
+	return total;
+}
+
+static bool allocate_env( prefiltered_env *env ) {
+	env->size = ENV_PREFILTER_SIZE;
+	env->level_count = ENV_PREFILTER_LEVELS;
+	env->data = (unsigned char *)malloc( env_bytes( env->size, env->level_count ) );
+	if ( !env->data ) {
+		return false;
+	}
+	unsigned char *p = env->data;
+	for ( int l = 0; l < env->level_count; l++ ) {
+		int s = env->size >> l > 0 ? env->size >> l : 1;
+		for ( int i = 0; i < 6; i++ ) {
+			env->faces[l][i] = p;
+			p += (size_t)s * s * 4;
+		}
+	}
+	return true;
+}
+
+static bool read_cache( const char *path, prefiltered_env *env ) {
+	FILE *f = fopen( path, "rb" );
+	if ( !f ) {
+		return false;
+	}
+	env_cache_header header;
+	bool ok = 1 == fread( &header, sizeof( header ), 1, f ) &&
+						0 == memcmp( header.magic, "ENV1", 4 ) &&
+						ENV_CACHE_VERSION == header.version && ENV_PREFILTER_SIZE == header.size &&
+						ENV_PREFILTER_LEVELS == header.level_count &&
+						ENV_PREFILTER_SAMPLES == header.sample_count && allocate_env( env );
+	ok = ok && 1 == fread( env->data, env_bytes( env->size, env->level_count ), 1, f );
+	if ( ok ) {
+		memcpy( env->irradiance_sh, header.irradiance_sh, sizeof( env->irradiance_sh ) );
+	}
+	fclose( f );
+	if ( !ok ) {
+		free_prefiltered_env( env );
+	}
+	return ok;
+}
+
+static void write_cache( const char *path, const prefiltered_env *env ) {
+	env_cache_header header;
+	memset( &header, 0, sizeof( header ) );
+	memcpy( header.magic, "ENV1", 4 );
+	header.version = ENV_CACHE_VERSION;
+	header.size = env->size;
+	header.level_count = env->level_count;
+	header.sample_count = ENV_PREFILTER_SAMPLES;
+	memcpy( header.irradiance_sh, env->irradiance_sh, sizeof( header.irradiance_sh ) );
+	file_chunk chunks[2] = { { &header, sizeof( header ) },
+													 { env->data, env_bytes( env->size, env->level_count ) } };
+	if ( !write_file_atomic( path, chunks, 2 ) ) {
+		gl_log_err( "WARNING: could not write environment cache %s\n", path );
+	}
+}
+
+/*--------------------------------------MAIN----------------------------------*/
+bool prefilter_environment( const char **face_files, prefiltered_env *env ) {
+	memset( env, 0, sizeof( prefiltered_env ) );
+	/* hash all six files, so editing any face misses the cache */
+	unsigned long long key = FNV1A64_SEED;
+	for ( int i = 0; i < 6; i++ ) {
+		mapped_file mf;
+		if ( !map_file( face_files[i], &mf ) ) {
+			fprintf( stderr, "ERROR: could not load %s\n", face_files[i] );
+			return false;
+		}
+		key = fnv1a64( mf.data, mf.size, key );
+		unmap_file( &mf );
+	}
+	int params[5] = { ENV_CACHE_VERSION, ENV_PREFILTER_SIZE, ENV_PREFILTER_LEVELS,
+										ENV_PREFILTER_SAMPLES, ENV_SOURCE_MAX_SIZE };
+	key = fnv1a64( (const unsigned char *)params, sizeof( params ), key );
+	char path[1024];
+	snprintf( path, sizeof( path ), "%s/%016llx.env", ENV_CACHE_DIR, key );
+	if ( read_cache( path, env ) ) {
+		gl_log( "environment cache hit %s for %s\n", path, face_files[0] );
+		return true;
+	}
+
+	double start = glfwGetTime();
+	env_source src;
+	if ( !load_source( face_files, &src ) ) {
+		return false;
+	}
+	if ( !allocate_env( env ) ) {
+		fprintf( stderr, "ERROR: out of memory prefiltering %s\n", face_files[0] );
+		free( src.data );
+		return false;
+	}
+	env_sample samples[ENV_PREFILTER_SAMPLES];
+	for ( int l = 0; l < env->level_count; l++ ) {
+		env_job job;
+		job.src = &src;
+		job.size = env->size >> l > 0 ? env->size >> l : 1;
+		float roughness = (float)l / ( env->level_count - 1 );
+		job.sample_count = make_samples( &src, roughness, job.size, samples );
+		job.samples = samples;
+		memcpy( job.faces, env->faces[l], sizeof( job.faces ) );
+		parallel_for( 6 * job.size, filter_row, &job );
+	}
+	project_irradiance( &src, env->irradiance_sh );
+	free( src.data );
+	gl_log( "prefiltered %s and the other sky-box faces in %.3fs. caching as %s\n",
+					face_files[0], glfwGetTime() - start, path );
+	write_cache( path, env );
+	return true;
+}
+
+void free_prefiltered_env( prefiltered_env *env ) {
+	free( env->data );
+	memset( env, 0, sizeof( prefiltered_env ) );
+}
+
+bool upload_prefiltered_env( const prefiltered_env *env, GLuint *tex ) {
+	glGenTextures( 1, tex );
+	glBindTexture( GL_TEXTURE_CUBE_MAP, *tex );
+	for ( int l = 0; l < env->level_count; l++ ) {
+		int s = env->size >> l > 0 ? env->size >> l : 1;
+		for ( int i = 0; i < 6; i++ ) {
+			glTexImage2D( GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, l, GL_RGBA, s, s, 0, GL_RGBA,
+										GL_UNSIGNED_BYTE, env->faces[l][i] );
+		}
+	}
+	glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, env->level_count - 1 );
+	glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+	glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+	glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE );
+	glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+	/* the rough levels are a few texels across, so filtering across the face
+	edges matters */
+	glEnable( GL_TEXTURE_CUBE_MAP_SEAMLESS );
+	return true;
+}
+
+bool load_prefiltered_env( const char **face_files, GLuint *tex,
+													 float *irradiance_sh ) {
+	prefiltered_env env;
+	if ( !prefilter_environment( face_files, &env ) ) {
+		return false;
+	}
+	bool ok = upload_prefiltered_env( &env, tex );
+	if ( irradiance_sh ) {
+		memcpy( irradiance_sh, env.irradiance_sh, sizeof( env.irradiance_sh ) );
+	}
+	free_prefiltered_env( &env );
+	return ok;
+}
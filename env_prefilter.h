@@ -0,0 +1,59 @@
+/******************************************************************************\
+| GGX prefiltered environment map                                              |
+| Convolves the six faces of a sky-box with the GGX lobe for a range of        |
+| roughness, one roughness per mip of a cube map: level 0 is a mirror and the  |
+| last level is fully rough. A rough reflection is then one textureLod() at    |
+| roughness * (level_count - 1), instead of many samples per pixel.            |
+|******************************************************************************|
+| Each output texel importance-samples the lobe around its own direction       |
+| (N = V = R, as usual for split-sum prefiltering). The sample directions for  |
+| a level are the same for every texel, so they are worked out once per level  |
+| in tangent space. Each sample reads the source at the mip matching its       |
+| solid angle, which keeps the noise down with few samples. Texels are RGBA    |
+| floats in linear light, filtered 4 channels at a time with SSE, and rows of  |
+| every face are spread over the worker threads.                               |
+|******************************************************************************|
+| The result needs no GL to build and is cached in ENV_CACHE_DIR under a hash  |
+| of the six source files, so it is worked out once per sky-box; a cache       |
+| file from any earlier run can be shipped as the offline bake.                |
+|******************************************************************************|
+| The same pass projects the sky-box onto 9 L2 spherical harmonics, weighted   |
+| by texel solid angle and already convolved with the cosine lobe, for diffuse |
+| ambient: a shader gets the irradiance for a world-space normal from a short  |
+| polynomial in its x, y and z (see sh_irradiance() in the lit shaders).       |
+\******************************************************************************/
+#ifndef _ENV_PREFILTER_H_
+#define _ENV_PREFILTER_H_
+#include <GL/glew.h>
+
+#define ENV_CACHE_DIR "cache"
+#define ENV_PREFILTER_SIZE 256 // level 0, per face
+#define ENV_PREFILTER_LEVELS 6 // roughness 0, 0.2 ... 1
+#define ENV_PREFILTER_SAMPLES 128
+/* the source is read from its mips no bigger than this */
+#define ENV_SOURCE_MAX_SIZE 512
+/* irradiance is smooth enough to project from a small mip */
+#define ENV_SH_SOURCE_SIZE 128
+#define ENV_SH_COEFFS 9
+
+struct prefiltered_env {
+	int size;
+	int level_count;
+	/* RGBA8, sRGB-encoded like the source. faces in GL order +X -X +Y -Y +Z -Z */
+	unsigned char *faces[ENV_PREFILTER_LEVELS][6];
+	unsigned char *data; // everything, in one allocation
+	/* linear RGB. irradiance / pi, so the shader multiplies by albedo and that's
+	the diffuse ambient */
+	float irradiance_sh[ENV_SH_COEFFS][3];
+};
+
+/* face_files in GL face order, as above. needs no GL context */
+bool prefilter_environment( const char **face_files, prefiltered_env *env );
+void free_prefiltered_env( prefiltered_env *env );
+/* into a new cube map, one roughness per level, with seamless filtering on */
+bool upload_prefiltered_env( const prefiltered_env *env, GLuint *tex );
+/* prefilter (or fetch from the cache) and upload in one go. irradiance_sh, if
+given, gets the ENV_SH_COEFFS rgb triples for glUniform3fv() */
+bool load_prefiltered_env( const char **face_files, GLuint *tex,
+													 float *irradiance_sh = NULL );
+#endif
@@ -13,14 +13,17 @@
 | it is really making life easier.                                             |
 \******************************************************************************/
 #include "gl_utils.h"
+#include "parallel.h"
+#include "texture_container.h"
+#include "upload_ring.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #define GL_LOG_FILE "gl.log"
-#define MAX_SHADER_LENGTH 262144
 
 /*--------------------------------LOG FUNCTIONS-------------------------------*/
 bool restart_gl_log() {
@@ -147,33 +150,6 @@ void _update_fps_counter( GLFWwindow *window ) {
 }
 
 /*-----------------------------------SHADERS----------------------------------*/
-bool parse_file_into_str( const char *file_name, char *shader_str, int max_len ) {
-	shader_str[0] = '\0'; // reset string
-	FILE *file = fopen( file_name, "r" );
-	if ( !file ) {
-		gl_log_err( "ERROR: opening file for reading: %s\n", file_name );
-		return false;
-	}
-	int current_len = 0;
-	char line[2048];
-	strcpy( line, "" ); // remember to clean up before using for first time!
-	while ( !feof( file ) ) {
-		if ( NULL != fgets( line, 2048, file ) ) {
-			current_len += strlen( line ); // +1 for \n at end
-			if ( current_len >= max_len ) {
-				gl_log_err( "ERROR: shader length is longer than string buffer length %i\n",
-										max_len );
-			}
-			strcat( shader_str, line );
-		}
-	}
-	if ( EOF == fclose( file ) ) { // probably unnecesssary validation
-		gl_log_err( "ERROR: closing file from reading %s\n", file_name );
-		return false;
-	}
-	return true;
-}
-
 void print_shader_info_log( GLuint shader_index ) {
 	int max_length = 2048;
 	int actual_length = 0;
@@ -183,26 +159,42 @@ void print_shader_info_log( GLuint shader_index ) {
 	gl_log( "shader info log for GL index %i:\n%s\n", shader_index, log );
 }
 
-bool create_shader( const char *file_name, GLuint *shader, GLenum type ) {
-	gl_log( "creating shader from %s...\n", file_name );
-	char shader_string[MAX_SHADER_LENGTH];
-	parse_file_into_str( file_name, shader_string, MAX_SHADER_LENGTH );
-	*shader = glCreateShader( type );
-	const GLchar *p = (const GLchar *)shader_string;
-	glShaderSource( *shader, 1, &p, NULL );
-	glCompileShader( *shader );
-	// check for compile errors
+bool check_shader_compiled( GLuint shader, const shader_source *src ) {
 	int params = -1;
-	glGetShaderiv( *shader, GL_COMPILE_STATUS, &params );
+	glGetShaderiv( shader, GL_COMPILE_STATUS, &params );
 	if ( GL_TRUE != params ) {
-		gl_log_err( "ERROR: GL shader index %i did not compile\n", *shader );
-		print_shader_info_log( *shader );
+		gl_log_err( "ERROR: GL shader index %i did not compile from %s\n", shader,
+								src->files[0] );
+		/* errors say file:line, with the file as a number */
+		for ( int i = 0; i < src->file_count; i++ ) {
+			gl_log_err( "  source string %i is %s\n", i, src->files[i] );
+		}
+		print_shader_info_log( shader );
 		return false; // or exit or something
 	}
-	gl_log( "shader compiled. index %i\n", *shader );
+	gl_log( "shader compiled from %s. index %i\n", src->files[0], shader );
 	return true;
 }
 
+bool compile_shader( const shader_source *src, GLuint *shader, GLenum type ) {
+	*shader = glCreateShader( type );
+	const GLchar *p = (const GLchar *)src->text;
+	glShaderSource( *shader, 1, &p, NULL );
+	glCompileShader( *shader );
+	return check_shader_compiled( *shader, src );
+}
+
+bool create_shader( const char *file_name, GLuint *shader, GLenum type ) {
+	gl_log( "creating shader from %s...\n", file_name );
+	shader_source src;
+	if ( !preprocess_shader( file_name, NULL, &src ) ) {
+		return false;
+	}
+	bool ok = compile_shader( &src, shader, type );
+	free_shader_source( &src );
+	return ok;
+}
+
 void print_programme_info_log( GLuint sp ) {
 	int max_length = 2048;
 	int actual_length = 0;
@@ -231,6 +223,8 @@ bool create_programme( GLuint vert, GLuint frag, GLuint *programme ) {
 					vert, frag );
 	glAttachShader( *programme, vert );
 	glAttachShader( *programme, frag );
+	// so that the linked binary can go in the program cache
+	glProgramParameteri( *programme, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
 	// link the shader programme. if binding input attributes do that before link
 	glLinkProgram( *programme );
 	GLint params = -1;
@@ -241,7 +235,11 @@ bool create_programme( GLuint vert, GLuint frag, GLuint *programme ) {
 		print_programme_info_log( *programme );
 		return false;
 	}
+#ifndef NDEBUG
+	/* validating waits on the driver, and only says anything useful while
+	debugging */
 	( is_programme_valid( *programme ) );
+#endif
 	// delete shaders here to free memory
 	glDeleteShader( vert );
 	glDeleteShader( frag );
@@ -250,56 +248,161 @@ bool create_programme( GLuint vert, GLuint frag, GLuint *programme ) {
 
 GLuint create_programme_from_files( const char *vert_file_name,
 																		const char *frag_file_name ) {
-	GLuint vert, frag, programme;
-	( create_shader( vert_file_name, &vert, GL_VERTEX_SHADER ) );
-	( create_shader( frag_file_name, &frag, GL_FRAGMENT_SHADER ) );
-	( create_programme( vert, frag, &programme ) );
-	return programme;
+	return build_programme( vert_file_name, frag_file_name, NULL );
 }
 
 /*----------------------------------TEXTURES----------------------------------*/
-bool load_texture( const char *file_name, GLuint *tex ) {
-	int x, y, n;
-	int force_channels = 4;
-	unsigned char *image_data = stbi_load( file_name, &x, &y, &n, force_channels );
-	if ( !image_data ) {
-		fprintf( stderr, "ERROR: could not load %s\n", file_name );
-		return false;
+void set_texture_filtering( GLenum target ) {
+	glTexParameteri( target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameteri( target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+	glTexParameteri( target, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+	glTexParameteri( target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+	GLfloat max_aniso = 0.0f;
+	glGetFloatv( GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &max_aniso );
+	// set the maximum!
+	glTexParameterf( target, GL_TEXTURE_MAX_ANISOTROPY_EXT, max_aniso );
+}
+
+/* copy one level (or one layer of one level) into the bound texture through
+the upload ring, or straight from pixels if even an empty ring can't take it */
+static void upload_level_pixels( GLenum target, int level, int layer, int w, int h,
+																 const unsigned char *pixels ) {
+	upload_ring *ring = default_upload_ring();
+	size_t bytes = (size_t)w * h * 4, offset;
+	unsigned char *dest = upload_ring_alloc( ring, bytes, &offset );
+	if ( !dest ) {
+		upload_ring_end_batch( ring );
+		dest = upload_ring_alloc( ring, bytes, &offset );
 	}
-	// NPOT check
-	if ( ( x & ( x - 1 ) ) != 0 || ( y & ( y - 1 ) ) != 0 ) {
-		fprintf( stderr, "WARNING: texture %s is not power-of-2 dimensions\n",
-						 file_name );
+	const void *data = pixels;
+	if ( dest ) {
+		memcpy( dest, pixels, bytes );
+		upload_ring_bind( ring );
+		data = UPLOAD_RING_OFFSET( offset );
 	}
-	int width_in_bytes = x * 4;
-	unsigned char *top = NULL;
-	unsigned char *bottom = NULL;
-	unsigned char temp = 0;
-	int half_height = y / 2;
-
-	for ( int row = 0; row < half_height; row++ ) {
-		top = image_data + row * width_in_bytes;
-		bottom = image_data + ( y - row - 1 ) * width_in_bytes;
-		for ( int col = 0; col < width_in_bytes; col++ ) {
-			temp = *top;
-			*top = *bottom;
-			*bottom = temp;
-			top++;
-			bottom++;
-		}
+	if ( GL_TEXTURE_2D_ARRAY == target ) {
+		glTexSubImage3D( target, level, 0, 0, layer, w, h, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+										 data );
+	} else {
+		glTexSubImage2D( target, level, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, data );
 	}
+	upload_ring_unbind();
+}
+
+/* a new 2D texture holding the chain from first_level down */
+static void upload_mip_chain( const mip_chain *chain, GLuint *tex, int first_level = 0 ) {
 	glGenTextures( 1, tex );
 	glBindTexture( GL_TEXTURE_2D, *tex );
-	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, x, y, 0, GL_RGBA, GL_UNSIGNED_BYTE,
-								image_data );
-	glGenerateMipmap( GL_TEXTURE_2D );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
-	GLfloat max_aniso = 0.0f;
-	glGetFloatv( GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &max_aniso );
-	// set the maximum!
-	glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, max_aniso );
+	for ( int l = first_level; l < chain->level_count; l++ ) {
+		glTexImage2D( GL_TEXTURE_2D, l - first_level, GL_RGBA, chain->widths[l],
+									chain->heights[l], 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+		upload_level_pixels( GL_TEXTURE_2D, l - first_level, 0, chain->widths[l],
+												 chain->heights[l], chain->levels[l] );
+	}
+	upload_ring_end_batch( default_upload_ring() );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, chain->level_count - 1 - first_level );
+	set_texture_filtering( GL_TEXTURE_2D );
+}
+
+bool upload_texture( const decoded_image *image, GLuint *tex, mip_content content ) {
+	mip_chain chain;
+	if ( !image->pixels ||
+			 !generate_mip_chain( image->pixels, image->width, image->height, content,
+														MIP_KAISER, &chain ) ) {
+		return false;
+	}
+	upload_mip_chain( &chain, tex );
+	free_mip_chain( &chain );
+	return true;
+}
+
+bool load_texture( const char *file_name, GLuint *tex, bool flip,
+									 mip_content content ) {
+	char container[1024];
+	if ( find_texture_container( file_name, container, sizeof( container ) ) &&
+			 load_texture_container( container, tex ) ) {
+		return true;
+	}
+	return load_texture_levels( file_name, tex, flip, content, 0 );
+}
+
+bool load_texture_levels( const char *file_name, GLuint *tex, bool flip,
+													mip_content content, int first_level ) {
+	/* the whole chain comes out of the image cache after the first run. every
+	level then goes through the upload ring */
+	decoded_image image;
+	image.file_name = file_name;
+	image.flip = flip;
+	mip_chain chain;
+	if ( !decode_image_mipped( &image, content, MIP_KAISER, &chain ) ) {
+		return false;
+	}
+	first_level = first_level < chain.level_count - 1 ? first_level : chain.level_count - 1;
+	upload_mip_chain( &chain, tex, first_level > 0 ? first_level : 0 );
+	free_mip_chain( &chain );
+	free_decoded_image( &image );
 	return true;
 }
+
+struct mipped_batch {
+	decoded_image *images;
+	const mip_content *contents;
+	mip_chain *chains;
+	bool *ok;
+};
+
+static void decode_one_mipped( int i, void *user ) {
+	mipped_batch *batch = (mipped_batch *)user;
+	batch->ok[i] = decode_image_mipped( &batch->images[i],
+																			batch->contents ? batch->contents[i] : MIP_COLOUR,
+																			MIP_KAISER, &batch->chains[i] );
+}
+
+bool load_texture_array( const char **file_names, int count, GLuint *tex,
+												 bool flip, const mip_content *contents ) {
+	decoded_image *images = (decoded_image *)malloc( count * sizeof( decoded_image ) );
+	mip_chain *chains = (mip_chain *)calloc( count, sizeof( mip_chain ) );
+	bool *decoded = (bool *)calloc( count, sizeof( bool ) );
+	for ( int i = 0; i < count; i++ ) {
+		images[i].file_name = file_names[i];
+		images[i].flip = flip;
+	}
+	mipped_batch batch = { images, contents, chains, decoded };
+	parallel_for( count, decode_one_mipped, &batch );
+	bool ok = true;
+	for ( int i = 0; i < count; i++ ) {
+		ok = ok && decoded[i];
+	}
+	for ( int i = 1; ok && i < count; i++ ) {
+		if ( images[i].width != images[0].width || images[i].height != images[0].height ) {
+			fprintf( stderr, "ERROR: %s is not the same size as %s\n", file_names[i],
+							 file_names[0] );
+			ok = false;
+		}
+	}
+	if ( ok ) {
+		glGenTextures( 1, tex );
+		glBindTexture( GL_TEXTURE_2D_ARRAY, *tex );
+		for ( int l = 0; l < chains[0].level_count; l++ ) {
+			int w = chains[0].widths[l], h = chains[0].heights[l];
+			glTexImage3D( GL_TEXTURE_2D_ARRAY, l, GL_RGBA, w, h, count, 0, GL_RGBA,
+										GL_UNSIGNED_BYTE, NULL );
+			for ( int i = 0; i < count; i++ ) {
+				upload_level_pixels( GL_TEXTURE_2D_ARRAY, l, i, w, h, chains[i].levels[l] );
+			}
+		}
+		upload_ring_end_batch( default_upload_ring() );
+		glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, chains[0].level_count - 1 );
+		set_texture_filtering( GL_TEXTURE_2D_ARRAY );
+	}
+	for ( int i = 0; i < count; i++ ) {
+		if ( decoded[i] ) {
+			free_mip_chain( &chains[i] );
+			free_decoded_image( &images[i] );
+		}
+	}
+	free( decoded );
+	free( chains );
+	free( images );
+	return ok;
+}
@@ -18,6 +18,9 @@
 #include <GL/glew.h>		// include GLEW and new version of GL on Windows
 #include <GLFW/glfw3.h> // GLFW helper library
 #include <stdarg.h>			// used by log functions to have variable number of args
+#include "image_loader.h" // decoded_image
+#include "mipmap.h"				// mip_content
+#include "shader_build.h"		// shader_source
 
 /*------------------------------GLOBAL VARIABLES------------------------------*/
 extern int g_gl_width;
@@ -34,14 +37,43 @@ void glfw_error_callback( int error, const char *description );
 void glfw_framebuffer_size_callback( GLFWwindow *window, int width, int height );
 void _update_fps_counter( GLFWwindow *window );
 /*-----------------------------------SHADERS----------------------------------*/
-bool parse_file_into_str( const char *file_name, char *shader_str, int max_len );
 void print_shader_info_log( GLuint shader_index );
+void print_programme_info_log( GLuint sp );
+/* asks for the compile status, so it waits for the compile to finish. logs
+the errors, with which file each source string number is */
+bool check_shader_compiled( GLuint shader, const shader_source *src );
+/* from an already preprocessed source. see shader_build.h */
+bool compile_shader( const shader_source *src, GLuint *shader, GLenum type );
+/* preprocesses the file with no defines, then compiles it */
 bool create_shader( const char *file_name, GLuint *shader, GLenum type );
+/* glValidateProgram(). create_programme() only does this in debug builds */
 bool is_programme_valid( GLuint sp );
 bool create_programme( GLuint vert, GLuint frag, GLuint *programme );
-/* just use this func to create most shaders; give it vertex and frag files */
+/* just use this func to create most shaders; give it vertex and frag files.
+the same as build_programme() with no defines, so it goes through the program
+binary cache. use shader_variants for programs with defines */
 GLuint create_programme_from_files( const char *vert_file_name,
 																		const char *frag_file_name );
 /*----------------------------------TEXTURES----------------------------------*/
-bool load_texture( const char *file_name, GLuint *tex );
+/* clamp, trilinear and max anisotropy on the currently bound texture. the
+texture must already have its mip chain */
+void set_texture_filtering( GLenum target );
+/* upload an already-decoded image into a new mipmapped 2D texture. the mips
+are built on the CPU, filtered as content says */
+bool upload_texture( const decoded_image *image, GLuint *tex,
+										 mip_content content = MIP_COLOUR );
+/* decode and upload in one go, on this thread. pass flip = false for images
+whose UVs are already bottom-up, to skip the row swap altogether. a .ktx2 or
+.dds next to the image is loaded instead when there is one */
+bool load_texture( const char *file_name, GLuint *tex, bool flip = true,
+									 mip_content content = MIP_COLOUR );
+/* load_texture() without the container check, leaving out the first_level
+biggest mips. level first_level of the image becomes level 0 */
+bool load_texture_levels( const char *file_name, GLuint *tex, bool flip,
+													mip_content content, int first_level );
+/* decode a batch of same-sized images into the layers of a new mipmapped
+GL_TEXTURE_2D_ARRAY, layer i being file_names[i] and filtered as contents[i].
+NULL contents means they are all colour */
+bool load_texture_array( const char **file_names, int count, GLuint *tex,
+												 bool flip = true, const mip_content *contents = NULL );
 #endif
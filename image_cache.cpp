@@ -0,0 +1,297 @@
+/******************************************************************************\
+| Content-addressed cache of decoded images - see image_cache.h                |
+\******************************************************************************/
+#include "image_cache.h"
+#include "gl_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <mutex>
+#ifdef _WIN32
+#include <direct.h> // _mkdir
+#include <process.h> // _getpid
+#include <sys/utime.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+/* bump this whenever the entry layout or the decoding changes */
+#define IMAGE_CACHE_VERSION 1
+/* pixel data starts on this boundary in the file, and so in the mapping */
+#define IMAGE_CACHE_DATA_ALIGN 64
+/* most entries looked at when trimming the cache */
+#define IMAGE_CACHE_MAX_ENTRIES 4096
+
+struct image_cache_header {
+	char magic[4]; // "IMC1"
+	int version;
+	int width;
+	int height;
+	int channels; // the source file's, for decoded_image
+	int level_count;
+	unsigned long long level_offsets[MIP_MAX_LEVELS]; // from the start of the file
+};
+
+unsigned long long fnv1a64( const unsigned char *data, size_t n,
+														unsigned long long h ) {
+	for ( size_t i = 0; i < n; i++ ) {
+		h ^= data[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+unsigned long long image_cache_key( const unsigned char *file_data, size_t size,
+																		bool flip, bool mipped, mip_content content,
+																		mip_filter filter ) {
+	unsigned long long key = fnv1a64( file_data, size );
+	int params[4] = { IMAGE_CACHE_VERSION, flip ? 1 : 0, mipped ? (int)content : -1,
+										mipped ? (int)filter : -1 };
+	return fnv1a64( (const unsigned char *)params, sizeof( params ), key );
+}
+
+static void entry_path( unsigned long long key, char *path, int max_len ) {
+	snprintf( path, max_len, "%s/%016llx.img", IMAGE_CACHE_DIR, key );
+}
+
+/* every directory in path, leaving off the file name at the end */
+static void make_parent_dirs( const char *path ) {
+	char dir[1024];
+	for ( int i = 0; path[i] && i < (int)sizeof( dir ) - 1; i++ ) {
+		if ( '/' == path[i] && i > 0 ) {
+			dir[i] = '\0';
+#ifdef _WIN32
+			_mkdir( dir );
+#else
+			mkdir( dir, 0755 );
+#endif
+		}
+		dir[i] = path[i];
+	}
+}
+
+bool write_file_atomic( const char *path, const file_chunk *chunks, int chunk_count ) {
+	make_parent_dirs( path );
+	/* a name no other thread or process is using, so two writers of the same
+	entry never interleave */
+	static std::atomic<int> counter( 0 );
+#ifdef _WIN32
+	int pid = _getpid();
+#else
+	int pid = (int)getpid();
+#endif
+	char temp_path[1024];
+	snprintf( temp_path, sizeof( temp_path ), "%s.%i.%i.tmp", path, pid, counter++ );
+	FILE *f = fopen( temp_path, "wb" );
+	if ( !f ) {
+		return false;
+	}
+	bool ok = true;
+	for ( int i = 0; ok && i < chunk_count; i++ ) {
+		ok = 0 == chunks[i].size || 1 == fwrite( chunks[i].data, chunks[i].size, 1, f );
+	}
+	ok = 0 == fclose( f ) && ok;
+	/* the old entry is only touched once the new one is whole */
+#ifdef _WIN32
+	ok = ok && MoveFileExA( temp_path, path, MOVEFILE_REPLACE_EXISTING );
+#else
+	ok = ok && 0 == rename( temp_path, path );
+#endif
+	if ( !ok ) {
+		remove( temp_path );
+	}
+	return ok;
+}
+
+static size_t level_bytes( int width, int height, int level ) {
+	int w = width >> level, h = height >> level;
+	return (size_t)( w > 0 ? w : 1 ) * ( h > 0 ? h : 1 ) * 4;
+}
+
+bool fetch_cached_image( unsigned long long key, decoded_image *image,
+												 mip_chain *chain ) {
+	char path[1024];
+	entry_path( key, path, sizeof( path ) );
+	mapped_file mf;
+	if ( !map_file( path, &mf ) ) {
+		return false;
+	}
+	const image_cache_header *header = (const image_cache_header *)mf.data;
+	bool ok = mf.size >= sizeof( image_cache_header ) &&
+						0 == memcmp( header->magic, "IMC1", 4 ) &&
+						IMAGE_CACHE_VERSION == header->version && header->width > 0 &&
+						header->height > 0 && header->level_count > 0 &&
+						header->level_count <= MIP_MAX_LEVELS &&
+						( !chain || header->level_count ==
+													mip_level_count( header->width, header->height ) );
+	for ( int l = 0; ok && l < header->level_count; l++ ) {
+		ok = header->level_offsets[l] <= mf.size &&
+				 level_bytes( header->width, header->height, l ) <=
+					 mf.size - header->level_offsets[l];
+	}
+	if ( !ok ) {
+		gl_log_err( "WARNING: ignoring bad image cache entry %s\n", path );
+		unmap_file( &mf );
+		return false;
+	}
+	image->cache_file = mf;
+	image->width = header->width;
+	image->height = header->height;
+	image->channels = header->channels;
+	/* read-only. nothing writes to decoded pixels once they're loaded */
+	image->pixels = (unsigned char *)mf.data + header->level_offsets[0];
+	if ( chain ) {
+		memset( chain, 0, sizeof( mip_chain ) );
+		chain->level_count = header->level_count;
+		for ( int l = 0; l < header->level_count; l++ ) {
+			chain->widths[l] = header->width >> l > 0 ? header->width >> l : 1;
+			chain->heights[l] = header->height >> l > 0 ? header->height >> l : 1;
+			chain->levels[l] = mf.data + header->level_offsets[l];
+		}
+	}
+	/* the modification time is the last use, for trim_cache() */
+#ifdef _WIN32
+	_utime( path, NULL );
+#else
+	utime( path, NULL );
+#endif
+	return true;
+}
+
+struct cache_entry {
+	char name[64];
+	long long size;
+	long long last_used;
+};
+
+static int compare_last_used( const void *a, const void *b ) {
+	long long ta = ( (const cache_entry *)a )->last_used;
+	long long tb = ( (const cache_entry *)b )->last_used;
+	return ta < tb ? -1 : ( ta > tb ? 1 : 0 );
+}
+
+/* every entry in the directory, up to max */
+static int list_entries( cache_entry *entries, int max ) {
+	int count = 0;
+#ifdef _WIN32
+	WIN32_FIND_DATAA found;
+	HANDLE find = FindFirstFileA( IMAGE_CACHE_DIR "/*.img", &found );
+	if ( INVALID_HANDLE_VALUE == find ) {
+		return 0;
+	}
+	do {
+		snprintf( entries[count].name, sizeof( entries[count].name ), "%s",
+							found.cFileName );
+		entries[count].size = ( (long long)found.nFileSizeHigh << 32 ) | found.nFileSizeLow;
+		entries[count].last_used = ( (long long)found.ftLastWriteTime.dwHighDateTime << 32 ) |
+															 found.ftLastWriteTime.dwLowDateTime;
+		count++;
+	} while ( count < max && FindNextFileA( find, &found ) );
+	FindClose( find );
+#else
+	DIR *dir = opendir( IMAGE_CACHE_DIR );
+	if ( !dir ) {
+		return 0;
+	}
+	struct dirent *de;
+	while ( count < max && ( de = readdir( dir ) ) ) {
+		size_t len = strlen( de->d_name );
+		if ( len < 4 || len >= sizeof( entries[count].name ) ||
+				 0 != strcmp( de->d_name + len - 4, ".img" ) ) {
+			continue;
+		}
+		char path[1024];
+		snprintf( path, sizeof( path ), "%s/%s", IMAGE_CACHE_DIR, de->d_name );
+		struct stat st;
+		if ( 0 != stat( path, &st ) ) {
+			continue; // another process just trimmed it
+		}
+		memcpy( entries[count].name, de->d_name, len + 1 );
+		entries[count].size = (long long)st.st_size;
+		entries[count].last_used = (long long)st.st_mtime;
+		count++;
+	}
+	closedir( dir );
+#endif
+	return count;
+}
+
+/* delete least recently used entries until the total fits, keeping the one
+just written however big it is */
+static void trim_cache( const char *keep_name ) {
+	static std::mutex trim_mutex; // worker threads store at the same time
+	std::lock_guard<std::mutex> lock( trim_mutex );
+	cache_entry *entries =
+		(cache_entry *)malloc( IMAGE_CACHE_MAX_ENTRIES * sizeof( cache_entry ) );
+	if ( !entries ) {
+		return;
+	}
+	int count = list_entries( entries, IMAGE_CACHE_MAX_ENTRIES );
+	long long total = 0;
+	for ( int i = 0; i < count; i++ ) {
+		total += entries[i].size;
+	}
+	if ( total > IMAGE_CACHE_MAX_BYTES ) {
+		qsort( entries, count, sizeof( cache_entry ), compare_last_used );
+		for ( int i = 0; i < count && total > IMAGE_CACHE_MAX_BYTES; i++ ) {
+			if ( 0 == strcmp( entries[i].name, keep_name ) ) {
+				continue;
+			}
+			char path[1024];
+			snprintf( path, sizeof( path ), "%s/%s", IMAGE_CACHE_DIR, entries[i].name );
+			if ( 0 == remove( path ) ) {
+				gl_log( "image cache: evicted %s\n", path );
+			}
+			/* gone either way - if the remove failed, someone else got there first */
+			total -= entries[i].size;
+		}
+	}
+	free( entries );
+}
+
+void store_cached_image( unsigned long long key, const decoded_image *image,
+												 const mip_chain *chain ) {
+	if ( !image->pixels ) {
+		return;
+	}
+	image_cache_header header;
+	memset( &header, 0, sizeof( header ) );
+	memcpy( header.magic, "IMC1", 4 );
+	header.version = IMAGE_CACHE_VERSION;
+	header.width = image->width;
+	header.height = image->height;
+	header.channels = image->channels;
+	header.level_count = chain ? chain->level_count : 1;
+	size_t offset = ( sizeof( header ) + IMAGE_CACHE_DATA_ALIGN - 1 ) &
+									~(size_t)( IMAGE_CACHE_DATA_ALIGN - 1 );
+	for ( int l = 0; l < header.level_count; l++ ) {
+		header.level_offsets[l] = offset;
+		offset += level_bytes( image->width, image->height, l );
+		offset = ( offset + IMAGE_CACHE_DATA_ALIGN - 1 ) & ~(size_t)( IMAGE_CACHE_DATA_ALIGN - 1 );
+	}
+
+	/* the header, then each level after zeros up to its offset */
+	static const unsigned char zeros[IMAGE_CACHE_DATA_ALIGN] = { 0 };
+	file_chunk chunks[1 + 2 * MIP_MAX_LEVELS];
+	int chunk_count = 0;
+	chunks[chunk_count++] = { &header, sizeof( header ) };
+	size_t written = sizeof( header );
+	for ( int l = 0; l < header.level_count; l++ ) {
+		size_t bytes = level_bytes( image->width, image->height, l );
+		chunks[chunk_count++] = { zeros, header.level_offsets[l] - written };
+		chunks[chunk_count++] = { chain ? chain->levels[l] : image->pixels, bytes };
+		written = header.level_offsets[l] + bytes;
+	}
+	char path[1024];
+	entry_path( key, path, sizeof( path ) );
+	if ( !write_file_atomic( path, chunks, chunk_count ) ) {
+		gl_log_err( "WARNING: could not write image cache %s\n", path );
+		return;
+	}
+	trim_cache( path + strlen( IMAGE_CACHE_DIR ) + 1 );
+}
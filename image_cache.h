@@ -0,0 +1,50 @@
+/******************************************************************************\
+| Content-addressed cache of decoded images                                    |
+| Decoded pixels are kept in IMAGE_CACHE_DIR, one raw file per entry, named    |
+| after a hash of the source file's bytes and the way it was decoded (flip,    |
+| and the mip filter when the entry holds a whole chain). A hit maps the entry |
+| and points straight into it, so a repeat launch does no PNG/JPEG decoding,   |
+| and the OS shares the pages between processes loading the same images.       |
+|******************************************************************************|
+| Entries are written to a temporary name and renamed into place, so processes |
+| sharing the directory never see half an entry. The other caches write the    |
+| same way, through write_file_atomic(). A hit touches the entry's             |
+| modification time, which makes it the LRU clock: after each new entry the    |
+| oldest are deleted until the directory is under IMAGE_CACHE_MAX_BYTES.       |
+\******************************************************************************/
+#ifndef _IMAGE_CACHE_H_
+#define _IMAGE_CACHE_H_
+#include "image_loader.h" // decoded_image
+#include "mipmap.h"
+#include <stddef.h>
+
+#define IMAGE_CACHE_DIR "cache/images"
+#define IMAGE_CACHE_MAX_BYTES ( 512LL * 1024 * 1024 )
+#define FNV1A64_SEED 14695981039346656037ULL
+
+/* one piece of a file written with write_file_atomic() */
+struct file_chunk {
+	const void *data;
+	size_t size;
+};
+
+/* writes the chunks to a temporary name beside path, making path's directories
+first, and renames it over path only once every write and the close worked.
+on failure the temporary is deleted and whatever was at path is left alone */
+bool write_file_atomic( const char *path, const file_chunk *chunks, int chunk_count );
+
+unsigned long long fnv1a64( const unsigned char *data, size_t n,
+														unsigned long long h = FNV1A64_SEED );
+/* key for an image file's bytes, decoded with flip. mipped entries hold the
+whole chain as built with content and filter, which are ignored otherwise */
+unsigned long long image_cache_key( const unsigned char *file_data, size_t size,
+																		bool flip, bool mipped, mip_content content,
+																		mip_filter filter );
+/* on a hit, maps the entry into image->cache_file and points image->pixels
+into it, along with every level of chain if one is given. false on a miss */
+bool fetch_cached_image( unsigned long long key, decoded_image *image,
+												 mip_chain *chain = NULL );
+/* add an entry, then trim the cache down to size. chain may be NULL */
+void store_cached_image( unsigned long long key, const decoded_image *image,
+												 const mip_chain *chain = NULL );
+#endif
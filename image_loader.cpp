@@ -0,0 +1,175 @@
+/******************************************************************************\
+| Image decoding off the GL thread - see image_loader.h                        |
+\******************************************************************************/
+#include "image_loader.h"
+#include "image_cache.h"
+#include "parallel.h"
+#include "stb_image.h" // Sean Barrett's image loader - nothings.org
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void flip_image_rows( unsigned char *pixels, int row_bytes, int rows ) {
+	/* swap whole rows through a small buffer. memcpy is vectorised by the C
+	library so this is a few wide copies per row instead of one per byte. rows
+	wider than the buffer go through it a piece at a time, so nothing is
+	allocated and nothing can fail */
+	unsigned char temp[16384]; // a 4096-wide RGBA row
+	for ( int row = 0; row < rows / 2; row++ ) {
+		unsigned char *top = pixels + (size_t)row * row_bytes;
+		unsigned char *bottom = pixels + (size_t)( rows - row - 1 ) * row_bytes;
+		for ( int offset = 0; offset < row_bytes; offset += (int)sizeof( temp ) ) {
+			int bytes = row_bytes - offset < (int)sizeof( temp ) ? row_bytes - offset
+																														: (int)sizeof( temp );
+			memcpy( temp, top + offset, bytes );
+			memcpy( top + offset, bottom + offset, bytes );
+			memcpy( bottom + offset, temp, bytes );
+		}
+	}
+}
+
+/* decode from the source file's bytes, already mapped for hashing */
+static bool decode_mapped( decoded_image *image, const mapped_file *source ) {
+	int force_channels = 4;
+	image->pixels = stbi_load_from_memory( source->data, (int)source->size,
+																				 &image->width, &image->height,
+																				 &image->channels, force_channels );
+	if ( !image->pixels ) {
+		fprintf( stderr, "ERROR: could not load %s\n", image->file_name );
+		return false;
+	}
+	// NPOT check
+	if ( ( image->width & ( image->width - 1 ) ) != 0 ||
+			 ( image->height & ( image->height - 1 ) ) != 0 ) {
+		fprintf( stderr, "WARNING: image %s is not power-of-2 dimensions\n",
+						 image->file_name );
+	}
+	if ( image->flip ) {
+		flip_image_rows( image->pixels, image->width * 4, image->height );
+	}
+	return true;
+}
+
+static bool map_source( decoded_image *image, mapped_file *source ) {
+	image->pixels = NULL;
+	memset( &image->cache_file, 0, sizeof( mapped_file ) );
+	if ( !map_file( image->file_name, source ) ) {
+		fprintf( stderr, "ERROR: could not load %s\n", image->file_name );
+		return false;
+	}
+	return true;
+}
+
+bool decode_image( decoded_image *image ) {
+	mapped_file source;
+	if ( !map_source( image, &source ) ) {
+		return false;
+	}
+	unsigned long long key = image_cache_key( source.data, source.size, image->flip,
+																						false, MIP_COLOUR, MIP_BOX );
+	bool ok = fetch_cached_image( key, image );
+	if ( !ok ) {
+		ok = decode_mapped( image, &source );
+		if ( ok ) {
+			store_cached_image( key, image );
+		}
+	}
+	unmap_file( &source );
+	return ok;
+}
+
+bool decode_image_mipped( decoded_image *image, mip_content content,
+													mip_filter filter, mip_chain *chain ) {
+	mapped_file source;
+	if ( !map_source( image, &source ) ) {
+		return false;
+	}
+	unsigned long long key = image_cache_key( source.data, source.size, image->flip,
+																						true, content, filter );
+	bool ok = fetch_cached_image( key, image, chain );
+	if ( !ok ) {
+		ok = decode_mapped( image, &source ) &&
+				 generate_mip_chain( image->pixels, image->width, image->height, content,
+														 filter, chain );
+		if ( ok ) {
+			store_cached_image( key, image, chain );
+		} else {
+			free_decoded_image( image );
+		}
+	}
+	unmap_file( &source );
+	return ok;
+}
+
+bool peek_image( decoded_image *image ) {
+	image->pixels = NULL;
+	memset( &image->cache_file, 0, sizeof( mapped_file ) );
+	if ( !stbi_info( image->file_name, &image->width, &image->height,
+									 &image->channels ) ) {
+		fprintf( stderr, "ERROR: could not load %s\n", image->file_name );
+		return false;
+	}
+	return true;
+}
+
+bool decode_image_into( decoded_image *image, unsigned char *dest ) {
+	int width = image->width, height = image->height;
+	if ( !decode_image( image ) ) {
+		return false;
+	}
+	if ( image->width != width || image->height != height ) {
+		fprintf( stderr, "ERROR: %s changed size since it was peeked\n",
+						 image->file_name );
+		free_decoded_image( image );
+		return false;
+	}
+	/* already flipped, by the decode or in the cache */
+	memcpy( dest, image->pixels, (size_t)width * height * 4 );
+	free_decoded_image( image );
+	image->pixels = dest;
+	return true;
+}
+
+static void decode_one( int i, void *user ) {
+	decode_image( &( (decoded_image *)user )[i] );
+}
+
+bool decode_images( decoded_image *images, int count ) {
+	parallel_for( count, decode_one, images );
+	bool ok = true;
+	for ( int i = 0; i < count; i++ ) {
+		ok = ok && images[i].pixels;
+	}
+	return ok;
+}
+
+struct decode_into_batch {
+	decoded_image *images;
+	unsigned char **dests;
+};
+
+static void decode_one_into( int i, void *user ) {
+	decode_into_batch *batch = (decode_into_batch *)user;
+	decode_image_into( &batch->images[i], batch->dests[i] );
+}
+
+bool decode_images_into( decoded_image *images, unsigned char **dests, int count ) {
+	decode_into_batch batch;
+	batch.images = images;
+	batch.dests = dests;
+	parallel_for( count, decode_one_into, &batch );
+	bool ok = true;
+	for ( int i = 0; i < count; i++ ) {
+		ok = ok && images[i].pixels;
+	}
+	return ok;
+}
+
+void free_decoded_image( decoded_image *image ) {
+	if ( image->cache_file.data ) {
+		unmap_file( &image->cache_file ); // pixels point into it
+	} else {
+		free( image->pixels );
+	}
+	image->pixels = NULL;
+}
@@ -0,0 +1,48 @@
+/******************************************************************************\
+| Image decoding off the GL thread                                             |
+| Decoding PNG/JPEG with stb_image needs no GL context, so a batch of images   |
+| can be decoded at the same time on the worker threads. The GL thread then    |
+| only has to upload the finished pixels. Startup costs about as much as the   |
+| slowest single image instead of the sum of all of them.                      |
+| Decoded pixels go through the image cache (see image_cache.h), so an image   |
+| that was decoded on an earlier run is just mapped from disk.                 |
+\******************************************************************************/
+#ifndef _IMAGE_LOADER_H_
+#define _IMAGE_LOADER_H_
+#include "mapped_file.h"
+#include "mipmap.h"
+
+struct decoded_image {
+	/* filled in by the caller */
+	const char *file_name;
+	/* flip so the first row is the bottom, as GL expects. leave it false if the
+	shaders or the asset bake already take care of the UV convention */
+	bool flip;
+	/* filled in by decode_image(). pixels are always RGBA8 */
+	unsigned char *pixels;
+	int width;
+	int height;
+	int channels; // how many channels the file itself had
+	/* the cache entry pixels point into, if they came from the image cache */
+	mapped_file cache_file;
+};
+
+/* swap rows top to bottom in place */
+void flip_image_rows( unsigned char *pixels, int row_bytes, int rows );
+bool decode_image( decoded_image *image );
+/* decode_image() and build the mip chain, both cached together. the chain's
+levels are only valid until free_decoded_image() */
+bool decode_image_mipped( decoded_image *image, mip_content content,
+													mip_filter filter, mip_chain *chain );
+/* decode a whole batch at once on the worker threads. returns false if any of
+them failed - those are left with pixels set to NULL */
+bool decode_images( decoded_image *images, int count );
+/* read just the header, to fill in the size. pixels is left NULL */
+bool peek_image( decoded_image *image );
+/* decode into memory the caller owns, such as a mapped upload buffer, after
+peek_image() has given the size. dest needs width * height * 4 bytes. pixels
+then points at dest, so don't free_decoded_image() it */
+bool decode_image_into( decoded_image *image, unsigned char *dest );
+bool decode_images_into( decoded_image *images, unsigned char **dests, int count );
+void free_decoded_image( decoded_image *image );
+#endif
@@ -0,0 +1,63 @@
+/******************************************************************************\
+| Hardware instancing - see instancing.h                                       |
+\******************************************************************************/
+#include "instancing.h"
+#include "gl_utils.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+mesh_instance make_instance( const vec3 &pos, const versor &rot, float scale ) {
+	mesh_instance mi;
+	mi.pos_scale[0] = pos.v[0];
+	mi.pos_scale[1] = pos.v[1];
+	mi.pos_scale[2] = pos.v[2];
+	mi.pos_scale[3] = scale;
+	mi.rot[0] = rot.q[1];
+	mi.rot[1] = rot.q[2];
+	mi.rot[2] = rot.q[3];
+	mi.rot[3] = rot.q[0];
+	return mi;
+}
+
+bool init_instance_buffer( instance_buffer *ib, GLuint vao, int capacity ) {
+	memset( ib, 0, sizeof( instance_buffer ) );
+	glGenBuffers( 1, &ib->vbo );
+	glBindBuffer( GL_ARRAY_BUFFER, ib->vbo );
+	glBufferData( GL_ARRAY_BUFFER, capacity * sizeof( mesh_instance ), NULL, GL_DYNAMIC_DRAW );
+	ib->capacity = capacity;
+
+	glBindVertexArray( vao );
+	GLsizei stride = sizeof( mesh_instance );
+	glVertexAttribPointer( INSTANCE_POS_SCALE_LOCATION, 4, GL_FLOAT, GL_FALSE, stride,
+												 (GLvoid *)offsetof( mesh_instance, pos_scale ) );
+	glVertexAttribDivisor( INSTANCE_POS_SCALE_LOCATION, 1 );
+	glEnableVertexAttribArray( INSTANCE_POS_SCALE_LOCATION );
+	glVertexAttribPointer( INSTANCE_ROT_LOCATION, 4, GL_FLOAT, GL_FALSE, stride,
+												 (GLvoid *)offsetof( mesh_instance, rot ) );
+	glVertexAttribDivisor( INSTANCE_ROT_LOCATION, 1 );
+	glEnableVertexAttribArray( INSTANCE_ROT_LOCATION );
+	glBindVertexArray( 0 );
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+	return true;
+}
+
+void update_instances( instance_buffer *ib, const mesh_instance *instances, int count ) {
+	glBindBuffer( GL_ARRAY_BUFFER, ib->vbo );
+	if ( count > ib->capacity ) {
+		/* the VAO refers to the buffer by name, so it sees the new storage */
+		gl_log( "instance buffer %u grown from %i to %i instances\n", ib->vbo, ib->capacity,
+						count );
+		ib->capacity = count;
+	}
+	/* orphan last frame's instances rather than wait for the draws reading them */
+	glBufferData( GL_ARRAY_BUFFER, ib->capacity * sizeof( mesh_instance ), NULL, GL_DYNAMIC_DRAW );
+	glBufferSubData( GL_ARRAY_BUFFER, 0, count * sizeof( mesh_instance ), instances );
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+	ib->count = count;
+}
+
+void free_instance_buffer( instance_buffer *ib ) {
+	glDeleteBuffers( 1, &ib->vbo );
+	memset( ib, 0, sizeof( instance_buffer ) );
+}
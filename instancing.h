@@ -0,0 +1,41 @@
+/******************************************************************************\
+| Hardware instancing                                                          |
+| Many copies of one mesh in a single draw. Each copy is a mesh_instance - a   |
+| position, a uniform scale and a rotation quaternion, 32 bytes - in a         |
+| per-instance vertex buffer that advances once per instance rather than per   |
+| vertex. Shaders built with the INSTANCED define read it from attribute       |
+| locations INSTANCE_POS_SCALE_LOCATION and INSTANCE_ROT_LOCATION, and turn    |
+| it into a transform themselves, so there is no per-copy uniform upload or    |
+| draw call, and no matrices to build on the CPU. The mesh vertex shaders      |
+| include shader/instancing.glsl for this. Its instance_matrix() is the        |
+| identity without INSTANCED.                                                  |
+|******************************************************************************|
+| GL 4.1 has no shader storage buffers, which is why it is a vertex buffer.    |
+\******************************************************************************/
+#ifndef _INSTANCING_H_
+#define _INSTANCING_H_
+#include "maths_funcs.h"
+#include <GL/glew.h>
+
+/* after the mesh's own positions, texture coordinates, normals and tangents */
+#define INSTANCE_POS_SCALE_LOCATION 4
+#define INSTANCE_ROT_LOCATION 5
+
+struct mesh_instance {
+	float pos_scale[4]; // world position, then uniform scale
+	float rot[4];				// unit quaternion as x, y, z, w - not versor's w first
+};
+
+struct instance_buffer {
+	GLuint vbo;
+	int count;		// instances uploaded
+	int capacity; // instances the buffer has room for
+};
+
+mesh_instance make_instance( const vec3 &pos, const versor &rot, float scale );
+/* creates the buffer, and points vao's instance attributes at it */
+bool init_instance_buffer( instance_buffer *ib, GLuint vao, int capacity );
+/* replace the instances, growing the buffer if there are more than before */
+void update_instances( instance_buffer *ib, const mesh_instance *instances, int count );
+void free_instance_buffer( instance_buffer *ib );
+#endif
@@ -13,6 +13,19 @@
 #include "gl_utils.h"    // common opengl functions and small utilities like logs
 #include "maths_funcs.h" // my maths functions
 #include "obj_parser.h"  // my little Wavefront .obj mesh loader
+#include "bvh.h"         // triangle BVH for mouse picking
+#include "image_loader.h" // parallel image decoding
+#include "texture_compress.h" // BC encoder for the material maps
+#include "texture_container.h" // baked .ktx2/.dds textures
+#include "material_pack.h" // material maps packed into streamed texture arrays
+#include "upload_ring.h" // fenced pixel-unpack ring for texture uploads
+#include "texture_manager.h" // GPU texture memory budget
+#include "env_prefilter.h" // GGX prefiltered sky-box for rough reflections
+#include "shader_reload.h" // rebuild programs when their shader files change
+#include "shader_build.h" // #include, defines and variants for shaders
+#include "uniforms.h"    // uniform reflection and the per-frame uniform block
+#include "render_queue.h" // sorted draws with redundant state left out
+#include "instancing.h"   // many copies of a mesh in one draw
 #include "stb_image.h"   // Sean Barrett's image loader - nothings.org
 #include "GL/glew.h"     // include GLEW and new version of GL on Windows
 #include "GLFW/glfw3.h"  // GLFW helper library
@@ -20,6 +33,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 #define MESH_FILE "res/baoxiang03.fbx"
 
@@ -31,17 +45,40 @@
 
 #define CUBE_VERT_FILE "shader/cube_vs.glsl"
 #define CUBE_FRAG_FILE "shader/cube_fs.glsl"
+#define SHADER_DIR "shader"
+/* chests along each side of a square field. the first is the one that is
+picked and streamed for */
+#define CHEST_GRID 1
+/* a field is drawn in one instanced call and lit in world space. a lone chest
+is drawn plainly and lit in its own space, from a camera and light taken there
+once on the CPU */
+#define CHEST_INSTANCED ( CHEST_GRID > 1 )
+/* the chest material's features, as defines for its shader variant */
+#define CHEST_FEATURES ( CHEST_INSTANCED ? "NORMAL_MAP SPECULAR_MAP INSTANCED" : "NORMAL_MAP SPECULAR_MAP" )
+/* reflect_fs.glsl picks the prefiltered sky-box level from this */
+#define REFLECT_ROUGHNESS 0.3f
+// most draws submitted in a frame
+#define RENDER_QUEUE_ITEMS 1024
 #define FRONT "res/skybox/negz.jpg"
 #define BACK "res/skybox/posz.jpg"
 #define TOP "res/skybox/posy.jpg"
 #define BOTTOM "res/skybox/negy.jpg"
 #define LEFT "res/skybox/negx.jpg"
 #define RIGHT "res/skybox/posx.jpg"
+#define DIFFUSE_FILE "res/baoxiang03_D.png"
+#define NORMAL_FILE "res/baoxiang03_N.png"
+#define SPECULAR_FILE "res/baoxiang03_SGE.png"
+#define TEXTURE_BUDGET_MB 256
 
 // keep track of window size for things like the viewport and the mouse cursor
 int g_gl_width      = 640;
 int g_gl_height     = 480;
 GLFWwindow* g_window = NULL;
+// every texture counts against the one budget
+texture_manager g_textures;
+// programs are built on first use and rebuilt when their files change
+shader_reloader g_shader_reloader;
+shader_variants g_shaders;
 
 /* big cube. returns Vertex Array Object */
 GLuint make_big_cube() {
@@ -78,47 +115,142 @@ GLuint make_big_cube() {
   return vao;
 }
 
-/* use stb_image to load an image file into memory, and then into one side of
-a cube-map texture. */
-bool load_cube_map_side( GLuint texture, GLenum side_target, const char* file_name ) {
-  glBindTexture( GL_TEXTURE_CUBE_MAP, texture );
-
-  int x, y, n;
-  int force_channels        = 4;
-  unsigned char* image_data = stbi_load( file_name, &x, &y, &n, force_channels );
-  if ( !image_data ) {
-    fprintf( stderr, "ERROR: could not load %s\n", file_name );
-    return false;
-  }
-  // non-power-of-2 dimensions check
-  if ( ( x & ( x - 1 ) ) != 0 || ( y & ( y - 1 ) ) != 0 ) { fprintf( stderr, "WARNING: image %s is not power-of-2 dimensions\n", file_name ); }
+/* copy a decoded side into its (already allocated) side of the bound cube-map.
+pixels are client memory, or an offset into the upload ring while it is bound */
+bool load_cube_map_side( GLenum side_target, const decoded_image* image, const void* pixels ) {
+  if ( !image->pixels ) { return false; }
 
   // copy image data into 'target' side of cube map
-  glTexImage2D( side_target, 0, GL_RGBA, x, y, 0, GL_RGBA, GL_UNSIGNED_BYTE, image_data );
-  free( image_data );
+  glTexSubImage2D( side_target, 0, 0, 0, image->width, image->height, GL_RGBA, GL_UNSIGNED_BYTE, pixels );
   return true;
 }
 
-/* load all 6 sides of the cube-map from images, then apply formatting to the
-final texture */
-void create_cube_map( const char* front, const char* back, const char* top, const char* bottom, const char* left, const char* right, GLuint* tex_cube ) {
+/* decode all 6 sides into a cube-map, then apply formatting to the final
+texture. sides are in the order front, back, top, bottom, left, right. the
+worker threads decode as many sides as fit in the upload ring at a time
+straight into it, and the GL thread copies them into the texture from there.
+false, with no texture left behind, unless every side loaded */
+bool create_cube_map( const char** side_files, GLuint* tex_cube ) {
+  const GLenum side_targets[6] = { GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, GL_TEXTURE_CUBE_MAP_POSITIVE_Z,
+                                   GL_TEXTURE_CUBE_MAP_POSITIVE_Y, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
+                                   GL_TEXTURE_CUBE_MAP_NEGATIVE_X, GL_TEXTURE_CUBE_MAP_POSITIVE_X };
+  decoded_image sides[6];
+  bool ok = true;
+  for ( int i = 0; i < 6; i++ ) {
+    sides[i].file_name = side_files[i];
+    sides[i].flip      = false; // cube-map sides are used the right way up
+    if ( !peek_image( &sides[i] ) ) {
+      sides[i].width = sides[i].height = 0;
+      ok                               = false;
+    }
+  }
+  if ( !ok ) {
+    fprintf( stderr, "ERROR: could not read the cube-map sides\n" );
+    return false;
+  }
   // generate a cube-map texture to hold all the sides
   glActiveTexture( GL_TEXTURE0 );
   glGenTextures( 1, tex_cube );
+  glBindTexture( GL_TEXTURE_CUBE_MAP, *tex_cube );
+  for ( int i = 0; i < 6; i++ ) {
+    if ( sides[i].width > 0 ) {
+      glTexImage2D( side_targets[i], 0, GL_RGBA, sides[i].width, sides[i].height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+    }
+  }
 
-  // load each image and copy into a side of the cube-map texture
-  load_cube_map_side( *tex_cube, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, front );
-  load_cube_map_side( *tex_cube, GL_TEXTURE_CUBE_MAP_POSITIVE_Z, back );
-  load_cube_map_side( *tex_cube, GL_TEXTURE_CUBE_MAP_POSITIVE_Y, top );
-  load_cube_map_side( *tex_cube, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, bottom );
-  load_cube_map_side( *tex_cube, GL_TEXTURE_CUBE_MAP_NEGATIVE_X, left );
-  load_cube_map_side( *tex_cube, GL_TEXTURE_CUBE_MAP_POSITIVE_X, right );
+  upload_ring* ring = default_upload_ring();
+  int next          = 0;
+  while ( next < 6 ) {
+    unsigned char* dests[6];
+    size_t offsets[6];
+    int count = 0;
+    while ( next + count < 6 ) {
+      size_t bytes   = (size_t)sides[next + count].width * sides[next + count].height * 4;
+      dests[count]   = upload_ring_alloc( ring, bytes, &offsets[count] );
+      if ( !dests[count] && 0 == count ) {
+        upload_ring_end_batch( ring );
+        dests[count] = upload_ring_alloc( ring, bytes, &offsets[count] );
+      }
+      if ( !dests[count] ) { break; }
+      count++;
+    }
+    if ( 0 == count ) {
+      // this side is bigger than the whole ring - upload it the old way
+      if ( decode_image( &sides[next] ) ) {
+        load_cube_map_side( side_targets[next], &sides[next], sides[next].pixels );
+        free_decoded_image( &sides[next] );
+      } else {
+        ok = false;
+      }
+      next++;
+      continue;
+    }
+    ok = decode_images_into( &sides[next], dests, count ) && ok;
+    upload_ring_bind( ring );
+    for ( int i = 0; i < count; i++ ) {
+      ok = load_cube_map_side( side_targets[next + i], &sides[next + i], UPLOAD_RING_OFFSET( offsets[i] ) ) && ok;
+    }
+    upload_ring_unbind();
+    upload_ring_end_batch( ring );
+    next += count;
+  }
   // format cube map texture
   glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
   glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
   glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE );
   glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
   glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+  if ( !ok ) {
+    fprintf( stderr, "ERROR: could not decode the cube-map sides\n" );
+    glDeleteTextures( 1, tex_cube );
+    *tex_cube = 0;
+  }
+  return ok;
+}
+
+/* same as create_cube_map() but from a baked .ktx2 or .dds next to each side
+image, with its mips. creates nothing and returns false unless all 6 are there
+and agree on size and format */
+bool create_cube_map_from_containers( const char** side_files, GLuint* tex_cube ) {
+  const GLenum side_targets[6] = { GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, GL_TEXTURE_CUBE_MAP_POSITIVE_Z,
+                                   GL_TEXTURE_CUBE_MAP_POSITIVE_Y, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
+                                   GL_TEXTURE_CUBE_MAP_NEGATIVE_X, GL_TEXTURE_CUBE_MAP_POSITIVE_X };
+  texture_container sides[6];
+  int opened = 0;
+  for ( int i = 0; i < 6; i++ ) {
+    char path[1024];
+    if ( !find_texture_container( side_files[i], path, sizeof( path ) ) ||
+         !open_texture_container( path, &sides[i] ) ) {
+      break;
+    }
+    opened++;
+  }
+  bool ok = 6 == opened && container_format_supported( &sides[0] );
+  for ( int i = 0; ok && i < 6; i++ ) {
+    ok = 1 == sides[i].face_count && sides[i].internal_format == sides[0].internal_format &&
+         sides[i].width == sides[0].width && sides[i].height == sides[0].height &&
+         sides[i].level_count == sides[0].level_count;
+  }
+  if ( ok ) {
+    glActiveTexture( GL_TEXTURE0 );
+    glGenTextures( 1, tex_cube );
+    glBindTexture( GL_TEXTURE_CUBE_MAP, *tex_cube );
+    allocate_container_storage( &sides[0], GL_TEXTURE_CUBE_MAP );
+    for ( int i = 0; i < 6; i++ ) { upload_container_face( &sides[i], 0, side_targets[i] ); }
+    if ( sides[0].generate_mips ) { glGenerateMipmap( GL_TEXTURE_CUBE_MAP ); }
+    set_texture_filtering( GL_TEXTURE_CUBE_MAP );
+    glTexParameteri( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE );
+  }
+  for ( int i = 0; i < opened; i++ ) { close_texture_container( &sides[i] ); }
+  return ok;
+}
+
+/* the sky-box for the texture manager, which calls this again to reload it
+after an eviction. user is the 6 side files. false if neither way loads it, so
+the manager never tracks a broken texture */
+bool load_sky_box( void* user, GLuint* tex ) {
+  const char** side_files = (const char**)user;
+  return create_cube_map_from_containers( side_files, tex ) || create_cube_map( side_files, tex );
 }
 
 // camera matrices. it's easier if they are global
@@ -136,6 +268,10 @@ double right_move_diff = 0;
 double left_move_diff = 0;
 double x_pre = 0;
 double y_pre = 0;
+// right-click asks the render loop to pick the mesh under the cursor
+bool pick_requested = false;
+double pick_x = 0;
+double pick_y = 0;
 static void cursor_position_callback(GLFWwindow* window, double xpos, double ypos)
 {
     if(is_in_shoot_game_state){
@@ -156,6 +292,11 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
         is_in_shoot_game_state = true;
 			  glfwGetCursorPos( g_window, &x_pre, &y_pre );
     }
+    if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS && !is_in_shoot_game_state)
+    {
+        glfwGetCursorPos( g_window, &pick_x, &pick_y );
+        pick_requested = true;
+    }
 }
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -180,6 +321,58 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
     }
 }
 
+/* uniform locations in the chest's program. looked up again whenever a shader
+reload swaps it. view and projection aren't here - every program reads them
+from the per-frame uniform block */
+struct scene_uniforms {
+  int monkey_M_location, monkey_cam_pos_loc, monkey_light_dir_loc;
+  int monkey_light_dir_wor_loc; // for the INSTANCED variant
+  int diffuse_map_loc, specular_map_loc, normal_map_loc;
+};
+
+/* look up the locations, and set every uniform that doesn't change each frame */
+void setup_programmes( GLuint monkey_sp, scene_uniforms* u, const float* sky_sh, int env_unit ) {
+  programme_info info;
+  reflect_programme( monkey_sp, &info );
+  u->monkey_M_location        = uniform_location( &info, "M" );
+  u->monkey_cam_pos_loc       = uniform_location( &info, "cam_pos_loc" );
+  u->monkey_light_dir_loc     = uniform_location( &info, "light_dir_loc" );
+  u->monkey_light_dir_wor_loc = uniform_location( &info, "light_dir_wor" );
+  u->diffuse_map_loc          = uniform_location( &info, "diffuse_map" );
+  u->specular_map_loc         = uniform_location( &info, "specular_map" );
+  u->normal_map_loc           = uniform_location( &info, "normal_map" );
+  // material arrays live on units 1 and up. unit 0 is the sky box's
+  set_material_samplers( monkey_sp, 1 );
+  glUseProgram( monkey_sp );
+  glUniform1i( uniform_location( &info, "cube_texture" ), env_unit );
+  glUniform1f( uniform_location( &info, "roughness" ), REFLECT_ROUGHNESS );
+  glUniform1f( uniform_location( &info, "env_max_lod" ), (float)( ENV_PREFILTER_LEVELS - 1 ) );
+  glUniform3fv( uniform_location( &info, "sh_coeffs" ), ENV_SH_COEFFS, sky_sh );
+}
+
+/* what the chest's draw sets once its program is bound, filled in each frame */
+struct chest_draw {
+  const scene_uniforms* u;
+  mat4 M;
+  vec3 cam_pos_loc, light_dir_loc; // in model space
+  vec3 light_dir_wor;
+  material_map diffuse, specular, normal;
+};
+
+/* the variant's defines decide which of these its program declares. only
+those get set */
+void set_chest_uniforms( const void* user ) {
+  const chest_draw* c = (const chest_draw*)user;
+  glUniformMatrix4fv( c->u->monkey_M_location, 1, GL_FALSE, c->M.m );
+  if ( c->u->monkey_cam_pos_loc >= 0 ) { glUniform3fv( c->u->monkey_cam_pos_loc, 1, c->cam_pos_loc.v ); }
+  if ( c->u->monkey_light_dir_loc >= 0 ) { glUniform3fv( c->u->monkey_light_dir_loc, 1, c->light_dir_loc.v ); }
+  if ( c->u->monkey_light_dir_wor_loc >= 0 ) { glUniform3fv( c->u->monkey_light_dir_wor_loc, 1, c->light_dir_wor.v ); }
+  // no texture binds - just which layers this material's maps are in
+  glUniform2i( c->u->diffuse_map_loc, c->diffuse.array, c->diffuse.layer );
+  if ( c->u->specular_map_loc >= 0 ) { glUniform2i( c->u->specular_map_loc, c->specular.array, c->specular.layer ); }
+  if ( c->u->normal_map_loc >= 0 ) { glUniform2i( c->u->normal_map_loc, c->normal.array, c->normal.layer ); }
+}
+
 int main() {
   /*--------------------------------START
    * OPENGL--------------------------------*/
@@ -192,51 +385,75 @@ int main() {
 
   /*---------------------------------CUBE
    * MAP-----------------------------------*/
-  GLuint cube_vao = make_big_cube();
-  GLuint cube_map_texture;
-  create_cube_map( FRONT, BACK, TOP, BOTTOM, LEFT, RIGHT, &cube_map_texture );
+  init_texture_manager( &g_textures, (long long)TEXTURE_BUDGET_MB * 1024 * 1024 );
+  GLuint cube_vao            = make_big_cube();
+  const char* image_files[6] = { FRONT, BACK, TOP, BOTTOM, LEFT, RIGHT };
+  texture_handle sky_texture = acquire_texture_from( &g_textures, "sky-box", GL_TEXTURE_CUBE_MAP, load_sky_box, (void*)image_files );
+  /* one GGX roughness per mip, and the spherical harmonics for diffuse
+  ambient. worked out on the CPU once, then cached */
+  GLuint env_texture = 0;
+  float sky_sh[ENV_SH_COEFFS * 3];
+  memset( sky_sh, 0, sizeof( sky_sh ) );
+  const char* env_files[6] = { RIGHT, LEFT, TOP, BOTTOM, BACK, FRONT }; // GL face order
+  load_prefiltered_env( env_files, &env_texture, sky_sh );
   
   GLuint vao;
   mat4 bone_offset_mats;
   int bone_count = 0;
   int g_point_count = 0;
-  load_mesh(MESH_FILE, &vao, &g_point_count, &bone_offset_mats, &bone_count);
-
-  GLuint mesh_diffuse;
-  load_texture("res/baoxiang03_D.png", &mesh_diffuse);
-
-  GLuint mesh_normal;
-  load_texture("res/baoxiang03_N.png", &mesh_normal);
+  float* mesh_points = NULL;
+  mesh_bounds chest_bounds;
+  // the chest is static so it gets 16-bit positions
+  mat4 chest_dequant_mat;
+  // only the bounding sphere is used, so the oriented box isn't fitted
+  load_mesh(MESH_FILE, &vao, &g_point_count, &bone_offset_mats, &bone_count, NULL, NULL, &mesh_points, &chest_bounds, &chest_dequant_mat, NULL, false);
+
+  // BVH in model space over the same triangle list that glDrawElements draws
+  bvh mesh_bvh;
+  memset( &mesh_bvh, 0, sizeof( mesh_bvh ) );
+  if ( mesh_points ) {
+    build_bvh( mesh_points, NULL, g_point_count / 3, &mesh_bvh );
+    free( mesh_points );
+  }
 
-  GLuint mesh_specular;
-  load_texture("res/baoxiang03_SGE.png", &mesh_specular);
+  /* material maps are block-compressed once and then come from the cache.
+  specular/gloss/emission is 3 channels so it can't use BC4. they are packed
+  into texture arrays that stream in over the first frames while the chest
+  draws with placeholders */
+  material_packer materials;
+  init_material_packer( &materials );
+  material_map chest_diffuse, chest_specular, chest_normal;
+  add_material_map( &materials, DIFFUSE_FILE, BC7, MIP_COLOUR, true, &chest_diffuse );
+  add_material_map( &materials, SPECULAR_FILE, BC7, MIP_DATA, true, &chest_specular );
+  add_material_map( &materials, NORMAL_FILE, BC5, MIP_NORMAL, true, &chest_normal );
+  start_material_streaming( &materials );
+
+  // the prefiltered sky-box is worked out here, so it can't be made again
+  texture_handle env_handle = track_texture( &g_textures, "prefiltered sky-box", env_texture, GL_TEXTURE_CUBE_MAP );
+  // streamed arrays give memory back by streaming fewer levels
+  texture_handle material_textures[MATERIAL_MAX_ARRAYS];
+  for ( int a = 0; a < materials.array_count; a++ ) {
+    material_textures[a] = acquire_streamed_texture( &g_textures, "material array", &materials.arrays[a] );
+  }
 
   
 
   /*-------------------------------CREATE
    * SHADERS-------------------------------*/
-  // shaders for "Suzanne" mesh
-  GLuint monkey_sp      = create_programme_from_files( MONKEY_VERT_FILE, MONKEY_FRAG_FILE );
-  int monkey_M_location = glGetUniformLocation( monkey_sp, "M" );
-  int monkey_V_location = glGetUniformLocation( monkey_sp, "V" );
-  int monkey_P_location = glGetUniformLocation( monkey_sp, "P" );
-
-	 GLint diffuse_map_loc, specular_map_loc, normal_map_loc, emission_map_loc;
-	 diffuse_map_loc = glGetUniformLocation (monkey_sp, "diffuse_map");
-	 specular_map_loc = glGetUniformLocation (monkey_sp, "specular_map");
-	 normal_map_loc = glGetUniformLocation (monkey_sp, "normal_map");
-
-	 glUseProgram (monkey_sp);
-
-    glUniform1i (diffuse_map_loc, 0);
-    glUniform1i (specular_map_loc, 1);
-    glUniform1i (normal_map_loc, 2);
-
-  // cube-map shaders
-  GLuint cube_sp = create_programme_from_files( CUBE_VERT_FILE, CUBE_FRAG_FILE );
-  // note that this view matrix should NOT contain camera translation.
-  int cube_V_location = glGetUniformLocation( cube_sp, "V" );
-  int cube_P_location = glGetUniformLocation( cube_sp, "P" );
+  // edits to any of these shaders show up without a restart
+  init_shader_reloader( &g_shader_reloader, SHADER_DIR );
+  init_shader_variants( &g_shaders, &g_shader_reloader );
+  // everything drawn from the start, compiled together on the driver's threads
+  programme_request startup_programmes[] = {
+    { MONKEY_VERT_FILE, MONKEY_FRAG_FILE, CHEST_FEATURES, 0 }, // shaders for "Suzanne" mesh
+    { CUBE_VERT_FILE, CUBE_FRAG_FILE, NULL, 0 }                // cube-map shaders
+  };
+  build_shader_variants( &g_shaders, startup_programmes, 2 );
+  GLuint monkey_sp = startup_programmes[0].programme;
+  GLuint cube_sp   = startup_programmes[1].programme;
+
+  // material arrays are on units 1 and up. the prefiltered sky-box goes on the first unit after them
+  const int env_unit = 1 + MATERIAL_MAX_ARRAYS;
 
   // input variables
   float cam_near = 0.1f;                                     // clipping plane
@@ -259,16 +476,44 @@ int main() {
 
   /*---------------------------SET RENDERING
    * DEFAULTS---------------------------*/
-  glUseProgram( monkey_sp );
-  glUniformMatrix4fv( monkey_V_location, 1, GL_FALSE, view_mat.m );
-  glUniformMatrix4fv( monkey_P_location, 1, GL_FALSE, proj_mat.m );
-  glUseProgram( cube_sp );
-  glUniformMatrix4fv( cube_V_location, 1, GL_FALSE, R.m );
-  glUniformMatrix4fv( cube_P_location, 1, GL_FALSE, proj_mat.m );
+  scene_uniforms u;
+  GLuint frame_ubo;
+  init_frame_uniforms( &frame_ubo );
+  render_queue queue;
+  init_render_queue( &queue, RENDER_QUEUE_ITEMS, cam_far );
+  setup_programmes( monkey_sp, &u, sky_sh, env_unit );
   // unique model matrix for each sphere
 
   versor q_model = quat_from_axis_deg(-90, 1.0, 0.0, 0.0 );
   mat4 model_mat = quat_to_mat4( q_model );
+  // what the shader gets - also takes the 16-bit positions back to mesh space
+  mat4 draw_model_mat = model_mat * chest_dequant_mat;
+  // and back again, for lighting a lone chest in the mesh's own space
+  mat4 inv_draw_model_mat = inverse( draw_model_mat );
+  vec3 light_dir_wor( -1.0f, -2.0f, -1.0f );
+
+  // the field of chests, a little more than a chest apart
+  instance_buffer chest_instances;
+  memset( &chest_instances, 0, sizeof( chest_instances ) );
+  if ( CHEST_INSTANCED ) {
+    init_instance_buffer( &chest_instances, vao, CHEST_GRID * CHEST_GRID );
+    int field_count       = CHEST_GRID * CHEST_GRID;
+    mesh_instance* field  = (mesh_instance*)malloc( field_count * sizeof( mesh_instance ) );
+    mesh_instance one_chest;
+    if ( !field ) {
+      // still draw the chest that is picked and streamed for
+      gl_log_err( "ERROR: could not allocate %i chest instances. drawing one\n", field_count );
+      field       = &one_chest;
+      field_count = 1;
+    }
+    float spacing = 2.5f * chest_bounds.sphere_radius;
+    for ( int i = 0; i < field_count; i++ ) {
+      vec3 pos( ( i % CHEST_GRID ) * spacing, 0.0f, -( i / CHEST_GRID ) * spacing );
+      field[i] = make_instance( pos, quat_from_axis_deg( 0.0f, 0.0f, 1.0f, 0.0f ), 1.0f );
+    }
+    update_instances( &chest_instances, field, field_count );
+    if ( field != &one_chest ) { free( field ); }
+  }
 
   glEnable( GL_DEPTH_TEST );          // enable depth-testing
   glDepthFunc( GL_LESS );             // depth-testing interprets a smaller value as "closer"
@@ -286,6 +531,12 @@ int main() {
     double elapsed_seconds         = current_seconds - previous_seconds;
     previous_seconds               = current_seconds;
     _update_fps_counter( g_window );
+    // swap in any program rebuilt since the last frame. the old one drew until now
+    if ( update_shader_reloader( &g_shader_reloader ) ) {
+      monkey_sp = get_shader_variant( &g_shaders, MONKEY_VERT_FILE, MONKEY_FRAG_FILE, CHEST_FEATURES );
+      cube_sp   = get_shader_variant( &g_shaders, CUBE_VERT_FILE, CUBE_FRAG_FILE );
+      setup_programmes( monkey_sp, &u, sky_sh, env_unit );
+    }
 
     int fb_width, fb_height;
     glfwGetFramebufferSize( g_window, &fb_width, &fb_height );
@@ -293,33 +544,101 @@ int main() {
     float aspect = (float)fb_width / (float)fb_height; // aspect ratio
     proj_mat     = perspective( fovy, aspect, cam_near, cam_far );
 
+    // camera and time, once for every program drawn this frame
+    frame_uniforms fu;
+    memcpy( fu.V, view_mat.m, sizeof( fu.V ) );
+    memcpy( fu.P, proj_mat.m, sizeof( fu.P ) );
+    memcpy( fu.VP, ( proj_mat * view_mat ).m, sizeof( fu.VP ) );
+    fu.cam_pos_wor[0] = cam_pos.v[0];
+    fu.cam_pos_wor[1] = cam_pos.v[1];
+    fu.cam_pos_wor[2] = cam_pos.v[2];
+    fu.cam_pos_wor[3] = 1.0f;
+    fu.time           = (float)current_seconds;
+    update_frame_uniforms( frame_ubo, &fu );
+
     // wipe the drawing surface clear
     glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
 
+    // the chest's projected bounding sphere decides how much detail to stream
+    vec4 chest_centre_eye = view_mat * model_mat * vec4( chest_bounds.sphere_centre, 1.0f );
+    float chest_dist      = -chest_centre_eye.v[2];
+    float chest_pixels    = chest_dist > chest_bounds.sphere_radius
+                              ? chest_bounds.sphere_radius * proj_mat.m[5] * (float)fb_height / chest_dist
+                              : (float)fb_height;
+    // this or end_texture_frame() can replace the arrays, so use_texture() names them per draw
+    update_material_streaming( &materials, chest_pixels, STREAM_BYTES_PER_FRAME );
+
+    begin_render_queue( &queue );
     // render a sky-box using the cube-map texture
-    glDepthMask( GL_FALSE );
-    glUseProgram( cube_sp );
-  	glUniformMatrix4fv( cube_P_location, 1, GL_FALSE, proj_mat.m );
-    glActiveTexture( GL_TEXTURE0 );
-    glBindTexture( GL_TEXTURE_CUBE_MAP, cube_map_texture );
-    glBindVertexArray( cube_vao );
-    glDrawArrays( GL_TRIANGLES, 0, 36 );
-    glDepthMask( GL_TRUE );
-
-    glUseProgram( monkey_sp );
-    glBindVertexArray( vao );
-    glUniformMatrix4fv( monkey_M_location, 1, GL_FALSE, model_mat.m );
-  	glUniformMatrix4fv( monkey_P_location, 1, GL_FALSE, proj_mat.m );
-    glActiveTexture( GL_TEXTURE0 );
-    glBindTexture( GL_TEXTURE_2D, mesh_diffuse );
-    glActiveTexture( GL_TEXTURE1 );
-    glBindTexture( GL_TEXTURE_2D, mesh_specular );
-    glActiveTexture( GL_TEXTURE2 );
-    glBindTexture( GL_TEXTURE_2D, mesh_normal );
-    glDrawArrays( GL_TRIANGLES, 0, g_point_count );
+    draw_item sky;
+    memset( &sky, 0, sizeof( sky ) );
+    sky.pass          = RENDER_PASS_SKY;
+    sky.programme     = cube_sp;
+    sky.vao           = cube_vao;
+    sky.textures[0]   = { 0, GL_TEXTURE_CUBE_MAP, use_texture( &g_textures, sky_texture ) };
+    sky.texture_count = 1;
+    sky.mode          = GL_TRIANGLES;
+    sky.count         = 36;
+    submit_draw( &queue, &sky );
+
+    chest_draw chest;
+    chest.u = &u;
+    chest.M = draw_model_mat;
+    if ( CHEST_INSTANCED ) {
+      chest.light_dir_wor = light_dir_wor;
+    } else {
+      // camera and light in model space, once for the object rather than per vertex
+      chest.cam_pos_loc   = vec3( inv_draw_model_mat * vec4( cam_pos, 1.0f ) );
+      chest.light_dir_loc = vec3( inv_draw_model_mat * vec4( light_dir_wor, 0.0f ) );
+    }
+    chest.diffuse       = chest_diffuse;
+    chest.specular      = chest_specular;
+    chest.normal        = chest_normal;
+    draw_item chest_item;
+    memset( &chest_item, 0, sizeof( chest_item ) );
+    chest_item.pass          = RENDER_PASS_OPAQUE;
+    chest_item.programme     = monkey_sp;
+    chest_item.vao           = vao;
+    chest_item.textures[0]   = { (GLuint)env_unit, GL_TEXTURE_CUBE_MAP, use_texture( &g_textures, env_handle ) };
+    for ( int a = 0; a < materials.array_count; a++ ) {
+      chest_item.textures[1 + a] = { (GLuint)( 1 + a ), GL_TEXTURE_2D_ARRAY, use_texture( &g_textures, material_textures[a] ) };
+    }
+    chest_item.texture_count = 1 + materials.array_count;
+    chest_item.mode          = GL_TRIANGLES;
+    chest_item.count         = g_point_count;
+    chest_item.index_type    = GL_UNSIGNED_INT;
+    chest_item.instances     = chest_instances.count; // 0 for a plain draw
+    chest_item.depth         = chest_dist;
+    chest_item.set_uniforms  = set_chest_uniforms;
+    chest_item.user          = &chest;
+    submit_draw( &queue, &chest_item );
+    execute_render_queue( &queue );
+
     // update other events like input handling
     glfwPollEvents();
 
+    // cast a ray from the camera through the cursor into the mesh
+    if ( pick_requested ) {
+      pick_requested = false;
+      int win_width, win_height;
+      glfwGetWindowSize( g_window, &win_width, &win_height );
+      float x_ndc = 2.0f * (float)pick_x / (float)win_width - 1.0f;
+      float y_ndc = 1.0f - 2.0f * (float)pick_y / (float)win_height;
+      vec4 ray_eye = inverse( proj_mat ) * vec4( x_ndc, y_ndc, -1.0f, 1.0f );
+      ray_eye      = vec4( ray_eye.v[0], ray_eye.v[1], -1.0f, 0.0f );
+      vec3 ray_wor = normalise( vec3( inverse( view_mat ) * ray_eye ) );
+      // take the ray into the mesh's local space rather than moving the mesh
+      mat4 inv_model   = inverse( model_mat );
+      vec3 ray_origin  = vec3( inv_model * vec4( cam_pos, 1.0f ) );
+      vec3 ray_dir     = vec3( inv_model * vec4( ray_wor, 0.0f ) );
+      ray_hit hit;
+      if ( bvh_closest_hit( &mesh_bvh, ray_origin, ray_dir, cam_far, &hit ) ) {
+        gl_log( "picked triangle %i at distance %.3f\n", hit.triangle, hit.t );
+      } else {
+        gl_log( "picked nothing\n" );
+      }
+    }
+
     // control keys
     bool cam_moved = false;
     vec3 move( 0.0, 0.0, 0.0 );
@@ -366,22 +685,27 @@ int main() {
       mat4 T  = translate( identity_mat4(), vec3( cam_pos ) );
 
       view_mat = inverse( R ) * inverse( T );
-      glUseProgram( monkey_sp );
-      glUniformMatrix4fv( monkey_V_location, 1, GL_FALSE, view_mat.m );
-
-      // cube-map view matrix has rotation, but not translation
-      glUseProgram( cube_sp );
-      glUniformMatrix4fv( cube_V_location, 1, GL_FALSE, inverse( R ).m );
     }
 
 
     //std::cout<<cam_yaw << " " << cam_pitch<<std::endl;
     x_diff = 0;
     y_diff = 0;
+    end_texture_frame( &g_textures );
     // put the stuff we've been drawing onto the display
     glfwSwapBuffers( g_window );
   }
 
+  free_shader_reloader( &g_shader_reloader );
+  free_shader_variants( &g_shaders );
+  log_render_stats( &queue );
+  free_render_queue( &queue );
+  free_instance_buffer( &chest_instances );
+  glDeleteBuffers( 1, &frame_ubo );
+  free_bvh( &mesh_bvh );
+  log_texture_usage( &g_textures );
+  free_texture_manager( &g_textures );
+  free_material_packer( &materials );
   // close GL context and any other GLFW resources
   glfwTerminate();
   return 0;
@@ -0,0 +1,86 @@
+/******************************************************************************\
+| Read-only memory-mapped files - see mapped_file.h                            |
+\******************************************************************************/
+#include "mapped_file.h"
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+bool map_file( const char *file_name, mapped_file *mf ) {
+	memset( mf, 0, sizeof( mapped_file ) );
+	HANDLE file = CreateFileA( file_name, GENERIC_READ, FILE_SHARE_READ, NULL,
+														 OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( INVALID_HANDLE_VALUE == file ) {
+		return false;
+	}
+	LARGE_INTEGER size;
+	if ( !GetFileSizeEx( file, &size ) || 0 == size.QuadPart ) {
+		CloseHandle( file );
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	if ( !mapping ) {
+		CloseHandle( file );
+		return false;
+	}
+	void *view = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	if ( !view ) {
+		CloseHandle( mapping );
+		CloseHandle( file );
+		return false;
+	}
+	mf->data = (const unsigned char *)view;
+	mf->size = (size_t)size.QuadPart;
+	mf->file_handle = file;
+	mf->mapping_handle = mapping;
+	return true;
+}
+
+void unmap_file( mapped_file *mf ) {
+	if ( mf->data ) {
+		UnmapViewOfFile( mf->data );
+		CloseHandle( (HANDLE)mf->mapping_handle );
+		CloseHandle( (HANDLE)mf->file_handle );
+	}
+	memset( mf, 0, sizeof( mapped_file ) );
+}
+#else
+bool map_file( const char *file_name, mapped_file *mf ) {
+	memset( mf, 0, sizeof( mapped_file ) );
+	mf->fd = -1;
+	int fd = open( file_name, O_RDONLY );
+	if ( fd < 0 ) {
+		return false;
+	}
+	struct stat st;
+	if ( fstat( fd, &st ) != 0 || 0 == st.st_size ) {
+		close( fd );
+		return false;
+	}
+	void *view = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	if ( MAP_FAILED == view ) {
+		close( fd );
+		return false;
+	}
+	mf->data = (const unsigned char *)view;
+	mf->size = (size_t)st.st_size;
+	mf->fd = fd;
+	return true;
+}
+
+void unmap_file( mapped_file *mf ) {
+	if ( mf->data ) {
+		munmap( (void *)mf->data, mf->size );
+		close( mf->fd );
+	}
+	memset( mf, 0, sizeof( mapped_file ) );
+	mf->fd = -1;
+}
+#endif
@@ -0,0 +1,27 @@
+/******************************************************************************\
+| Read-only memory-mapped files                                                |
+| Maps a whole file into the address space so loaders can point straight into  |
+| it instead of reading it into a malloc'd copy first. The OS pages it in on   |
+| demand and can drop the pages again under memory pressure.                   |
+\******************************************************************************/
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+#include <stddef.h>
+
+struct mapped_file {
+	const unsigned char *data;
+	size_t size;
+	/* platform handles. only used by unmap_file() */
+#ifdef _WIN32
+	void *file_handle;
+	void *mapping_handle;
+#else
+	int fd;
+#endif
+};
+
+/* returns false if the file doesn't exist or is empty */
+bool map_file( const char *file_name, mapped_file *mf );
+void unmap_file( mapped_file *mf );
+
+#endif
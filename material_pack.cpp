@@ -0,0 +1,118 @@
+/******************************************************************************\
+| Material texture packing - see material_pack.h                               |
+\******************************************************************************/
+#include "material_pack.h"
+#include "gl_utils.h"
+#include "stb_image.h" // Sean Barrett's image loader - nothings.org
+#include <stdio.h>
+#include <string.h>
+
+void init_material_packer( material_packer *mp ) {
+	memset( mp, 0, sizeof( material_packer ) );
+}
+
+/* size and GL format the map will have once loaded, without loading it */
+static bool peek_map( const char *file_name, bc_format format, GLenum *internal_format,
+											int *width, int *height ) {
+	char path[1024];
+	texture_container tc;
+	if ( find_texture_container( file_name, path, sizeof( path ) ) &&
+			 open_texture_container( path, &tc ) ) {
+		*internal_format = tc.internal_format;
+		*width = tc.width;
+		*height = tc.height;
+		close_texture_container( &tc );
+		return true;
+	}
+	int channels;
+	if ( !stbi_info( file_name, width, height, &channels ) ) {
+		fprintf( stderr, "ERROR: could not load %s\n", file_name );
+		return false;
+	}
+	*internal_format = bc_gl_format( bc_best_supported_format( format ) );
+	return true;
+}
+
+bool add_material_map( material_packer *mp, const char *file_name,
+											 bc_format format, mip_content content, bool flip,
+											 material_map *map ) {
+	map->array = 0;
+	map->layer = 0;
+	if ( mp->started ) {
+		gl_log_err( "ERROR: %s added after the material arrays started streaming\n",
+								file_name );
+		return false;
+	}
+	GLenum internal_format;
+	int width, height;
+	if ( !peek_map( file_name, format, &internal_format, &width, &height ) ) {
+		return false;
+	}
+	int a = 0;
+	for ( ; a < mp->array_count; a++ ) {
+		if ( mp->internal_formats[a] == internal_format && mp->widths[a] == width &&
+				 mp->heights[a] == height && mp->flips[a] == flip &&
+				 mp->layer_counts[a] < STREAM_MAX_LAYERS ) {
+			break;
+		}
+	}
+	if ( a == mp->array_count ) {
+		if ( MATERIAL_MAX_ARRAYS == mp->array_count ) {
+			gl_log_err( "ERROR: no room for another material array for %s\n", file_name );
+			return false;
+		}
+		mp->internal_formats[a] = internal_format;
+		mp->formats[a] = format;
+		mp->flips[a] = flip;
+		mp->widths[a] = width;
+		mp->heights[a] = height;
+		mp->array_count++;
+	}
+	map->array = a;
+	map->layer = mp->layer_counts[a];
+	mp->file_names[a][mp->layer_counts[a]] = file_name;
+	mp->contents[a][mp->layer_counts[a]++] = content;
+	return true;
+}
+
+void start_material_streaming( material_packer *mp ) {
+	for ( int a = 0; a < mp->array_count; a++ ) {
+		stream_texture_array( mp->file_names[a], mp->contents[a], mp->layer_counts[a],
+													mp->formats[a], mp->flips[a], &mp->arrays[a] );
+		gl_log( "material array %i: %ix%i, %i layers\n", a, mp->widths[a],
+						mp->heights[a], mp->layer_counts[a] );
+	}
+	mp->started = true;
+}
+
+void bind_material_arrays( const material_packer *mp, int first_unit ) {
+	for ( int a = 0; a < mp->array_count; a++ ) {
+		glActiveTexture( GL_TEXTURE0 + first_unit + a );
+		glBindTexture( GL_TEXTURE_2D_ARRAY, mp->arrays[a].tex );
+	}
+}
+
+void set_material_samplers( GLuint program, int first_unit ) {
+	GLint units[MATERIAL_MAX_ARRAYS];
+	for ( int a = 0; a < MATERIAL_MAX_ARRAYS; a++ ) {
+		units[a] = first_unit + a;
+	}
+	glUseProgram( program );
+	glUniform1iv( glGetUniformLocation( program, "material_arrays" ),
+								MATERIAL_MAX_ARRAYS, units );
+}
+
+bool update_material_streaming( material_packer *mp, float screen_pixels,
+																int byte_budget ) {
+	for ( int a = 0; a < mp->array_count; a++ ) {
+		stream_texture_feedback( &mp->arrays[a], screen_pixels );
+	}
+	return update_texture_streaming( mp->arrays, mp->array_count, byte_budget );
+}
+
+void free_material_packer( material_packer *mp ) {
+	for ( int a = 0; a < mp->array_count; a++ ) {
+		free_streamed_texture( &mp->arrays[a] );
+	}
+	mp->array_count = 0;
+}
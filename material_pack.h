@@ -0,0 +1,66 @@
+/******************************************************************************\
+| Material texture packing                                                     |
+| Maps from any number of materials are grouped by size and format into a      |
+| few GL_TEXTURE_2D_ARRAYs, one layer per map. Each array stays bound to its   |
+| own texture unit, and a material only carries (array, layer) pairs, so       |
+| drawing with a different material is a couple of uniform or per-instance     |
+| attribute changes instead of texture rebinds.                                |
+|******************************************************************************|
+| The shaders see the arrays as one array of samplers:                         |
+|     uniform sampler2DArray material_arrays[MATERIAL_MAX_ARRAYS];             |
+|     uniform ivec2 diffuse_map; // x = array, y = layer                       |
+|     texture (material_arrays[diffuse_map.x], vec3 (st, diffuse_map.y));      |
+| The array index has to be the same for every fragment of a draw; the layer   |
+| can vary freely.                                                             |
+\******************************************************************************/
+#ifndef _MATERIAL_PACK_H_
+#define _MATERIAL_PACK_H_
+#include "texture_stream.h"
+#include <GL/glew.h>
+
+/* must match the size of material_arrays[] in the shaders */
+#define MATERIAL_MAX_ARRAYS 4
+
+/* where one map ended up. goes straight into an ivec2 */
+struct material_map {
+	int array;
+	int layer;
+};
+
+struct material_packer {
+	int array_count;
+	bool started;
+	/* how maps are grouped, gathered until start_material_streaming() */
+	GLenum internal_formats[MATERIAL_MAX_ARRAYS];
+	bc_format formats[MATERIAL_MAX_ARRAYS];
+	bool flips[MATERIAL_MAX_ARRAYS];
+	int widths[MATERIAL_MAX_ARRAYS];
+	int heights[MATERIAL_MAX_ARRAYS];
+	int layer_counts[MATERIAL_MAX_ARRAYS];
+	const char *file_names[MATERIAL_MAX_ARRAYS][STREAM_MAX_LAYERS];
+	mip_content contents[MATERIAL_MAX_ARRAYS][STREAM_MAX_LAYERS];
+	streamed_texture arrays[MATERIAL_MAX_ARRAYS];
+};
+
+void init_material_packer( material_packer *mp );
+/* find a layer for the map, in an existing array of the same size and format
+or a new one. content only changes how its mips are filtered, so colour,
+data and normal maps can share an array. only the image header is read here.
+the name is not copied */
+bool add_material_map( material_packer *mp, const char *file_name,
+											 bc_format format, mip_content content, bool flip,
+											 material_map *map );
+/* after the last add_material_map(). each array streams in like any other
+streamed_texture */
+void start_material_streaming( material_packer *mp );
+/* bind every array, array i to unit first_unit + i */
+void bind_material_arrays( const material_packer *mp, int first_unit );
+/* point a program's material_arrays[] at the units bind_material_arrays() used */
+void set_material_samplers( GLuint program, int first_unit );
+/* feedback and upload for every array. returns true when the arrays need
+binding again */
+bool update_material_streaming( material_packer *mp, float screen_pixels,
+																int byte_budget );
+void free_material_packer( material_packer *mp );
+
+#endif
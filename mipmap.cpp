@@ -0,0 +1,339 @@
+/******************************************************************************\
+| CPU mip chain generation - see mipmap.h                                      |
+\******************************************************************************/
+#include "mipmap.h"
+#include "parallel.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined( __SSE2__ ) || defined( _M_X64 ) ||                                \
+	( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define MIP_SSE
+#include <emmintrin.h>
+#endif
+
+/* rows per parallel_for() iteration. small enough to share the work out on the
+lower levels, big enough that the threads aren't mostly passing work around */
+#define MIP_BAND_ROWS 16
+#define MIP_MAX_TAPS 6
+/* kaiser window half-width in destination texels, and its shape parameter */
+#define KAISER_HALF_WIDTH 1.5f
+#define KAISER_ALPHA 4.0f
+
+/*-------------------------------------sRGB-----------------------------------*/
+struct srgb_tables {
+	float to_linear[256];
+	/* linear value halfway between each pair of neighbouring 8-bit codes, so
+	encoding is a search that rounds the same way on every machine */
+	float thresholds[255];
+	srgb_tables() {
+		for ( int i = 0; i < 256; i++ ) {
+			to_linear[i] = decode( i / 255.0f );
+		}
+		for ( int i = 0; i < 255; i++ ) {
+			thresholds[i] = decode( ( i + 0.5f ) / 255.0f );
+		}
+	}
+	static float decode( float c ) {
+		return c <= 0.04045f ? c / 12.92f : powf( ( c + 0.055f ) / 1.055f, 2.4f );
+	}
+};
+
+/* built the first time any thread needs it */
+static const srgb_tables &get_srgb_tables() {
+	static srgb_tables tables;
+	return tables;
+}
+
+static unsigned char encode_srgb( const srgb_tables &tables, float v ) {
+	int lo = 0, hi = 255;
+	while ( lo < hi ) {
+		int mid = ( lo + hi ) / 2;
+		if ( v >= tables.thresholds[mid] ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return (unsigned char)lo;
+}
+
+static unsigned char encode_unorm( float v ) {
+	v = v < 0.0f ? 0.0f : ( v > 1.0f ? 1.0f : v );
+	return (unsigned char)( v * 255.0f + 0.5f );
+}
+
+/*------------------------------------KERNELS---------------------------------*/
+/* weights for one axis of a 2:1 reduction. destination texel x reads source
+texels first + t, where first = 2x + 1 - taps / 2 */
+struct mip_kernel {
+	int taps;
+	float weights[MIP_MAX_TAPS];
+};
+
+/* zeroth order modified bessel function of the first kind */
+static float bessel_i0( float x ) {
+	float sum = 1.0f, term = 1.0f;
+	for ( int k = 1; k < 16; k++ ) {
+		term *= ( x * 0.5f / k ) * ( x * 0.5f / k );
+		sum += term;
+	}
+	return sum;
+}
+
+static float kaiser_sinc( float x ) {
+	float t = x / KAISER_HALF_WIDTH;
+	if ( t * t >= 1.0f ) {
+		return 0.0f;
+	}
+	float window = bessel_i0( KAISER_ALPHA * sqrtf( 1.0f - t * t ) ) / bessel_i0( KAISER_ALPHA );
+	float sinc = fabsf( x ) < 1e-6f ? 1.0f : sinf( 3.14159265f * x ) / ( 3.14159265f * x );
+	return window * sinc;
+}
+
+static void make_kernel( mip_filter filter, int source_size, mip_kernel *k ) {
+	if ( 1 == source_size ) {
+		k->taps = 1; // nothing to reduce along this axis
+		k->weights[0] = 1.0f;
+		return;
+	}
+	if ( MIP_BOX == filter ) {
+		k->taps = 2;
+		k->weights[0] = k->weights[1] = 0.5f;
+		return;
+	}
+	k->taps = MIP_MAX_TAPS;
+	float sum = 0.0f;
+	for ( int t = 0; t < k->taps; t++ ) {
+		/* source texel centre relative to the destination texel centre, in
+		destination texels */
+		float x = ( t - k->taps / 2 + 0.5f ) * 0.5f;
+		k->weights[t] = kaiser_sinc( x );
+		sum += k->weights[t];
+	}
+	for ( int t = 0; t < k->taps; t++ ) {
+		k->weights[t] /= sum;
+	}
+}
+
+/* weighted sum of taps texels at src + offsets[t] floats */
+static void filter_texel( const float *src, const int *offsets,
+													const float *weights, int taps, float *out ) {
+#ifdef MIP_SSE
+	__m128 acc = _mm_setzero_ps();
+	for ( int t = 0; t < taps; t++ ) {
+		acc = _mm_add_ps( acc, _mm_mul_ps( _mm_set1_ps( weights[t] ),
+																			 _mm_loadu_ps( src + offsets[t] ) ) );
+	}
+	_mm_storeu_ps( out, acc );
+#else
+	out[0] = out[1] = out[2] = out[3] = 0.0f;
+	for ( int t = 0; t < taps; t++ ) {
+		const float *texel = src + offsets[t];
+		for ( int c = 0; c < 4; c++ ) {
+			out[c] += weights[t] * texel[c];
+		}
+	}
+#endif
+}
+
+/* where the taps of destination texel i land, edges clamped */
+static void tap_offsets( const mip_kernel *k, int i, int size, int stride,
+												 int *offsets ) {
+	int first = 2 * i + 1 - k->taps / 2;
+	for ( int t = 0; t < k->taps; t++ ) {
+		int s = first + t;
+		s = s < 0 ? 0 : ( s >= size ? size - 1 : s );
+		offsets[t] = s * stride;
+	}
+}
+
+/*-------------------------------------PASSES---------------------------------*/
+struct mip_job {
+	mip_content content;
+	const unsigned char *in; // level 0, for the conversion to float
+	const float *src;
+	float *tmp; // dw x h, between the two passes
+	float *dst;
+	unsigned char *out;
+	int w, h, dw, dh;
+	mip_kernel kx, ky;
+};
+
+static void band_rows( int band, int rows, int *begin, int *end ) {
+	*begin = band * MIP_BAND_ROWS;
+	*end = *begin + MIP_BAND_ROWS < rows ? *begin + MIP_BAND_ROWS : rows;
+}
+
+static void to_float_band( int band, void *user ) {
+	mip_job *job = (mip_job *)user;
+	const srgb_tables &tables = get_srgb_tables();
+	int begin, end;
+	band_rows( band, job->h, &begin, &end );
+	for ( size_t i = (size_t)begin * job->w; i < (size_t)end * job->w; i++ ) {
+		const unsigned char *p = job->in + i * 4;
+		float *f = job->dst + i * 4;
+		for ( int c = 0; c < 3; c++ ) {
+			if ( MIP_COLOUR == job->content ) {
+				f[c] = tables.to_linear[p[c]];
+			} else if ( MIP_NORMAL == job->content ) {
+				f[c] = p[c] / 127.5f - 1.0f;
+			} else {
+				f[c] = p[c] / 255.0f;
+			}
+		}
+		f[3] = p[3] / 255.0f;
+	}
+}
+
+static void horizontal_band( int band, void *user ) {
+	mip_job *job = (mip_job *)user;
+	int begin, end;
+	band_rows( band, job->h, &begin, &end );
+	int offsets[MIP_MAX_TAPS];
+	for ( int y = begin; y < end; y++ ) {
+		for ( int x = 0; x < job->dw; x++ ) {
+			tap_offsets( &job->kx, x, job->w, 4, offsets );
+			filter_texel( job->src + (size_t)y * job->w * 4, offsets, job->kx.weights,
+										job->kx.taps, job->tmp + ( (size_t)y * job->dw + x ) * 4 );
+		}
+	}
+}
+
+/* the vertical pass, then renormalise, clamp and encode the finished rows */
+static void vertical_band( int band, void *user ) {
+	mip_job *job = (mip_job *)user;
+	const srgb_tables &tables = get_srgb_tables();
+	int begin, end;
+	band_rows( band, job->dh, &begin, &end );
+	int offsets[MIP_MAX_TAPS];
+	for ( int y = begin; y < end; y++ ) {
+		tap_offsets( &job->ky, y, job->h, job->dw * 4, offsets );
+		for ( int x = 0; x < job->dw; x++ ) {
+			size_t i = (size_t)y * job->dw + x;
+			float *f = job->dst + i * 4;
+			filter_texel( job->tmp + x * 4, offsets, job->ky.weights, job->ky.taps, f );
+			unsigned char *p = job->out + i * 4;
+			if ( MIP_NORMAL == job->content ) {
+				float len = sqrtf( f[0] * f[0] + f[1] * f[1] + f[2] * f[2] );
+				if ( len > 1e-6f ) {
+					f[0] /= len;
+					f[1] /= len;
+					f[2] /= len;
+				} else {
+					f[0] = f[1] = 0.0f; // cancelled out. face straight out of the surface
+					f[2] = 1.0f;
+				}
+				for ( int c = 0; c < 3; c++ ) {
+					p[c] = encode_unorm( f[c] * 0.5f + 0.5f );
+				}
+			} else {
+				/* the kaiser's negative lobes can overshoot */
+				for ( int c = 0; c < 3; c++ ) {
+					f[c] = f[c] < 0.0f ? 0.0f : ( f[c] > 1.0f ? 1.0f : f[c] );
+					p[c] = MIP_COLOUR == job->content ? encode_srgb( tables, f[c] )
+																						: encode_unorm( f[c] );
+				}
+			}
+			f[3] = f[3] < 0.0f ? 0.0f : ( f[3] > 1.0f ? 1.0f : f[3] );
+			p[3] = encode_unorm( f[3] );
+		}
+	}
+}
+
+/*--------------------------------------CHAIN---------------------------------*/
+int mip_level_count( int width, int height ) {
+	int count = 1;
+	while ( ( width > 1 || height > 1 ) && count < MIP_MAX_LEVELS ) {
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+		count++;
+	}
+	return count;
+}
+
+bool generate_mip_chain( const unsigned char *pixels, int width, int height,
+												 mip_content content, mip_filter filter,
+												 mip_chain *chain ) {
+	memset( chain, 0, sizeof( mip_chain ) );
+	chain->level_count = mip_level_count( width, height );
+	size_t offsets[MIP_MAX_LEVELS];
+	size_t total = 0;
+	for ( int l = 0; l < chain->level_count; l++ ) {
+		chain->widths[l] = l > 0 ? ( chain->widths[l - 1] > 1 ? chain->widths[l - 1] / 2 : 1 )
+														 : width;
+		chain->heights[l] = l > 0 ? ( chain->heights[l - 1] > 1 ? chain->heights[l - 1] / 2 : 1 )
+															: height;
+		offsets[l] = total;
+		if ( l > 0 ) {
+			total += (size_t)chain->widths[l] * chain->heights[l] * 4;
+		}
+	}
+	/* levels are filtered in float from the float level above, so rounding to 8
+	bits never builds up down the chain. src holds level 0 at most and dst
+	level 1 at most, and they swap as the levels shrink */
+	size_t pixel_count = (size_t)width * height;
+	size_t half_count = chain->level_count > 1
+												? (size_t)chain->widths[1] * chain->heights[1]
+												: 1;
+	size_t tmp_count = chain->level_count > 1 ? (size_t)chain->widths[1] * height : 1;
+	chain->data = (unsigned char *)malloc( total > 0 ? total : 1 );
+	float *src = (float *)malloc( pixel_count * 4 * sizeof( float ) );
+	float *dst = (float *)malloc( half_count * 4 * sizeof( float ) );
+	float *tmp = (float *)malloc( tmp_count * 4 * sizeof( float ) );
+	if ( !chain->data || !src || !dst || !tmp ) {
+		fprintf( stderr, "ERROR: out of memory building %ix%i mip chain\n", width, height );
+		free( src );
+		free( dst );
+		free( tmp );
+		free_mip_chain( chain );
+		return false;
+	}
+	chain->levels[0] = pixels;
+	for ( int l = 1; l < chain->level_count; l++ ) {
+		chain->levels[l] = chain->data + offsets[l];
+	}
+
+	mip_job job;
+	job.content = content;
+	job.in = pixels;
+	job.w = width;
+	job.h = height;
+	job.dst = src;
+	parallel_for( ( height + MIP_BAND_ROWS - 1 ) / MIP_BAND_ROWS, to_float_band, &job );
+	for ( int l = 1; l < chain->level_count; l++ ) {
+		job.src = src;
+		job.tmp = tmp;
+		job.dst = dst;
+		job.out = chain->data + offsets[l];
+		job.w = chain->widths[l - 1];
+		job.h = chain->heights[l - 1];
+		job.dw = chain->widths[l];
+		job.dh = chain->heights[l];
+		make_kernel( filter, job.w, &job.kx );
+		make_kernel( filter, job.h, &job.ky );
+		parallel_for( ( job.h + MIP_BAND_ROWS - 1 ) / MIP_BAND_ROWS, horizontal_band, &job );
+		parallel_for( ( job.dh + MIP_BAND_ROWS - 1 ) / MIP_BAND_ROWS, vertical_band, &job );
+		float *swap = src;
+		src = dst;
+		dst = swap;
+	}
+	free( src );
+	free( dst );
+	free( tmp );
+	return true;
+}
+
+void free_mip_chain( mip_chain *chain ) {
+	free( chain->data );
+	memset( chain, 0, sizeof( mip_chain ) );
+}
+
+float srgb_to_linear( unsigned char c ) {
+	return get_srgb_tables().to_linear[c];
+}
+
+unsigned char linear_to_srgb( float v ) {
+	return encode_srgb( get_srgb_tables(), v );
+}
@@ -0,0 +1,44 @@
+/******************************************************************************\
+| CPU mip chain generation                                                     |
+| Builds every level of an RGBA8 image on the CPU rather than with             |
+| glGenerateMipmap(), so the result is the same on every driver and doesn't    |
+| depend on a slow path in software rasterisers. Each level is filtered from   |
+| the one above in float, separably, in linear space:                          |
+|   MIP_COLOUR - sRGB-encoded colour. rgb go to linear light and back          |
+|   MIP_DATA   - already linear (gloss, masks and so on)                       |
+|   MIP_NORMAL - tangent-space normals in rgb. renormalised on every level     |
+| Alpha is always treated as linear.                                           |
+|******************************************************************************|
+| The texel loops are SSE (one texel's 4 channels per register), and each pass |
+| is split into bands of rows across the worker threads.                       |
+\******************************************************************************/
+#ifndef _MIPMAP_H_
+#define _MIPMAP_H_
+
+#define MIP_MAX_LEVELS 16
+
+enum mip_content { MIP_COLOUR, MIP_DATA, MIP_NORMAL };
+/* box is 2x2 texels. kaiser is a windowed sinc over 6x6, sharper, with less
+aliasing */
+enum mip_filter { MIP_BOX, MIP_KAISER };
+
+struct mip_chain {
+	int level_count;
+	int widths[MIP_MAX_LEVELS];
+	int heights[MIP_MAX_LEVELS];
+	/* RGBA8. level 0 is the caller's image, not a copy */
+	const unsigned char *levels[MIP_MAX_LEVELS];
+	unsigned char *data; // levels 1 and down, in one allocation
+};
+
+/* levels down to 1x1, halving each side that is still bigger than 1 */
+int mip_level_count( int width, int height );
+/* needs no GL context. pixels must stay valid for as long as the chain */
+bool generate_mip_chain( const unsigned char *pixels, int width, int height,
+												 mip_content content, mip_filter filter,
+												 mip_chain *chain );
+void free_mip_chain( mip_chain *chain );
+/* the sRGB transfer function, through the same tables the filters use */
+float srgb_to_linear( unsigned char c );
+unsigned char linear_to_srgb( float v );
+#endif
@@ -15,6 +15,8 @@
 | Faces MUST come after all other data in the .obj file                        |
 \******************************************************************************/
 #include "obj_parser.h"
+#include "gl_utils.h"
+#include "upload_ring.h"
 #include "assimp/cimport.h"
 #include "assimp/postprocess.h" // various extra operations
 #include "assimp/scene.h"				// collects data
@@ -24,19 +26,182 @@
 #include "stb_image.h"
 #include <iostream>
 
+/* entries in the post-transform cache that triangles are ordered for. small
+enough to suit older hardware, and orders that suit 16 suit bigger caches too */
+#define VERTEX_CACHE_SIZE 16
+
 mat4 convert_assimp_matrix( aiMatrix4x4 m ) {
 	return mat4( 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f,
 							 0.0f, m.a4, m.b4, m.c4, m.d4 );
 }
 
+/* move each element of a per-vertex array to its slot in remap. elements
+that remap to -1 are dropped. frees the old array */
+static void *reorder_stream( void *data, size_t element_size, const int *remap,
+														 int old_count, int new_count ) {
+	if ( !data ) {
+		return NULL;
+	}
+	unsigned char *reordered = (unsigned char *)malloc( new_count * element_size );
+	for ( int i = 0; i < old_count; i++ ) {
+		if ( remap[i] >= 0 ) {
+			memcpy( &reordered[remap[i] * element_size],
+							&( (unsigned char *)data )[i * element_size], element_size );
+		}
+	}
+	free( data );
+	return reordered;
+}
+
+/* average cache miss ratio - vertices transformed per triangle through a FIFO
+post-transform cache of cache_size. 3 is no reuse at all, 0.5 the ideal */
+static float vertex_cache_acmr( const GLuint *indices, int index_count, int vertex_count,
+																int cache_size ) {
+	if ( index_count < 3 ) {
+		return 0.0f;
+	}
+	int *entered = (int *)malloc( vertex_count * sizeof( int ) );
+	if ( !entered ) {
+		return 0.0f;
+	}
+	for ( int v = 0; v < vertex_count; v++ ) {
+		entered[v] = -cache_size - 1;
+	}
+	int misses = 0;
+	for ( int i = 0; i < index_count; i++ ) {
+		GLuint v = indices[i];
+		if ( misses - entered[v] > cache_size ) {
+			entered[v] = misses++; // FIFO - hits don't refresh
+		}
+	}
+	free( entered );
+	return (float)misses / (float)( index_count / 3 );
+}
+
+/* reorder the triangles for the post-transform vertex cache. Sander, Nehab and
+Barczak's "tipsify": fan out around one vertex at a time, then move to a
+neighbour still in the cache with triangles left, or back to a recent vertex
+when there is none. linear time. false, with indices untouched, if out of
+memory */
+static bool tipsify( GLuint *indices, int index_count, int vertex_count, int cache_size ) {
+	int tri_count = index_count / 3;
+	int *offsets = (int *)calloc( vertex_count + 1, sizeof( int ) );
+	int *live = (int *)calloc( vertex_count, sizeof( int ) );
+	int *cache_time = (int *)calloc( vertex_count, sizeof( int ) );
+	int *adjacency = (int *)malloc( index_count * sizeof( int ) );
+	int *dead_end = (int *)malloc( index_count * sizeof( int ) );
+	bool *emitted = (bool *)calloc( tri_count, sizeof( bool ) );
+	GLuint *out = (GLuint *)malloc( index_count * sizeof( GLuint ) );
+	if ( !offsets || !live || !cache_time || !adjacency || !dead_end || !emitted || !out ) {
+		free( offsets );
+		free( live );
+		free( cache_time );
+		free( adjacency );
+		free( dead_end );
+		free( emitted );
+		free( out );
+		return false;
+	}
+	/* each vertex's triangles */
+	for ( int i = 0; i < index_count; i++ ) {
+		live[indices[i]]++;
+	}
+	for ( int v = 0; v < vertex_count; v++ ) {
+		offsets[v + 1] = offsets[v] + live[v];
+	}
+	int *fill = cache_time; // zero, and not needed until after this
+	for ( int i = 0; i < index_count; i++ ) {
+		GLuint v = indices[i];
+		adjacency[offsets[v] + fill[v]++] = i / 3;
+	}
+	memset( cache_time, 0, vertex_count * sizeof( int ) );
+
+	int out_count = 0, dead_count = 0;
+	int time = cache_size + 1, cursor = 0;
+	int fan = 0;
+	while ( fan >= 0 ) {
+		int first_candidate = dead_count;
+		for ( int a = offsets[fan]; a < offsets[fan + 1]; a++ ) {
+			int t = adjacency[a];
+			if ( emitted[t] ) {
+				continue;
+			}
+			emitted[t] = true;
+			for ( int k = 0; k < 3; k++ ) {
+				GLuint v = indices[t * 3 + k];
+				out[out_count++] = v;
+				dead_end[dead_count++] = (int)v;
+				live[v]--;
+				if ( time - cache_time[v] > cache_size ) {
+					cache_time[v] = time++;
+				}
+			}
+		}
+		/* the candidate still in the cache after its own fan, oldest first. one
+		that has fallen out scores 0 and never wins - the dead-end stack below
+		picks a better restart */
+		int best = -1, best_priority = 0;
+		for ( int c = first_candidate; c < dead_count; c++ ) {
+			int v = dead_end[c];
+			if ( live[v] > 0 ) {
+				int priority = 0;
+				if ( time - cache_time[v] + 2 * live[v] <= cache_size ) {
+					priority = time - cache_time[v];
+				}
+				if ( priority > best_priority ) {
+					best_priority = priority;
+					best = v;
+				}
+			}
+		}
+		if ( best < 0 ) {
+			/* dead end. a recent vertex with triangles left, or the next one in
+			order */
+			while ( dead_count > 0 && best < 0 ) {
+				int v = dead_end[--dead_count];
+				best = live[v] > 0 ? v : -1;
+			}
+			while ( best < 0 && cursor < vertex_count ) {
+				best = live[cursor] > 0 ? cursor : -1;
+				cursor++;
+			}
+		}
+		fan = best;
+	}
+	memcpy( indices, out, out_count * sizeof( GLuint ) );
+	free( offsets );
+	free( live );
+	free( cache_time );
+	free( adjacency );
+	free( dead_end );
+	free( emitted );
+	free( out );
+	return true;
+}
+
 /* load a mesh using the assimp library */
 bool load_mesh( const char *file_name, GLuint *vao, int *point_count,
-								mat4 *bone_offset_mats, int *bone_count ) {
-	const aiScene *scene = aiImportFile( file_name, aiProcess_Triangulate | aiProcess_CalcTangentSpace  );
+								mat4 *bone_offset_mats, int *bone_count,
+								anim_clip **clips, int *clip_count, float **points_out,
+								mesh_bounds *bounds, mat4 *dequant_mat, GLuint *depth_vao,
+								bool with_obb ) {
+	if ( bounds ) {
+		memset( (void *)bounds, 0, sizeof( mesh_bounds ) );
+	}
+	/* without joining, every corner is its own vertex and the index buffer would
+	just count up */
+	const aiScene *scene = aiImportFile( file_name, aiProcess_Triangulate | aiProcess_CalcTangentSpace |
+																									 aiProcess_JoinIdenticalVertices );
 	if ( !scene ) {
 		fprintf( stderr, "ERROR: reading mesh %s\n", file_name );
 		return false;
 	}
+	if ( scene->mNumMeshes < 1 || !scene->mMeshes[0]->HasPositions() ||
+			 scene->mMeshes[0]->mNumVertices < 1 ) {
+		fprintf( stderr, "ERROR: mesh %s has no vertices\n", file_name );
+		aiReleaseImport( scene );
+		return false;
+	}
 	printf( "  %i animations\n", scene->mNumAnimations );
 	printf( "  %i cameras\n", scene->mNumCameras );
 	printf( "  %i lights\n", scene->mNumLights );
@@ -44,8 +209,53 @@ bool load_mesh( const char *file_name, GLuint *vao, int *point_count,
 	printf( "  %i meshes\n", scene->mNumMeshes );
 	printf( "  %i textures\n", scene->mNumTextures );
 
+	/* compress animation clips straight away so the float keys can go with the
+	scene */
+	int anim_count = 0;
+	anim_clip *anims = NULL;
+	if ( scene->mNumAnimations > 0 ) {
+		anims = (anim_clip *)calloc( scene->mNumAnimations, sizeof( anim_clip ) );
+		if ( !anims ) {
+			fprintf( stderr, "ERROR: out of memory for %i clips in %s\n",
+							 scene->mNumAnimations, file_name );
+		}
+	}
+	for ( int a_i = 0; anims && a_i < (int)scene->mNumAnimations; a_i++ ) {
+		/* failed clips are left out, and the ones after move down */
+		anim_clip *clip = &anims[anim_count];
+		if ( !compress_animation( scene->mAnimations[a_i], ANIM_DEFAULT_MAX_ERROR, clip ) ) {
+			fprintf( stderr, "ERROR: could not compress clip %i of %s. skipping it\n", a_i,
+							 file_name );
+			continue;
+		}
+		anim_count++;
+		float ratio = clip->compressed_bytes > 0
+										? (float)clip->raw_bytes / (float)clip->compressed_bytes
+										: 0.0f;
+		printf( "    clip[%i] %s: %i tracks %.2fs, %i -> %i bytes (%.2f:1), max error %f\n",
+						a_i, clip->name, clip->track_count, clip->duration_seconds,
+						clip->raw_bytes, clip->compressed_bytes, ratio, clip->max_error );
+		gl_log( "clip %s: %i -> %i bytes (%.2f:1), max error %f\n", clip->name,
+						clip->raw_bytes, clip->compressed_bytes, ratio, clip->max_error );
+	}
+	if ( clips && clip_count ) {
+		*clips = anims;
+		*clip_count = anim_count;
+	} else {
+		for ( int a_i = 0; a_i < anim_count; a_i++ ) {
+			free_anim_clip( &anims[a_i] );
+		}
+		free( anims );
+	}
+
 	/* get first mesh in file only */
 	const aiMesh *mesh = scene->mMeshes[0];
+	if ( points_out ) {
+		*points_out = NULL;
+	}
+	if ( dequant_mat ) {
+		*dequant_mat = identity_mat4();
+	}
 	printf( "    %i vertices in mesh[0]\n", mesh->mNumVertices );
 	printf( "    %i face in mesh[0]\n", mesh->mNumFaces );
 
@@ -74,6 +284,11 @@ bool load_mesh( const char *file_name, GLuint *vao, int *point_count,
 			points[i * 3 + 1] = (GLfloat)vp->y;
 			points[i * 3 + 2] = (GLfloat)vp->z;
 		}
+		// while the points are still in cache
+		if ( bounds ) {
+			compute_mesh_bounds( points, *point_count, with_obb, bounds );
+			print_bounds( *bounds );
+		}
 	}
 	if ( mesh->HasNormals() ) {
 		normals = (GLfloat *)malloc( *point_count * 3 * sizeof( GLfloat ) );
@@ -160,58 +375,167 @@ bool load_mesh( const char *file_name, GLuint *vao, int *point_count,
 	}		// endif
 
 
-	/* copy mesh data into VBOs */
+	/* build an index list from the faces, then renumber the vertices in the
+	order that list first uses them. the vertex fetch then walks forwards through
+	memory instead of jumping around. unused vertices fall off the end */
+	GLuint *indices = (GLuint *)malloc( mesh->mNumFaces * 3 * sizeof( GLuint ) );
+	int index_count = 0;
+	for ( unsigned int f_i = 0; f_i < mesh->mNumFaces; f_i++ ) {
+		const aiFace *face = &mesh->mFaces[f_i];
+		if ( face->mNumIndices != 3 ) { // stray points and lines
+			continue;
+		}
+		for ( int k = 0; k < 3; k++ ) {
+			indices[index_count++] = face->mIndices[k];
+		}
+	}
+	/* triangles in cache order first, so that the fetch order below follows it */
+	float acmr_before = vertex_cache_acmr( indices, index_count, *point_count, VERTEX_CACHE_SIZE );
+	if ( tipsify( indices, index_count, *point_count, VERTEX_CACHE_SIZE ) ) {
+		printf( "    vertex cache ACMR %.3f -> %.3f\n", acmr_before,
+						vertex_cache_acmr( indices, index_count, *point_count, VERTEX_CACHE_SIZE ) );
+	}
+	int *remap = (int *)malloc( *point_count * sizeof( int ) );
+	for ( int i = 0; i < *point_count; i++ ) {
+		remap[i] = -1;
+	}
+	int used_count = 0;
+	for ( int i = 0; i < index_count; i++ ) {
+		if ( remap[indices[i]] < 0 ) {
+			remap[indices[i]] = used_count++;
+		}
+		indices[i] = (GLuint)remap[indices[i]];
+	}
+	points = (GLfloat *)reorder_stream( points, 3 * sizeof( GLfloat ), remap,
+																			*point_count, used_count );
+	normals = (GLfloat *)reorder_stream( normals, 3 * sizeof( GLfloat ), remap,
+																			 *point_count, used_count );
+	texcoords = (GLfloat *)reorder_stream( texcoords, 2 * sizeof( GLfloat ), remap,
+																				 *point_count, used_count );
+	tangents = (GLfloat *)reorder_stream( tangents, 4 * sizeof( GLfloat ), remap,
+																				*point_count, used_count );
+	bone_ids = (GLint *)reorder_stream( bone_ids, sizeof( GLint ), remap,
+																			*point_count, used_count );
+	free( remap );
+	printf( "    %i indices over %i vertices (%.2f per vertex)\n", index_count, used_count,
+					used_count > 0 ? (float)index_count / (float)used_count : 0.0f );
+	*point_count = used_count;
+
+	/* copy mesh data into VBOs. positions get a stream of their own so that
+	depth-only passes fetch 12 (or 6 if quantised) bytes per vertex. everything
+	else is interleaved into a second stream */
+	GLuint points_vbo = 0;
+	GLenum points_type = GL_FLOAT;
 	if ( mesh->HasPositions() ) {
-		GLuint vbo;
-		glGenBuffers( 1, &vbo );
-		glBindBuffer( GL_ARRAY_BUFFER, vbo );
-		glBufferData( GL_ARRAY_BUFFER, 3 * *point_count * sizeof( GLfloat ), points,
-									GL_STATIC_DRAW );
-		glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 0, NULL );
+		glGenBuffers( 1, &points_vbo );
+		glBindBuffer( GL_ARRAY_BUFFER, points_vbo );
+		if ( dequant_mat ) {
+			/* half the bytes of floats. GL normalises the shorts to 0-1 and the
+			matrix takes them back to mesh space */
+			float mn[3], mx[3];
+			compute_aabb( points, *point_count, mn, mx );
+			GLushort *quantised = (GLushort *)malloc( *point_count * 3 * sizeof( GLushort ) );
+			quantise_positions( points, *point_count, mn, mx, quantised, dequant_mat );
+			upload_buffer_data( GL_ARRAY_BUFFER, 3 * *point_count * sizeof( GLushort ),
+												 quantised, GL_STATIC_DRAW );
+			points_type = GL_UNSIGNED_SHORT;
+			free( quantised );
+		} else {
+			upload_buffer_data( GL_ARRAY_BUFFER, 3 * *point_count * sizeof( GLfloat ), points,
+												 GL_STATIC_DRAW );
+		}
+		glVertexAttribPointer( 0, 3, points_type, GL_UNSIGNED_SHORT == points_type,
+													 0, NULL );
 		glEnableVertexAttribArray( 0 );
+		if ( points_out ) {
+			// callers get the triangles in draw order, not the indexed vertices
+			*points_out = (float *)malloc( index_count * 3 * sizeof( float ) );
+			for ( int i = 0; i < index_count; i++ ) {
+				memcpy( &( *points_out )[i * 3], &points[indices[i] * 3], 3 * sizeof( float ) );
+			}
+		}
 		free( points );
 	}
-	if ( mesh->HasTextureCoords( 0 ) ) {
+	int stride = 0; // in floats
+	stride += mesh->HasTextureCoords( 0 ) ? 2 : 0;
+	stride += mesh->HasNormals() ? 3 : 0;
+	stride += mesh->HasTangentsAndBitangents() ? 4 : 0;
+	if ( stride > 0 ) {
+		GLfloat *interleaved = (GLfloat *)malloc( *point_count * stride * sizeof( GLfloat ) );
+		for ( int i = 0; i < *point_count; i++ ) {
+			GLfloat *v = &interleaved[i * stride];
+			if ( texcoords ) {
+				memcpy( v, &texcoords[i * 2], 2 * sizeof( GLfloat ) );
+				v += 2;
+			}
+			if ( normals ) {
+				memcpy( v, &normals[i * 3], 3 * sizeof( GLfloat ) );
+				v += 3;
+			}
+			if ( tangents ) {
+				memcpy( v, &tangents[i * 4], 4 * sizeof( GLfloat ) );
+			}
+		}
 		GLuint vbo;
 		glGenBuffers( 1, &vbo );
 		glBindBuffer( GL_ARRAY_BUFFER, vbo );
-		glBufferData( GL_ARRAY_BUFFER, 2 * *point_count * sizeof( GLfloat ), texcoords,
-									GL_STATIC_DRAW );
-		glVertexAttribPointer( 1, 2, GL_FLOAT, GL_FALSE, 0, NULL );
-		glEnableVertexAttribArray( 1 );
+		upload_buffer_data( GL_ARRAY_BUFFER, *point_count * stride * sizeof( GLfloat ),
+											 interleaved, GL_STATIC_DRAW );
+		GLsizei stride_bytes = stride * sizeof( GLfloat );
+		size_t offset = 0;
+		if ( texcoords ) {
+			glVertexAttribPointer( 1, 2, GL_FLOAT, GL_FALSE, stride_bytes, (GLvoid *)offset );
+			glEnableVertexAttribArray( 1 );
+			offset += 2 * sizeof( GLfloat );
+		}
+		if ( normals ) {
+			glVertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, stride_bytes, (GLvoid *)offset );
+			glEnableVertexAttribArray( 2 );
+			offset += 3 * sizeof( GLfloat );
+		}
+		if ( tangents ) {
+			glVertexAttribPointer( 3, 4, GL_FLOAT, GL_FALSE, stride_bytes, (GLvoid *)offset );
+			glEnableVertexAttribArray( 3 );
+		}
+		free( interleaved );
 		free( texcoords );
-	}
-	if ( mesh->HasNormals() ) {
-		GLuint vbo;
-		glGenBuffers( 1, &vbo );
-		glBindBuffer( GL_ARRAY_BUFFER, vbo );
-		glBufferData( GL_ARRAY_BUFFER, 3 * *point_count * sizeof( GLfloat ), normals,
-									GL_STATIC_DRAW );
-		glVertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, 0, NULL );
-		glEnableVertexAttribArray( 2 );
 		free( normals );
-	}
-	if ( mesh->HasTangentsAndBitangents() )
-	{
-		GLuint tangents_vbo;
-		glGenBuffers( 1, &tangents_vbo );
-		glBindBuffer( GL_ARRAY_BUFFER, tangents_vbo );
-		glBufferData( GL_ARRAY_BUFFER, 4 * *point_count * sizeof( GLfloat ), tangents,
-									GL_STATIC_DRAW );
-		glVertexAttribPointer( 3, 4, GL_FLOAT, GL_FALSE, 0, NULL );
-		glEnableVertexAttribArray( 3 );
-		free(tangents);
+		free( tangents );
 	}
 	if ( mesh->HasBones() ) {
 		GLuint vbo;
 		glGenBuffers( 1, &vbo );
 		glBindBuffer( GL_ARRAY_BUFFER, vbo );
-		glBufferData( GL_ARRAY_BUFFER, *point_count * sizeof( GLint ), bone_ids,
-									GL_STATIC_DRAW );
+		upload_buffer_data( GL_ARRAY_BUFFER, *point_count * sizeof( GLint ), bone_ids,
+											 GL_STATIC_DRAW );
 		glVertexAttribIPointer( 3, 1, GL_INT, 0, NULL );
 		glEnableVertexAttribArray( 3 );
 		free( bone_ids );
 	}
+	GLuint ebo;
+	glGenBuffers( 1, &ebo );
+	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, ebo );
+	upload_buffer_data( GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof( GLuint ), indices,
+									 GL_STATIC_DRAW );
+	free( indices );
+
+	/* second VAO for depth-only passes that shares the position stream and the
+	indices but never touches the interleaved attributes */
+	if ( depth_vao ) {
+		glGenVertexArrays( 1, depth_vao );
+		glBindVertexArray( *depth_vao );
+		if ( points_vbo ) {
+			glBindBuffer( GL_ARRAY_BUFFER, points_vbo );
+			glVertexAttribPointer( 0, 3, points_type, GL_UNSIGNED_SHORT == points_type,
+														 0, NULL );
+			glEnableVertexAttribArray( 0 );
+		}
+		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, ebo );
+	}
+	glBindVertexArray( 0 );
+
+	/* from here on point_count is the number of indices to draw */
+	*point_count = index_count;
 
 	aiReleaseImport( scene );
 	printf( "mesh loaded\n" );
@@ -220,7 +544,12 @@ bool load_mesh( const char *file_name, GLuint *vao, int *point_count,
 }
 
 bool load_obj_file( const char *file_name, float *&points, float *&tex_coords,
-										float *&normals, int &point_count ) {
+										float *&normals, int &point_count, mesh_bounds *bounds,
+										unsigned short **quantised_points, mat4 *dequant_mat,
+										bool with_obb ) {
+	if ( bounds ) {
+		memset( (void *)bounds, 0, sizeof( mesh_bounds ) );
+	}
 
 	float *unsorted_vp_array = NULL;
 	float *unsorted_vt_array = NULL;
@@ -357,5 +686,17 @@ bool load_obj_file( const char *file_name, float *&points, float *&tex_coords,
 	free( unsorted_vn_array );
 	free( unsorted_vt_array );
 	printf( "allocated %i points\n", point_count );
+	if ( bounds && point_count > 0 ) {
+		compute_mesh_bounds( points, point_count, with_obb, bounds );
+		print_bounds( *bounds );
+	}
+	if ( quantised_points && dequant_mat ) {
+		float mn[3], mx[3];
+		compute_aabb( points, point_count, mn, mx );
+		*quantised_points =
+			(unsigned short *)malloc( point_count * 3 * sizeof( unsigned short ) );
+		quantise_positions( points, point_count, mn, mx, *quantised_points,
+												dequant_mat );
+	}
 	return true;
 }
@@ -19,11 +19,36 @@
 
 #include "GL/glew.h"     // include GLEW and new version of GL on Windows
 #include "maths_funcs.h" // my maths functions
+#include "anim_compress.h" // packed animation clips
+#include "bounds.h"			 // mesh bounding volumes
+#include "vertex_quantise.h" // 16-bit positions
 
 
+/* bounds, if given, gets the box, sphere and oriented box of the points.
+give both quantised_points and dequant_mat to also get 16-bit positions (3
+per point, free() when done) and the matrix to fold into the model matrix */
 bool load_obj_file( const char *file_name, float *&points, float *&tex_coords,
-										float *&normals, int &point_count );
+										float *&normals, int &point_count,
+										mesh_bounds *bounds = NULL,
+										unsigned short **quantised_points = NULL,
+										mat4 *dequant_mat = NULL, bool with_obb = true );
 
+/* every animation in the file is compressed and its ratio and error logged.
+pass clips and clip_count to keep the compressed clips - free each one with
+free_anim_clip() and the array with free().
+pass points to keep a CPU copy of the vertex positions in draw order, 3 floats
+per point, for things like building a BVH. free() it when done.
+bounds, if given, gets the box and sphere of the first mesh, and its oriented
+box too if with_obb is set. fitting the oriented box is the slow part.
+pass dequant_mat to opt in to 16-bit positions. the VAO then reads normalised
+unsigned shorts and the caller must draw with M * dequant_mat.
+the mesh is indexed - draw it with glDrawElements( GL_TRIANGLES, point_count,
+GL_UNSIGNED_INT, 0 ). depth_vao, if given, gets a second VAO with only the
+positions enabled, for shadow and depth pre-passes */
 bool load_mesh( const char *file_name, GLuint *vao, int *point_count,
-								mat4 *bone_offset_mats, int *bone_count );
+								mat4 *bone_offset_mats, int *bone_count,
+								anim_clip **clips = NULL, int *clip_count = NULL,
+								float **points = NULL, mesh_bounds *bounds = NULL,
+								mat4 *dequant_mat = NULL, GLuint *depth_vao = NULL,
+								bool with_obb = true );
 #endif
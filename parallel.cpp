@@ -0,0 +1,102 @@
+/******************************************************************************\
+| Tiny worker thread pool - see parallel.h                                     |
+\******************************************************************************/
+#include "parallel.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* one loop at a time is shared out. workers sleep on the condition variable
+until a new generation of work is posted */
+struct parallel_pool {
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::mutex busy; // held by whoever is running a loop on the pool
+	std::condition_variable wake;
+	std::condition_variable finished;
+	unsigned long generation;
+	void ( *fn )( int, void * );
+	void *user;
+	int count;
+	std::atomic<int> next;
+	int active; // workers still inside the current loop
+};
+
+static thread_local bool g_is_worker = false;
+
+static void run_loop( parallel_pool *pool ) {
+	for ( int i = pool->next++; i < pool->count; i = pool->next++ ) {
+		pool->fn( i, pool->user );
+	}
+}
+
+static void worker_main( parallel_pool *pool ) {
+	g_is_worker = true;
+	unsigned long seen = 0;
+	while ( true ) {
+		{
+			std::unique_lock<std::mutex> lock( pool->mutex );
+			while ( pool->generation == seen ) {
+				pool->wake.wait( lock );
+			}
+			seen = pool->generation;
+		}
+		run_loop( pool );
+		std::lock_guard<std::mutex> lock( pool->mutex );
+		if ( 0 == --pool->active ) {
+			pool->finished.notify_one();
+		}
+	}
+}
+
+static parallel_pool *start_pool() {
+	// deliberately leaked - workers are parked forever and die with the process
+	parallel_pool *pool = new parallel_pool;
+	pool->generation = 0;
+	pool->active = 0;
+	pool->count = 0;
+	int n = (int)std::thread::hardware_concurrency() - 1;
+	for ( int i = 0; i < n; i++ ) {
+		pool->threads.push_back( std::thread( worker_main, pool ) );
+		pool->threads.back().detach();
+	}
+	return pool;
+}
+
+static parallel_pool *get_pool() {
+	static parallel_pool *pool = start_pool(); // thread-safe since C++11
+	return pool;
+}
+
+int parallel_thread_count() { return (int)get_pool()->threads.size() + 1; }
+
+void parallel_for( int count, void ( *fn )( int i, void *user ), void *user ) {
+	parallel_pool *pool = get_pool();
+	if ( count <= 1 || g_is_worker || pool->threads.empty() ||
+			 !pool->busy.try_lock() ) {
+		for ( int i = 0; i < count; i++ ) {
+			fn( i, user );
+		}
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock( pool->mutex );
+		pool->fn = fn;
+		pool->user = user;
+		pool->count = count;
+		pool->next = 0;
+		pool->active = (int)pool->threads.size();
+		pool->generation++;
+	}
+	pool->wake.notify_all();
+	run_loop( pool );
+	{
+		std::unique_lock<std::mutex> lock( pool->mutex );
+		while ( pool->active > 0 ) {
+			pool->finished.wait( lock );
+		}
+	}
+	pool->busy.unlock();
+}
@@ -0,0 +1,15 @@
+/******************************************************************************\
+| Tiny worker thread pool                                                      |
+| parallel_for() splits a loop over the pool's threads and the calling thread, |
+| and returns when every iteration is done. The threads are started the first  |
+| time it's used and live until the program exits. Calls from inside a worker, |
+| or while another thread's loop is running, just run the loop in place.       |
+\******************************************************************************/
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+/* call fn( i, user ) for every i in [0, count) across the pool */
+void parallel_for( int count, void ( *fn )( int i, void *user ), void *user );
+/* number of threads that parallel_for() spreads work over, caller included */
+int parallel_thread_count();
+#endif
@@ -0,0 +1,282 @@
+/******************************************************************************\
+| Render queue - see render_queue.h                                            |
+\******************************************************************************/
+#include "render_queue.h"
+#include "gl_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PASS_BITS 3
+#define PROGRAMME_BITS 10
+#define MATERIAL_BITS 14
+#define VAO_BITS 13
+#define DEPTH_BITS 24
+#define PASS_SHIFT ( 64 - PASS_BITS )
+#define MASK( bits ) ( ( 1ULL << ( bits ) ) - 1 )
+
+bool init_render_queue( render_queue *rq, int max_items, float depth_range ) {
+	memset( rq, 0, sizeof( render_queue ) );
+	rq->items = (draw_item *)malloc( max_items * sizeof( draw_item ) );
+	rq->keys = (unsigned long long *)malloc( max_items * sizeof( unsigned long long ) );
+	rq->order = (int *)malloc( max_items * sizeof( int ) );
+	rq->sort_keys = (unsigned long long *)malloc( max_items * sizeof( unsigned long long ) );
+	rq->sort_order = (int *)malloc( max_items * sizeof( int ) );
+	rq->programmes = (GLuint *)malloc( max_items * sizeof( GLuint ) );
+	rq->material_items = (int *)malloc( max_items * sizeof( int ) );
+	rq->vaos = (GLuint *)malloc( max_items * sizeof( GLuint ) );
+	if ( !rq->items || !rq->keys || !rq->order || !rq->sort_keys || !rq->sort_order ||
+			 !rq->programmes || !rq->material_items || !rq->vaos ) {
+		gl_log_err( "ERROR: out of memory for a render queue of %i items\n", max_items );
+		free_render_queue( rq );
+		return false;
+	}
+	rq->max_items = max_items;
+	rq->depth_range = depth_range;
+	return true;
+}
+
+void begin_render_queue( render_queue *rq ) {
+	rq->count = 0;
+	rq->programme_count = rq->material_count = rq->vao_count = 0;
+}
+
+/*-------------------------------------KEYS-----------------------------------*/
+/* the id of name in the list, adding it if it's new. ids past what the key
+field holds share its last value - still correct, just sorted less well */
+static unsigned long long name_id( GLuint *names, int *count, GLuint name, int bits ) {
+	int i = 0;
+	for ( ; i < *count; i++ ) {
+		if ( names[i] == name ) {
+			break;
+		}
+	}
+	if ( i == *count ) {
+		names[( *count )++] = name;
+	}
+	return i < (int)MASK( bits ) ? (unsigned long long)i : MASK( bits );
+}
+
+static bool same_textures( const draw_item *a, const draw_item *b ) {
+	return a->texture_count == b->texture_count &&
+				 0 == memcmp( a->textures, b->textures, a->texture_count * sizeof( render_texture ) );
+}
+
+static unsigned long long material_id( render_queue *rq, const draw_item *item ) {
+	int i = 0;
+	for ( ; i < rq->material_count; i++ ) {
+		if ( same_textures( &rq->items[rq->material_items[i]], item ) ) {
+			break;
+		}
+	}
+	if ( i == rq->material_count ) {
+		rq->material_items[rq->material_count++] = (int)( item - rq->items );
+	}
+	return i < (int)MASK( MATERIAL_BITS ) ? (unsigned long long)i : MASK( MATERIAL_BITS );
+}
+
+static unsigned long long make_key( render_queue *rq, const draw_item *item ) {
+	float d = rq->depth_range > 0.0f ? item->depth / rq->depth_range : 0.0f;
+	d = d < 0.0f ? 0.0f : ( d > 1.0f ? 1.0f : d );
+	unsigned long long depth = (unsigned long long)( d * (float)MASK( DEPTH_BITS ) );
+	unsigned long long programme =
+		name_id( rq->programmes, &rq->programme_count, item->programme, PROGRAMME_BITS );
+	unsigned long long material = material_id( rq, item );
+	unsigned long long vao = name_id( rq->vaos, &rq->vao_count, item->vao, VAO_BITS );
+	unsigned long long key = (unsigned long long)item->pass << PASS_SHIFT;
+	if ( RENDER_PASS_TRANSPARENT == item->pass ) {
+		/* blending needs far to near before anything else */
+		key |= ( MASK( DEPTH_BITS ) - depth ) << ( PASS_SHIFT - DEPTH_BITS );
+		key |= programme << ( MATERIAL_BITS + VAO_BITS );
+		key |= material << VAO_BITS;
+		key |= vao;
+	} else {
+		/* state first. depth last, near to far, so the depth test rejects more */
+		key |= programme << ( MATERIAL_BITS + VAO_BITS + DEPTH_BITS );
+		key |= material << ( VAO_BITS + DEPTH_BITS );
+		key |= vao << DEPTH_BITS;
+		key |= depth;
+	}
+	return key;
+}
+
+bool submit_draw( render_queue *rq, const draw_item *item ) {
+	if ( rq->count >= rq->max_items ) {
+		gl_log_err( "ERROR: render queue is full at %i items\n", rq->max_items );
+		return false;
+	}
+	int i = rq->count++;
+	rq->items[i] = *item;
+	rq->keys[i] = make_key( rq, &rq->items[i] );
+	rq->order[i] = i;
+	return true;
+}
+
+/*-------------------------------------SORT-----------------------------------*/
+/* least significant byte first, 8 passes of a counting sort, each stable. a
+byte that is the same in every key is skipped, which with few distinct
+states is most of them */
+static void radix_sort( render_queue *rq ) {
+	unsigned long long *keys = rq->keys, *tmp_keys = rq->sort_keys;
+	int *order = rq->order, *tmp_order = rq->sort_order;
+	for ( int shift = 0; shift < 64; shift += 8 ) {
+		int counts[256];
+		memset( counts, 0, sizeof( counts ) );
+		for ( int i = 0; i < rq->count; i++ ) {
+			counts[( keys[i] >> shift ) & 0xFF]++;
+		}
+		if ( rq->count == counts[( keys[0] >> shift ) & 0xFF] ) {
+			continue;
+		}
+		int offset = 0;
+		for ( int b = 0; b < 256; b++ ) {
+			int c = counts[b];
+			counts[b] = offset;
+			offset += c;
+		}
+		for ( int i = 0; i < rq->count; i++ ) {
+			int dst = counts[( keys[i] >> shift ) & 0xFF]++;
+			tmp_keys[dst] = keys[i];
+			tmp_order[dst] = order[i];
+		}
+		unsigned long long *k = keys;
+		keys = tmp_keys;
+		tmp_keys = k;
+		int *o = order;
+		order = tmp_order;
+		tmp_order = o;
+	}
+	/* an odd number of passes leaves the result in the scratch arrays */
+	if ( keys != rq->keys ) {
+		memcpy( rq->keys, keys, rq->count * sizeof( unsigned long long ) );
+		memcpy( rq->order, order, rq->count * sizeof( int ) );
+	}
+}
+
+/*------------------------------------EXECUTE---------------------------------*/
+static void set_pass_state( render_pass pass ) {
+	switch ( pass ) {
+	case RENDER_PASS_SKY:
+		glDepthMask( GL_FALSE );
+		glDisable( GL_BLEND );
+		break;
+	case RENDER_PASS_OPAQUE:
+		glDepthMask( GL_TRUE );
+		glDisable( GL_BLEND );
+		break;
+	case RENDER_PASS_TRANSPARENT:
+		glDepthMask( GL_FALSE );
+		glEnable( GL_BLEND );
+		glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+		break;
+	}
+}
+
+void execute_render_queue( render_queue *rq ) {
+	memset( &rq->frame, 0, sizeof( render_stats ) );
+	if ( rq->count > 0 ) {
+		radix_sort( rq );
+	}
+
+	/* what this frame has set. other code binds things between frames, so
+	nothing is assumed from the last one */
+	int pass = -1;
+	GLuint programme = 0, vao = 0;
+	bool programme_set = false, vao_set = false;
+	GLenum unit_targets[RENDER_QUEUE_MAX_UNITS];
+	GLuint unit_textures[RENDER_QUEUE_MAX_UNITS];
+	memset( unit_targets, 0, sizeof( unit_targets ) );
+	memset( unit_textures, 0, sizeof( unit_textures ) );
+	GLuint active_unit = RENDER_QUEUE_MAX_UNITS;
+	render_stats *st = &rq->frame;
+
+	for ( int i = 0; i < rq->count; i++ ) {
+		const draw_item *item = &rq->items[rq->order[i]];
+		if ( item->pass != pass ) {
+			pass = item->pass;
+			set_pass_state( item->pass );
+			st->state_changes++;
+		}
+		if ( !programme_set || item->programme != programme ) {
+			glUseProgram( item->programme );
+			programme = item->programme;
+			programme_set = true;
+			st->state_changes++;
+		} else {
+			st->skipped_changes++;
+		}
+		for ( int t = 0; t < item->texture_count; t++ ) {
+			const render_texture *rt = &item->textures[t];
+			if ( rt->unit < RENDER_QUEUE_MAX_UNITS && unit_targets[rt->unit] == rt->target &&
+					 unit_textures[rt->unit] == rt->tex ) {
+				st->skipped_changes++;
+				continue;
+			}
+			if ( rt->unit != active_unit ) {
+				glActiveTexture( GL_TEXTURE0 + rt->unit );
+				active_unit = rt->unit;
+			}
+			glBindTexture( rt->target, rt->tex );
+			if ( rt->unit < RENDER_QUEUE_MAX_UNITS ) {
+				unit_targets[rt->unit] = rt->target;
+				unit_textures[rt->unit] = rt->tex;
+			}
+			st->state_changes++;
+		}
+		if ( !vao_set || item->vao != vao ) {
+			glBindVertexArray( item->vao );
+			vao = item->vao;
+			vao_set = true;
+			st->state_changes++;
+		} else {
+			st->skipped_changes++;
+		}
+		if ( item->set_uniforms ) {
+			item->set_uniforms( item->user );
+		}
+		if ( item->instances > 0 ) {
+			if ( item->index_type ) {
+				glDrawElementsInstanced( item->mode, item->count, item->index_type, NULL,
+																 item->instances );
+			} else {
+				glDrawArraysInstanced( item->mode, 0, item->count, item->instances );
+			}
+		} else if ( item->index_type ) {
+			glDrawElements( item->mode, item->count, item->index_type, NULL );
+		} else {
+			glDrawArrays( item->mode, 0, item->count );
+		}
+		st->draws++;
+	}
+	if ( pass != RENDER_PASS_OPAQUE ) {
+		set_pass_state( RENDER_PASS_OPAQUE );
+	}
+
+	rq->total_draws += st->draws;
+	rq->total_changes += st->state_changes;
+	rq->total_skipped += st->skipped_changes;
+	rq->frames++;
+}
+
+void log_render_stats( const render_queue *rq ) {
+	if ( rq->frames < 1 ) {
+		return;
+	}
+	double frames = (double)rq->frames;
+	gl_log( "render queue: %.1f draws, %.1f state changes and %.1f skipped per frame over %i "
+					"frames\n",
+					rq->total_draws / frames, rq->total_changes / frames, rq->total_skipped / frames,
+					rq->frames );
+}
+
+void free_render_queue( render_queue *rq ) {
+	free( rq->items );
+	free( rq->keys );
+	free( rq->order );
+	free( rq->sort_keys );
+	free( rq->sort_order );
+	free( rq->programmes );
+	free( rq->material_items );
+	free( rq->vaos );
+	memset( rq, 0, sizeof( render_queue ) );
+}
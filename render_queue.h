@@ -0,0 +1,89 @@
+/******************************************************************************\
+| Render queue                                                                 |
+| Draws are submitted as draw_items during the frame, in any order, and        |
+| executed together at the end. Each item gets a 64-bit key, and the keys are  |
+| radix sorted so that items sharing state end up next to each other:          |
+|   opaque       pass:3 | programme:10 | material:14 | vao:13 | depth:24       |
+|   transparent  pass:3 | far-to-near depth:24 | programme:10 | ...            |
+| The programme, material (the set of textures) and VAO fields are small ids   |
+| handed out in order of first use each frame, not GL names, so they fit.      |
+|******************************************************************************|
+| Executing keeps a copy of the state it has set, and only calls GL for what   |
+| differs from the item before. The number of state changes then follows the   |
+| number of distinct states, not objects, and the ones that weren't needed     |
+| are counted in render_stats::skipped_changes.                                |
+\******************************************************************************/
+#ifndef _RENDER_QUEUE_H_
+#define _RENDER_QUEUE_H_
+#include <GL/glew.h>
+
+#define RENDER_ITEM_MAX_TEXTURES 8
+#define RENDER_QUEUE_MAX_UNITS 32
+
+/* executed in this order. the sky draws first without writing depth, and
+transparent items draw last, blended */
+enum render_pass { RENDER_PASS_SKY = 0, RENDER_PASS_OPAQUE, RENDER_PASS_TRANSPARENT };
+
+struct render_texture {
+	GLuint unit; // 0 is GL_TEXTURE0
+	GLenum target;
+	GLuint tex;
+};
+
+struct draw_item {
+	render_pass pass;
+	GLuint programme;
+	GLuint vao;
+	render_texture textures[RENDER_ITEM_MAX_TEXTURES];
+	int texture_count;
+	GLenum mode; // GL_TRIANGLES etc
+	GLsizei count;
+	GLenum index_type; // 0 for glDrawArrays()
+	GLsizei instances; // copies drawn with one instanced call. 0 for a plain draw
+	float depth;			 // distance from the camera. orders items within a pass
+	/* the item's own uniforms, set after its program is in use. may be NULL */
+	void ( *set_uniforms )( const void *user );
+	const void *user; // must last until the queue is executed
+};
+
+struct render_stats {
+	int draws;
+	int state_changes;	 // GL calls made for programs, textures, VAOs and passes
+	int skipped_changes; // binds left out because that state was already set
+};
+
+struct render_queue {
+	draw_item *items;
+	unsigned long long *keys;
+	int *order; // item indices, sorted by key
+	unsigned long long *sort_keys; // radix sort scratch
+	int *sort_order;
+	int count, max_items;
+	float depth_range; // depths are quantised over [0, depth_range]
+
+	/* state ids for the keys, in order of first use this frame */
+	GLuint *programmes;
+	int programme_count;
+	int *material_items; // an item with each distinct texture set
+	int material_count;
+	GLuint *vaos;
+	int vao_count;
+
+	render_stats frame; // the last frame executed
+	long long total_draws, total_changes, total_skipped;
+	int frames;
+};
+
+/* depth_range is the far clipping distance */
+bool init_render_queue( render_queue *rq, int max_items, float depth_range );
+/* empty the queue for a new frame */
+void begin_render_queue( render_queue *rq );
+/* copies the item. false if the queue is full */
+bool submit_draw( render_queue *rq, const draw_item *item );
+/* sort and draw everything submitted since begin_render_queue(). leaves depth
+writes on and blending off */
+void execute_render_queue( render_queue *rq );
+/* average state changes per frame, made and skipped */
+void log_render_stats( const render_queue *rq );
+void free_render_queue( render_queue *rq );
+#endif
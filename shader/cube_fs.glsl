@@ -1,5 +1,3 @@
-#version 410
-
 in vec3 texcoords;
 uniform samplerCube cube_texture;
 out vec4 frag_colour;
@@ -1,10 +1,9 @@
-#version 410
-
 in vec3 vp;
-uniform mat4 P, V;
+#include "frame_uniforms.glsl"
 out vec3 texcoords;
 
 void main () {
 	texcoords = vp;
-	gl_Position = P * V * vec4 (vp, 1.0);
+	// the sky is infinitely far away, so it only turns with the camera
+	gl_Position = P * mat4 (mat3 (V)) * vec4 (vp, 1.0);
 }
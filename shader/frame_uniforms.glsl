@@ -0,0 +1,9 @@
+// the same for every program during a frame. uploaded once a frame and bound
+// at FRAME_UNIFORMS_BINDING - see uniforms.h, whose frame_uniforms must match
+layout (std140) uniform frame_uniforms {
+	mat4 V;
+	mat4 P;
+	mat4 VP; // P * V
+	vec4 cam_pos_wor;
+	float time;
+};
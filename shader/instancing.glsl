@@ -0,0 +1,34 @@
+// INSTANCED - one copy of the mesh per instance, placed by the per-instance
+// attributes under M. see instancing.h, whose locations these must match.
+// without it instance_matrix() is the identity, so one shader serves both
+#ifdef INSTANCED
+layout(location = 4) in vec4 instance_pos_scale; // world position, uniform scale
+layout(location = 5) in vec4 instance_rot; // unit quaternion, w last
+
+mat3 quat_to_mat3 (vec4 q) {
+	vec3 q2 = q.xyz * 2.0;
+	vec3 xx = q.xyz * q2; // x*2x, y*2y, z*2z
+	float xy = q.x * q2.y, xz = q.x * q2.z, yz = q.y * q2.z;
+	vec3 w = q.w * q2;
+	return mat3 (
+		1.0 - xx.y - xx.z, xy + w.z, xz - w.y,
+		xy - w.z, 1.0 - xx.x - xx.z, yz + w.x,
+		xz + w.y, yz - w.x, 1.0 - xx.x - xx.y
+	);
+}
+
+// this copy's transform, to go in front of M
+mat4 instance_matrix () {
+	mat3 rs = quat_to_mat3 (instance_rot) * instance_pos_scale.w;
+	return mat4 (
+		vec4 (rs[0], 0.0),
+		vec4 (rs[1], 0.0),
+		vec4 (rs[2], 0.0),
+		vec4 (instance_pos_scale.xyz, 1.0)
+	);
+}
+#else
+mat4 instance_matrix () {
+	return mat4 (1.0);
+}
+#endif
@@ -1,51 +1,65 @@
-/* NOTE: this shader is for GLSL 4.2.0 (OpenGL 4.2)
-to convert it to an earlier version, you'll need to remove
-layout (binding = x) for each texture, and instead explicitly
-set glUniform1i() for each texture in C with these values */
-
-//#version 420
-#version 410
+/* material features are variant defines. see shader_build.h
+NORMAL_MAP   - perturb the normal with normal_map. flat without it
+SPECULAR_MAP - specular colour from specular_map. no highlight without it */
 
 in vec2 st;
 in vec3 view_dir_tan;
 in vec3 light_dir_tan;
+in mat3 tan_to_wor;
 
-uniform sampler2D diffuse_map;
-uniform sampler2D specular_map;
-uniform sampler2D normal_map;
-uniform sampler2D emission_map;
-
-uniform mat4 view;
+// every material's maps, packed into texture arrays. see material_pack.h
+uniform sampler2DArray material_arrays[4];
+// which array (x) and layer (y) each map is in
+uniform ivec2 diffuse_map;
+#ifdef SPECULAR_MAP
+uniform ivec2 specular_map;
+#endif
+#ifdef NORMAL_MAP
+uniform ivec2 normal_map;
+#endif
 
 out vec4 frag_colour;
 
 vec3 light_position_world = vec3 (1.0, 1.0, 10.0);
 vec3 Ls = vec3 (1.0, 1.0, 1.0); // white specular colour
 vec3 Ld = vec3 (0.7, 0.7, 0.7); // dull white diffuse light colour
-vec3 La = vec3 (0.2, 0.2, 0.2); // grey ambient colour
 float specular_exponent = 100.0; // specular 'power'
 
+#include "sh_irradiance.glsl"
+
 void main() {
-	vec3 Ia = vec3 (0.0, 0.0, 0.0);
-	
-	// sample the normal map and covert from 0:1 range to -1:1 range
-	vec3 normal_tan = texture (normal_map, st).rgb;
-	normal_tan = normalize (normal_tan * 2.0 - 1.0);
+#ifdef NORMAL_MAP
+	// sample the normal map and covert from 0:1 range to -1:1 range. the map is
+	// BC5 so only x and y are stored - rebuild z from the unit length
+	vec3 normal_tan;
+	normal_tan.xy = texture (material_arrays[normal_map.x], vec3 (st, normal_map.y)).rg * 2.0 - 1.0;
+	normal_tan.z = sqrt (max (0.0, 1.0 - dot (normal_tan.xy, normal_tan.xy)));
+	normal_tan = normalize (normal_tan);
+#else
+	vec3 normal_tan = vec3 (0.0, 0.0, 1.0);
+#endif
 
 	// diffuse light equation done in tangent space
 	vec3 direction_to_light_tan = normalize (-light_dir_tan);
 	float dot_prod = dot (direction_to_light_tan, normal_tan);
 	dot_prod = max (dot_prod, 0.0);
-	vec4 texel = texture (diffuse_map, st);
+	vec4 texel = texture (material_arrays[diffuse_map.x], vec3 (st, diffuse_map.y));
 	vec3 Id =  vec3 (1, 1, 1) * texel.rgb * dot_prod;
 
+	// ambient light from the sky in the direction the surface faces
+	vec3 Ia = texel.rgb * sh_irradiance (normalize (tan_to_wor * normal_tan));
+
+#ifdef SPECULAR_MAP
 	// specular light equation done in tangent space
 	vec3 reflection_tan = reflect (normalize (light_dir_tan), normal_tan);
 	float dot_prod_specular = dot (reflection_tan, normalize (view_dir_tan));
 	dot_prod_specular = max (dot_prod_specular, 0.0);
 	float specular_factor = pow (dot_prod_specular, 1.0);
-	vec3 Ks = texture (specular_map, st).rgb;
+	vec3 Ks = texture (material_arrays[specular_map.x], vec3 (st, specular_map.y)).rgb;
 	vec3 Is = vec3 (1.0, 1.0, 1.0) * Ks * specular_factor;
+#else
+	vec3 Is = vec3 (0.0);
+#endif
 
 // phong light output
 	frag_colour.rgb = Is + Id + Ia;
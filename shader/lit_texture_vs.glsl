@@ -1,16 +1,10 @@
-/* NOTE: this shader is for GLSL 4.2.0 (OpenGL 4.2)
- to convert it to an earlier version, for example on Apple, you'll need to
- remove layout (binding = x) for each texture, and instead explicitly
- set glUniform1i() for each texture in C with these values */
-
-#version 420
-//#version 410
-
 layout(location = 0) in vec3 vertex_position;
 layout(location = 1) in vec2 texture_coord;
 layout(location = 2) in vec3 vertex_normal;
 
-uniform mat4 M, V, P;
+#include "frame_uniforms.glsl"
+#include "instancing.glsl"
+uniform mat4 M;
 
 out vec3 pos_eye;
 out vec3 norm_eye; // positions and normals in eye space
@@ -18,7 +12,8 @@ out vec2 st; // texture coordinates passed through from from vertex shader
 
 void main() {
 	st = texture_coord;
-	norm_eye = (V * M * vec4 (vertex_normal, 0.0)).xyz;;
-	pos_eye = (V * M * vec4 (vertex_position, 1.0)).xyz;
+	mat4 model = instance_matrix () * M;
+	norm_eye = (V * model * vec4 (vertex_normal, 0.0)).xyz;;
+	pos_eye = (V * model * vec4 (vertex_position, 1.0)).xyz;
 	gl_Position = P * vec4 (pos_eye, 1.0);
 }
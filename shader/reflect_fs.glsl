@@ -1,9 +1,9 @@
-#version 410
-
 in vec3 pos_eye;
 in vec3 n_eye;
-uniform samplerCube cube_texture;
-uniform mat4 V; // view matrix
+uniform samplerCube cube_texture; // GGX prefiltered - one roughness per mip
+uniform float roughness; // 0 is a mirror, 1 fully rough
+uniform float env_max_lod; // the fully rough level
+#include "frame_uniforms.glsl"
 out vec4 frag_colour;
 
 void main () {
@@ -15,5 +15,5 @@ void main () {
 	// convert from eye to world space
 	reflected = vec3 (inverse (V) * vec4 (reflected, 0.0));
 
-	frag_colour = texture (cube_texture, reflected);
+	frag_colour = textureLod (cube_texture, reflected, roughness * env_max_lod);
 }
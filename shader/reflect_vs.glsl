@@ -1,13 +1,14 @@
-#version 410
-
 layout(location = 0) in vec3 vp; // positions from mesh
 layout(location = 1) in vec3 vn; // normals from mesh
-uniform mat4 P, V, M; // proj, view, model matrices
+#include "frame_uniforms.glsl"
+#include "instancing.glsl"
+uniform mat4 M; // model matrix
 out vec3 pos_eye;
 out vec3 n_eye;
 
 void main () {
-	pos_eye = vec3 (V * M * vec4 (vp, 1.0));
-	n_eye = vec3 (V * M * vec4 (vn, 0.0));
-	gl_Position = P * V * M * vec4 (vp, 1.0);
+	mat4 model = instance_matrix () * M;
+	pos_eye = vec3 (V * model * vec4 (vp, 1.0));
+	n_eye = vec3 (V * model * vec4 (vn, 0.0));
+	gl_Position = VP * model * vec4 (vp, 1.0);
 }
@@ -0,0 +1,11 @@
+/* diffuse ambient from the sky-box's 9 spherical-harmonic coefficients, already
+convolved and divided by pi on the CPU. see env_prefilter.h */
+uniform vec3 sh_coeffs[9];
+
+vec3 sh_irradiance (vec3 n) {
+	return sh_coeffs[0] +
+		sh_coeffs[1] * n.y + sh_coeffs[2] * n.z + sh_coeffs[3] * n.x +
+		sh_coeffs[4] * (n.x * n.y) + sh_coeffs[5] * (n.y * n.z) +
+		sh_coeffs[6] * (3.0 * n.z * n.z - 1.0) + sh_coeffs[7] * (n.x * n.z) +
+		sh_coeffs[8] * (n.x * n.x - n.y * n.y);
+}
@@ -1,5 +1,3 @@
-#version 410
-
 in vec2 texture_coordinates;
 uniform sampler2D diffuse_map;
 out vec4 frag_colour;
@@ -0,0 +1,475 @@
+/******************************************************************************\
+| Shader build step: preprocessing and variants - see shader_build.h           |
+\******************************************************************************/
+#include "shader_build.h"
+#include "gl_utils.h"
+#include "image_cache.h" // fnv1a64
+#include "shader_cache.h"
+#include "shader_reload.h"
+#include "uniforms.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SHADER_MAX_INCLUDE_DEPTH 8
+
+/*----------------------------------PREPROCESS--------------------------------*/
+/* grows by doubling, so appending is linear overall */
+struct text_buffer {
+	char *data;
+	size_t length;
+	size_t capacity;
+};
+
+static bool append( text_buffer *tb, const char *str, size_t n ) {
+	if ( tb->length + n + 1 > tb->capacity ) {
+		size_t capacity = tb->capacity ? tb->capacity : 4096;
+		while ( tb->length + n + 1 > capacity ) {
+			capacity *= 2;
+		}
+		char *data = (char *)realloc( tb->data, capacity );
+		if ( !data ) {
+			return false;
+		}
+		tb->data = data;
+		tb->capacity = capacity;
+	}
+	memcpy( tb->data + tb->length, str, n );
+	tb->length += n;
+	tb->data[tb->length] = '\0';
+	return true;
+}
+
+static bool append_str( text_buffer *tb, const char *str ) {
+	return append( tb, str, strlen( str ) );
+}
+
+/* the whole file, nul-terminated. NULL if it can't be read */
+static char *read_text_file( const char *file_name ) {
+	FILE *file = fopen( file_name, "rb" );
+	if ( !file ) {
+		return NULL;
+	}
+	fseek( file, 0, SEEK_END );
+	long size = ftell( file );
+	fseek( file, 0, SEEK_SET );
+	char *text = size >= 0 ? (char *)malloc( size + 1 ) : NULL;
+	if ( text && (size_t)size != fread( text, 1, size, file ) ) {
+		free( text );
+		text = NULL;
+	}
+	fclose( file );
+	if ( text ) {
+		text[size] = '\0';
+	}
+	return text;
+}
+
+/* if line is the directive, a pointer to what follows it */
+static const char *directive( const char *line, const char *name ) {
+	while ( ' ' == *line || '\t' == *line ) {
+		line++;
+	}
+	if ( '#' != *line ) {
+		return NULL;
+	}
+	line++;
+	while ( ' ' == *line || '\t' == *line ) {
+		line++;
+	}
+	size_t n = strlen( name );
+	if ( 0 != strncmp( line, name, n ) || ( ' ' != line[n] && '\t' != line[n] &&
+																					 '"' != line[n] && '\n' != line[n] &&
+																					 '\r' != line[n] && '\0' != line[n] ) ) {
+		return NULL;
+	}
+	return line + n;
+}
+
+static int find_file( const shader_source *src, const char *path ) {
+	for ( int i = 0; i < src->file_count; i++ ) {
+		if ( 0 == strcmp( src->files[i], path ) ) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static bool expand_file( const char *file_name, int depth, shader_source *src,
+												 text_buffer *out );
+
+/* the path of an #include "name" inside including_file, relative to it */
+static bool include_path( const char *including_file, const char *args, char *path ) {
+	const char *open = strchr( args, '"' );
+	const char *close = open ? strchr( open + 1, '"' ) : NULL;
+	if ( !close ) {
+		return false;
+	}
+	const char *slash = strrchr( including_file, '/' );
+	int dir_len = slash ? (int)( slash - including_file ) + 1 : 0;
+	int name_len = (int)( close - open - 1 );
+	if ( dir_len + name_len >= SHADER_MAX_PATH ) {
+		return false;
+	}
+	memcpy( path, including_file, dir_len );
+	memcpy( path + dir_len, open + 1, name_len );
+	path[dir_len + name_len] = '\0';
+	return true;
+}
+
+static bool expand_file( const char *file_name, int depth, shader_source *src,
+												 text_buffer *out ) {
+	if ( src->file_count >= SHADER_MAX_FILES ) {
+		gl_log_err( "ERROR: too many shader files included, at %s\n", file_name );
+		return false;
+	}
+	char *text = read_text_file( file_name );
+	if ( !text ) {
+		gl_log_err( "ERROR: opening file for reading: %s\n", file_name );
+		return false;
+	}
+	int index = src->file_count++;
+	snprintf( src->files[index], SHADER_MAX_PATH, "%s", file_name );
+	char line_directive[64];
+	snprintf( line_directive, sizeof( line_directive ), "#line 1 %i\n", index );
+	bool ok = append_str( out, line_directive );
+
+	int line_number = 1;
+	for ( const char *line = text; ok && *line; line_number++ ) {
+		const char *end = strchr( line, '\n' );
+		const char *next = end ? end + 1 : line + strlen( line );
+		const char *args;
+		if ( directive( line, "version" ) ) {
+			ok = append_str( out, "\n" ); // SHADER_GLSL_VERSION is already at the top
+		} else if ( ( args = directive( line, "include" ) ) ) {
+			char path[SHADER_MAX_PATH];
+			if ( !include_path( file_name, args, path ) ) {
+				gl_log_err( "ERROR: bad #include in %s line %i\n", file_name, line_number );
+				ok = false;
+			} else if ( depth >= SHADER_MAX_INCLUDE_DEPTH ) {
+				gl_log_err( "ERROR: #includes nested too deep in %s line %i\n", file_name,
+										line_number );
+				ok = false;
+			} else if ( find_file( src, path ) < 0 ) {
+				ok = expand_file( path, depth + 1, src, out );
+				/* back to where we were */
+				snprintf( line_directive, sizeof( line_directive ), "#line %i %i\n",
+									line_number + 1, index );
+				ok = ok && append_str( out, line_directive );
+			} else {
+				ok = append_str( out, "\n" ); // already in. once is enough
+			}
+		} else {
+			ok = append( out, line, next - line );
+			if ( ok && !end ) {
+				ok = append_str( out, "\n" );
+			}
+		}
+		line = next;
+	}
+	free( text );
+	return ok;
+}
+
+/* one #define per key of "A B=1 C" */
+static bool append_defines( const char *defines, text_buffer *out ) {
+	bool ok = true;
+	const char *p = defines;
+	while ( ok && p && *p ) {
+		while ( ' ' == *p ) {
+			p++;
+		}
+		size_t len = strcspn( p, " " );
+		if ( 0 == len ) {
+			break;
+		}
+		const char *equals = (const char *)memchr( p, '=', len );
+		ok = append_str( out, "#define " );
+		if ( equals ) {
+			ok = ok && append( out, p, equals - p ) && append_str( out, " " ) &&
+					 append( out, equals + 1, len - ( equals - p ) - 1 );
+		} else {
+			ok = ok && append( out, p, len );
+		}
+		ok = ok && append_str( out, "\n" );
+		p += len;
+	}
+	return ok;
+}
+
+bool preprocess_shader( const char *file_name, const char *defines, shader_source *src ) {
+	memset( src, 0, sizeof( shader_source ) );
+	text_buffer out;
+	memset( &out, 0, sizeof( out ) );
+	bool ok = append_str( &out, "#version " SHADER_GLSL_VERSION "\n" ) &&
+						append_defines( defines, &out ) && expand_file( file_name, 0, src, &out );
+	if ( !ok ) {
+		free( out.data );
+		return false;
+	}
+	src->text = out.data;
+	src->length = out.length;
+	return true;
+}
+
+void free_shader_source( shader_source *src ) {
+	free( src->text );
+	src->text = NULL;
+	src->length = 0;
+}
+
+/*-------------------------------------BUILD----------------------------------*/
+typedef void( GLAPIENTRY *max_compiler_threads_fn )( GLuint count );
+
+bool enable_parallel_shader_compile() {
+	static int enabled = -1;
+	if ( enabled < 0 ) {
+		/* let the driver compile on as many threads as it likes */
+		max_compiler_threads_fn max_threads = NULL;
+		if ( glfwExtensionSupported( "GL_KHR_parallel_shader_compile" ) ) {
+			max_threads =
+				(max_compiler_threads_fn)glfwGetProcAddress( "glMaxShaderCompilerThreadsKHR" );
+		} else if ( GLEW_ARB_parallel_shader_compile ) {
+			max_threads = (max_compiler_threads_fn)glMaxShaderCompilerThreadsARB;
+		}
+		if ( max_threads ) {
+			max_threads( 0xFFFFFFFF );
+		}
+		enabled = max_threads ? 1 : 0;
+	}
+	return 1 == enabled;
+}
+
+/* one program of a batch, between submitting it and collecting it */
+struct pending_build {
+	shader_source vert_src, frag_src; // text freed once submitted. files kept for errors
+	unsigned long long key;
+	GLuint vert, frag;
+	bool pending;
+};
+
+/* submit compiling and linking without asking for any status, or take it from
+the cache. false if the files didn't preprocess */
+static bool submit_build( programme_request *req, pending_build *pb ) {
+	if ( !preprocess_shader( req->vert_file, req->defines, &pb->vert_src ) ) {
+		return false;
+	}
+	if ( !preprocess_shader( req->frag_file, req->defines, &pb->frag_src ) ) {
+		free_shader_source( &pb->vert_src );
+		return false;
+	}
+	/* a hit skips compiling and linking. anything else builds from source */
+	const char *sources[2] = { pb->vert_src.text, pb->frag_src.text };
+	pb->key = programme_cache_key( sources, 2, req->defines );
+	if ( !fetch_cached_programme( pb->key, &req->programme ) ) {
+		gl_log( "creating shaders from %s and %s [%s]...\n", req->vert_file, req->frag_file,
+						req->defines ? req->defines : "" );
+		pb->vert = glCreateShader( GL_VERTEX_SHADER );
+		pb->frag = glCreateShader( GL_FRAGMENT_SHADER );
+		glShaderSource( pb->vert, 1, &sources[0], NULL );
+		glShaderSource( pb->frag, 1, &sources[1], NULL );
+		glCompileShader( pb->vert );
+		glCompileShader( pb->frag );
+		req->programme = glCreateProgram();
+		glAttachShader( req->programme, pb->vert );
+		glAttachShader( req->programme, pb->frag );
+		// so that the linked binary can go in the program cache
+		glProgramParameteri( req->programme, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+		glLinkProgram( req->programme );
+		pb->pending = true;
+	}
+	free_shader_source( &pb->vert_src );
+	free_shader_source( &pb->frag_src );
+	return true;
+}
+
+/* ask for the link status, which waits if it isn't done yet */
+static void collect_build( programme_request *req, pending_build *pb ) {
+	pb->pending = false;
+	GLint linked = GL_FALSE;
+	glGetProgramiv( req->programme, GL_LINK_STATUS, &linked );
+	if ( GL_TRUE != linked ) {
+		/* a shader that didn't compile says more than the link log */
+		bool compiled = check_shader_compiled( pb->vert, &pb->vert_src );
+		compiled = check_shader_compiled( pb->frag, &pb->frag_src ) && compiled;
+		if ( compiled ) {
+			gl_log_err( "ERROR: could not link shader programme GL index %u\n", req->programme );
+			print_programme_info_log( req->programme );
+		}
+		glDeleteProgram( req->programme );
+		req->programme = 0;
+	} else {
+#ifndef NDEBUG
+		( is_programme_valid( req->programme ) );
+#endif
+		store_cached_programme( pb->key, req->programme );
+	}
+	glDeleteShader( pb->vert );
+	glDeleteShader( pb->frag );
+}
+
+int build_programmes( programme_request *requests, int count ) {
+	pending_build *builds = (pending_build *)calloc( count, sizeof( pending_build ) );
+	if ( !builds ) {
+		gl_log_err( "ERROR: out of memory building %i programs\n", count );
+		return 0;
+	}
+	int pending = 0;
+	for ( int i = 0; i < count; i++ ) {
+		requests[i].programme = 0;
+		submit_build( &requests[i], &builds[i] );
+		pending += builds[i].pending ? 1 : 0;
+	}
+	/* collect whatever has finished. when nothing has, wait on the first one
+	still going rather than spin - the rest carry on meanwhile */
+	bool parallel = enable_parallel_shader_compile();
+	while ( pending > 0 ) {
+		int collected = 0;
+		for ( int i = 0; i < count && parallel; i++ ) {
+			if ( !builds[i].pending ) {
+				continue;
+			}
+			GLint done = GL_FALSE;
+			glGetProgramiv( requests[i].programme, GL_COMPLETION_STATUS_KHR, &done );
+			if ( GL_TRUE == done ) {
+				collect_build( &requests[i], &builds[i] );
+				collected++;
+			}
+		}
+		for ( int i = 0; i < count && !collected; i++ ) {
+			if ( builds[i].pending ) {
+				collect_build( &requests[i], &builds[i] );
+				collected++;
+			}
+		}
+		pending -= collected;
+	}
+	free( builds );
+
+	int built = 0;
+	for ( int i = 0; i < count; i++ ) {
+		if ( requests[i].programme ) {
+			/* block bindings aren't in the shader or the binary, so set them either way */
+			bind_uniform_blocks( requests[i].programme );
+			built++;
+		}
+	}
+	gl_log( "built %i of %i programs%s\n", built, count, parallel ? ", parallel compile" : "" );
+	return built;
+}
+
+GLuint build_programme( const char *vert_file_name, const char *frag_file_name,
+												const char *defines ) {
+	programme_request req = { vert_file_name, frag_file_name, defines, 0 };
+	build_programmes( &req, 1 );
+	return req.programme;
+}
+
+/*------------------------------------VARIANTS--------------------------------*/
+void init_shader_variants( shader_variants *sv, shader_reloader *reloader ) {
+	memset( sv, 0, sizeof( shader_variants ) );
+	sv->reloader = reloader;
+}
+
+static unsigned long long variant_key( const char *vert_file_name,
+																			 const char *frag_file_name, const char *defines ) {
+	/* with the terminators, so the strings can't run into each other */
+	unsigned long long key =
+		fnv1a64( (const unsigned char *)vert_file_name, strlen( vert_file_name ) + 1 );
+	key = fnv1a64( (const unsigned char *)frag_file_name, strlen( frag_file_name ) + 1, key );
+	return fnv1a64( (const unsigned char *)defines, strlen( defines ) + 1, key );
+}
+
+static shader_variant *find_variant( shader_variants *sv, unsigned long long key ) {
+	for ( int i = 0; i < sv->count; i++ ) {
+		if ( sv->variants[i].key == key ) {
+			return &sv->variants[i];
+		}
+	}
+	return NULL;
+}
+
+/* kept even if it failed, so it isn't rebuilt every frame - a reload picks it
+up once the files are fixed */
+static void add_variant( shader_variants *sv, unsigned long long key, const char *vert_file_name,
+												 const char *frag_file_name, const char *defines, GLuint programme ) {
+	shader_variant *v = &sv->variants[sv->count++];
+	v->key = key;
+	snprintf( v->vert_file, sizeof( v->vert_file ), "%s", vert_file_name );
+	snprintf( v->frag_file, sizeof( v->frag_file ), "%s", frag_file_name );
+	snprintf( v->defines, sizeof( v->defines ), "%s", defines );
+	v->programme = programme;
+	if ( sv->reloader ) {
+		watch_programme( sv->reloader, v->vert_file, v->frag_file, v->defines, &v->programme );
+	}
+}
+
+GLuint get_shader_variant( shader_variants *sv, const char *vert_file_name,
+													 const char *frag_file_name, const char *defines ) {
+	defines = defines ? defines : "";
+	unsigned long long key = variant_key( vert_file_name, frag_file_name, defines );
+	shader_variant *v = find_variant( sv, key );
+	if ( v ) {
+		return v->programme;
+	}
+	if ( sv->count >= SHADER_VARIANT_MAX ) {
+		gl_log_err( "ERROR: no room for another shader variant of %s [%s]\n", frag_file_name,
+								defines );
+		return 0;
+	}
+	/* first use */
+	add_variant( sv, key, vert_file_name, frag_file_name, defines,
+							 build_programme( vert_file_name, frag_file_name, defines ) );
+	return sv->variants[sv->count - 1].programme;
+}
+
+void build_shader_variants( shader_variants *sv, programme_request *requests, int count ) {
+	programme_request *missing =
+		(programme_request *)malloc( count * sizeof( programme_request ) );
+	if ( !missing ) {
+		gl_log_err( "ERROR: out of memory building %i shader variants\n", count );
+		return;
+	}
+	int missing_count = 0;
+	for ( int i = 0; i < count; i++ ) {
+		const char *defines = requests[i].defines ? requests[i].defines : "";
+		shader_variant *v =
+			find_variant( sv, variant_key( requests[i].vert_file, requests[i].frag_file, defines ) );
+		if ( !v ) {
+			missing[missing_count++] = requests[i];
+		}
+	}
+	build_programmes( missing, missing_count );
+	for ( int i = 0; i < missing_count; i++ ) {
+		const char *defines = missing[i].defines ? missing[i].defines : "";
+		unsigned long long key = variant_key( missing[i].vert_file, missing[i].frag_file, defines );
+		/* the same variant asked for twice in one batch */
+		shader_variant *v = find_variant( sv, key );
+		if ( v ) {
+			glDeleteProgram( missing[i].programme );
+			continue;
+		}
+		if ( sv->count >= SHADER_VARIANT_MAX ) {
+			gl_log_err( "ERROR: no room for another shader variant of %s [%s]\n",
+									missing[i].frag_file, defines );
+			glDeleteProgram( missing[i].programme );
+			continue;
+		}
+		add_variant( sv, key, missing[i].vert_file, missing[i].frag_file, defines,
+								 missing[i].programme );
+	}
+	for ( int i = 0; i < count; i++ ) {
+		const char *defines = requests[i].defines ? requests[i].defines : "";
+		shader_variant *v =
+			find_variant( sv, variant_key( requests[i].vert_file, requests[i].frag_file, defines ) );
+		requests[i].programme = v ? v->programme : 0;
+	}
+	free( missing );
+}
+
+void free_shader_variants( shader_variants *sv ) {
+	for ( int i = 0; i < sv->count; i++ ) {
+		glDeleteProgram( sv->variants[i].programme );
+	}
+	sv->count = 0;
+}
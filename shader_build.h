@@ -0,0 +1,98 @@
+/******************************************************************************\
+| Shader build step: preprocessing and variants                                |
+| Shader files are read through a small preprocessor before GL sees them:      |
+| - #include "file" pastes in another file, relative to the one including it.  |
+|   Each file goes in once per shader, so shared snippets need no guards.      |
+| - the #version line comes from SHADER_GLSL_VERSION, for every shader, and    |
+|   any #version in the files is dropped.                                      |
+| - a variant's defines go in right after it, one #define per key.             |
+| #line directives keep compile errors pointing at the right line, with the    |
+| source string number being the file's index in shader_source::files.         |
+|******************************************************************************|
+| A variant is a vertex and fragment file pair plus a string of defines such   |
+| as "NORMAL_MAP SAMPLES=4". Variants are compiled the first time they are     |
+| asked for and kept by key, so a material feature can be an #ifdef that       |
+| compiles away instead of a branch at run time.                               |
+|******************************************************************************|
+| build_programmes() builds a batch together. Every compile and link is        |
+| submitted before any status is asked for - asking makes the driver finish    |
+| that one first - so with GL_KHR_parallel_shader_compile (or its ARB twin)    |
+| the driver works on the whole batch at once. Programs are then collected as  |
+| GL_COMPLETION_STATUS_KHR says they are done. Give it everything needed at    |
+| start-up.                                                                    |
+\******************************************************************************/
+#ifndef _SHADER_BUILD_H_
+#define _SHADER_BUILD_H_
+#include <GL/glew.h>
+#include <stddef.h>
+
+/* the context is GL 4.1 core, the most OS X offers */
+#define SHADER_GLSL_VERSION "410"
+#define SHADER_MAX_FILES 16 // the shader's own file and everything it includes
+#define SHADER_MAX_PATH 256
+#define SHADER_VARIANT_MAX 64
+
+struct shader_reloader;
+
+struct shader_source {
+	char *text; // ready for glShaderSource()
+	size_t length;
+	/* every file read, the shader's own first. for error messages and reloads */
+	char files[SHADER_MAX_FILES][SHADER_MAX_PATH];
+	int file_count;
+};
+
+/* defines is a space-separated list of NAME or NAME=VALUE, and may be NULL */
+bool preprocess_shader( const char *file_name, const char *defines, shader_source *src );
+void free_shader_source( shader_source *src );
+
+/* KHR_parallel_shader_compile isn't in our GLEW. its ARB twin is, with the same
+values */
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+/* let the driver compile on its own threads, if it can. true if it can, in
+which case programs can be polled for GL_COMPLETION_STATUS_KHR */
+bool enable_parallel_shader_compile();
+
+struct programme_request {
+	const char *vert_file;
+	const char *frag_file;
+	const char *defines; // may be NULL
+	GLuint programme;		 // out. 0 if it didn't build
+};
+
+/* compile and link a batch of programs from preprocessed files, all submitted
+before any is waited for. goes through the program binary cache. returns how
+many built */
+int build_programmes( programme_request *requests, int count );
+/* a batch of one. 0 if it didn't build */
+GLuint build_programme( const char *vert_file_name, const char *frag_file_name,
+												const char *defines );
+
+struct shader_variant {
+	unsigned long long key;
+	char vert_file[SHADER_MAX_PATH];
+	char frag_file[SHADER_MAX_PATH];
+	char defines[SHADER_MAX_PATH];
+	GLuint programme; // the reloader swaps this when the files change
+};
+
+struct shader_variants {
+	shader_variant variants[SHADER_VARIANT_MAX];
+	int count;
+	shader_reloader *reloader; // may be NULL
+};
+
+/* new variants are watched by reloader, if it isn't NULL */
+void init_shader_variants( shader_variants *sv, shader_reloader *reloader );
+/* the program for this variant, built now if this is the first time it has
+been asked for. cheap enough to call every time the program is used */
+GLuint get_shader_variant( shader_variants *sv, const char *vert_file_name,
+													 const char *frag_file_name, const char *defines = NULL );
+/* build, in one batch, every requested variant that isn't built yet, so that
+get_shader_variant() just finds them. fills in each request's programme */
+void build_shader_variants( shader_variants *sv, programme_request *requests, int count );
+void free_shader_variants( shader_variants *sv );
+#endif
@@ -0,0 +1,107 @@
+/******************************************************************************\
+| Cache of linked program binaries - see shader_cache.h                        |
+\******************************************************************************/
+#include "shader_cache.h"
+#include "gl_utils.h"
+#include "image_cache.h" // fnv1a64, write_file_atomic
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* bump this whenever the entry layout changes */
+#define SHADER_CACHE_VERSION 1
+
+struct shader_cache_header {
+	char magic[4]; // "PGB1"
+	int version;
+	GLenum format;
+	int length;
+};
+
+/* hashed with the terminator, so "ab" + "c" and "a" + "bc" differ */
+static unsigned long long hash_str( const char *str, unsigned long long h ) {
+	return fnv1a64( (const unsigned char *)str, strlen( str ) + 1, h );
+}
+
+unsigned long long programme_cache_key( const char **sources, int count,
+																				const char *defines ) {
+	unsigned long long key = FNV1A64_SEED;
+	int params[2] = { SHADER_CACHE_VERSION, count };
+	key = fnv1a64( (const unsigned char *)params, sizeof( params ), key );
+	for ( int i = 0; i < count; i++ ) {
+		key = hash_str( sources[i], key );
+	}
+	key = hash_str( defines ? defines : "", key );
+	/* binaries only load on the driver that made them */
+	const char *renderer = (const char *)glGetString( GL_RENDERER );
+	const char *version = (const char *)glGetString( GL_VERSION );
+	key = hash_str( renderer ? renderer : "", key );
+	key = hash_str( version ? version : "", key );
+	return key;
+}
+
+static void entry_path( unsigned long long key, char *path, int max_len ) {
+	snprintf( path, max_len, "%s/%016llx.bin", SHADER_CACHE_DIR, key );
+}
+
+bool fetch_cached_programme( unsigned long long key, GLuint *programme ) {
+	char path[1024];
+	entry_path( key, path, sizeof( path ) );
+	FILE *f = fopen( path, "rb" );
+	if ( !f ) {
+		return false;
+	}
+	shader_cache_header header;
+	bool ok = 1 == fread( &header, sizeof( header ), 1, f ) &&
+						0 == memcmp( header.magic, "PGB1", 4 ) &&
+						SHADER_CACHE_VERSION == header.version && header.length > 0;
+	void *binary = ok ? malloc( header.length ) : NULL;
+	ok = binary && 1 == fread( binary, header.length, 1, f );
+	fclose( f );
+	if ( !ok ) {
+		gl_log_err( "WARNING: ignoring bad program cache entry %s\n", path );
+		free( binary );
+		return false;
+	}
+	*programme = glCreateProgram();
+	glProgramBinary( *programme, header.format, binary, header.length );
+	free( binary );
+	GLint linked = GL_FALSE;
+	glGetProgramiv( *programme, GL_LINK_STATUS, &linked );
+	if ( GL_TRUE != linked ) {
+		gl_log( "program cache entry %s rejected by the driver. rebuilding\n", path );
+		glDeleteProgram( *programme );
+		*programme = 0;
+		return false;
+	}
+	gl_log( "program %u loaded from %s\n", *programme, path );
+	return true;
+}
+
+void store_cached_programme( unsigned long long key, GLuint programme ) {
+	GLint formats = 0, length = 0;
+	glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &formats );
+	glGetProgramiv( programme, GL_PROGRAM_BINARY_LENGTH, &length );
+	if ( 0 == formats || length <= 0 ) {
+		return; // nothing the driver could load back
+	}
+	shader_cache_header header;
+	memset( &header, 0, sizeof( header ) );
+	memcpy( header.magic, "PGB1", 4 );
+	header.version = SHADER_CACHE_VERSION;
+	void *binary = malloc( length );
+	if ( !binary ) {
+		return;
+	}
+	glGetProgramBinary( programme, length, &header.length, &header.format, binary );
+	char path[1024];
+	entry_path( key, path, sizeof( path ) );
+	file_chunk chunks[2] = { { &header, sizeof( header ) }, { binary, (size_t)header.length } };
+	bool ok = header.length > 0 && write_file_atomic( path, chunks, 2 );
+	free( binary );
+	if ( !ok ) {
+		gl_log_err( "WARNING: could not write program cache %s\n", path );
+		return;
+	}
+	gl_log( "program %u cached as %s\n", programme, path );
+}
@@ -0,0 +1,28 @@
+/******************************************************************************\
+| Cache of linked program binaries                                             |
+| Linked programs are saved with glGetProgramBinary() into SHADER_CACHE_DIR,   |
+| one file per program, named after a hash of the shader sources, any defines, |
+| and the GL_RENDERER and GL_VERSION strings. A hit loads the binary with      |
+| glProgramBinary() and skips compiling and linking altogether.                |
+|******************************************************************************|
+| A driver update can still reject a binary that hashes the same. Then the     |
+| fetch fails like a miss: the caller compiles from source and the store       |
+| writes over the stale entry. Drivers that offer no binary formats just       |
+| always miss.                                                                 |
+\******************************************************************************/
+#ifndef _SHADER_CACHE_H_
+#define _SHADER_CACHE_H_
+#include <GL/glew.h>
+
+#define SHADER_CACHE_DIR "cache/programs"
+
+/* key for a program built from count shader sources. defines may be NULL.
+needs the GL context the program is for */
+unsigned long long programme_cache_key( const char **sources, int count,
+																				const char *defines );
+/* on a hit, a new linked program in *programme. false on a miss, or if the
+driver rejected the binary */
+bool fetch_cached_programme( unsigned long long key, GLuint *programme );
+/* the program must have been linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT */
+void store_cached_programme( unsigned long long key, GLuint programme );
+#endif
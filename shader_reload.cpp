@@ -0,0 +1,270 @@
+/******************************************************************************\
+| Shader hot reload - see shader_reload.h                                      |
+\******************************************************************************/
+#include "shader_reload.h"
+#include "gl_utils.h"
+#include "shader_cache.h"
+#include "uniforms.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <errno.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+static long long modified_time( const char *file_name ) {
+	struct stat st;
+	if ( 0 != stat( file_name, &st ) ) {
+		return 0;
+	}
+	return (long long)st.st_mtime;
+}
+
+bool init_shader_reloader( shader_reloader *sr, const char *dir ) {
+	memset( sr, 0, sizeof( shader_reloader ) );
+	snprintf( sr->dir, sizeof( sr->dir ), "%s", dir );
+	sr->inotify_fd = -1;
+
+	sr->parallel_compile = enable_parallel_shader_compile();
+
+#ifdef __linux__
+	sr->inotify_fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+	/* editors that save to a temporary file and rename it show up as IN_MOVED_TO */
+	if ( sr->inotify_fd >= 0 &&
+			 inotify_add_watch( sr->inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO ) < 0 ) {
+		close( sr->inotify_fd );
+		sr->inotify_fd = -1;
+	}
+#endif
+	gl_log( "watching %s for shader changes (%s%s)\n", dir,
+					sr->inotify_fd >= 0 ? "inotify" : "polling",
+					sr->parallel_compile ? ", parallel compile" : "" );
+	return true;
+}
+
+/* what to watch from here on: every file the two shaders read */
+static void record_files( reloadable_programme *rp, const shader_source *vert_src,
+													const shader_source *frag_src ) {
+	rp->file_count = 0;
+	const shader_source *srcs[2] = { vert_src, frag_src };
+	for ( int s = 0; s < 2; s++ ) {
+		for ( int i = 0; i < srcs[s]->file_count; i++ ) {
+			strcpy( rp->files[rp->file_count], srcs[s]->files[i] );
+			rp->mtimes[rp->file_count] = modified_time( srcs[s]->files[i] );
+			rp->file_count++;
+		}
+	}
+}
+
+bool watch_programme( shader_reloader *sr, const char *vert_file_name,
+											const char *frag_file_name, const char *defines,
+											GLuint *programme ) {
+	if ( sr->count >= SHADER_RELOAD_MAX ) {
+		gl_log_err( "ERROR: no room to watch another program for %s\n", vert_file_name );
+		return false;
+	}
+	reloadable_programme *rp = &sr->programmes[sr->count++];
+	memset( rp, 0, sizeof( reloadable_programme ) );
+	snprintf( rp->vert_file, sizeof( rp->vert_file ), "%s", vert_file_name );
+	snprintf( rp->frag_file, sizeof( rp->frag_file ), "%s", frag_file_name );
+	snprintf( rp->defines, sizeof( rp->defines ), "%s", defines ? defines : "" );
+	rp->programme = programme;
+	/* only to find the includes. if it doesn't preprocess, watch the two files
+	until it does */
+	shader_source vert_src, frag_src;
+	bool vert_ok = preprocess_shader( vert_file_name, defines, &vert_src );
+	bool frag_ok = preprocess_shader( frag_file_name, defines, &frag_src );
+	if ( vert_ok && frag_ok ) {
+		record_files( rp, &vert_src, &frag_src );
+	} else {
+		rp->file_count = 2;
+		strcpy( rp->files[0], rp->vert_file );
+		strcpy( rp->files[1], rp->frag_file );
+		rp->mtimes[0] = modified_time( rp->files[0] );
+		rp->mtimes[1] = modified_time( rp->files[1] );
+	}
+	if ( vert_ok ) {
+		free_shader_source( &vert_src );
+	}
+	if ( frag_ok ) {
+		free_shader_source( &frag_src );
+	}
+	return true;
+}
+
+/*------------------------------------REBUILD---------------------------------*/
+static void cancel_rebuild( reloadable_programme *rp ) {
+	if ( rp->pending ) {
+		glDeleteProgram( rp->pending );
+		glDeleteShader( rp->pending_vert );
+		glDeleteShader( rp->pending_frag );
+		rp->pending = rp->pending_vert = rp->pending_frag = 0;
+	}
+}
+
+/* kick off compiling and linking without asking for any status, which would
+wait for the driver */
+static void start_rebuild( reloadable_programme *rp ) {
+	cancel_rebuild( rp ); // edited again before the last one finished
+	shader_source vert_src, frag_src;
+	if ( !preprocess_shader( rp->vert_file, rp->defines, &vert_src ) ) {
+		return;
+	}
+	if ( !preprocess_shader( rp->frag_file, rp->defines, &frag_src ) ) {
+		free_shader_source( &vert_src );
+		return;
+	}
+	/* the edit may have added or removed includes */
+	record_files( rp, &vert_src, &frag_src );
+	gl_log( "rebuilding program from %s and %s [%s]\n", rp->vert_file, rp->frag_file,
+					rp->defines );
+	const char *sources[2] = { vert_src.text, frag_src.text };
+	rp->pending_key = programme_cache_key( sources, 2, rp->defines );
+	rp->pending_vert = glCreateShader( GL_VERTEX_SHADER );
+	rp->pending_frag = glCreateShader( GL_FRAGMENT_SHADER );
+	glShaderSource( rp->pending_vert, 1, &sources[0], NULL );
+	glShaderSource( rp->pending_frag, 1, &sources[1], NULL );
+	glCompileShader( rp->pending_vert );
+	glCompileShader( rp->pending_frag );
+	rp->pending = glCreateProgram();
+	glAttachShader( rp->pending, rp->pending_vert );
+	glAttachShader( rp->pending, rp->pending_frag );
+	glProgramParameteri( rp->pending, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+	glLinkProgram( rp->pending );
+	rp->started_this_frame = true;
+	free_shader_source( &vert_src );
+	free_shader_source( &frag_src );
+}
+
+/* true if the rebuild linked and *rp->programme is now the new program */
+static bool finish_rebuild( shader_reloader *sr, reloadable_programme *rp ) {
+	if ( sr->parallel_compile ) {
+		GLint done = GL_FALSE;
+		glGetProgramiv( rp->pending, GL_COMPLETION_STATUS_KHR, &done );
+		if ( GL_TRUE != done ) {
+			return false; // still going. ask again next frame
+		}
+	}
+	GLint linked = GL_FALSE;
+	glGetProgramiv( rp->pending, GL_LINK_STATUS, &linked );
+	if ( GL_TRUE != linked ) {
+		/* keep drawing with the old program until the next save */
+		GLint compiled = GL_FALSE;
+		glGetShaderiv( rp->pending_vert, GL_COMPILE_STATUS, &compiled );
+		if ( GL_TRUE != compiled ) {
+			gl_log_err( "ERROR: %s did not compile\n", rp->vert_file );
+			print_shader_info_log( rp->pending_vert );
+		}
+		glGetShaderiv( rp->pending_frag, GL_COMPILE_STATUS, &compiled );
+		if ( GL_TRUE != compiled ) {
+			gl_log_err( "ERROR: %s did not compile\n", rp->frag_file );
+			print_shader_info_log( rp->pending_frag );
+		}
+		gl_log_err( "ERROR: reloaded program for %s and %s did not link. keeping the old one\n",
+								rp->vert_file, rp->frag_file );
+		print_programme_info_log( rp->pending );
+		cancel_rebuild( rp );
+		return false;
+	}
+	store_cached_programme( rp->pending_key, rp->pending );
+	bind_uniform_blocks( rp->pending );
+	glDeleteShader( rp->pending_vert );
+	glDeleteShader( rp->pending_frag );
+	glDeleteProgram( *rp->programme );
+	*rp->programme = rp->pending;
+	gl_log( "reloaded program %u from %s and %s\n", rp->pending, rp->vert_file,
+					rp->frag_file );
+	rp->pending = rp->pending_vert = rp->pending_frag = 0;
+	return true;
+}
+
+/*-------------------------------------WATCH----------------------------------*/
+/* does file_name name dir/name? */
+static bool is_file_in_dir( const char *file_name, const char *dir, const char *name ) {
+	size_t dir_len = strlen( dir );
+	return 0 == strncmp( file_name, dir, dir_len ) && '/' == file_name[dir_len] &&
+				 0 == strcmp( file_name + dir_len + 1, name );
+}
+
+/* start rebuilding every program that uses dir/name */
+static void file_changed( shader_reloader *sr, const char *name ) {
+	for ( int i = 0; i < sr->count; i++ ) {
+		reloadable_programme *rp = &sr->programmes[i];
+		for ( int j = 0; j < rp->file_count; j++ ) {
+			if ( is_file_in_dir( rp->files[j], sr->dir, name ) ) {
+				start_rebuild( rp );
+				break;
+			}
+		}
+	}
+}
+
+static void check_for_changes( shader_reloader *sr ) {
+#ifdef __linux__
+	if ( sr->inotify_fd >= 0 ) {
+		/* aligned for the events read into it */
+		char buffer[4096] __attribute__( ( aligned( __alignof__( struct inotify_event ) ) ) );
+		ssize_t len;
+		while ( ( len = read( sr->inotify_fd, buffer, sizeof( buffer ) ) ) > 0 ) {
+			for ( char *p = buffer; p < buffer + len; ) {
+				const struct inotify_event *event = (const struct inotify_event *)p;
+				if ( event->len > 0 ) {
+					file_changed( sr, event->name );
+				}
+				p += sizeof( struct inotify_event ) + event->len;
+			}
+		}
+		return;
+	}
+#endif
+	double now = glfwGetTime();
+	if ( now < sr->next_poll ) {
+		return;
+	}
+	sr->next_poll = now + SHADER_RELOAD_POLL_INTERVAL;
+	for ( int i = 0; i < sr->count; i++ ) {
+		reloadable_programme *rp = &sr->programmes[i];
+		for ( int j = 0; j < rp->file_count; j++ ) {
+			if ( modified_time( rp->files[j] ) != rp->mtimes[j] ) {
+				/* noted first, so a file that won't preprocess isn't retried every poll */
+				for ( int k = 0; k < rp->file_count; k++ ) {
+					rp->mtimes[k] = modified_time( rp->files[k] );
+				}
+				start_rebuild( rp );
+				break;
+			}
+		}
+	}
+}
+
+bool update_shader_reloader( shader_reloader *sr ) {
+	for ( int i = 0; i < sr->count; i++ ) {
+		sr->programmes[i].started_this_frame = false;
+	}
+	check_for_changes( sr );
+	bool swapped = false;
+	for ( int i = 0; i < sr->count; i++ ) {
+		reloadable_programme *rp = &sr->programmes[i];
+		/* a rebuild started just now is left to compile until the next frame.
+		asking straight away would wait on the driver */
+		if ( rp->pending && !rp->started_this_frame && finish_rebuild( sr, rp ) ) {
+			swapped = true;
+		}
+	}
+	return swapped;
+}
+
+void free_shader_reloader( shader_reloader *sr ) {
+	for ( int i = 0; i < sr->count; i++ ) {
+		cancel_rebuild( &sr->programmes[i] );
+	}
+#ifdef __linux__
+	if ( sr->inotify_fd >= 0 ) {
+		close( sr->inotify_fd );
+	}
+#endif
+	sr->count = 0;
+}
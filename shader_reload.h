@@ -0,0 +1,64 @@
+/******************************************************************************\
+| Shader hot reload                                                            |
+| Watches the shader directory and rebuilds any program whose shader files, or |
+| the files they include, change, while the old program keeps drawing. The new |
+| program only replaces the caller's handle once it has linked, between two    |
+| frames, so an edit never drops a frame and a broken edit just logs its       |
+| errors and leaves the last good program in place.                            |
+|******************************************************************************|
+| On Linux changes come from inotify. Elsewhere the watched files'             |
+| modification times are polled a few times a second. With                     |
+| GL_KHR_parallel_shader_compile (or its ARB twin) compiling and linking run   |
+| on the driver's threads, and the program is polled for                       |
+| GL_COMPLETION_STATUS_KHR each frame. Without it, the link status is only     |
+| asked for on the frame after the rebuild was started.                        |
+\******************************************************************************/
+#ifndef _SHADER_RELOAD_H_
+#define _SHADER_RELOAD_H_
+#include "shader_build.h" // SHADER_MAX_FILES
+#include <GL/glew.h>
+
+#define SHADER_RELOAD_MAX 32
+/* both shaders' files, includes and all */
+#define SHADER_RELOAD_MAX_FILES ( 2 * SHADER_MAX_FILES )
+/* seconds between modification time checks, where there's no inotify */
+#define SHADER_RELOAD_POLL_INTERVAL 0.5
+
+struct reloadable_programme {
+	char vert_file[SHADER_MAX_PATH];
+	char frag_file[SHADER_MAX_PATH];
+	char defines[SHADER_MAX_PATH];
+	/* every file the last build read, and when each last changed */
+	char files[SHADER_RELOAD_MAX_FILES][SHADER_MAX_PATH];
+	long long mtimes[SHADER_RELOAD_MAX_FILES];
+	int file_count;
+	GLuint *programme; // the caller's handle. swapped when a rebuild links
+	/* the rebuild in flight, if any */
+	GLuint pending;
+	GLuint pending_vert, pending_frag;
+	unsigned long long pending_key; // for the program cache
+	bool started_this_frame; // not asked about until the next update
+};
+
+struct shader_reloader {
+	reloadable_programme programmes[SHADER_RELOAD_MAX];
+	int count;
+	char dir[256];
+	bool parallel_compile;
+	int inotify_fd; // -1 when polling
+	double next_poll;
+};
+
+/* dir is where the shader files live. needs the GL context */
+bool init_shader_reloader( shader_reloader *sr, const char *dir );
+/* rebuild *programme from these files, with these defines, whenever either of
+them or anything they include changes. with inotify only files right in the
+watched dir are noticed */
+bool watch_programme( shader_reloader *sr, const char *vert_file_name,
+											const char *frag_file_name, const char *defines,
+											GLuint *programme );
+/* call once a frame. true if any handle now holds a new program, which will
+need its uniform locations and values set again */
+bool update_shader_reloader( shader_reloader *sr );
+void free_shader_reloader( shader_reloader *sr );
+#endif
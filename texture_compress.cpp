@@ -0,0 +1,662 @@
+/******************************************************************************\
+| CPU block compression - see texture_compress.h                               |
+\******************************************************************************/
+#include "texture_compress.h"
+#include "gl_utils.h"
+#include "image_cache.h" // fnv1a64, write_file_atomic
+#include "parallel.h"
+#include "texture_container.h"
+#include "stb_image.h" // Sean Barrett's image loader - nothings.org
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined( __SSE2__ ) || defined( _M_X64 ) ||                                \
+	( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define BC_SSE
+#include <emmintrin.h>
+#endif
+
+/* bump this whenever the encoder output changes to invalidate old caches */
+#define BC_CACHE_VERSION 2
+
+/*---------------------------------BLOCK MATHS--------------------------------*/
+/* index of the palette entry nearest to px. pal holds 4 channels of up to 16
+entries and count must be a multiple of 4. channels the format doesn't use
+are 0 in both pal and px so they never add any distance */
+static int nearest_entry( const float pal[4][16], int count, const float *px ) {
+#ifdef BC_SSE
+	__m128 best_d = _mm_set1_ps( FLT_MAX );
+	__m128i best_i = _mm_setzero_si128();
+	for ( int k = 0; k < count; k += 4 ) {
+		__m128 d = _mm_setzero_ps();
+		for ( int c = 0; c < 4; c++ ) {
+			__m128 diff = _mm_sub_ps( _mm_loadu_ps( &pal[c][k] ), _mm_set1_ps( px[c] ) );
+			d = _mm_add_ps( d, _mm_mul_ps( diff, diff ) );
+		}
+		__m128i closer = _mm_castps_si128( _mm_cmplt_ps( d, best_d ) );
+		__m128i idx = _mm_set_epi32( k + 3, k + 2, k + 1, k );
+		best_i = _mm_or_si128( _mm_and_si128( closer, idx ), _mm_andnot_si128( closer, best_i ) );
+		best_d = _mm_min_ps( d, best_d );
+	}
+	float ds[4];
+	int is[4];
+	_mm_storeu_ps( ds, best_d );
+	_mm_storeu_si128( (__m128i *)is, best_i );
+	int best = 0;
+	for ( int lane = 1; lane < 4; lane++ ) {
+		if ( ds[lane] < ds[best] || ( ds[lane] == ds[best] && is[lane] < is[best] ) ) {
+			best = lane;
+		}
+	}
+	return is[best];
+#else
+	int best = 0;
+	float best_d = FLT_MAX;
+	for ( int k = 0; k < count; k++ ) {
+		float d = 0.0f;
+		for ( int c = 0; c < 4; c++ ) {
+			float diff = pal[c][k] - px[c];
+			d += diff * diff;
+		}
+		if ( d < best_d ) {
+			best_d = d;
+			best = k;
+		}
+	}
+	return best;
+#endif
+}
+
+/* fit a line through the block's texels (in the first `channels` channels)
+and return the two ends of the segment the texels cover */
+static void endpoints_along_axis( const unsigned char px[16][4], int channels,
+																	float *lo, float *hi ) {
+	float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	float mn[4] = { 255.0f, 255.0f, 255.0f, 255.0f };
+	float mx[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for ( int i = 0; i < 16; i++ ) {
+		for ( int c = 0; c < channels; c++ ) {
+			float v = px[i][c];
+			mean[c] += v;
+			mn[c] = v < mn[c] ? v : mn[c];
+			mx[c] = v > mx[c] ? v : mx[c];
+		}
+	}
+	float cov[4][4] = { { 0.0f } };
+	for ( int c = 0; c < channels; c++ ) {
+		mean[c] /= 16.0f;
+	}
+	for ( int i = 0; i < 16; i++ ) {
+		float d[4];
+		for ( int c = 0; c < channels; c++ ) {
+			d[c] = px[i][c] - mean[c];
+		}
+		for ( int r = 0; r < channels; r++ ) {
+			for ( int c = 0; c < channels; c++ ) {
+				cov[r][c] += d[r] * d[c];
+			}
+		}
+	}
+	/* power iteration for the principal axis, starting from the box diagonal */
+	float axis[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	float len2 = 0.0f;
+	for ( int c = 0; c < channels; c++ ) {
+		axis[c] = mx[c] - mn[c];
+		len2 += axis[c] * axis[c];
+	}
+	if ( len2 <= 0.0f ) { // flat block
+		for ( int c = 0; c < 4; c++ ) {
+			lo[c] = hi[c] = mean[c];
+		}
+		return;
+	}
+	for ( int iter = 0; iter < 8; iter++ ) {
+		float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		len2 = 0.0f;
+		for ( int r = 0; r < channels; r++ ) {
+			for ( int c = 0; c < channels; c++ ) {
+				next[r] += cov[r][c] * axis[c];
+			}
+			len2 += next[r] * next[r];
+		}
+		if ( len2 < 1e-12f ) {
+			break;
+		}
+		float inv = 1.0f / sqrtf( len2 );
+		for ( int c = 0; c < channels; c++ ) {
+			axis[c] = next[c] * inv;
+		}
+	}
+	len2 = 0.0f;
+	for ( int c = 0; c < channels; c++ ) {
+		len2 += axis[c] * axis[c];
+	}
+	float inv = 1.0f / sqrtf( len2 );
+	float tmin = FLT_MAX, tmax = -FLT_MAX;
+	for ( int i = 0; i < 16; i++ ) {
+		float t = 0.0f;
+		for ( int c = 0; c < channels; c++ ) {
+			t += ( px[i][c] - mean[c] ) * axis[c] * inv;
+		}
+		tmin = t < tmin ? t : tmin;
+		tmax = t > tmax ? t : tmax;
+	}
+	for ( int c = 0; c < 4; c++ ) {
+		float a = c < channels ? axis[c] * inv : 0.0f;
+		lo[c] = mean[c] + a * tmin;
+		hi[c] = mean[c] + a * tmax;
+		lo[c] = lo[c] < 0.0f ? 0.0f : ( lo[c] > 255.0f ? 255.0f : lo[c] );
+		hi[c] = hi[c] < 0.0f ? 0.0f : ( hi[c] > 255.0f ? 255.0f : hi[c] );
+	}
+}
+
+static void put_bits( unsigned char *block, int *pos, unsigned int value,
+											int bits ) {
+	for ( int i = 0; i < bits; i++, ( *pos )++ ) {
+		if ( ( value >> i ) & 1 ) {
+			block[*pos >> 3] |= (unsigned char)( 1 << ( *pos & 7 ) );
+		}
+	}
+}
+
+/*-----------------------------------ENCODERS---------------------------------*/
+static unsigned short pack_565( const float *c ) {
+	int r = (int)( c[0] * 31.0f / 255.0f + 0.5f );
+	int g = (int)( c[1] * 63.0f / 255.0f + 0.5f );
+	int b = (int)( c[2] * 31.0f / 255.0f + 0.5f );
+	return (unsigned short)( ( r << 11 ) | ( g << 5 ) | b );
+}
+
+static void unpack_565( unsigned short v, float *c ) {
+	int r = ( v >> 11 ) & 31, g = ( v >> 5 ) & 63, b = v & 31;
+	c[0] = (float)( ( r << 3 ) | ( r >> 2 ) );
+	c[1] = (float)( ( g << 2 ) | ( g >> 4 ) );
+	c[2] = (float)( ( b << 3 ) | ( b >> 2 ) );
+}
+
+/* 8 bytes. always 4-colour mode (c0 > c1) so it is also valid inside BC3 */
+static void encode_bc1( const unsigned char px[16][4], unsigned char *out ) {
+	float lo[4], hi[4];
+	endpoints_along_axis( px, 3, lo, hi );
+	unsigned short c0 = pack_565( hi ), c1 = pack_565( lo );
+	if ( c0 < c1 ) {
+		unsigned short tmp = c0;
+		c0 = c1;
+		c1 = tmp;
+	}
+	unsigned int indices = 0;
+	// equal endpoints would mean 3-colour mode, so they just use index 0
+	if ( c0 != c1 ) {
+		float pal[4][16];
+		memset( pal, 0, sizeof( pal ) );
+		float e0[3], e1[3];
+		unpack_565( c0, e0 );
+		unpack_565( c1, e1 );
+		for ( int c = 0; c < 3; c++ ) {
+			pal[c][0] = e0[c];
+			pal[c][1] = e1[c];
+			pal[c][2] = ( 2.0f * e0[c] + e1[c] ) / 3.0f;
+			pal[c][3] = ( e0[c] + 2.0f * e1[c] ) / 3.0f;
+		}
+		for ( int i = 0; i < 16; i++ ) {
+			float p[4] = { (float)px[i][0], (float)px[i][1], (float)px[i][2], 0.0f };
+			indices |= (unsigned int)nearest_entry( pal, 4, p ) << ( 2 * i );
+		}
+	}
+	out[0] = (unsigned char)( c0 & 0xFF );
+	out[1] = (unsigned char)( c0 >> 8 );
+	out[2] = (unsigned char)( c1 & 0xFF );
+	out[3] = (unsigned char)( c1 >> 8 );
+	for ( int i = 0; i < 4; i++ ) {
+		out[4 + i] = (unsigned char)( ( indices >> ( 8 * i ) ) & 0xFF );
+	}
+}
+
+/* 8 bytes for one channel, in 8-value mode (a0 > a1) */
+static void encode_bc4( const unsigned char px[16][4], int channel,
+												unsigned char *out ) {
+	int a0 = 0, a1 = 255;
+	for ( int i = 0; i < 16; i++ ) {
+		a0 = px[i][channel] > a0 ? px[i][channel] : a0;
+		a1 = px[i][channel] < a1 ? px[i][channel] : a1;
+	}
+	memset( out, 0, 8 );
+	out[0] = (unsigned char)a0;
+	out[1] = (unsigned char)a1;
+	if ( a0 == a1 ) {
+		return;
+	}
+	float pal[4][16];
+	memset( pal, 0, sizeof( pal ) );
+	pal[0][0] = (float)a0;
+	pal[0][1] = (float)a1;
+	for ( int k = 2; k < 8; k++ ) {
+		pal[0][k] = (float)( ( ( 8 - k ) * a0 + ( k - 1 ) * a1 ) / 7 );
+	}
+	unsigned long long bits = 0;
+	for ( int i = 0; i < 16; i++ ) {
+		float p[4] = { (float)px[i][channel], 0.0f, 0.0f, 0.0f };
+		bits |= (unsigned long long)nearest_entry( pal, 8, p ) << ( 3 * i );
+	}
+	for ( int i = 0; i < 6; i++ ) {
+		out[2 + i] = (unsigned char)( ( bits >> ( 8 * i ) ) & 0xFF );
+	}
+}
+
+static const int g_bc7_weights4[16] = { 0,	4,	9,	13, 17, 21, 26, 30,
+																				34, 38, 43, 47, 51, 55, 60, 64 };
+
+/* quantise an endpoint to 7 bits per channel plus the shared p-bit that gets
+closest to it */
+static void bc7_quantise_endpoint( const float *e, int *q, int *p ) {
+	float best_err = FLT_MAX;
+	for ( int pbit = 0; pbit < 2; pbit++ ) {
+		int tq[4];
+		float err = 0.0f;
+		for ( int c = 0; c < 4; c++ ) {
+			int v = (int)floorf( ( e[c] - pbit ) * 0.5f + 0.5f );
+			tq[c] = v < 0 ? 0 : ( v > 127 ? 127 : v );
+			float d = (float)( tq[c] * 2 + pbit ) - e[c];
+			err += d * d;
+		}
+		if ( err < best_err ) {
+			best_err = err;
+			*p = pbit;
+			memcpy( q, tq, sizeof( tq ) );
+		}
+	}
+}
+
+/* 16 bytes, mode 6 */
+static void encode_bc7( const unsigned char px[16][4], unsigned char *out ) {
+	float lo[4], hi[4];
+	endpoints_along_axis( px, 4, lo, hi );
+	int q[2][4], p[2];
+	bc7_quantise_endpoint( lo, q[0], &p[0] );
+	bc7_quantise_endpoint( hi, q[1], &p[1] );
+	float pal[4][16];
+	for ( int c = 0; c < 4; c++ ) {
+		int e0 = q[0][c] * 2 + p[0], e1 = q[1][c] * 2 + p[1];
+		for ( int k = 0; k < 16; k++ ) {
+			int w = g_bc7_weights4[k];
+			pal[c][k] = (float)( ( ( 64 - w ) * e0 + w * e1 + 32 ) >> 6 );
+		}
+	}
+	int idx[16];
+	for ( int i = 0; i < 16; i++ ) {
+		float pf[4] = { (float)px[i][0], (float)px[i][1], (float)px[i][2], (float)px[i][3] };
+		idx[i] = nearest_entry( pal, 16, pf );
+	}
+	/* the first index only has 3 bits stored, so its top bit must be 0 */
+	if ( idx[0] & 8 ) {
+		for ( int c = 0; c < 4; c++ ) {
+			int tmp = q[0][c];
+			q[0][c] = q[1][c];
+			q[1][c] = tmp;
+		}
+		int tmp = p[0];
+		p[0] = p[1];
+		p[1] = tmp;
+		for ( int i = 0; i < 16; i++ ) {
+			idx[i] = 15 - idx[i];
+		}
+	}
+	memset( out, 0, 16 );
+	int pos = 0;
+	put_bits( out, &pos, 1 << 6, 7 ); // mode 6
+	for ( int c = 0; c < 4; c++ ) {
+		put_bits( out, &pos, q[0][c], 7 );
+		put_bits( out, &pos, q[1][c], 7 );
+	}
+	put_bits( out, &pos, p[0], 1 );
+	put_bits( out, &pos, p[1], 1 );
+	put_bits( out, &pos, idx[0], 3 );
+	for ( int i = 1; i < 16; i++ ) {
+		put_bits( out, &pos, idx[i], 4 );
+	}
+}
+
+/*--------------------------------IMAGE ENCODING------------------------------*/
+int bc_block_bytes( bc_format format ) {
+	return ( BC1 == format || BC4 == format ) ? 8 : 16;
+}
+
+struct bc_job {
+	const unsigned char *rgba;
+	int width, height;
+	bc_format format;
+	unsigned char *out;
+};
+
+/* one row of blocks. edge blocks repeat the last row/column of texels */
+static void compress_block_row( int by, void *user ) {
+	const bc_job *job = (const bc_job *)user;
+	int blocks_x = ( job->width + 3 ) / 4;
+	int block_bytes = bc_block_bytes( job->format );
+	unsigned char px[16][4];
+	for ( int bx = 0; bx < blocks_x; bx++ ) {
+		for ( int y = 0; y < 4; y++ ) {
+			int sy = by * 4 + y < job->height ? by * 4 + y : job->height - 1;
+			for ( int x = 0; x < 4; x++ ) {
+				int sx = bx * 4 + x < job->width ? bx * 4 + x : job->width - 1;
+				memcpy( px[y * 4 + x], &job->rgba[( sy * job->width + sx ) * 4], 4 );
+			}
+		}
+		unsigned char *out = &job->out[( by * blocks_x + bx ) * block_bytes];
+		switch ( job->format ) {
+		case BC1:
+			encode_bc1( px, out );
+			break;
+		case BC3:
+			encode_bc4( px, 3, out );
+			encode_bc1( px, out + 8 );
+			break;
+		case BC4:
+			encode_bc4( px, 0, out );
+			break;
+		case BC5:
+			encode_bc4( px, 0, out );
+			encode_bc4( px, 1, out + 8 );
+			break;
+		case BC7:
+			encode_bc7( px, out );
+			break;
+		}
+	}
+}
+
+void bc_compress_image( const unsigned char *rgba, int width, int height,
+												bc_format format, unsigned char *out ) {
+	bc_job job;
+	job.rgba = rgba;
+	job.width = width;
+	job.height = height;
+	job.format = format;
+	job.out = out;
+	parallel_for( ( height + 3 ) / 4, compress_block_row, &job );
+}
+
+static int level_bytes( bc_format format, int w, int h ) {
+	return ( ( w + 3 ) / 4 ) * ( ( h + 3 ) / 4 ) * bc_block_bytes( format );
+}
+
+bool alloc_compressed_levels( const mip_chain *chain, bc_format format,
+															compressed_texture *out ) {
+	memset( out, 0, sizeof( compressed_texture ) );
+	out->format = format;
+	out->width = chain->widths[0];
+	out->height = chain->heights[0];
+	out->level_count = chain->level_count;
+	for ( int l = 0; l < out->level_count; l++ ) {
+		out->level_sizes[l] = level_bytes( format, chain->widths[l], chain->heights[l] );
+		out->level_data[l] = (unsigned char *)malloc( out->level_sizes[l] );
+		if ( !out->level_data[l] ) {
+			free_compressed_texture( out );
+			return false;
+		}
+	}
+	return true;
+}
+
+void compress_level( const mip_chain *chain, int level, compressed_texture *ct ) {
+	bc_compress_image( chain->levels[level], chain->widths[level], chain->heights[level],
+										 ct->format, ct->level_data[level] );
+}
+
+bool compress_texture( const decoded_image *image, bc_format format,
+											 mip_content content, compressed_texture *out ) {
+	memset( out, 0, sizeof( compressed_texture ) );
+	mip_chain chain;
+	if ( !image->pixels ||
+			 !generate_mip_chain( image->pixels, image->width, image->height, content,
+														MIP_KAISER, &chain ) ) {
+		return false;
+	}
+	if ( !alloc_compressed_levels( &chain, format, out ) ) {
+		fprintf( stderr, "ERROR: out of memory compressing %s\n", image->file_name );
+		free_mip_chain( &chain );
+		return false;
+	}
+	for ( int l = 0; l < out->level_count; l++ ) {
+		compress_level( &chain, l, out );
+	}
+	free_mip_chain( &chain );
+	return true;
+}
+
+void free_compressed_level( compressed_texture *ct, int level ) {
+	free( ct->level_data[level] );
+	ct->level_data[level] = NULL;
+}
+
+void free_compressed_texture( compressed_texture *ct ) {
+	for ( int l = 0; l < BC_MAX_LEVELS; l++ ) {
+		free_compressed_level( ct, l );
+	}
+}
+
+/*-------------------------------------CACHE----------------------------------*/
+struct bc_cache_header {
+	char magic[4]; // "BCT1"
+	int version;
+	int format;
+	int width;
+	int height;
+	int level_count;
+	int level_sizes[BC_MAX_LEVELS];
+};
+
+static void cache_path( unsigned long long key, char *path, int max_len ) {
+	snprintf( path, max_len, "%s/%016llx.bct", BC_CACHE_DIR, key );
+}
+
+static bool read_cache( const char *path, bc_format format,
+												compressed_texture *ct ) {
+	FILE *f = fopen( path, "rb" );
+	if ( !f ) {
+		return false;
+	}
+	bc_cache_header header;
+	bool ok = 1 == fread( &header, sizeof( header ), 1, f ) &&
+						0 == memcmp( header.magic, "BCT1", 4 ) &&
+						BC_CACHE_VERSION == header.version && (int)format == header.format &&
+						header.level_count > 0 && header.level_count <= BC_MAX_LEVELS;
+	if ( ok ) {
+		memset( ct, 0, sizeof( compressed_texture ) );
+		ct->format = format;
+		ct->width = header.width;
+		ct->height = header.height;
+		ct->level_count = header.level_count;
+		for ( int l = 0; ok && l < header.level_count; l++ ) {
+			ct->level_sizes[l] = header.level_sizes[l];
+			ct->level_data[l] = (unsigned char *)malloc( header.level_sizes[l] );
+			ok = ct->level_data[l] && 1 == fread( ct->level_data[l], header.level_sizes[l], 1, f );
+		}
+		if ( !ok ) {
+			free_compressed_texture( ct );
+		}
+	}
+	fclose( f );
+	return ok;
+}
+
+static void write_cache( const char *path, const compressed_texture *ct ) {
+	bc_cache_header header;
+	memset( &header, 0, sizeof( header ) );
+	memcpy( header.magic, "BCT1", 4 );
+	header.version = BC_CACHE_VERSION;
+	header.format = (int)ct->format;
+	header.width = ct->width;
+	header.height = ct->height;
+	header.level_count = ct->level_count;
+	file_chunk chunks[1 + BC_MAX_LEVELS];
+	chunks[0] = { &header, sizeof( header ) };
+	for ( int l = 0; l < ct->level_count; l++ ) {
+		header.level_sizes[l] = ct->level_sizes[l];
+		chunks[1 + l] = { ct->level_data[l], (size_t)ct->level_sizes[l] };
+	}
+	if ( !write_file_atomic( path, chunks, 1 + ct->level_count ) ) {
+		gl_log_err( "WARNING: could not write texture cache %s\n", path );
+	}
+}
+
+/*-------------------------------------GL-------------------------------------*/
+GLenum bc_gl_format( bc_format format ) {
+	switch ( format ) {
+	case BC1:
+		return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case BC3:
+		return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case BC4:
+		return GL_COMPRESSED_RED_RGTC1;
+	case BC5:
+		return GL_COMPRESSED_RG_RGTC2;
+	case BC7:
+		return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	}
+	return 0;
+}
+
+bool bc_format_supported( bc_format format ) {
+	switch ( format ) {
+	case BC1:
+	case BC3:
+		return GLEW_EXT_texture_compression_s3tc;
+	case BC4:
+	case BC5:
+		return true; // RGTC is core since GL 3.0
+	case BC7:
+		return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+	}
+	return false;
+}
+
+bool upload_compressed_texture( const compressed_texture *ct, GLuint *tex ) {
+	for ( int l = 0; l < ct->level_count; l++ ) {
+		if ( !ct->level_data[l] ) {
+			return false;
+		}
+	}
+	glGenTextures( 1, tex );
+	glBindTexture( GL_TEXTURE_2D, *tex );
+	int w = ct->width, h = ct->height;
+	for ( int l = 0; l < ct->level_count; l++ ) {
+		glCompressedTexImage2D( GL_TEXTURE_2D, l, bc_gl_format( ct->format ), w, h, 0,
+														ct->level_sizes[l], ct->level_data[l] );
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, ct->level_count - 1 );
+	set_texture_filtering( GL_TEXTURE_2D );
+	return true;
+}
+
+bc_format bc_best_supported_format( bc_format format ) {
+	if ( BC7 == format && !bc_format_supported( BC7 ) ) {
+		return BC3; // still keeps alpha
+	}
+	return format;
+}
+
+bool bc_cache_key( const char *file_name, bc_format format, mip_content content,
+									 bool flip, unsigned long long *key ) {
+	/* hash the file itself, so an edited source image misses the cache */
+	FILE *f = fopen( file_name, "rb" );
+	if ( !f ) {
+		fprintf( stderr, "ERROR: could not load %s\n", file_name );
+		return false;
+	}
+	fseek( f, 0, SEEK_END );
+	long file_size = ftell( f );
+	fseek( f, 0, SEEK_SET );
+	unsigned char *file_data = (unsigned char *)malloc( file_size > 0 ? file_size : 1 );
+	bool read_ok = file_data && file_size > 0 && 1 == fread( file_data, file_size, 1, f );
+	fclose( f );
+	if ( !read_ok ) {
+		fprintf( stderr, "ERROR: could not read %s\n", file_name );
+		free( file_data );
+		return false;
+	}
+	*key = fnv1a64( file_data, file_size );
+	free( file_data );
+	int params[4] = { BC_CACHE_VERSION, (int)format, flip ? 1 : 0, (int)content };
+	*key = fnv1a64( (const unsigned char *)params, sizeof( params ), *key );
+	return true;
+}
+
+bool read_compressed_levels( unsigned long long key, bc_format format,
+														 const char *file_name, compressed_texture *ct ) {
+	char path[1024];
+	cache_path( key, path, sizeof( path ) );
+	if ( !read_cache( path, format, ct ) ) {
+		return false;
+	}
+	gl_log( "texture cache hit %s for %s\n", path, file_name );
+	return true;
+}
+
+void store_compressed_levels( unsigned long long key, const compressed_texture *ct ) {
+	char path[1024];
+	cache_path( key, path, sizeof( path ) );
+	write_cache( path, ct );
+}
+
+bool compress_and_cache( const decoded_image *image, bc_format format,
+												 mip_content content, unsigned long long key,
+												 compressed_texture *ct ) {
+	double start = glfwGetTime();
+	if ( !compress_texture( image, format, content, ct ) ) {
+		return false;
+	}
+	gl_log( "compressed %s to block format %i in %.3fs\n", image->file_name, format,
+					glfwGetTime() - start );
+	store_compressed_levels( key, ct );
+	return true;
+}
+
+bool load_compressed_levels( const char *file_name, bc_format format,
+														 mip_content content, bool flip,
+														 compressed_texture *ct ) {
+	unsigned long long key;
+	if ( !bc_cache_key( file_name, format, content, flip, &key ) ) {
+		return false;
+	}
+	if ( read_compressed_levels( key, format, file_name, ct ) ) {
+		return true;
+	}
+	decoded_image image;
+	memset( &image, 0, sizeof( decoded_image ) );
+	image.file_name = file_name;
+	image.flip = flip;
+	if ( !decode_image( &image ) ) {
+		return false;
+	}
+	bool ok = compress_and_cache( &image, format, content, key, ct );
+	free_decoded_image( &image );
+	return ok;
+}
+
+bool load_texture_compressed( const char *file_name, bc_format format,
+															mip_content content, GLuint *tex, bool flip ) {
+	/* a baked container beats compressing here */
+	char container[1024];
+	if ( find_texture_container( file_name, container, sizeof( container ) ) &&
+			 load_texture_container( container, tex ) ) {
+		return true;
+	}
+	format = bc_best_supported_format( format );
+	if ( !bc_format_supported( format ) ) {
+		gl_log( "no support for block format %i. loading %s uncompressed\n", format,
+						file_name );
+		return load_texture( file_name, tex, flip, content );
+	}
+	compressed_texture ct;
+	if ( !load_compressed_levels( file_name, format, content, flip, &ct ) ) {
+		return false;
+	}
+	bool ok = upload_compressed_texture( &ct, tex );
+	free_compressed_texture( &ct );
+	return ok;
+}
@@ -0,0 +1,89 @@
+/******************************************************************************\
+| CPU block compression (BC1/BC3/BC4/BC5/BC7) with an on-disk cache            |
+| Every 4x4 block is fitted with two endpoints along the principal axis of its |
+| colours, then each texel picks the nearest palette entry. The nearest-entry  |
+| search is SSE, 4 palette entries at a time, and block rows are spread over   |
+| the worker threads.                                                          |
+|   BC1 - RGB 565 endpoints, 2-bit indices. 4 bits per texel                   |
+|   BC3 - BC1 colour plus a BC4 alpha block. 8 bits per texel                  |
+|   BC4 - one channel, 8-bit endpoints, 3-bit indices. 4 bits per texel        |
+|   BC5 - two BC4 blocks for red and green, for tangent-space normal maps. the |
+|         shader rebuilds blue from the other two. 8 bits per texel            |
+|   BC7 - mode 6 only: RGBA 7777 endpoints plus a p-bit, 4-bit indices. 8 bits |
+|         per texel                                                            |
+| The mip chain comes from generate_mip_chain() before compression. Results    |
+| are cached in BC_CACHE_DIR under a hash of the source file's bytes, the      |
+| format, the flip setting and the mip content, so the encoder only runs once  |
+| per asset.                                                                   |
+\******************************************************************************/
+#ifndef _TEXTURE_COMPRESS_H_
+#define _TEXTURE_COMPRESS_H_
+
+#include <GL/glew.h>			// include GLEW and new version of GL on Windows
+#include "image_loader.h" // decoded_image
+#include "mipmap.h"				// mip_content
+
+#define BC_CACHE_DIR "cache"
+#define BC_MAX_LEVELS 16
+
+enum bc_format { BC1, BC3, BC4, BC5, BC7 };
+
+/* a full mip chain of compressed blocks, one allocation per level so each can
+be freed as soon as it has been uploaded */
+struct compressed_texture {
+	bc_format format;
+	int width;
+	int height;
+	int level_count;
+	int level_sizes[BC_MAX_LEVELS];
+	unsigned char *level_data[BC_MAX_LEVELS];
+};
+
+int bc_block_bytes( bc_format format );
+GLenum bc_gl_format( bc_format format );
+/* true if the GL context can sample this format */
+bool bc_format_supported( bc_format format );
+/* compress one RGBA8 image of width x height into out, which must hold
+ceil(w/4) * ceil(h/4) blocks */
+void bc_compress_image( const unsigned char *rgba, int width, int height,
+												bc_format format, unsigned char *out );
+/* filter a mip chain from the decoded image as content says, and compress
+every level */
+bool compress_texture( const decoded_image *image, bc_format format,
+											 mip_content content, compressed_texture *out );
+/* the same in steps, for a caller that wants levels in its own order: size and
+allocate a level for each of chain's, then compress them one at a time */
+bool alloc_compressed_levels( const mip_chain *chain, bc_format format,
+															compressed_texture *out );
+void compress_level( const mip_chain *chain, int level, compressed_texture *ct );
+/* the level's blocks are gone but its size stays */
+void free_compressed_level( compressed_texture *ct, int level );
+void free_compressed_texture( compressed_texture *ct );
+bool upload_compressed_texture( const compressed_texture *ct, GLuint *tex );
+/* BC7 needs BPTC, so this swaps it for BC3 on drivers without it */
+bc_format bc_best_supported_format( bc_format format );
+/* the cache key for an image: a hash of the file's bytes and the settings */
+bool bc_cache_key( const char *file_name, bc_format format, mip_content content,
+									 bool flip, unsigned long long *key );
+/* the cached levels under key, if there are any */
+bool read_compressed_levels( unsigned long long key, bc_format format,
+														 const char *file_name, compressed_texture *ct );
+/* write every level to the cache under key */
+void store_compressed_levels( unsigned long long key, const compressed_texture *ct );
+/* compress_texture() an image that is already decoded and cache it under key.
+lets a loader decode every cache miss in one decode_images() batch first */
+bool compress_and_cache( const decoded_image *image, bc_format format,
+												 mip_content content, unsigned long long key,
+												 compressed_texture *ct );
+/* the three above in a row for a single image. needs no GL context, so it can
+run on a loader thread */
+bool load_compressed_levels( const char *file_name, bc_format format,
+														 mip_content content, bool flip,
+														 compressed_texture *ct );
+/* load through the cache, compressing and filling the cache on a miss. falls
+back to plain load_texture() if the context has no support for the format.
+a baked .ktx2 or .dds next to the image takes priority over both */
+bool load_texture_compressed( const char *file_name, bc_format format,
+															mip_content content, GLuint *tex,
+															bool flip = true );
+#endif
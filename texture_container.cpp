@@ -0,0 +1,440 @@
+/******************************************************************************\
+| KTX2 and DDS texture containers - see texture_container.h                    |
+\******************************************************************************/
+#include "texture_container.h"
+#include "gl_utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* both containers are little-endian, as is every platform this builds for */
+static unsigned int read_u32( const unsigned char *p ) {
+	unsigned int v;
+	memcpy( &v, p, 4 );
+	return v;
+}
+
+static unsigned long long read_u64( const unsigned char *p ) {
+	unsigned long long v;
+	memcpy( &v, p, 8 );
+	return v;
+}
+
+static unsigned int fourcc( char a, char b, char c, char d ) {
+	return (unsigned int)a | ( (unsigned int)b << 8 ) | ( (unsigned int)c << 16 ) |
+				 ( (unsigned int)d << 24 );
+}
+
+/*------------------------------------FORMATS---------------------------------*/
+/* block_bytes is 0 for uncompressed formats */
+struct container_format {
+	GLenum internal_format;
+	int block_bytes;
+	GLenum format;
+	GLenum type;
+	int pixel_bytes;
+};
+
+static void set_compressed( container_format *cf, GLenum internal_format,
+														int block_bytes ) {
+	memset( cf, 0, sizeof( container_format ) );
+	cf->internal_format = internal_format;
+	cf->block_bytes = block_bytes;
+}
+
+static void set_uncompressed( container_format *cf, GLenum internal_format,
+															GLenum format ) {
+	memset( cf, 0, sizeof( container_format ) );
+	cf->internal_format = internal_format;
+	cf->format = format;
+	cf->type = GL_UNSIGNED_BYTE;
+	cf->pixel_bytes = 4;
+}
+
+/* KTX2 stores a VkFormat */
+static bool format_from_vk( unsigned int vk, container_format *cf ) {
+	switch ( vk ) {
+	case 37: set_uncompressed( cf, GL_RGBA8, GL_RGBA ); return true; // R8G8B8A8_UNORM
+	case 43: set_uncompressed( cf, GL_SRGB8_ALPHA8, GL_RGBA ); return true;
+	case 131: set_compressed( cf, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 8 ); return true;
+	case 132: set_compressed( cf, GL_COMPRESSED_SRGB_S3TC_DXT1_EXT, 8 ); return true;
+	case 133: set_compressed( cf, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 8 ); return true;
+	case 134: set_compressed( cf, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, 8 ); return true;
+	case 135: set_compressed( cf, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 16 ); return true;
+	case 136: set_compressed( cf, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT, 16 ); return true;
+	case 137: set_compressed( cf, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 16 ); return true;
+	case 138: set_compressed( cf, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 16 ); return true;
+	case 139: set_compressed( cf, GL_COMPRESSED_RED_RGTC1, 8 ); return true;
+	case 140: set_compressed( cf, GL_COMPRESSED_SIGNED_RED_RGTC1, 8 ); return true;
+	case 141: set_compressed( cf, GL_COMPRESSED_RG_RGTC2, 16 ); return true;
+	case 142: set_compressed( cf, GL_COMPRESSED_SIGNED_RG_RGTC2, 16 ); return true;
+	case 143: set_compressed( cf, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, 16 ); return true;
+	case 144: set_compressed( cf, GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT, 16 ); return true;
+	case 145: set_compressed( cf, GL_COMPRESSED_RGBA_BPTC_UNORM, 16 ); return true;
+	case 146: set_compressed( cf, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM, 16 ); return true;
+	}
+	return false;
+}
+
+/* DDS files with a DX10 header store a DXGI_FORMAT */
+static bool format_from_dxgi( unsigned int dxgi, container_format *cf ) {
+	switch ( dxgi ) {
+	case 28: set_uncompressed( cf, GL_RGBA8, GL_RGBA ); return true; // R8G8B8A8_UNORM
+	case 29: set_uncompressed( cf, GL_SRGB8_ALPHA8, GL_RGBA ); return true;
+	case 87: set_uncompressed( cf, GL_RGBA8, GL_BGRA ); return true; // B8G8R8A8_UNORM
+	case 91: set_uncompressed( cf, GL_SRGB8_ALPHA8, GL_BGRA ); return true;
+	case 71: set_compressed( cf, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 8 ); return true;
+	case 72: set_compressed( cf, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, 8 ); return true;
+	case 74: set_compressed( cf, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 16 ); return true;
+	case 75: set_compressed( cf, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT, 16 ); return true;
+	case 77: set_compressed( cf, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 16 ); return true;
+	case 78: set_compressed( cf, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 16 ); return true;
+	case 80: set_compressed( cf, GL_COMPRESSED_RED_RGTC1, 8 ); return true;
+	case 81: set_compressed( cf, GL_COMPRESSED_SIGNED_RED_RGTC1, 8 ); return true;
+	case 83: set_compressed( cf, GL_COMPRESSED_RG_RGTC2, 16 ); return true;
+	case 84: set_compressed( cf, GL_COMPRESSED_SIGNED_RG_RGTC2, 16 ); return true;
+	case 95: set_compressed( cf, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, 16 ); return true;
+	case 96: set_compressed( cf, GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT, 16 ); return true;
+	case 98: set_compressed( cf, GL_COMPRESSED_RGBA_BPTC_UNORM, 16 ); return true;
+	case 99: set_compressed( cf, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM, 16 ); return true;
+	}
+	return false;
+}
+
+/* bytes in one face of one mip level */
+static int image_bytes( const container_format *cf, int w, int h ) {
+	if ( cf->block_bytes ) {
+		return ( ( w + 3 ) / 4 ) * ( ( h + 3 ) / 4 ) * cf->block_bytes;
+	}
+	return w * h * cf->pixel_bytes;
+}
+
+static void store_format( const container_format *cf, texture_container *tc ) {
+	tc->internal_format = cf->internal_format;
+	tc->compressed = cf->block_bytes > 0;
+	tc->format = cf->format;
+	tc->type = cf->type;
+}
+
+/*-------------------------------------KTX2-----------------------------------*/
+#define KTX2_HEADER_BYTES 80
+#define KTX2_LEVEL_INDEX_BYTES 24
+
+static const unsigned char g_ktx2_magic[12] = { 0xAB, 'K',	'T',	'X',
+																								' ',	'2',	'0',	0xBB,
+																								'\r', '\n', 0x1A, '\n' };
+
+static bool parse_ktx2( const char *file_name, texture_container *tc ) {
+	const unsigned char *d = tc->file.data;
+	size_t size = tc->file.size;
+	if ( size < KTX2_HEADER_BYTES ) {
+		return false;
+	}
+	unsigned int vk_format = read_u32( d + 12 );
+	int width = (int)read_u32( d + 20 );
+	int height = (int)read_u32( d + 24 );
+	unsigned int depth = read_u32( d + 28 );
+	unsigned int layer_count = read_u32( d + 32 );
+	int face_count = (int)read_u32( d + 36 );
+	int level_count = (int)read_u32( d + 40 );
+	unsigned int supercompression = read_u32( d + 44 );
+	container_format cf;
+	if ( !format_from_vk( vk_format, &cf ) ) {
+		gl_log_err( "ERROR: %s has unsupported VkFormat %u\n", file_name, vk_format );
+		return false;
+	}
+	if ( supercompression != 0 || depth > 0 || layer_count > 0 ||
+			 ( face_count != 1 && face_count != 6 ) || width < 1 || height < 1 ) {
+		gl_log_err( "ERROR: %s is not a plain 2D or cube KTX2 texture\n", file_name );
+		return false;
+	}
+	/* level count 0 asks the loader to make the mips */
+	tc->generate_mips = 0 == level_count;
+	if ( tc->generate_mips ) {
+		if ( cf.block_bytes ) {
+			gl_log_err( "ERROR: %s has no mips and is block-compressed\n", file_name );
+			return false;
+		}
+		level_count = 1;
+	}
+	if ( level_count > CONTAINER_MAX_LEVELS ||
+			 size < KTX2_HEADER_BYTES + (size_t)level_count * KTX2_LEVEL_INDEX_BYTES ) {
+		return false;
+	}
+	store_format( &cf, tc );
+	tc->width = width;
+	tc->height = height;
+	tc->level_count = level_count;
+	tc->face_count = face_count;
+	int w = width, h = height;
+	for ( int l = 0; l < level_count; l++ ) {
+		const unsigned char *entry = d + KTX2_HEADER_BYTES + l * KTX2_LEVEL_INDEX_BYTES;
+		unsigned long long offset = read_u64( entry );
+		unsigned long long length = read_u64( entry + 8 );
+		int face_bytes = image_bytes( &cf, w, h );
+		if ( offset + length > size || length < (unsigned long long)face_bytes * face_count ) {
+			gl_log_err( "ERROR: %s mip level %i is truncated\n", file_name, l );
+			return false;
+		}
+		/* faces of a level are back to back */
+		for ( int f = 0; f < face_count; f++ ) {
+			tc->images[l][f] = d + offset + (size_t)f * face_bytes;
+		}
+		tc->image_sizes[l] = face_bytes;
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+	return true;
+}
+
+/*-------------------------------------DDS------------------------------------*/
+#define DDS_HEADER_BYTES 128 // including the magic
+#define DDS_DX10_HEADER_BYTES 20
+#define DDPF_FOURCC 0x4
+#define DDPF_RGB 0x40
+#define DDSCAPS2_CUBEMAP 0x200
+#define DDSCAPS2_CUBEMAP_ALLFACES 0xFC00
+#define DDS_RESOURCE_MISC_TEXTURECUBE 0x4
+
+static bool parse_dds( const char *file_name, texture_container *tc ) {
+	const unsigned char *d = tc->file.data;
+	size_t size = tc->file.size;
+	if ( size < DDS_HEADER_BYTES ) {
+		return false;
+	}
+	int height = (int)read_u32( d + 12 );
+	int width = (int)read_u32( d + 16 );
+	int level_count = (int)read_u32( d + 28 );
+	unsigned int pf_flags = read_u32( d + 80 );
+	unsigned int pf_fourcc = read_u32( d + 84 );
+	unsigned int pf_bits = read_u32( d + 88 );
+	unsigned int pf_rmask = read_u32( d + 92 );
+	unsigned int caps2 = read_u32( d + 112 );
+	size_t data_offset = DDS_HEADER_BYTES;
+	bool is_cube = ( caps2 & DDSCAPS2_CUBEMAP ) != 0;
+	if ( is_cube && ( caps2 & DDSCAPS2_CUBEMAP_ALLFACES ) != DDSCAPS2_CUBEMAP_ALLFACES ) {
+		gl_log_err( "ERROR: %s is a cube map without all 6 faces\n", file_name );
+		return false;
+	}
+
+	container_format cf;
+	bool known = false;
+	if ( pf_flags & DDPF_FOURCC ) {
+		if ( fourcc( 'D', 'X', '1', '0' ) == pf_fourcc ) {
+			if ( size < DDS_HEADER_BYTES + DDS_DX10_HEADER_BYTES ) {
+				return false;
+			}
+			const unsigned char *dx10 = d + DDS_HEADER_BYTES;
+			known = format_from_dxgi( read_u32( dx10 ), &cf );
+			is_cube = is_cube || ( read_u32( dx10 + 8 ) & DDS_RESOURCE_MISC_TEXTURECUBE );
+			if ( read_u32( dx10 + 12 ) > 1 ) {
+				gl_log_err( "ERROR: %s is a texture array\n", file_name );
+				return false;
+			}
+			data_offset += DDS_DX10_HEADER_BYTES;
+		} else if ( fourcc( 'D', 'X', 'T', '1' ) == pf_fourcc ) {
+			set_compressed( &cf, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 8 );
+			known = true;
+		} else if ( fourcc( 'D', 'X', 'T', '3' ) == pf_fourcc ) {
+			set_compressed( &cf, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 16 );
+			known = true;
+		} else if ( fourcc( 'D', 'X', 'T', '5' ) == pf_fourcc ) {
+			set_compressed( &cf, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 16 );
+			known = true;
+		} else if ( fourcc( 'A', 'T', 'I', '1' ) == pf_fourcc ||
+								fourcc( 'B', 'C', '4', 'U' ) == pf_fourcc ) {
+			set_compressed( &cf, GL_COMPRESSED_RED_RGTC1, 8 );
+			known = true;
+		} else if ( fourcc( 'A', 'T', 'I', '2' ) == pf_fourcc ||
+								fourcc( 'B', 'C', '5', 'U' ) == pf_fourcc ) {
+			set_compressed( &cf, GL_COMPRESSED_RG_RGTC2, 16 );
+			known = true;
+		}
+	} else if ( ( pf_flags & DDPF_RGB ) && 32 == pf_bits ) {
+		/* legacy uncompressed. only the two common byte orders */
+		if ( 0x000000FF == pf_rmask ) {
+			set_uncompressed( &cf, GL_RGBA8, GL_RGBA );
+			known = true;
+		} else if ( 0x00FF0000 == pf_rmask ) {
+			set_uncompressed( &cf, GL_RGBA8, GL_BGRA );
+			known = true;
+		}
+	}
+	if ( !known ) {
+		gl_log_err( "ERROR: %s has an unsupported DDS pixel format\n", file_name );
+		return false;
+	}
+	level_count = level_count > 0 ? level_count : 1;
+	if ( level_count > CONTAINER_MAX_LEVELS || width < 1 || height < 1 ) {
+		return false;
+	}
+	store_format( &cf, tc );
+	tc->width = width;
+	tc->height = height;
+	tc->level_count = level_count;
+	tc->face_count = is_cube ? 6 : 1;
+	/* unlike KTX2, each face holds its whole mip chain before the next face */
+	size_t offset = data_offset;
+	for ( int f = 0; f < tc->face_count; f++ ) {
+		int w = width, h = height;
+		for ( int l = 0; l < level_count; l++ ) {
+			int face_bytes = image_bytes( &cf, w, h );
+			if ( offset + face_bytes > size ) {
+				gl_log_err( "ERROR: %s is truncated\n", file_name );
+				return false;
+			}
+			tc->images[l][f] = d + offset;
+			tc->image_sizes[l] = face_bytes;
+			offset += face_bytes;
+			w = w > 1 ? w / 2 : 1;
+			h = h > 1 ? h / 2 : 1;
+		}
+	}
+	return true;
+}
+
+/*-----------------------------------OPENING----------------------------------*/
+bool open_texture_container( const char *file_name, texture_container *tc ) {
+	memset( tc, 0, sizeof( texture_container ) );
+	if ( !map_file( file_name, &tc->file ) ) {
+		gl_log_err( "ERROR: could not map %s\n", file_name );
+		return false;
+	}
+	bool ok = false;
+	if ( tc->file.size >= sizeof( g_ktx2_magic ) &&
+			 0 == memcmp( tc->file.data, g_ktx2_magic, sizeof( g_ktx2_magic ) ) ) {
+		ok = parse_ktx2( file_name, tc );
+	} else if ( tc->file.size >= 4 && 0 == memcmp( tc->file.data, "DDS ", 4 ) ) {
+		ok = parse_dds( file_name, tc );
+	} else {
+		gl_log_err( "ERROR: %s is not a KTX2 or DDS file\n", file_name );
+	}
+	if ( !ok ) {
+		close_texture_container( tc );
+	}
+	return ok;
+}
+
+void close_texture_container( texture_container *tc ) {
+	unmap_file( &tc->file );
+	memset( tc, 0, sizeof( texture_container ) );
+}
+
+bool find_texture_container( const char *image_file, char *path, int max_len ) {
+	const char *extensions[2] = { ".ktx2", ".dds" };
+	const char *dot = strrchr( image_file, '.' );
+	const char *slash = strrchr( image_file, '/' );
+	const char *backslash = strrchr( image_file, '\\' );
+	if ( !dot || ( slash && slash > dot ) || ( backslash && backslash > dot ) ) {
+		dot = image_file + strlen( image_file );
+	}
+	int stem_len = (int)( dot - image_file );
+	for ( int i = 0; i < 2; i++ ) {
+		if ( stem_len + (int)strlen( extensions[i] ) >= max_len ) {
+			return false;
+		}
+		memcpy( path, image_file, stem_len );
+		strcpy( path + stem_len, extensions[i] );
+		struct stat st;
+		if ( 0 == stat( path, &st ) ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*-------------------------------------GL-------------------------------------*/
+static bool has_texture_storage() {
+	return GLEW_VERSION_4_2 || GLEW_ARB_texture_storage;
+}
+
+bool container_format_supported( const texture_container *tc ) {
+	switch ( tc->internal_format ) {
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+	case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+		return GLEW_EXT_texture_compression_s3tc;
+	case GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT:
+	case GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT:
+	case GL_COMPRESSED_RGBA_BPTC_UNORM:
+	case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+		return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+	}
+	return true; // RGTC and RGBA8 are core
+}
+
+void allocate_container_storage( const texture_container *tc, GLenum target ) {
+	int levels = tc->level_count;
+	if ( tc->generate_mips ) {
+		/* room for the whole chain glGenerateMipmap() will fill in */
+		int size = tc->width > tc->height ? tc->width : tc->height;
+		for ( levels = 1; size > 1; size /= 2 ) {
+			levels++;
+		}
+	}
+	if ( has_texture_storage() ) {
+		glTexStorage2D( target, levels, tc->internal_format, tc->width, tc->height );
+	}
+	glTexParameteri( target, GL_TEXTURE_MAX_LEVEL, levels - 1 );
+}
+
+void upload_container_face( const texture_container *tc, int face,
+														GLenum face_target ) {
+	bool storage = has_texture_storage();
+	int w = tc->width, h = tc->height;
+	for ( int l = 0; l < tc->level_count; l++ ) {
+		const unsigned char *pixels = tc->images[l][face];
+		if ( tc->compressed && storage ) {
+			glCompressedTexSubImage2D( face_target, l, 0, 0, w, h, tc->internal_format,
+																 tc->image_sizes[l], pixels );
+		} else if ( tc->compressed ) {
+			glCompressedTexImage2D( face_target, l, tc->internal_format, w, h, 0,
+															tc->image_sizes[l], pixels );
+		} else if ( storage ) {
+			glTexSubImage2D( face_target, l, 0, 0, w, h, tc->format, tc->type, pixels );
+		} else {
+			glTexImage2D( face_target, l, tc->internal_format, w, h, 0, tc->format,
+										tc->type, pixels );
+		}
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+}
+
+bool load_texture_container( const char *file_name, GLuint *tex ) {
+	texture_container tc;
+	if ( !open_texture_container( file_name, &tc ) ) {
+		return false;
+	}
+	if ( !container_format_supported( &tc ) ) {
+		gl_log( "%s uses a format this driver can't sample. skipping it\n",
+						file_name );
+		close_texture_container( &tc );
+		return false;
+	}
+	GLenum target = 6 == tc.face_count ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+	glGenTextures( 1, tex );
+	glBindTexture( target, *tex );
+	allocate_container_storage( &tc, target );
+	for ( int f = 0; f < tc.face_count; f++ ) {
+		upload_container_face( &tc, f,
+													 6 == tc.face_count ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + f
+																							: GL_TEXTURE_2D );
+	}
+	if ( tc.generate_mips ) {
+		glGenerateMipmap( target );
+	}
+	set_texture_filtering( target );
+	if ( GL_TEXTURE_CUBE_MAP == target ) {
+		glTexParameteri( target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE );
+	}
+	gl_log( "loaded %s: %ix%i, %i levels, %i faces\n", file_name, tc.width,
+					tc.height, tc.level_count, tc.face_count );
+	close_texture_container( &tc );
+	return true;
+}
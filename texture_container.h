@@ -0,0 +1,60 @@
+/******************************************************************************\
+| KTX2 and DDS texture containers                                              |
+| Both formats store every mip level (and every cube face) already baked, so   |
+| loading is mapping the file and handing GL pointers into it - no decode, no  |
+| glGenerateMipmap. Block-compressed (BC1-7) and plain RGBA8 payloads are      |
+| supported. Supercompressed KTX2 (Basis, zstd) is rejected.                   |
+|******************************************************************************|
+| Callers don't have to know about the containers: load_texture() and friends  |
+| look for a .ktx2 or .dds with the same name next to the source image and use |
+| it instead when there is one.                                                |
+\******************************************************************************/
+#ifndef _TEXTURE_CONTAINER_H_
+#define _TEXTURE_CONTAINER_H_
+#include "mapped_file.h"
+#include <GL/glew.h>
+
+#define CONTAINER_MAX_LEVELS 16
+
+struct texture_container {
+	mapped_file file;
+	GLenum internal_format; // sized
+	/* only for uncompressed payloads */
+	GLenum format;
+	GLenum type;
+	bool compressed;
+	/* the file had no mips (KTX2 levelCount 0), so GL has to make them */
+	bool generate_mips;
+	int width;
+	int height;
+	int level_count;
+	int face_count; // 1 or 6. cube faces are in GL's +X,-X,+Y,-Y,+Z,-Z order
+	/* pointers into the mapped file */
+	const unsigned char *images[CONTAINER_MAX_LEVELS][6];
+	int image_sizes[CONTAINER_MAX_LEVELS];
+};
+
+/* map and validate a .ktx2 or .dds file (chosen by the magic number) */
+bool open_texture_container( const char *file_name, texture_container *tc );
+void close_texture_container( texture_container *tc );
+
+/* looks for image_file's name with a .ktx2, then a .dds, extension. writes the
+one it found into path */
+bool find_texture_container( const char *image_file, char *path, int max_len );
+
+/* false if the driver lacks the extension for the container's block format */
+bool container_format_supported( const texture_container *tc );
+
+/* give the bound texture on target enough storage for the container. this is
+immutable glTexStorage2D storage when the driver has it */
+void allocate_container_storage( const texture_container *tc, GLenum target );
+/* copy every level of one face into face_target: GL_TEXTURE_2D or one side of
+a cube map. allocate_container_storage() must have been called first */
+void upload_container_face( const texture_container *tc, int face,
+														GLenum face_target );
+
+/* open, upload to a new 2D or cube texture, close. images go up as they are
+stored, so bake them bottom row first (toktx --lower_left_maps_to_s0t0) */
+bool load_texture_container( const char *file_name, GLuint *tex );
+
+#endif
@@ -0,0 +1,418 @@
+/******************************************************************************\
+| GPU texture memory budget - see texture_manager.h                            |
+\******************************************************************************/
+#include "texture_manager.h"
+#include "gl_utils.h"
+#include "texture_container.h"
+#include "texture_stream.h"
+#include <stdio.h>
+#include <string.h>
+
+#define MB( bytes ) ( (double)( bytes ) / ( 1024.0 * 1024.0 ) )
+
+/*------------------------------------MEASURE---------------------------------*/
+/* uncompressed formats. drivers pad 3-channel formats out to 4 */
+static int texel_bytes( GLint internal_format ) {
+	switch ( internal_format ) {
+	case GL_R8:
+		return 1;
+	case GL_RG8:
+	case GL_R16F:
+		return 2;
+	case GL_RGBA16F:
+	case GL_RGB16F:
+		return 8;
+	case GL_RGBA32F:
+	case GL_RGB32F:
+		return 16;
+	default:
+		return 4; // RGBA8, RGB8 and their sRGB twins, depth, and anything else
+	}
+}
+
+static GLenum binding_for( GLenum target ) {
+	switch ( target ) {
+	case GL_TEXTURE_2D_ARRAY:
+		return GL_TEXTURE_BINDING_2D_ARRAY;
+	case GL_TEXTURE_CUBE_MAP:
+		return GL_TEXTURE_BINDING_CUBE_MAP;
+	case GL_TEXTURE_3D:
+		return GL_TEXTURE_BINDING_3D;
+	default:
+		return GL_TEXTURE_BINDING_2D;
+	}
+}
+
+long long measure_texture_bytes( GLuint tex, GLenum target ) {
+	if ( !tex ) {
+		return 0;
+	}
+	GLint previous = 0;
+	glGetIntegerv( binding_for( target ), &previous );
+	glBindTexture( target, tex );
+	/* level parameters of a cube map are per face, and every face is the same */
+	GLenum level_target = target;
+	int faces = 1;
+	if ( GL_TEXTURE_CUBE_MAP == target ) {
+		level_target = GL_TEXTURE_CUBE_MAP_POSITIVE_X;
+		faces = 6;
+	}
+	long long total = 0;
+	for ( int level = 0; level < MIP_MAX_LEVELS; level++ ) {
+		GLint w = 0, h = 0, d = 0, compressed = 0, format = 0;
+		glGetTexLevelParameteriv( level_target, level, GL_TEXTURE_WIDTH, &w );
+		if ( 0 == w ) {
+			break; // no more levels defined
+		}
+		glGetTexLevelParameteriv( level_target, level, GL_TEXTURE_HEIGHT, &h );
+		glGetTexLevelParameteriv( level_target, level, GL_TEXTURE_DEPTH, &d );
+		glGetTexLevelParameteriv( level_target, level, GL_TEXTURE_COMPRESSED, &compressed );
+		if ( compressed ) {
+			/* already covers every layer of an array level */
+			GLint size = 0;
+			glGetTexLevelParameteriv( level_target, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE,
+																&size );
+			total += (long long)size * faces;
+		} else {
+			glGetTexLevelParameteriv( level_target, level, GL_TEXTURE_INTERNAL_FORMAT, &format );
+			total += (long long)w * h * ( d > 0 ? d : 1 ) * texel_bytes( format ) * faces;
+		}
+	}
+	glBindTexture( target, previous );
+	return total;
+}
+
+/*-------------------------------------SLOTS----------------------------------*/
+void init_texture_manager( texture_manager *tm, long long budget_bytes ) {
+	memset( tm, 0, sizeof( texture_manager ) );
+	tm->budget = budget_bytes;
+	gl_log( "texture budget: %.1f MB\n", MB( budget_bytes ) );
+}
+
+static managed_texture *get( texture_manager *tm, texture_handle handle ) {
+	if ( handle < 0 || handle >= TEXTURE_MANAGER_MAX || !tm->textures[handle].in_use ) {
+		return NULL;
+	}
+	return &tm->textures[handle];
+}
+
+static texture_handle new_slot( texture_manager *tm, const char *name ) {
+	for ( int i = 0; i < TEXTURE_MANAGER_MAX; i++ ) {
+		managed_texture *t = &tm->textures[i];
+		if ( !t->in_use ) {
+			memset( t, 0, sizeof( managed_texture ) );
+			t->in_use = true;
+			t->ref_count = 1;
+			t->last_used = tm->frame;
+			snprintf( t->name, sizeof( t->name ), "%s", name );
+			return i;
+		}
+	}
+	gl_log_err( "ERROR: no room to manage another texture for %s\n", name );
+	return -1;
+}
+
+/* account for whatever t->tex holds now */
+static void remeasure( texture_manager *tm, managed_texture *t ) {
+	tm->resident_bytes -= t->bytes;
+	t->bytes = measure_texture_bytes( t->tex, t->target );
+	tm->resident_bytes += t->bytes;
+}
+
+/* (re)load a managed texture leaving out its dropped levels */
+static bool load( texture_manager *tm, managed_texture *t ) {
+	GLuint tex = 0;
+	bool ok;
+	if ( t->load_fn ) {
+		ok = t->load_fn( t->load_user, &tex );
+	} else if ( t->dropped_levels > 0 ) {
+		ok = load_texture_levels( t->name, &tex, t->flip, t->content, t->dropped_levels );
+	} else {
+		ok = load_texture( t->name, &tex, t->flip, t->content );
+	}
+	if ( !ok ) {
+		return false;
+	}
+	glDeleteTextures( 1, &t->tex );
+	t->tex = tex;
+	remeasure( tm, t );
+	return true;
+}
+
+texture_handle acquire_texture( texture_manager *tm, const char *file_name,
+																bool flip, mip_content content ) {
+	for ( int i = 0; i < TEXTURE_MANAGER_MAX; i++ ) {
+		managed_texture *t = &tm->textures[i];
+		if ( t->in_use && !t->tracked && !t->load_fn && !t->stream && t->flip == flip &&
+				 t->content == content && 0 == strcmp( t->name, file_name ) ) {
+			t->ref_count++;
+			return i;
+		}
+	}
+	texture_handle handle = new_slot( tm, file_name );
+	managed_texture *t = get( tm, handle );
+	if ( !t ) {
+		return -1;
+	}
+	t->flip = flip;
+	t->content = content;
+	t->target = GL_TEXTURE_2D;
+	char container[1024];
+	t->droppable = !find_texture_container( file_name, container, sizeof( container ) );
+	if ( !load( tm, t ) ) {
+		t->in_use = false;
+		return -1;
+	}
+	glBindTexture( GL_TEXTURE_2D, t->tex );
+	glGetTexLevelParameteriv( GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &t->width );
+	gl_log( "texture %s: %.2f MB. %.1f of %.1f MB in use\n", file_name, MB( t->bytes ),
+					MB( tm->resident_bytes ), MB( tm->budget ) );
+	return handle;
+}
+
+texture_handle acquire_texture_from( texture_manager *tm, const char *name,
+																		 GLenum target, texture_load_fn load_fn,
+																		 void *user ) {
+	for ( int i = 0; i < TEXTURE_MANAGER_MAX; i++ ) {
+		managed_texture *t = &tm->textures[i];
+		if ( t->in_use && t->load_fn == load_fn && t->load_user == user &&
+				 0 == strcmp( t->name, name ) ) {
+			t->ref_count++;
+			return i;
+		}
+	}
+	texture_handle handle = new_slot( tm, name );
+	managed_texture *t = get( tm, handle );
+	if ( !t ) {
+		return -1;
+	}
+	t->target = target;
+	t->load_fn = load_fn;
+	t->load_user = user;
+	if ( !load( tm, t ) ) {
+		t->in_use = false;
+		return -1;
+	}
+	gl_log( "texture %s: %.2f MB. %.1f of %.1f MB in use\n", name, MB( t->bytes ),
+					MB( tm->resident_bytes ), MB( tm->budget ) );
+	return handle;
+}
+
+/* streamed textures change size as they stream, so they are measured as used */
+static void measure_stream( texture_manager *tm, managed_texture *t ) {
+	tm->resident_bytes -= t->bytes;
+	t->bytes = streamed_texture_bytes( t->stream );
+	tm->resident_bytes += t->bytes;
+	if ( t->bytes > 0 && t->stream->top_level <= t->dropped_levels ) {
+		t->granted_bytes = 0; // the restored level is in, and counted in bytes
+	}
+}
+
+texture_handle acquire_streamed_texture( texture_manager *tm, const char *label,
+																				 streamed_texture *st ) {
+	texture_handle handle = new_slot( tm, label );
+	managed_texture *t = get( tm, handle );
+	if ( !t ) {
+		return -1;
+	}
+	t->stream = st;
+	t->target = st->target;
+	t->tex = st->tex;
+	measure_stream( tm, t );
+	return handle;
+}
+
+texture_handle track_texture( texture_manager *tm, const char *label, GLuint tex,
+															GLenum target ) {
+	texture_handle handle = new_slot( tm, label );
+	managed_texture *t = get( tm, handle );
+	if ( !t ) {
+		return -1;
+	}
+	t->tracked = true;
+	t->tex = tex;
+	t->target = target;
+	remeasure( tm, t );
+	gl_log( "texture %s: %.2f MB. %.1f of %.1f MB in use\n", label, MB( t->bytes ),
+					MB( tm->resident_bytes ), MB( tm->budget ) );
+	return handle;
+}
+
+void retrack_texture( texture_manager *tm, texture_handle handle, GLuint tex ) {
+	managed_texture *t = get( tm, handle );
+	if ( t && t->tracked ) {
+		t->tex = tex;
+		remeasure( tm, t );
+	}
+}
+
+static void forget( texture_manager *tm, managed_texture *t ) {
+	if ( !t->tracked && !t->stream ) {
+		glDeleteTextures( 1, &t->tex );
+	}
+	tm->resident_bytes -= t->bytes;
+	t->in_use = false;
+}
+
+void release_texture( texture_manager *tm, texture_handle handle ) {
+	managed_texture *t = get( tm, handle );
+	if ( t && --t->ref_count <= 0 ) {
+		forget( tm, t );
+	}
+}
+
+GLuint use_texture( texture_manager *tm, texture_handle handle ) {
+	managed_texture *t = get( tm, handle );
+	if ( !t ) {
+		return 0;
+	}
+	t->last_used = tm->frame;
+	if ( t->stream ) {
+		t->tex = t->stream->tex;
+		measure_stream( tm, t );
+		return t->tex;
+	}
+	if ( !t->tex && !t->tracked ) {
+		/* back in view. the budget is checked again at the end of the frame */
+		if ( load( tm, t ) ) {
+			gl_log( "texture %s reloaded: %.2f MB\n", t->name, MB( t->bytes ) );
+		}
+	}
+	return t->tex;
+}
+
+/*-------------------------------------BUDGET---------------------------------*/
+/* a streamed texture can give memory back while capping it leaves its top
+level at least TEXTURE_MIN_DROP_SIZE. it is never evicted */
+static bool stream_can_drop( const managed_texture *t ) {
+	const streamed_texture *st = t->stream;
+	int size = st->width > st->height ? st->width : st->height;
+	return t->dropped_levels + 1 < st->level_count &&
+				 size >> ( t->dropped_levels + 1 ) >= TEXTURE_MIN_DROP_SIZE;
+}
+
+/* the least recently sampled texture that could give memory back, not counting
+any used this frame */
+static managed_texture *least_recently_used( texture_manager *tm ) {
+	managed_texture *lru = NULL;
+	for ( int i = 0; i < TEXTURE_MANAGER_MAX; i++ ) {
+		managed_texture *t = &tm->textures[i];
+		bool can_shed = t->stream ? stream_can_drop( t ) : t->tex != 0;
+		if ( t->in_use && !t->tracked && can_shed && t->last_used < tm->frame &&
+				 ( !lru || t->last_used < lru->last_used ) ) {
+			lru = t;
+		}
+	}
+	return lru;
+}
+
+static void evict( texture_manager *tm, managed_texture *t ) {
+	gl_log( "texture %s evicted: %.2f MB freed\n", t->name, MB( t->bytes ) );
+	glDeleteTextures( 1, &t->tex );
+	t->tex = 0;
+	tm->resident_bytes -= t->bytes;
+	t->bytes = 0;
+}
+
+static void shed_memory( texture_manager *tm ) {
+	while ( tm->resident_bytes > tm->budget ) {
+		managed_texture *t = least_recently_used( tm );
+		if ( !t ) {
+			if ( !tm->over_budget ) {
+				gl_log_err( "WARNING: textures in use need %.1f MB, over the %.1f MB budget\n",
+										MB( tm->resident_bytes ), MB( tm->budget ) );
+				tm->over_budget = true;
+			}
+			return;
+		}
+		if ( t->stream ) {
+			long long before = t->bytes;
+			t->dropped_levels++;
+			t->granted_bytes = 0;
+			limit_streamed_texture( t->stream, t->dropped_levels );
+			measure_stream( tm, t );
+			gl_log( "texture %s capped at level %i: %.2f MB freed\n", t->name,
+							t->dropped_levels, MB( before - t->bytes ) );
+			continue;
+		}
+		int top = t->width >> t->dropped_levels;
+		if ( !t->droppable || top / 2 < TEXTURE_MIN_DROP_SIZE ) {
+			evict( tm, t );
+			continue;
+		}
+		long long before = t->bytes;
+		t->dropped_levels++;
+		if ( load( tm, t ) ) {
+			gl_log( "texture %s dropped to %ipx: %.2f MB freed\n", t->name, top / 2,
+							MB( before - t->bytes ) );
+		} else {
+			evict( tm, t );
+		}
+	}
+	tm->over_budget = false;
+}
+
+/* give the most recently used texture with dropped mips one level back, if
+that fits. a level is about 3x the size of everything below it. levels given
+back to streamed textures count as used from then on, and a texture that has
+not grown into the last one it was given gets no more */
+static void restore_memory( texture_manager *tm ) {
+	managed_texture *mru = NULL;
+	long long committed = tm->resident_bytes;
+	for ( int i = 0; i < TEXTURE_MANAGER_MAX; i++ ) {
+		managed_texture *t = &tm->textures[i];
+		if ( !t->in_use ) {
+			continue;
+		}
+		committed += t->granted_bytes;
+		if ( !t->tracked && ( t->tex || t->stream ) && t->dropped_levels > 0 &&
+				 0 == t->granted_bytes && ( !mru || t->last_used > mru->last_used ) ) {
+			mru = t;
+		}
+	}
+	if ( !mru || committed + mru->bytes * 3 > tm->budget ) {
+		return;
+	}
+	mru->dropped_levels--;
+	if ( mru->stream ) {
+		/* the storage grows again as the finer level streams in */
+		mru->granted_bytes = mru->bytes * 3;
+		limit_streamed_texture( mru->stream, mru->dropped_levels );
+		gl_log( "texture %s may stream to level %i again\n", mru->name,
+						mru->dropped_levels );
+	} else if ( load( tm, mru ) ) {
+		gl_log( "texture %s restored to %ipx: %.2f MB\n", mru->name,
+						mru->width >> mru->dropped_levels, MB( mru->bytes ) );
+	}
+}
+
+void end_texture_frame( texture_manager *tm ) {
+	if ( tm->resident_bytes > tm->budget ) {
+		shed_memory( tm );
+	} else {
+		restore_memory( tm );
+	}
+	tm->frame++;
+}
+
+void log_texture_usage( const texture_manager *tm ) {
+	gl_log( "texture memory: %.1f of %.1f MB\n", MB( tm->resident_bytes ),
+					MB( tm->budget ) );
+	for ( int i = 0; i < TEXTURE_MANAGER_MAX; i++ ) {
+		const managed_texture *t = &tm->textures[i];
+		if ( !t->in_use ) {
+			continue;
+		}
+		gl_log( "  %8.2f MB %s%s%s%s\n", MB( t->bytes ), t->name,
+						t->tracked ? " (tracked)" : "", t->stream ? " (streamed)" : "",
+						t->tex ? "" : " (evicted)" );
+	}
+}
+
+void free_texture_manager( texture_manager *tm ) {
+	for ( int i = 0; i < TEXTURE_MANAGER_MAX; i++ ) {
+		if ( tm->textures[i].in_use ) {
+			forget( tm, &tm->textures[i] );
+		}
+	}
+}
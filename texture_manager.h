@@ -0,0 +1,98 @@
+/******************************************************************************\
+| GPU texture memory budget                                                    |
+| Owns textures loaded from files behind reference-counted handles, and keeps  |
+| count of how many bytes each one holds on the GPU, from its format and the   |
+| mips it has. Textures created elsewhere (the sky-box, streamed arrays) can be|
+| tracked too, so they count against the budget, but they are never touched.   |
+|******************************************************************************|
+| Call use_texture() whenever a texture is bound for drawing, and              |
+| end_texture_frame() once a frame. While the total is over budget, the least  |
+| recently sampled texture sheds its biggest mip, or is evicted altogether once|
+| it is down to TEXTURE_MIN_DROP_SIZE (or is a baked container, whose levels   |
+| can't be dropped). An evicted texture comes back the next time it is used,   |
+| and dropped mips come back one at a time when there is room again. Reloads   |
+| come out of the image cache, so they don't decode anything. Every drop,      |
+| eviction and restore goes to the log.                                        |
+\******************************************************************************/
+#ifndef _TEXTURE_MANAGER_H_
+#define _TEXTURE_MANAGER_H_
+#include "mipmap.h" // mip_content
+#include <GL/glew.h>
+
+#define TEXTURE_MANAGER_MAX 256
+#define TEXTURE_NAME_MAX 256
+/* nothing is dropped below this many pixels across. evicted instead */
+#define TEXTURE_MIN_DROP_SIZE 128
+
+typedef int texture_handle; // -1 for none
+/* makes a new texture object each time, for textures the manager can't load
+from one image file itself, such as cube maps */
+typedef bool ( *texture_load_fn )( void *user, GLuint *tex );
+struct streamed_texture;
+
+struct managed_texture {
+	bool in_use; // slot taken
+	char name[TEXTURE_NAME_MAX]; // the file, or a label for tracked textures
+	bool flip;
+	mip_content content;
+	bool tracked; // created elsewhere. counted but never dropped or evicted
+	bool droppable; // false for baked containers - only all or nothing
+	texture_load_fn load_fn; // NULL to load name as an image file
+	void *load_user;
+	/* budgeted through the finest level it may stream, rather than reloaded.
+	dropped_levels is that level */
+	streamed_texture *stream;
+	int ref_count;
+	GLuint tex; // 0 while evicted
+	GLenum target;
+	int width; // of level 0 of the file, whatever is resident
+	int dropped_levels; // how many of the biggest mips are left out
+	long long bytes; // GPU memory held right now
+	/* a streamed texture's restored level, counted against the budget until its
+	storage has grown to take it */
+	long long granted_bytes;
+	unsigned long long last_used; // frame it was last sampled in
+};
+
+struct texture_manager {
+	long long budget;
+	long long resident_bytes;
+	unsigned long long frame;
+	bool over_budget; // logged once per stretch of being stuck over budget
+	managed_texture textures[TEXTURE_MANAGER_MAX];
+};
+
+void init_texture_manager( texture_manager *tm, long long budget_bytes );
+/* load the file, or add a reference if it is already loaded the same way */
+texture_handle acquire_texture( texture_manager *tm, const char *file_name,
+																bool flip = true, mip_content content = MIP_COLOUR );
+/* the same for a texture made by load_fn, which is called again to reload it
+after an eviction. it can only be evicted whole, never dropped a level */
+texture_handle acquire_texture_from( texture_manager *tm, const char *name,
+																		 GLenum target, texture_load_fn load_fn,
+																		 void *user );
+/* budget a streamed texture by capping how fine it may stream. it must stay
+at the same address until released, and the caller still frees it */
+texture_handle acquire_streamed_texture( texture_manager *tm, const char *label,
+																				 streamed_texture *st );
+/* count a texture created elsewhere against the budget. it is never dropped
+or evicted, so only for textures that can't be made again */
+texture_handle track_texture( texture_manager *tm, const char *label, GLuint tex,
+															GLenum target );
+/* for tracked textures whose object was replaced. measures it again */
+void retrack_texture( texture_manager *tm, texture_handle handle, GLuint tex );
+/* drop a reference. the last one deletes the texture, unless it is tracked */
+void release_texture( texture_manager *tm, texture_handle handle );
+/* the texture to bind this frame, reloading it if it was evicted. the name can
+change from frame to frame, so don't keep it */
+GLuint use_texture( texture_manager *tm, texture_handle handle );
+/* enforce the budget and start the next frame */
+void end_texture_frame( texture_manager *tm );
+/* every texture and its size, and the total against the budget */
+void log_texture_usage( const texture_manager *tm );
+/* bytes a texture object holds, from its format and every defined level.
+binds it to the active unit, and restores whatever was bound there */
+long long measure_texture_bytes( GLuint tex, GLenum target );
+/* releases everything, deleting the textures the manager loaded */
+void free_texture_manager( texture_manager *tm );
+#endif
@@ -0,0 +1,713 @@
+/******************************************************************************\
+| Progressive texture streaming - see texture_stream.h                         |
+\******************************************************************************/
+#include "texture_stream.h"
+#include "gl_utils.h"
+#include "texture_manager.h" // measure_texture_bytes
+#include "upload_ring.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define STREAM_QUEUE_MAX 64
+
+/* one loader thread is plenty: the work is file IO and, on a cold cache, the
+encoder - which already spreads each image over the worker pool */
+struct stream_loader {
+	std::mutex mutex; // guards the queue and every texture's state
+	std::condition_variable wake;
+	std::condition_variable loaded;
+	streamed_texture *queue[STREAM_QUEUE_MAX];
+	int head;
+	int count;
+};
+
+static stream_loader *g_loader = NULL;
+
+static bool has_texture_storage() {
+	return GLEW_VERSION_4_2 || GLEW_ARB_texture_storage;
+}
+
+/*--------------------------------LOADER THREAD-------------------------------*/
+/* open the layer's baked container if it has one it can stream. false means the
+levels have to come from the BC cache instead */
+static bool open_container( stream_layer *layer ) {
+	char path[1024];
+	if ( !find_texture_container( layer->file_name, path, sizeof( path ) ) ||
+			 !open_texture_container( path, &layer->container ) ) {
+		return false;
+	}
+	if ( layer->container.face_count != 1 || layer->container.generate_mips ) {
+		close_texture_container( &layer->container ); // nothing to stream in those
+		return false;
+	}
+	layer->from_container = true;
+	return true;
+}
+
+/* fill in one layer's level table from its container or compressed levels, and
+check it agrees with the layers before it - and, loading a second time, with
+what the storage was allocated for */
+static bool describe_layer( streamed_texture *st, int index ) {
+	stream_layer *layer = &st->layers[index];
+	GLenum internal_format, pixel_format = 0, pixel_type = 0;
+	bool compressed = true;
+	int width, height, level_count;
+	if ( layer->from_container ) {
+		texture_container *tc = &layer->container;
+		internal_format = tc->internal_format;
+		compressed = tc->compressed;
+		pixel_format = tc->format;
+		pixel_type = tc->type;
+		width = tc->width;
+		height = tc->height;
+		level_count = tc->level_count;
+		for ( int l = 0; l < level_count; l++ ) {
+			layer->level_data[l] = tc->images[l][0];
+			layer->level_sizes[l] = tc->image_sizes[l];
+		}
+	} else {
+		compressed_texture *ct = &layer->levels;
+		internal_format = bc_gl_format( ct->format );
+		width = ct->width;
+		height = ct->height;
+		level_count = ct->level_count;
+		for ( int l = 0; l < level_count; l++ ) {
+			layer->level_data[l] = ct->level_data[l];
+			layer->level_sizes[l] = ct->level_sizes[l];
+		}
+	}
+	if ( 0 == index && 0 == st->level_count ) {
+		st->internal_format = internal_format;
+		st->compressed = compressed;
+		st->pixel_format = pixel_format;
+		st->pixel_type = pixel_type;
+		st->width = width;
+		st->height = height;
+		st->level_count = level_count;
+		return true;
+	}
+	if ( internal_format != st->internal_format || width != st->width ||
+			 height != st->height || level_count != st->level_count ) {
+		gl_log_err( "ERROR: %s doesn't match the size and format of %s\n",
+								layer->file_name, st->layers[0].file_name );
+		return false;
+	}
+	return true;
+}
+
+/* hand this level and the coarser ones over to the GL thread */
+static void publish_levels( streamed_texture *st, int level ) {
+	std::lock_guard<std::mutex> lock( g_loader->mutex );
+	st->loaded_level = level;
+}
+
+/* containers and cache hits first, then every layer that missed the cache is
+decoded in one decode_images() batch on the worker threads. the misses are
+encoded a level at a time from the smallest up, each level handed over as soon
+as every layer has it, and only cached once the whole chain is done */
+static bool load_chain( streamed_texture *st ) {
+	decoded_image misses[STREAM_MAX_LAYERS];
+	mip_chain chains[STREAM_MAX_LAYERS];
+	unsigned long long keys[STREAM_MAX_LAYERS];
+	int miss_layers[STREAM_MAX_LAYERS];
+	int miss_count = 0;
+	for ( int i = 0; i < st->layer_count; i++ ) {
+		stream_layer *layer = &st->layers[i];
+		if ( open_container( layer ) ) {
+			continue;
+		}
+		unsigned long long key;
+		if ( !bc_cache_key( layer->file_name, st->format, layer->content, st->flip, &key ) ) {
+			return false;
+		}
+		if ( read_compressed_levels( key, st->format, layer->file_name, &layer->levels ) ) {
+			continue;
+		}
+		decoded_image *image = &misses[miss_count];
+		memset( image, 0, sizeof( decoded_image ) );
+		image->file_name = layer->file_name;
+		image->flip = st->flip;
+		keys[miss_count] = key;
+		miss_layers[miss_count] = i;
+		miss_count++;
+	}
+	bool ok = miss_count > 0 ? decode_images( misses, miss_count ) : true;
+	int chain_count = 0;
+	for ( ; ok && chain_count < miss_count; chain_count++ ) {
+		const decoded_image *image = &misses[chain_count];
+		stream_layer *layer = &st->layers[miss_layers[chain_count]];
+		if ( !generate_mip_chain( image->pixels, image->width, image->height,
+															layer->content, MIP_KAISER, &chains[chain_count] ) ) {
+			ok = false;
+			break;
+		}
+		if ( !alloc_compressed_levels( &chains[chain_count], st->format, &layer->levels ) ) {
+			fprintf( stderr, "ERROR: out of memory compressing %s\n", image->file_name );
+			ok = false;
+		}
+	}
+	for ( int i = 0; ok && i < st->layer_count; i++ ) {
+		ok = describe_layer( st, i );
+	}
+	if ( ok ) {
+		double start = glfwGetTime();
+		for ( int l = miss_count > 0 ? st->level_count - 1 : 0; l >= 0; l-- ) {
+			for ( int m = 0; m < miss_count; m++ ) {
+				compress_level( &chains[m], l, &st->layers[miss_layers[m]].levels );
+			}
+			publish_levels( st, l );
+		}
+		if ( miss_count > 0 ) {
+			gl_log( "compressed %i of %i layers of %s to block format %i in %.3fs\n",
+							miss_count, st->layer_count, st->layers[0].file_name, st->format,
+							glfwGetTime() - start );
+		}
+		for ( int m = 0; m < miss_count; m++ ) {
+			store_compressed_levels( keys[m], &st->layers[miss_layers[m]].levels );
+		}
+	}
+	for ( int m = 0; m < chain_count; m++ ) {
+		free_mip_chain( &chains[m] );
+	}
+	for ( int m = 0; m < miss_count; m++ ) {
+		free_decoded_image( &misses[m] ); // after the chains - level 0 points into it
+	}
+	return ok;
+}
+
+static void loader_main( stream_loader *loader ) {
+	while ( true ) {
+		streamed_texture *st;
+		{
+			std::unique_lock<std::mutex> lock( loader->mutex );
+			while ( 0 == loader->count ) {
+				loader->wake.wait( lock );
+			}
+			st = loader->queue[loader->head];
+			loader->head = ( loader->head + 1 ) % STREAM_QUEUE_MAX;
+			loader->count--;
+		}
+		bool ok = load_chain( st );
+		std::lock_guard<std::mutex> lock( loader->mutex );
+		if ( !ok ) {
+			st->state = STREAM_FAILED;
+		}
+		st->loading = false;
+		loader->loaded.notify_all();
+	}
+}
+
+static stream_loader *get_loader() {
+	if ( !g_loader ) {
+		// deliberately leaked - the thread is parked forever and dies with the process
+		g_loader = new stream_loader;
+		g_loader->head = 0;
+		g_loader->count = 0;
+		std::thread( loader_main, g_loader ).detach();
+	}
+	return g_loader;
+}
+
+/* hand the texture to the loader, from nothing loaded. false if the queue is
+full */
+static bool queue_load( streamed_texture *st ) {
+	stream_loader *loader = get_loader();
+	std::lock_guard<std::mutex> lock( loader->mutex );
+	if ( STREAM_QUEUE_MAX == loader->count ) {
+		return false;
+	}
+	st->loading = true;
+	st->loaded_level = BC_MAX_LEVELS;
+	loader->queue[( loader->head + loader->count ) % STREAM_QUEUE_MAX] = st;
+	loader->count++;
+	loader->wake.notify_one();
+	return true;
+}
+
+/* the state and how far the loader has got, all at one moment */
+static stream_state get_progress( streamed_texture *st, int *loaded_level,
+																	bool *loading ) {
+	std::lock_guard<std::mutex> lock( g_loader->mutex );
+	*loaded_level = st->loaded_level;
+	*loading = st->loading;
+	return st->state;
+}
+
+static stream_state get_state( streamed_texture *st ) {
+	std::lock_guard<std::mutex> lock( g_loader->mutex );
+	return st->state;
+}
+
+static void set_state( streamed_texture *st, stream_state state ) {
+	std::lock_guard<std::mutex> lock( g_loader->mutex );
+	st->state = state;
+}
+
+/*----------------------------------GL THREAD---------------------------------*/
+static void make_placeholder( streamed_texture *st ) {
+	const unsigned char grey[4] = { 128, 128, 128, 255 };
+	glGenTextures( 1, &st->tex );
+	glBindTexture( st->target, st->tex );
+	if ( GL_TEXTURE_2D_ARRAY == st->target ) {
+		/* one layer is enough - higher layer indices clamp to it */
+		glTexImage3D( st->target, 0, GL_RGBA, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey );
+	} else {
+		glTexImage2D( st->target, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey );
+	}
+	glTexParameteri( st->target, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+	glTexParameteri( st->target, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+}
+
+/* the synchronous way, for when streaming isn't possible */
+static void load_all_at_once( streamed_texture *st ) {
+	bool ok;
+	if ( GL_TEXTURE_2D_ARRAY == st->target ) {
+		const char *file_names[STREAM_MAX_LAYERS];
+		mip_content contents[STREAM_MAX_LAYERS];
+		for ( int i = 0; i < st->layer_count; i++ ) {
+			file_names[i] = st->layers[i].file_name;
+			contents[i] = st->layers[i].content;
+		}
+		ok = load_texture_array( file_names, st->layer_count, &st->tex, st->flip,
+														 contents );
+	} else {
+		ok = load_texture( st->layers[0].file_name, &st->tex, st->flip,
+											 st->layers[0].content );
+	}
+	if ( !ok ) {
+		make_placeholder( st );
+	}
+}
+
+static void start_streaming( const char **file_names, const mip_content *contents,
+														 int count, GLenum target, bc_format format,
+														 bool flip, streamed_texture *st ) {
+	memset( st, 0, sizeof( streamed_texture ) );
+	st->target = target;
+	st->format = bc_best_supported_format( format );
+	st->flip = flip;
+	st->screen_pixels = 1e9f;
+	st->loaded_level = BC_MAX_LEVELS;
+	st->layer_count = count;
+	st->layers = (stream_layer *)calloc( count, sizeof( stream_layer ) );
+	for ( int i = 0; i < count; i++ ) {
+		st->layers[i].file_name = file_names[i];
+		st->layers[i].content = contents[i];
+	}
+	if ( !bc_format_supported( st->format ) ) {
+		gl_log( "no support for block format %i. loading %s uncompressed\n",
+						st->format, file_names[0] );
+		load_all_at_once( st );
+		st->state = STREAM_DONE;
+		return;
+	}
+	make_placeholder( st );
+	st->state = STREAM_LOADING;
+	if ( !queue_load( st ) ) {
+		st->state = STREAM_FAILED; // picked up as a synchronous load next update
+	}
+}
+
+void stream_texture( const char *file_name, bc_format format, mip_content content,
+										 bool flip, streamed_texture *st ) {
+	start_streaming( &file_name, &content, 1, GL_TEXTURE_2D, format, flip, st );
+}
+
+void stream_texture_array( const char **file_names, const mip_content *contents,
+													 int count, bc_format format, bool flip,
+													 streamed_texture *st ) {
+	if ( count > STREAM_MAX_LAYERS ) {
+		gl_log_err( "ERROR: can't stream %i layers. only the first %i will load\n",
+								count, STREAM_MAX_LAYERS );
+		count = STREAM_MAX_LAYERS;
+	}
+	start_streaming( file_names, contents, count, GL_TEXTURE_2D_ARRAY, format, flip,
+									 st );
+}
+
+void stream_texture_feedback( streamed_texture *st, float screen_pixels ) {
+	st->screen_pixels = screen_pixels;
+}
+
+/* storage for chain level top and the smaller ones, bound */
+static void allocate_storage( streamed_texture *st, int top, bool storage ) {
+	int levels = st->level_count - top;
+	int w = st->width >> top, h = st->height >> top;
+	w = w > 0 ? w : 1;
+	h = h > 0 ? h : 1;
+	glGenTextures( 1, &st->tex );
+	glBindTexture( st->target, st->tex );
+	if ( storage && GL_TEXTURE_2D_ARRAY == st->target ) {
+		glTexStorage3D( st->target, levels, st->internal_format, w, h, st->layer_count );
+	} else if ( storage ) {
+		glTexStorage2D( st->target, levels, st->internal_format, w, h );
+	}
+	glTexParameteri( st->target, GL_TEXTURE_MAX_LEVEL, levels - 1 );
+	set_texture_filtering( st->target );
+	st->top_level = top;
+}
+
+/* mutable storage gets each level defined empty, then filled like the
+immutable kind */
+static void define_level( streamed_texture *st, int level ) {
+	int w = st->width >> level, h = st->height >> level;
+	w = w > 0 ? w : 1;
+	h = h > 0 ? h : 1;
+	int bytes = st->layers[0].level_sizes[level];
+	int gl_level = level - st->top_level;
+	bool array = GL_TEXTURE_2D_ARRAY == st->target;
+	if ( st->compressed && array ) {
+		glCompressedTexImage3D( st->target, gl_level, st->internal_format, w, h,
+														st->layer_count, 0, bytes * st->layer_count, NULL );
+	} else if ( st->compressed ) {
+		glCompressedTexImage2D( st->target, gl_level, st->internal_format, w, h, 0, bytes,
+														NULL );
+	} else if ( array ) {
+		glTexImage3D( st->target, gl_level, st->internal_format, w, h, st->layer_count, 0,
+									st->pixel_format, st->pixel_type, NULL );
+	} else {
+		glTexImage2D( st->target, gl_level, st->internal_format, w, h, 0, st->pixel_format,
+									st->pixel_type, NULL );
+	}
+}
+
+/* fill count layers of a level from first on, from data laid out one layer
+after another - in client memory or at an offset into the bound unpack
+buffer */
+static void put_layers( streamed_texture *st, int level, int first, int count,
+												const void *data ) {
+	int w = st->width >> level, h = st->height >> level;
+	w = w > 0 ? w : 1;
+	h = h > 0 ? h : 1;
+	int bytes = st->layers[0].level_sizes[level];
+	int gl_level = level - st->top_level;
+	bool array = GL_TEXTURE_2D_ARRAY == st->target;
+	if ( st->compressed && array ) {
+		glCompressedTexSubImage3D( st->target, gl_level, 0, 0, first, w, h, count,
+															 st->internal_format, bytes * count, data );
+	} else if ( st->compressed ) {
+		glCompressedTexSubImage2D( st->target, gl_level, 0, 0, w, h, st->internal_format,
+															 bytes, data );
+	} else if ( array ) {
+		glTexSubImage3D( st->target, gl_level, 0, 0, first, w, h, count, st->pixel_format,
+										 st->pixel_type, data );
+	} else {
+		glTexSubImage2D( st->target, gl_level, 0, 0, w, h, st->pixel_format,
+										 st->pixel_type, data );
+	}
+}
+
+static void upload_level( streamed_texture *st, int level, bool storage ) {
+	int bytes = st->layers[0].level_sizes[level];
+	if ( !storage ) {
+		define_level( st, level );
+	}
+	/* each layer goes through the upload ring, so GL copies it into the texture
+	whenever it gets round to it instead of stalling here. if the ring is full
+	even after finishing the batch, straight from client memory as before */
+	upload_ring *ring = default_upload_ring();
+	for ( int i = 0; i < st->layer_count; i++ ) {
+		const void *data = st->layers[i].level_data[level];
+		size_t offset;
+		unsigned char *dest = upload_ring_alloc( ring, bytes, &offset );
+		if ( !dest ) {
+			upload_ring_end_batch( ring );
+			dest = upload_ring_alloc( ring, bytes, &offset );
+		}
+		if ( dest ) {
+			memcpy( dest, data, bytes );
+			upload_ring_bind( ring );
+			data = UPLOAD_RING_OFFSET( offset );
+		}
+		put_layers( st, level, i, 1, data );
+		upload_ring_unbind();
+	}
+	st->uploaded_level = level;
+}
+
+/* sample only this level and coarser ones. the texture must be bound. the lod
+clamp counts from the base level, so only one of the two moves: immutable
+storage has every level, so clamping the lod is enough and is cheap to change,
+but mutable storage is incomplete until the base level skips the empty ones */
+static void set_residency( streamed_texture *st, int level, bool storage ) {
+	st->resident_level = level;
+	if ( storage ) {
+		glTexParameterf( st->target, GL_TEXTURE_MIN_LOD, (float)( level - st->top_level ) );
+	} else {
+		glTexParameteri( st->target, GL_TEXTURE_BASE_LEVEL, level - st->top_level );
+	}
+}
+
+/* move to storage that starts at chain level top, keeping every uploaded level
+it still covers. their CPU copies are gone, so they are copied on the GPU
+through a pixel pack buffer. the texture name changes */
+static void reallocate_storage( streamed_texture *st, int top, bool storage ) {
+	int first = top > st->uploaded_level ? top : st->uploaded_level;
+	size_t total = 0;
+	for ( int l = first; l < st->level_count; l++ ) {
+		total += (size_t)st->layers[0].level_sizes[l] * st->layer_count;
+	}
+	GLuint old_tex = st->tex;
+	int old_top = st->top_level;
+	GLuint buffer;
+	glGenBuffers( 1, &buffer );
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, buffer );
+	glBufferData( GL_PIXEL_PACK_BUFFER, total, NULL, GL_STREAM_COPY );
+	/* level sizes are tightly packed */
+	glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	glBindTexture( st->target, old_tex );
+	size_t offset = 0;
+	for ( int l = first; l < st->level_count; l++ ) {
+		if ( st->compressed ) {
+			glGetCompressedTexImage( st->target, l - old_top, (void *)offset );
+		} else {
+			glGetTexImage( st->target, l - old_top, st->pixel_format, st->pixel_type,
+										 (void *)offset );
+		}
+		offset += (size_t)st->layers[0].level_sizes[l] * st->layer_count;
+	}
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+	allocate_storage( st, top, storage );
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, buffer );
+	offset = 0;
+	for ( int l = first; l < st->level_count; l++ ) {
+		if ( !storage ) {
+			define_level( st, l );
+		}
+		put_layers( st, l, 0, st->layer_count, UPLOAD_RING_OFFSET( offset ) );
+		offset += (size_t)st->layers[0].level_sizes[l] * st->layer_count;
+	}
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+	glPixelStorei( GL_PACK_ALIGNMENT, 4 );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+	glDeleteBuffers( 1, &buffer );
+	glDeleteTextures( 1, &old_tex );
+	gl_log( "%s%s storage now starts at level %i: %ix%i\n", st->layers[0].file_name,
+					st->layer_count > 1 ? " and others" : "", top, st->width >> top,
+					st->height >> top );
+	st->uploaded_level = first;
+	set_residency( st, st->resident_level > first ? st->resident_level : first, storage );
+}
+
+static bool level_in_memory( const streamed_texture *st, int level ) {
+	for ( int i = 0; i < st->layer_count; i++ ) {
+		if ( !st->layers[i].level_data[level] ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void release_chain( streamed_texture *st ) {
+	for ( int i = 0; i < st->layer_count; i++ ) {
+		stream_layer *layer = &st->layers[i];
+		if ( layer->from_container ) {
+			close_texture_container( &layer->container );
+		} else {
+			free_compressed_texture( &layer->levels );
+		}
+		layer->from_container = false;
+		memset( layer->level_data, 0, sizeof( layer->level_data ) );
+	}
+}
+
+/* free the CPU copy of every level that is up. only while the loader doesn't
+hold the texture. container levels are pages of a mapped file, not heap, so
+those stay mapped until the whole chain is up */
+static void free_uploaded_levels( streamed_texture *st ) {
+	if ( 0 == st->uploaded_level ) {
+		release_chain( st );
+		return;
+	}
+	for ( int l = st->uploaded_level; l < st->level_count; l++ ) {
+		for ( int i = 0; i < st->layer_count; i++ ) {
+			stream_layer *layer = &st->layers[i];
+			if ( !layer->from_container ) {
+				free_compressed_level( &layer->levels, l );
+				layer->level_data[l] = NULL;
+			}
+		}
+	}
+}
+
+/* the level whose size is closest to, but not below, the on-screen size, and
+no finer than the texture manager allows */
+static int wanted_level( const streamed_texture *st ) {
+	int size = st->width > st->height ? st->width : st->height;
+	if ( st->screen_pixels <= 1.0f ) {
+		return st->level_count - 1;
+	}
+	int level = (int)floorf( log2f( (float)size / st->screen_pixels ) );
+	level = level > st->finest_level ? level : st->finest_level;
+	return level < st->level_count - 1 ? level : st->level_count - 1;
+}
+
+/* swap the placeholder for real storage and put up as much of the tail as is
+loaded so far */
+static void begin_streaming( streamed_texture *st, int loaded_level ) {
+	for ( int i = 0; i < st->layer_count; i++ ) {
+		if ( st->layers[i].from_container &&
+				 !container_format_supported( &st->layers[i].container ) ) {
+			gl_log( "%s has a container format this driver can't sample\n",
+							st->layers[i].file_name );
+			set_state( st, STREAM_FAILED ); // the chain goes once the loader is done
+			return;
+		}
+	}
+	bool storage = has_texture_storage();
+	glDeleteTextures( 1, &st->tex );
+	/* no room for levels finer than are wanted yet */
+	st->wanted_level = wanted_level( st );
+	allocate_storage( st, st->wanted_level, storage );
+	/* smallest first. the last level always goes up even if it is big */
+	upload_level( st, st->level_count - 1, storage );
+	for ( int l = st->level_count - 2; l >= loaded_level && l >= st->top_level; l-- ) {
+		int w = st->width >> l, h = st->height >> l;
+		if ( w > STREAM_TAIL_SIZE || h > STREAM_TAIL_SIZE ) {
+			break;
+		}
+		upload_level( st, l, storage );
+	}
+	set_residency( st, st->uploaded_level, storage );
+	gl_log( "streaming %s%s: %ix%i, %i layers, %i levels, storage from level %i, %i "
+					"resident at first\n",
+					st->layers[0].file_name, st->layer_count > 1 ? " and others" : "",
+					st->width, st->height, st->layer_count, st->level_count, st->top_level,
+					st->level_count - st->uploaded_level );
+	set_state( st, STREAM_STREAMING );
+}
+
+bool update_texture_streaming( streamed_texture *textures, int count,
+															 int byte_budget ) {
+	if ( !g_loader ) {
+		return false; // nothing was ever queued
+	}
+	glActiveTexture( GL_TEXTURE0 );
+	bool storage = has_texture_storage();
+	bool replaced = false;
+	for ( int i = 0; i < count; i++ ) {
+		streamed_texture *st = &textures[i];
+		int loaded_level;
+		bool loading;
+		stream_state state = get_progress( st, &loaded_level, &loading );
+		if ( STREAM_LOADING == state && loaded_level < BC_MAX_LEVELS ) {
+			begin_streaming( st, loaded_level );
+			state = get_progress( st, &loaded_level, &loading );
+			replaced = true;
+		}
+		if ( STREAM_FAILED == state && !loading ) {
+			gl_log_err( "WARNING: could not stream %s. loading it in one go\n",
+									st->layers[0].file_name );
+			release_chain( st );
+			glDeleteTextures( 1, &st->tex );
+			load_all_at_once( st );
+			set_state( st, STREAM_DONE );
+			replaced = true;
+		}
+		if ( STREAM_STREAMING != state ) {
+			continue;
+		}
+		/* the clamp follows the wanted level both ways, as far as there is data.
+		storage only grows here. it shrinks when the texture manager says so */
+		st->wanted_level = wanted_level( st );
+		if ( st->wanted_level < st->top_level ) {
+			reallocate_storage( st, st->wanted_level, storage );
+			replaced = true;
+		}
+		int resident =
+			st->wanted_level > st->uploaded_level ? st->wanted_level : st->uploaded_level;
+		if ( resident != st->resident_level ) {
+			glBindTexture( st->target, st->tex );
+			set_residency( st, resident, storage );
+		}
+		if ( loading ) {
+			continue;
+		}
+		free_uploaded_levels( st );
+		/* wanted again after its CPU copy went. the cache makes loading it a
+		second time cheap. if the queue is full it is tried again next frame */
+		int next = st->uploaded_level - 1;
+		if ( next >= st->wanted_level && !level_in_memory( st, next ) ) {
+			release_chain( st );
+			queue_load( st );
+		}
+	}
+
+	/* one level per texture per pass, so a big texture doesn't starve the rest.
+	at least one level goes up each frame however small the budget */
+	bool progress = true;
+	while ( progress && byte_budget > 0 ) {
+		progress = false;
+		for ( int i = 0; i < count && byte_budget > 0; i++ ) {
+			streamed_texture *st = &textures[i];
+			int loaded_level;
+			bool loading;
+			if ( STREAM_STREAMING != get_progress( st, &loaded_level, &loading ) ) {
+				continue;
+			}
+			int level = st->uploaded_level - 1;
+			if ( level < st->wanted_level || level < loaded_level ||
+					 ( !loading && !level_in_memory( st, level ) ) ) {
+				continue;
+			}
+			glBindTexture( st->target, st->tex );
+			upload_level( st, level, storage );
+			set_residency( st, level, storage );
+			byte_budget -= st->layers[0].level_sizes[level] * st->layer_count;
+			progress = true;
+		}
+	}
+	upload_ring_end_batch( default_upload_ring() );
+	return replaced;
+}
+
+void limit_streamed_texture( streamed_texture *st, int finest_level ) {
+	st->finest_level = finest_level > 0 ? finest_level : 0;
+	if ( !g_loader || STREAM_STREAMING != get_state( st ) ) {
+		return; // storage is sized to the limit when it is allocated
+	}
+	int top = st->finest_level < st->level_count - 1 ? st->finest_level : st->level_count - 1;
+	if ( top > st->top_level ) {
+		glActiveTexture( GL_TEXTURE0 );
+		reallocate_storage( st, top, has_texture_storage() );
+	}
+}
+
+long long streamed_texture_bytes( streamed_texture *st ) {
+	stream_state state = g_loader ? get_state( st ) : st->state;
+	if ( STREAM_DONE == state ) {
+		return measure_texture_bytes( st->tex, st->target );
+	}
+	if ( STREAM_STREAMING != state ) {
+		return 0; // a 1x1 placeholder
+	}
+	/* mutable storage only has the levels defined so far */
+	int first = has_texture_storage() ? st->top_level : st->uploaded_level;
+	long long total = 0;
+	for ( int l = first; l < st->level_count; l++ ) {
+		total += (long long)st->layers[0].level_sizes[l] * st->layer_count;
+	}
+	return total;
+}
+
+void free_streamed_texture( streamed_texture *st ) {
+	if ( g_loader ) {
+		std::unique_lock<std::mutex> lock( g_loader->mutex );
+		while ( st->loading ) {
+			g_loader->loaded.wait( lock );
+		}
+	}
+	if ( st->layers ) {
+		release_chain( st );
+		free( st->layers );
+		st->layers = NULL;
+	}
+	glDeleteTextures( 1, &st->tex );
+	st->tex = 0;
+	st->state = STREAM_DONE;
+}
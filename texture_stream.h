@@ -0,0 +1,115 @@
+/******************************************************************************\
+| Progressive texture streaming                                                |
+| A streamed texture is usable the moment it is created: it starts as a 1x1    |
+| grey placeholder while a loader thread fetches its mip chain (from a baked   |
+| container, or from the BC cache / encoder). The loader hands levels over     |
+| smallest first - a cold cache encodes the chain from the 1x1 level up - so   |
+| the GL thread allocates the full storage as soon as the smallest level       |
+| exists and uploads each level once it is loaded, the small tail in one go    |
+| and the rest a few levels per frame within a byte budget. Each level's CPU   |
+| copy is freed once it is uploaded. Texture arrays stream the same way, one   |
+| level of every layer at a time.                                              |
+|******************************************************************************|
+| How far down the chain a texture goes is driven by the render loop: it tells |
+| each texture how many pixels its object covers on screen, and levels finer   |
+| than that are not uploaded until they would be visible. The resident level   |
+| follows that both ways: as the object moves away sampling is clamped to a    |
+| coarser level, and moving back in lowers the clamp again down to the finest  |
+| level uploaded. The clamp is GL_TEXTURE_MIN_LOD on immutable storage and     |
+| GL_TEXTURE_BASE_LEVEL otherwise, so sampling never touches a level that has  |
+| no data yet.                                                                 |
+| Storage is only allocated from the finest level wanted so far, and grows as  |
+| finer ones are wanted. The texture manager can cap the finest level, which   |
+| moves the texture to smaller storage on the spot; the levels that stay are   |
+| copied on the GPU. Levels wanted again after their CPU copy went are loaded  |
+| a second time, from the cache.                                               |
+\******************************************************************************/
+#ifndef _TEXTURE_STREAM_H_
+#define _TEXTURE_STREAM_H_
+#include "texture_compress.h"
+#include "texture_container.h"
+#include <GL/glew.h>
+
+/* levels this size and smaller go up together as soon as the chain loads */
+#define STREAM_TAIL_SIZE 64
+#define STREAM_BYTES_PER_FRAME ( 1024 * 1024 )
+#define STREAM_MAX_LAYERS 64
+
+enum stream_state {
+	STREAM_LOADING,		// nothing loaded yet. still the placeholder
+	STREAM_STREAMING, // storage allocated. levels go up as they load and are wanted
+	STREAM_DONE,			// loaded in one go when streaming wasn't possible
+	STREAM_FAILED
+};
+
+/* one image's mip chain, from whichever of the two it was loaded into. a
+level_data entry is NULL once that level's CPU copy is freed */
+struct stream_layer {
+	const char *file_name; // not copied
+	mip_content content;
+	bool from_container;
+	texture_container container;
+	compressed_texture levels;
+	const unsigned char *level_data[BC_MAX_LEVELS];
+	int level_sizes[BC_MAX_LEVELS];
+};
+
+/* must stay at the same address from stream_texture() until
+free_streamed_texture() - the loader thread holds a pointer to it */
+struct streamed_texture {
+	/* always safe to bind, but the name changes once when the real storage
+	replaces the placeholder */
+	GLuint tex;
+	GLenum target; // GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY
+	bc_format format;
+	bool flip;
+	stream_state state; // only touch through the functions below
+	bool loading;				// the loader thread holds it. guarded like state
+	/* every layer has this level and all coarser ones in memory. handed over by
+	the loader, smallest first. BC_MAX_LEVELS while there are none */
+	int loaded_level;
+	/* from stream_texture_feedback(). level 0 is wanted until told otherwise */
+	float screen_pixels;
+	int wanted_level;
+	int uploaded_level; // most detailed level with data in the storage
+	int resident_level; // most detailed level sampled. never finer than uploaded
+	int top_level;			// the chain level that is level 0 of the storage
+	int finest_level;		// from limit_streamed_texture(). 0 unless memory is short
+	int layer_count;
+	stream_layer *layers;
+	/* every layer has to agree on these */
+	GLenum internal_format;
+	bool compressed;
+	GLenum pixel_format; // only for uncompressed containers
+	GLenum pixel_type;
+	int width;
+	int height;
+	int level_count;
+};
+
+/* create the placeholder and queue the file on the loader thread. falls back
+to a plain synchronous load_texture() if the block format isn't supported */
+void stream_texture( const char *file_name, bc_format format, mip_content content,
+										 bool flip, streamed_texture *st );
+/* the same for a GL_TEXTURE_2D_ARRAY, layer i being file_names[i] with mips
+filtered as contents[i]. the images must all be the same size and the names
+must outlive the texture */
+void stream_texture_array( const char **file_names, const mip_content *contents,
+													 int count, bc_format format, bool flip,
+													 streamed_texture *st );
+/* how many pixels across the texture's object is on screen this frame */
+void stream_texture_feedback( streamed_texture *st, float screen_pixels );
+/* call once a frame on the GL thread. uploads go through texture unit 0, which
+is left active. returns true when a texture object was replaced, so anything
+bound earlier needs binding again */
+bool update_texture_streaming( streamed_texture *textures, int count,
+															 int byte_budget );
+/* stream nothing finer than finest_level. raising it moves the texture to
+smaller storage now, so the name changes. for the texture manager */
+void limit_streamed_texture( streamed_texture *st, int finest_level );
+/* GPU memory the texture holds right now */
+long long streamed_texture_bytes( streamed_texture *st );
+/* waits for the loader if it is still busy with this texture */
+void free_streamed_texture( streamed_texture *st );
+
+#endif
@@ -0,0 +1,120 @@
+/******************************************************************************\
+| Uniform reflection and the per-frame uniform block - see uniforms.h          |
+\******************************************************************************/
+#include "uniforms.h"
+#include "gl_utils.h"
+#include "image_cache.h" // fnv1a64
+#include <stdio.h>
+#include <string.h>
+
+/* uniform blocks with a fixed binding, by block name */
+struct known_block {
+	const char *name;
+	GLuint binding;
+	GLint size;
+};
+static const known_block known_blocks[] = {
+	{ "frame_uniforms", FRAME_UNIFORMS_BINDING, (GLint)sizeof( frame_uniforms ) } };
+#define KNOWN_BLOCK_COUNT ( (int)( sizeof( known_blocks ) / sizeof( known_blocks[0] ) ) )
+
+static unsigned long long hash_name( const char *name ) {
+	return fnv1a64( (const unsigned char *)name, strlen( name ) );
+}
+
+/*------------------------------------REFLECT---------------------------------*/
+bool reflect_programme( GLuint programme, programme_info *info ) {
+	memset( info, 0, sizeof( programme_info ) );
+	info->programme = programme;
+	if ( !programme ) {
+		return false;
+	}
+	GLint block_count = 0;
+	glGetProgramiv( programme, GL_ACTIVE_UNIFORM_BLOCKS, &block_count );
+	if ( block_count > PROGRAMME_MAX_BLOCKS ) {
+		gl_log_err( "WARNING: program %u has %i uniform blocks. only reflecting %i\n",
+								programme, block_count, PROGRAMME_MAX_BLOCKS );
+		block_count = PROGRAMME_MAX_BLOCKS;
+	}
+	for ( int b = 0; b < block_count; b++ ) {
+		uniform_block_info *block = &info->blocks[b];
+		glGetActiveUniformBlockName( programme, b, UNIFORM_MAX_NAME, NULL, block->name );
+		glGetActiveUniformBlockiv( programme, b, GL_UNIFORM_BLOCK_DATA_SIZE, &block->size );
+		glGetActiveUniformBlockiv( programme, b, GL_UNIFORM_BLOCK_BINDING, &block->binding );
+	}
+	info->block_count = block_count;
+
+	GLint uniform_count = 0;
+	glGetProgramiv( programme, GL_ACTIVE_UNIFORMS, &uniform_count );
+	if ( uniform_count > PROGRAMME_MAX_UNIFORMS ) {
+		gl_log_err( "WARNING: program %u has %i uniforms. only reflecting %i\n", programme,
+								uniform_count, PROGRAMME_MAX_UNIFORMS );
+		uniform_count = PROGRAMME_MAX_UNIFORMS;
+	}
+	for ( int i = 0; i < uniform_count; i++ ) {
+		uniform_info *u = &info->uniforms[i];
+		glGetActiveUniform( programme, i, UNIFORM_MAX_NAME, NULL, &u->size, &u->type, u->name );
+		/* arrays are listed as "name[0]". look them up by plain name */
+		char *bracket = strchr( u->name, '[' );
+		if ( bracket ) {
+			*bracket = '\0';
+		}
+		u->name_hash = hash_name( u->name );
+		GLuint index = (GLuint)i;
+		glGetActiveUniformsiv( programme, 1, &index, GL_UNIFORM_BLOCK_INDEX, &u->block );
+		glGetActiveUniformsiv( programme, 1, &index, GL_UNIFORM_OFFSET, &u->offset );
+		u->location = u->block < 0 ? glGetUniformLocation( programme, u->name ) : -1;
+	}
+	info->uniform_count = uniform_count;
+	gl_log( "program %u: %i uniforms, %i blocks\n", programme, uniform_count, block_count );
+	return true;
+}
+
+const uniform_info *find_uniform( const programme_info *info, const char *name ) {
+	unsigned long long h = hash_name( name );
+	for ( int i = 0; i < info->uniform_count; i++ ) {
+		const uniform_info *u = &info->uniforms[i];
+		if ( u->name_hash == h && 0 == strcmp( u->name, name ) ) {
+			return u;
+		}
+	}
+	return NULL;
+}
+
+GLint uniform_location( const programme_info *info, const char *name ) {
+	const uniform_info *u = find_uniform( info, name );
+	return u ? u->location : -1;
+}
+
+void bind_uniform_blocks( GLuint programme ) {
+	for ( int k = 0; k < KNOWN_BLOCK_COUNT; k++ ) {
+		GLuint index = glGetUniformBlockIndex( programme, known_blocks[k].name );
+		if ( GL_INVALID_INDEX == index ) {
+			continue; // this program doesn't use it
+		}
+		GLint size = 0;
+		glGetActiveUniformBlockiv( programme, index, GL_UNIFORM_BLOCK_DATA_SIZE, &size );
+		/* drivers may or may not round the end up to a vec4, so only bigger is wrong */
+		if ( size > known_blocks[k].size ) {
+			gl_log_err( "WARNING: block %s in program %u is %i bytes but the engine's is %i\n",
+									known_blocks[k].name, programme, size, known_blocks[k].size );
+		}
+		glUniformBlockBinding( programme, index, known_blocks[k].binding );
+	}
+}
+
+/*-------------------------------------FRAME----------------------------------*/
+void init_frame_uniforms( GLuint *ubo ) {
+	glGenBuffers( 1, ubo );
+	glBindBuffer( GL_UNIFORM_BUFFER, *ubo );
+	glBufferData( GL_UNIFORM_BUFFER, sizeof( frame_uniforms ), NULL, GL_DYNAMIC_DRAW );
+	glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+}
+
+void update_frame_uniforms( GLuint ubo, const frame_uniforms *fu ) {
+	glBindBuffer( GL_UNIFORM_BUFFER, ubo );
+	/* orphan last frame's copy rather than wait for draws still reading it */
+	glBufferData( GL_UNIFORM_BUFFER, sizeof( frame_uniforms ), NULL, GL_DYNAMIC_DRAW );
+	glBufferSubData( GL_UNIFORM_BUFFER, 0, sizeof( frame_uniforms ), fu );
+	glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+	glBindBufferBase( GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, ubo );
+}
@@ -0,0 +1,70 @@
+/******************************************************************************\
+| Uniform reflection and the per-frame uniform block                           |
+| reflect_programme() reads a linked program's active uniforms and uniform     |
+| blocks once, into a table of locations, types, and offsets within blocks,    |
+| so nothing asks GL for a location by name while drawing.                     |
+|******************************************************************************|
+| Everything that is the same for every program during a frame - view and      |
+| projection, the camera position and the time - lives in one std140 uniform   |
+| block, "frame_uniforms" in shader/frame_uniforms.glsl. It is uploaded and    |
+| bound once per frame, at FRAME_UNIFORMS_BINDING, and every program reads     |
+| it from there, so neither the uploads nor the program switches grow with     |
+| the number of programs. GLSL 4.1 can't give a block its binding in the       |
+| shader, so bind_uniform_blocks() does it right after each link.              |
+\******************************************************************************/
+#ifndef _UNIFORMS_H_
+#define _UNIFORMS_H_
+#include <GL/glew.h>
+
+#define PROGRAMME_MAX_UNIFORMS 64
+#define PROGRAMME_MAX_BLOCKS 8
+#define UNIFORM_MAX_NAME 64
+#define FRAME_UNIFORMS_BINDING 0
+
+struct uniform_info {
+	unsigned long long name_hash;
+	char name[UNIFORM_MAX_NAME]; // arrays without the "[0]"
+	GLenum type;
+	GLint size;			// array length, or 1
+	GLint location; // -1 for block members
+	GLint block;		// index into programme_info::blocks, or -1
+	GLint offset;		// bytes into the block, for block members
+};
+
+struct uniform_block_info {
+	char name[UNIFORM_MAX_NAME];
+	GLint size; // bytes
+	GLint binding;
+};
+
+struct programme_info {
+	GLuint programme;
+	uniform_info uniforms[PROGRAMME_MAX_UNIFORMS];
+	int uniform_count;
+	uniform_block_info blocks[PROGRAMME_MAX_BLOCKS];
+	int block_count;
+};
+
+bool reflect_programme( GLuint programme, programme_info *info );
+/* like glGetUniformLocation(), from the table. -1 if it isn't active */
+GLint uniform_location( const programme_info *info, const char *name );
+/* the uniform's entry, or NULL if it isn't active */
+const uniform_info *find_uniform( const programme_info *info, const char *name );
+/* point every block the engine knows about at its binding. call after linking */
+void bind_uniform_blocks( GLuint programme );
+
+/* std140 layout of frame_uniforms. every member starts on a 16-byte boundary,
+so the C struct needs no padding of its own beyond the end */
+struct frame_uniforms {
+	float V[16];
+	float P[16];
+	float VP[16]; // P * V
+	float cam_pos_wor[4]; // w is 1
+	float time; // seconds since start
+	float pad[3];
+};
+
+void init_frame_uniforms( GLuint *ubo );
+/* upload this frame's values, and bind them for every program */
+void update_frame_uniforms( GLuint ubo, const frame_uniforms *fu );
+#endif
@@ -0,0 +1,224 @@
+/******************************************************************************\
+| Upload ring - see upload_ring.h                                              |
+\******************************************************************************/
+#include "upload_ring.h"
+#include "gl_utils.h"
+#include <string.h>
+
+static size_t align_up( size_t offset ) {
+	return ( offset + UPLOAD_RING_ALIGNMENT - 1 ) & ~(size_t)( UPLOAD_RING_ALIGNMENT - 1 );
+}
+
+bool init_upload_ring( upload_ring *ring, size_t size ) {
+	memset( ring, 0, sizeof( upload_ring ) );
+	ring->size = size;
+	glGenBuffers( 1, &ring->buffer );
+	glBindBuffer( GL_COPY_WRITE_BUFFER, ring->buffer );
+	if ( GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage ) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage( GL_COPY_WRITE_BUFFER, size, NULL, flags );
+		ring->mapped = (unsigned char *)glMapBufferRange( GL_COPY_WRITE_BUFFER, 0, size, flags );
+		ring->persistent = NULL != ring->mapped;
+		if ( !ring->persistent ) {
+			/* storage is immutable, so start again with a plain buffer */
+			glDeleteBuffers( 1, &ring->buffer );
+			glGenBuffers( 1, &ring->buffer );
+			glBindBuffer( GL_COPY_WRITE_BUFFER, ring->buffer );
+		}
+	}
+	if ( !ring->persistent ) {
+		glBufferData( GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_DRAW );
+	}
+	glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+	gl_log( "upload ring: %i MB, %s\n", (int)( size / ( 1024 * 1024 ) ),
+					ring->persistent ? "persistently mapped" : "mapped per batch" );
+	return true;
+}
+
+/* block until the oldest batch is done with. false if there isn't one */
+static bool wait_oldest( upload_ring *ring ) {
+	if ( 0 == ring->batch_count ) {
+		return false;
+	}
+	upload_batch *batch = &ring->batches[ring->first_batch];
+	GLenum result = glClientWaitSync( batch->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0 );
+	while ( GL_TIMEOUT_EXPIRED == result ) {
+		result = glClientWaitSync( batch->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000 );
+	}
+	glDeleteSync( batch->fence );
+	ring->first_batch = ( ring->first_batch + 1 ) % UPLOAD_RING_MAX_BATCHES;
+	ring->batch_count--;
+	return true;
+}
+
+/* drop batches the GPU has finished with, without waiting */
+static void retire_signalled( upload_ring *ring ) {
+	while ( ring->batch_count > 0 ) {
+		upload_batch *batch = &ring->batches[ring->first_batch];
+		GLenum result = glClientWaitSync( batch->fence, 0, 0 );
+		if ( GL_ALREADY_SIGNALED != result && GL_CONDITION_SATISFIED != result ) {
+			return;
+		}
+		glDeleteSync( batch->fence );
+		ring->first_batch = ( ring->first_batch + 1 ) % UPLOAD_RING_MAX_BATCHES;
+		ring->batch_count--;
+	}
+}
+
+void free_upload_ring( upload_ring *ring ) {
+	upload_ring_end_batch( ring );
+	while ( wait_oldest( ring ) ) {
+	}
+	if ( ring->persistent ) {
+		glBindBuffer( GL_COPY_WRITE_BUFFER, ring->buffer );
+		glUnmapBuffer( GL_COPY_WRITE_BUFFER );
+		glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+	}
+	glDeleteBuffers( 1, &ring->buffer );
+	memset( ring, 0, sizeof( upload_ring ) );
+}
+
+upload_ring *default_upload_ring() {
+	static upload_ring ring;
+	static bool started = false;
+	if ( !started ) {
+		init_upload_ring( &ring, UPLOAD_RING_BYTES );
+		started = true;
+	}
+	return &ring;
+}
+
+/* find room for bytes. span_end is where the free space it sits in ends */
+static bool find_space( upload_ring *ring, size_t bytes, size_t *offset,
+												size_t *span_end ) {
+	bool live = ring->open || ring->batch_count > 0;
+	if ( !live ) {
+		ring->head = 0; // nothing in use, so start from the top again
+		*offset = 0;
+		*span_end = ring->size;
+		return bytes <= ring->size;
+	}
+	size_t live_begin = ring->batch_count > 0 ? ring->batches[ring->first_batch].begin
+																						: ring->open_begin;
+	size_t at = align_up( ring->head );
+	if ( ring->head > live_begin ) {
+		/* in use is [live_begin, head). free is the end, then the start */
+		if ( at + bytes <= ring->size ) {
+			*offset = at;
+			*span_end = ring->size;
+			return true;
+		}
+		*offset = 0;
+		*span_end = live_begin;
+		return bytes <= live_begin;
+	}
+	/* wrapped round. free is the gap up to the oldest batch, if any */
+	*offset = at;
+	*span_end = live_begin;
+	return ring->head < live_begin && at + bytes <= live_begin;
+}
+
+unsigned char *upload_ring_alloc( upload_ring *ring, size_t bytes,
+																	size_t *offset ) {
+	bytes = bytes > 0 ? bytes : 1;
+	retire_signalled( ring );
+	size_t at, span_end;
+	while ( !find_space( ring, bytes, &at, &span_end ) ) {
+		if ( !wait_oldest( ring ) ) {
+			return NULL; // only this batch is in the way, or it's just too big
+		}
+	}
+	if ( !ring->persistent ) {
+		if ( ring->mapped && ( at < ring->map_begin || at + bytes > ring->map_end ) ) {
+			return NULL; // another mapping would invalidate the pointers handed out
+		}
+		if ( !ring->mapped ) {
+			/* map all the free space from here, so the rest of the batch fits */
+			glBindBuffer( GL_COPY_WRITE_BUFFER, ring->buffer );
+			ring->mapped = (unsigned char *)glMapBufferRange(
+				GL_COPY_WRITE_BUFFER, at, span_end - at,
+				GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+					GL_MAP_FLUSH_EXPLICIT_BIT );
+			glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+			if ( !ring->mapped ) {
+				gl_log_err( "ERROR: could not map the upload ring\n" );
+				return NULL;
+			}
+			ring->map_begin = at;
+			ring->map_end = span_end;
+		}
+	}
+	if ( !ring->open ) {
+		ring->open = true;
+		ring->open_begin = at;
+	}
+	ring->head = at + bytes;
+	*offset = at;
+	return ring->persistent ? ring->mapped + at : ring->mapped + ( at - ring->map_begin );
+}
+
+/* GL can't read a buffer while it is mapped, unless persistently */
+static void unmap( upload_ring *ring ) {
+	if ( ring->persistent || !ring->mapped ) {
+		return;
+	}
+	glBindBuffer( GL_COPY_WRITE_BUFFER, ring->buffer );
+	glFlushMappedBufferRange( GL_COPY_WRITE_BUFFER, 0, ring->head - ring->map_begin );
+	glUnmapBuffer( GL_COPY_WRITE_BUFFER );
+	glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+	ring->mapped = NULL;
+}
+
+void upload_ring_bind( upload_ring *ring ) {
+	unmap( ring );
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, ring->buffer );
+}
+
+void upload_ring_unbind() {
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+}
+
+void upload_ring_copy_to_buffer( upload_ring *ring, size_t offset,
+																 GLenum target, GLintptr dest_offset,
+																 GLsizeiptr bytes ) {
+	unmap( ring );
+	glBindBuffer( GL_COPY_READ_BUFFER, ring->buffer );
+	glCopyBufferSubData( GL_COPY_READ_BUFFER, target, offset, dest_offset, bytes );
+	glBindBuffer( GL_COPY_READ_BUFFER, 0 );
+}
+
+void upload_ring_end_batch( upload_ring *ring ) {
+	if ( !ring->open ) {
+		return;
+	}
+	unmap( ring );
+	if ( UPLOAD_RING_MAX_BATCHES == ring->batch_count ) {
+		wait_oldest( ring );
+	}
+	upload_batch *batch =
+		&ring->batches[( ring->first_batch + ring->batch_count ) % UPLOAD_RING_MAX_BATCHES];
+	batch->begin = ring->open_begin;
+	batch->end = ring->head;
+	batch->fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	ring->batch_count++;
+	ring->open = false;
+}
+
+void upload_buffer_data( GLenum target, GLsizeiptr bytes, const void *data,
+												 GLenum usage ) {
+	glBufferData( target, bytes, NULL, usage );
+	upload_ring *ring = default_upload_ring();
+	size_t offset;
+	unsigned char *dest = upload_ring_alloc( ring, bytes, &offset );
+	if ( !dest ) {
+		upload_ring_end_batch( ring );
+		dest = upload_ring_alloc( ring, bytes, &offset );
+	}
+	if ( !dest ) {
+		glBufferSubData( target, 0, bytes, data ); // bigger than the whole ring
+		return;
+	}
+	memcpy( dest, data, bytes );
+	upload_ring_copy_to_buffer( ring, offset, target, 0, bytes );
+	upload_ring_end_batch( ring );
+}
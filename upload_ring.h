@@ -0,0 +1,85 @@
+/******************************************************************************\
+| Upload ring                                                                  |
+| One big pixel-unpack / copy-source buffer handed out front to back as a      |
+| ring. Texture and buffer data is written straight into it (worker threads    |
+| can decode into it directly), then GL copies it to the real texture or       |
+| buffer from there. The copy is a GPU-side transfer the driver can overlap    |
+| with rendering, instead of a synchronous copy out of client memory.          |
+|******************************************************************************|
+| With ARB_buffer_storage the ring is mapped once, persistently. Without it,   |
+| (GL 4.1 / OSX) the free part is mapped UNSYNCHRONIZED when it is first       |
+| needed and unmapped before GL reads from it. Either way each finished batch  |
+| gets a fence, and space is only handed out again once its fence signals.     |
+|******************************************************************************|
+| Usage, on the GL thread:                                                     |
+|     ptr = upload_ring_alloc( ring, bytes, &offset ); // NULL: see below      |
+|     ...fill ptr, on any thread...                                            |
+|     upload_ring_bind( ring );                                                |
+|     glTexSubImage2D( ..., UPLOAD_RING_OFFSET( offset ) );                    |
+|     upload_ring_unbind();                                                    |
+|     upload_ring_end_batch( ring );                                           |
+| upload_ring_alloc() returns NULL when the request can't fit until the batch  |
+| so far is finished: end the batch and ask again. NULL with no open batch     |
+| means the request is bigger than the whole ring.                             |
+\******************************************************************************/
+#ifndef _UPLOAD_RING_H_
+#define _UPLOAD_RING_H_
+#include <GL/glew.h>
+#include <stddef.h>
+
+#define UPLOAD_RING_BYTES ( 32 * 1024 * 1024 )
+#define UPLOAD_RING_MAX_BATCHES 64
+/* allocations start on this boundary. plenty for any pixel or vertex type */
+#define UPLOAD_RING_ALIGNMENT 256
+/* GL takes buffer offsets through its pointer arguments */
+#define UPLOAD_RING_OFFSET( offset ) ( (const void *)(size_t)( offset ) )
+
+struct upload_batch {
+	size_t begin;
+	size_t end;
+	GLsync fence;
+};
+
+struct upload_ring {
+	GLuint buffer;
+	size_t size;
+	bool persistent;
+	unsigned char *mapped; // whole ring when persistent
+	/* non-persistent mapping of part of the ring */
+	size_t map_begin;
+	size_t map_end;
+	size_t head; // next free byte
+	/* the batch being filled */
+	size_t open_begin;
+	bool open;
+	/* finished batches the GPU may still be reading, oldest first */
+	upload_batch batches[UPLOAD_RING_MAX_BATCHES];
+	int first_batch;
+	int batch_count;
+};
+
+bool init_upload_ring( upload_ring *ring, size_t size );
+/* waits for everything in flight */
+void free_upload_ring( upload_ring *ring );
+/* the ring everything shares. created on first use, on the GL thread */
+upload_ring *default_upload_ring();
+
+unsigned char *upload_ring_alloc( upload_ring *ring, size_t bytes,
+																	size_t *offset );
+/* bind as GL_PIXEL_UNPACK_BUFFER for glTex(Sub)Image calls. nothing may write
+into this batch's memory after this */
+void upload_ring_bind( upload_ring *ring );
+void upload_ring_unbind();
+/* GPU-side copy from the ring into part of a buffer object */
+void upload_ring_copy_to_buffer( upload_ring *ring, size_t offset,
+																 GLenum target, GLintptr dest_offset,
+																 GLsizeiptr bytes );
+/* fence what was allocated so far. call after the GL commands that read it */
+void upload_ring_end_batch( upload_ring *ring );
+
+/* glBufferData() replacement for the bound buffer on target. copies through
+the default ring, or straight from data when it doesn't fit */
+void upload_buffer_data( GLenum target, GLsizeiptr bytes, const void *data,
+												 GLenum usage );
+
+#endif
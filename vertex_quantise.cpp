@@ -0,0 +1,49 @@
+/******************************************************************************\
+| 16-bit vertex position quantisation - see vertex_quantise.h                  |
+\******************************************************************************/
+#include "vertex_quantise.h"
+#include "gl_utils.h"
+#include <math.h>
+
+float quantise_positions( const float *points, int count, const float *mn,
+													const float *mx, unsigned short *quantised,
+													mat4 *dequant_mat ) {
+	float extent = 0.0f;
+	for ( int k = 0; k < 3; k++ ) {
+		extent = mx[k] - mn[k] > extent ? mx[k] - mn[k] : extent;
+	}
+	// a single point or empty mesh still needs an invertible matrix
+	if ( extent <= 0.0f ) {
+		extent = 1.0f;
+	}
+	float to_q = 65535.0f / extent;
+	for ( int i = 0; i < count * 3; i++ ) {
+		float f = ( points[i] - mn[i % 3] ) * to_q + 0.5f;
+		f = f < 0.0f ? 0.0f : ( f > 65535.0f ? 65535.0f : f );
+		quantised[i] = (unsigned short)f;
+	}
+	*dequant_mat = translate( scale( identity_mat4(), vec3( extent, extent, extent ) ),
+														vec3( mn[0], mn[1], mn[2] ) );
+
+	/* rebuild the points exactly as the vertex shader will see them and make
+	sure no axis is off by more than half a step */
+	float max_error = 0.0f;
+	for ( int i = 0; i < count; i++ ) {
+		vec4 p = *dequant_mat * vec4( quantised[i * 3] / 65535.0f,
+																	quantised[i * 3 + 1] / 65535.0f,
+																	quantised[i * 3 + 2] / 65535.0f, 1.0f );
+		for ( int k = 0; k < 3; k++ ) {
+			float err = fabsf( p.v[k] - points[i * 3 + k] );
+			max_error = err > max_error ? err : max_error;
+		}
+	}
+	// half a step plus float rounding of the matrix maths
+	float tolerance = 0.5f * extent / 65535.0f + extent * 1e-6f;
+	if ( max_error > tolerance ) {
+		gl_log_err( "ERROR: quantised positions off by %f, tolerance %f\n", max_error,
+								tolerance );
+	}
+	gl_log( "quantised %i positions to 16 bits. step %f max error %f\n", count,
+					extent / 65535.0f, max_error );
+	return max_error;
+}
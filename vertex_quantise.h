@@ -0,0 +1,24 @@
+/******************************************************************************\
+| 16-bit vertex position quantisation                                          |
+| Positions are stored as 3 unsigned shorts relative to the mesh's bounding    |
+| box and read by GL as normalised (0 to 1) floats. The "dequantisation" matrix|
+| takes them back to mesh space and gets folded into the model matrix, so the  |
+| vertex shaders don't know the difference.                                    |
+| The same scale is used on all 3 axes. This wastes a little precision on the  |
+| short axes of a long mesh but keeps the matrix a similarity transform, which |
+| matters because the shaders push normals, tangents and inverse(M) vectors    |
+| through it.                                                                  |
+\******************************************************************************/
+#ifndef _VERTEX_QUANTISE_H_
+#define _VERTEX_QUANTISE_H_
+
+#include "maths_funcs.h" // my maths functions
+
+/* quantise count packed x,y,z points inside the box mn-mx into 3 unsigned
+shorts each. dequant_mat maps the normalised shorts back to the original
+positions. returns the largest reconstruction error, which is checked against
+the quantisation step so that any bug shows up in the log at load time */
+float quantise_positions( const float *points, int count, const float *mn,
+													const float *mx, unsigned short *quantised,
+													mat4 *dequant_mat );
+#endif